@@ -1,18 +1,118 @@
 #include "actor.h"
+#include <QDebug>
 #include <QOpenGLShaderProgram>
 #include "mainview.h"
+#include "meshsimplifier.h"
 #include <iostream>
+#include <utility>
 
-Actor::Actor(const QString &filename, QOpenGLShaderProgram &program)
-    : shaderProgram(program)
+Actor::Actor(const QString &filename, QOpenGLShaderProgram &program, bool lods)
+    : Actor(loadMesh(filename, lods), program)
 {
-    Model model(filename);
-    QVector<QVector3D> meshCoords = model.getCoords();
-    QVector<QVector3D> meshColors = model.getRandomColors();
-    QVector<QVector2D> meshUVs = model.getTextureCoords();
-    QVector<QVector3D> meshNormals = model.getNormals();
+}
+
+MeshData Actor::loadMesh(const QString &filename, bool lods)
+{
+    MeshData mesh;
+    // The model hands its arrays over instead of copying them, and is gone
+    // before the levels of detail are unpacked
+    QVector<QVector3D> coords, normals, colors;
+    QVector<QVector2D> uvs;
+    QVector<QVector4D> tangents;
+    QVector<quint32> indices;
+    {
+        Model model(filename);
+        // One random color per indexed vertex, so all levels agree
+        colors = model.getRandomColorsIndexed();
+        coords = model.takeCoordsIndexed();
+        normals = model.takeNormalsIndexed();
+        uvs = model.takeTextureCoordsIndexed();
+        tangents = model.takeTangentsIndexed();
+        indices = model.takeIndices();
+    }
+
+    QVector<MeshSimplifier::Level> levels;
+    if (lods)
+    {
+        MeshSimplifier simplifier(coords, normals, uvs);
+        levels = simplifier.lodChain(indices);
+    }
+    else
+    {
+        levels.append({std::move(indices), 0.0F});
+    }
+    indices = {};
 
-    meshSize = meshCoords.size();
+    // The levels of detail are unpacked one after another into buffers of
+    // their final size, releasing the indices of every level once written
+    int total = 0;
+    for (const MeshSimplifier::Level &level : levels)
+    {
+        total += level.indices.size();
+    }
+    mesh.coords.resize(total);
+    mesh.colors.resize(total);
+    mesh.uvs.resize(total);
+    mesh.normals.resize(total);
+    mesh.tangents.resize(total);
+    mesh.lods.reserve(levels.size());
+    int next = 0;
+    for (MeshSimplifier::Level &level : levels)
+    {
+        mesh.lods.append({GLint(next), GLsizei(level.indices.size()), level.error});
+        for (quint32 index : level.indices)
+        {
+            mesh.coords[next] = coords[index];
+            mesh.colors[next] = colors[index];
+            mesh.uvs[next] = uvs[index];
+            mesh.normals[next] = normals[index];
+            mesh.tangents[next] = tangents[index];
+            next++;
+        }
+        level.indices = {};
+    }
+    qDebug() << ":: Levels of detail:" << mesh.lods.size() << "down to"
+             << (mesh.lods.isEmpty() ? 0 : mesh.lods.last().count / 3) << "triangles";
+
+    mesh.boundsMin = coords.isEmpty() ? QVector3D() : coords.first();
+    mesh.boundsMax = mesh.boundsMin;
+    for (const QVector3D &coord : coords)
+    {
+        mesh.boundsMin = QVector3D(qMin(mesh.boundsMin.x(), coord.x()),
+                                   qMin(mesh.boundsMin.y(), coord.y()),
+                                   qMin(mesh.boundsMin.z(), coord.z()));
+        mesh.boundsMax = QVector3D(qMax(mesh.boundsMax.x(), coord.x()),
+                                   qMax(mesh.boundsMax.y(), coord.y()),
+                                   qMax(mesh.boundsMax.z(), coord.z()));
+    }
+
+    // The coarsest level that stays within 1% of the mesh size is a cheap
+    // occluder that barely hides more than the mesh itself
+    float occluderTolerance = 0.01F * (mesh.boundsMax - mesh.boundsMin).length();
+    int occluderLod = 0;
+    while (occluderLod + 1 < mesh.lods.size() &&
+           mesh.lods[occluderLod + 1].error <= occluderTolerance)
+    {
+        occluderLod++;
+    }
+    if (!mesh.lods.isEmpty())
+    {
+        mesh.occluderMesh =
+            mesh.coords.mid(mesh.lods[occluderLod].first, mesh.lods[occluderLod].count);
+    }
+    return mesh;
+}
+
+qint64 MeshData::bytes() const
+{
+    return qint64(coords.size()) * (3 * sizeof(QVector3D) + sizeof(QVector2D) + sizeof(QVector4D));
+}
+
+Actor::Actor(const MeshData &mesh, QOpenGLShaderProgram &program)
+    : boundsMin(mesh.boundsMin), boundsMax(mesh.boundsMax), lods(mesh.lods),
+      occluderMesh(mesh.occluderMesh), shaderProgram(program)
+{
+    meshSize = lods.isEmpty() ? 0 : lods.first().count;
 
     // Generate VAO
     glGenVertexArrays(1, &VAO);
@@ -23,11 +123,12 @@ Actor::Actor(const QString &filename, QOpenGLShaderProgram &program)
     glGenBuffers(1, &colorVBO);
     glGenBuffers(1, &uvVBO);
     glGenBuffers(1, &normalVBO);
+    glGenBuffers(1, &tangentVBO);
 
     // Positions
     glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
-    glBufferData(GL_ARRAY_BUFFER, meshCoords.size() * sizeof(QVector3D),
-                 meshCoords.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.coords.size() * sizeof(QVector3D),
+                 mesh.coords.data(), GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(QVector3D),
                           reinterpret_cast<GLvoid *>(0));
@@ -35,8 +136,8 @@ Actor::Actor(const QString &filename, QOpenGLShaderProgram &program)
 
     // Copy the colors
     glBindBuffer(GL_ARRAY_BUFFER, colorVBO);
-    glBufferData(GL_ARRAY_BUFFER, meshColors.size() * sizeof(QVector3D),
-                 meshColors.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.colors.size() * sizeof(QVector3D),
+                 mesh.colors.data(), GL_STATIC_DRAW);
 
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(QVector3D),
                           reinterpret_cast<GLvoid *>(0));
@@ -44,103 +145,86 @@ Actor::Actor(const QString &filename, QOpenGLShaderProgram &program)
 
     // UV
     glBindBuffer(GL_ARRAY_BUFFER, uvVBO);
-    glBufferData(GL_ARRAY_BUFFER, meshUVs.size() * sizeof(QVector2D),
-                 meshUVs.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.uvs.size() * sizeof(QVector2D),
+                 mesh.uvs.data(), GL_STATIC_DRAW);
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(QVector2D),
                           reinterpret_cast<GLvoid *>(0));
     glEnableVertexAttribArray(2);
 
     // Normals
     glBindBuffer(GL_ARRAY_BUFFER, normalVBO);
-    glBufferData(GL_ARRAY_BUFFER, meshNormals.size() * sizeof(QVector3D),
-                 meshNormals.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(QVector3D),
+                 mesh.normals.data(), GL_STATIC_DRAW);
     glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(QVector3D),
                           reinterpret_cast<GLvoid *>(0));
     glEnableVertexAttribArray(3);
 
+    // Tangents, with the handedness in w (location 4 is the static batches'
+    // draw index)
+    glBindBuffer(GL_ARRAY_BUFFER, tangentVBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh.tangents.size() * sizeof(QVector4D),
+                 mesh.tangents.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(QVector4D),
+                          reinterpret_cast<GLvoid *>(0));
+    glEnableVertexAttribArray(5);
+
     // Unbind VBO and VAO
     glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
 }
 
-void Actor::setDiffuseTexture(QImage image)
+Actor::Actor(const Actor &mesh, QOpenGLShaderProgram &program)
+    : VAO(mesh.VAO), positionVBO(mesh.positionVBO), uvVBO(mesh.uvVBO),
+      normalVBO(mesh.normalVBO), colorVBO(mesh.colorVBO), tangentVBO(mesh.tangentVBO),
+      boundsMin(mesh.boundsMin), boundsMax(mesh.boundsMax), meshSize(mesh.meshSize),
+      lods(mesh.lods), occluderMesh(mesh.occluderMesh), shaderProgram(program)
 {
-    hasDiffuseTex = true;
-
-    glGenTextures(1, &texDiffuse);
-    glBindTexture(GL_TEXTURE_2D, texDiffuse);
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+Actor::Actor(QOpenGLShaderProgram &program)
+    : VAO(0), positionVBO(0), uvVBO(0), normalVBO(0), colorVBO(0), tangentVBO(0), meshSize(0),
+      texDiffuse(0), texEmission(0), texNormal(0), texSpecular(0), shaderProgram(program)
+{
+}
 
-    QVector<quint8> imageData = MainView::imageToBytes(image);
+void Actor::setTransform(const QMatrix4x4 &world)
+{
+    transform = world;
+    normalMatrix = world.normalMatrix();
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width(), image.height(), 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, imageData.data());
+void Actor::setDiffuseTexture(GLuint array, int layer)
+{
+    hasDiffuseTex = true;
+    texDiffuse = array;
+    diffuseLayer = layer;
 }
 
-void Actor::setEmissionTexture(QImage image)
+void Actor::setEmissionTexture(GLuint array, int layer)
 {
     hasEmissionTex = true;
-
-    glGenTextures(1, &texEmission);
-    glBindTexture(GL_TEXTURE_2D, texEmission);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    QVector<quint8> imageData = MainView::imageToBytes(image);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width(), image.height(), 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, imageData.data());
+    texEmission = array;
+    emissionLayer = layer;
 }
 
-void Actor::paint(
-    QMatrix4x4 &viewTransform, QMatrix4x4 &projectionTransform, float time)
+void Actor::setNormalTexture(GLuint array, int layer)
 {
-    shaderProgram.bind();
-    shaderProgram.setUniformValue("view", viewTransform);
-    shaderProgram.setUniformValue("projection", projectionTransform);
-    shaderProgram.setUniformValue("model", transform);
-    shaderProgram.setUniformValue("normalMatrix",
-                                  transform.normalMatrix());
-    shaderProgram.setUniformValue("time", time);
-
-    if (hasDiffuseTex)
-    {
-        shaderProgram.setUniformValue("hasDiffuseTex", true);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texDiffuse);
-        shaderProgram.setUniformValue("texDiffuse", 0);
-    }
-    else
-    {
-        shaderProgram.setUniformValue("hasDiffuseTex", false);
-
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-
-    if (hasEmissionTex)
-    {
-        shaderProgram.setUniformValue("hasEmissionTex", true);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, texEmission);
-        shaderProgram.setUniformValue("texEmission", 1);
-    }
-    else
-    {
-        shaderProgram.setUniformValue("hasEmissionTex", false);
+    hasNormalTex = true;
+    texNormal = array;
+    normalLayer = layer;
+}
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
+void Actor::setSpecularTexture(GLuint array, int layer)
+{
+    hasSpecularTex = true;
+    texSpecular = array;
+    specularLayer = layer;
+}
 
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, meshSize);
-    shaderProgram.release();
-}
\ No newline at end of file
+void Actor::destroyMesh()
+{
+    GLuint buffers[5] = {positionVBO, colorVBO, uvVBO, normalVBO, tangentVBO};
+    glDeleteBuffers(5, buffers);
+    glDeleteVertexArrays(1, &VAO);
+    VAO = 0;
+}
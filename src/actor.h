@@ -6,6 +6,7 @@
 #include <QVector3D>
 #include <QVector2D>
 #include <QString>
+#include <QVector>
 // Need GLuint and GLenum types
 #include <QOpenGLFunctions_3_3_Core>
 
@@ -21,51 +22,168 @@ class Model; // Assuming 'Model' is defined in model.h
 // implementation in actor.cpp that truly needs mainview.h.
 // For this header, let's assume the necessary type headers are enough.
 
+/**
+ * @brief One level of detail of a mesh: a range of the actor's vertex buffers.
+ */
+struct MeshLod
+{
+    GLint first;
+    GLsizei count;
+    float error; // object space distance to the full detail mesh
+};
+
+/**
+ * @brief The vertex data of a mesh as it goes into the buffers of an actor:
+ * all levels of detail unpacked one after another, plus what the culling
+ * needs. Building it needs no GL context, so it can be prepared on any thread.
+ */
+struct MeshData
+{
+    QVector<QVector3D> coords;
+    QVector<QVector3D> colors;
+    QVector<QVector2D> uvs;
+    QVector<QVector3D> normals;
+    QVector<QVector4D> tangents; // handedness in w
+    QVector<MeshLod> lods;
+    QVector3D boundsMin;
+    QVector3D boundsMax;
+    QVector<QVector3D> occluderMesh;
+
+    // Size of the vertex buffers
+    qint64 bytes() const;
+};
+
 /**
  * @brief The Actor class represents a drawable 3D object in the scene.
  */
 class Actor
 {
 public:
+    // Name of the scene entry this actor was created from
+    QString name;
+
     // OpenGL Buffer IDs
-    GLuint VAO, positionVBO, uvVBO, normalVBO, colorVBO;
+    GLuint VAO, positionVBO, uvVBO, normalVBO, colorVBO, tangentVBO;
+    // World space, and the inverse transpose of its upper 3x3 for the
+    // normals, cached instead of recomputed for every draw
     QMatrix4x4 transform;
+    QMatrix3x3 normalMatrix;
+    // Scene graph node that places this actor, -1 for none
+    int node = -1;
+
+    // Transform of the last frame, for the velocity buffer
+    QMatrix4x4 previousTransform;
+    bool hasPreviousTransform = false;
 
+    // Object space bounding box of the mesh
+    QVector3D boundsMin;
+    QVector3D boundsMax;
+    // False for meshes the vertex shader moves outside their bounds
+    bool cullable = true;
+    // Drawn as part of the static batches instead of on its own
+    bool batched = false;
+    // Writes a reflectiveness above 0, marked in the G-buffer stencil for SSR
+    bool reflective = false;
+    // Hides other actors from the occlusion culler, using occluderMesh
+    bool occluder = false;
+    // Moves at runtime: casts its shadow every frame instead of into the
+    // cached shadow cascades
+    bool dynamic = false;
+
+    // Vertices of the full detail mesh
     GLuint meshSize;
 
-    // Texture handling
+    // Levels of detail stored one after another in the same buffers, full
+    // detail first, and the one drawn this frame
+    QVector<MeshLod> lods;
+    int lod = 0;
+
+    // Object space triangles of a coarse level of detail, kept on the CPU for
+    // the occlusion culler and shared by all actors with this mesh
+    QVector<QVector3D> occluderMesh;
+
+    // Texture handling: the texture arrays holding the material's maps and
+    // the layers in them
     GLuint texDiffuse;
+    int diffuseLayer = 0;
     bool hasDiffuseTex = false;
 
     GLuint texEmission;
+    int emissionLayer = 0;
     bool hasEmissionTex = false;
 
-    // Shader program reference
+    GLuint texNormal; // tangent space
+    int normalLayer = 0;
+    bool hasNormalTex = false;
+
+    GLuint texSpecular; // reflectiveness in red
+    int specularLayer = 0;
+    bool hasSpecularTex = false;
+
+    // Shader program reference, the variant for shaderFeatures
     QOpenGLShaderProgram &shaderProgram;
+    int shaderFeatures = 0; // ShaderFeature bits
 
     /**
      * @brief Constructor for Actor.
      * @param filename Path to the model file.
      * @param program Reference to the shader program to use for rendering.
+     * @param lods Whether to build levels of detail, see loadMesh.
      */
-    Actor(const QString &filename, QOpenGLShaderProgram &program);
+    Actor(const QString &filename, QOpenGLShaderProgram &program, bool lods = true);
 
     /**
-     * @brief Sets the diffuse texture for the actor.
-     * @param image The QImage to use as the texture.
+     * @brief Creates an actor from prepared vertex data, uploading it.
+     * @param mesh The data, e.g. from loadMesh.
+     * @param program Reference to the shader program to use for rendering.
+     */
+    Actor(const MeshData &mesh, QOpenGLShaderProgram &program);
+
+    /**
+     * @brief Creates an actor that shares the mesh buffers of another actor.
+     * Transform and textures start out empty.
+     * @param mesh Actor whose vertex buffers are reused.
+     * @param program Reference to the shader program to use for rendering.
      */
-    void setDiffuseTexture(QImage image);
+    Actor(const Actor &mesh, QOpenGLShaderProgram &program);
+
+    /**
+     * @brief Creates an actor without a mesh, e.g. for benchmarks that never
+     * draw. Needs no GL context.
+     * @param program Reference to the shader program to use for rendering.
+     */
+    explicit Actor(QOpenGLShaderProgram &program);
+
+    Actor(const Actor &other) = default;
 
-    void setEmissionTexture(QImage image);
+    /**
+     * @brief Reads a model file and builds its levels of detail. Needs no GL
+     * context.
+     * @param lods False for meshes always drawn at full detail, which then get
+     * a single level and skip the simplification.
+     */
+    static MeshData loadMesh(const QString &filename, bool lods = true);
+
+    /**
+     * @brief Sets the world transform and recomputes the normal matrix.
+     */
+    void setTransform(const QMatrix4x4 &world);
+
+    /**
+     * @brief Sets the diffuse texture for the actor.
+     * @param array A GL_TEXTURE_2D_ARRAY, see TextureArrays.
+     * @param layer The layer of the texture in the array.
+     */
+    void setDiffuseTexture(GLuint array, int layer);
+    void setEmissionTexture(GLuint array, int layer);
+    void setNormalTexture(GLuint array, int layer);
+    void setSpecularTexture(GLuint array, int layer);
 
     /**
-     * @brief Renders the actor.
-     * @param viewTransform The view matrix.
-     * @param projectionTransform The projection matrix.
-     * @param time Current scene time for animations.
+     * @brief Deletes the vertex buffers of this actor. Other actors sharing the
+     * same mesh must not be drawn afterwards.
      */
-    void paint(
-        QMatrix4x4 &viewTransform, QMatrix4x4 &projectionTransform, float time = 0.0F);
+    void destroyMesh();
 };
 
 #endif // ACTOR_H
\ No newline at end of file
@@ -0,0 +1,507 @@
+#include "drawlist.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QOpenGLShaderProgram>
+#include <QVector4D>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "occlusionculler.h"
+
+namespace
+{
+  /**
+   * @brief outsideFrustum Whether a box is entirely on the outer side of one of
+   * the clip planes. Conservative: boxes crossing a frustum corner are kept.
+   */
+  bool outsideFrustum(const QMatrix4x4 &modelViewProjection, const QVector3D &min,
+                      const QVector3D &max)
+  {
+    int outside[6] = {0, 0, 0, 0, 0, 0};
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      QVector4D p = modelViewProjection *
+                    QVector4D(corner & 1 ? max.x() : min.x(), corner & 2 ? max.y() : min.y(),
+                              corner & 4 ? max.z() : min.z(), 1.0F);
+      outside[0] += p.x() < -p.w();
+      outside[1] += p.x() > p.w();
+      outside[2] += p.y() < -p.w();
+      outside[3] += p.y() > p.w();
+      outside[4] += p.z() < -p.w();
+      outside[5] += p.z() > p.w();
+    }
+    return std::find(outside, outside + 6, 8) != outside + 6;
+  }
+
+  // A coarser level is only picked once its error is this much below the
+  // threshold, so actors near the switching distance do not flicker
+  const float lodHysteresis = 0.25F;
+
+  /**
+   * @brief selectLod Picks the coarsest level of detail whose error covers at
+   * most threshold pixels, starting from the current one.
+   * @param pixelsPerUnit Size on screen of one object space unit at the
+   * nearest point of the actor.
+   */
+  int selectLod(const Actor &actor, float pixelsPerUnit, float threshold)
+  {
+    int count = actor.lods.size();
+    int lod = qBound(0, actor.lod, std::max(0, count - 1));
+    while (lod > 0 && actor.lods[lod].error * pixelsPerUnit > threshold)
+    {
+      lod--;
+    }
+    while (lod + 1 < count &&
+           actor.lods[lod + 1].error * pixelsPerUnit < threshold * (1.0F - lodHysteresis))
+    {
+      lod++;
+    }
+    return lod;
+  }
+
+  /**
+   * @brief sortKey Orders draws by program, then texture arrays, then mesh, so
+   * consecutive draws share as much state as possible. Materials only differ
+   * in their layers, which come with the per draw data.
+   */
+  quint64 sortKey(const Actor &actor)
+  {
+    quint64 program = actor.shaderProgram.programId() & 0xFF;
+    quint64 diffuse = actor.hasDiffuseTex ? actor.texDiffuse & 0xFFF : 0;
+    quint64 emission = actor.hasEmissionTex ? actor.texEmission & 0xFFF : 0;
+    quint64 mesh = actor.VAO & 0xFFFFFFFF;
+    return program << 56 | diffuse << 44 | emission << 32 | mesh;
+  }
+} // namespace
+
+DrawList::~DrawList()
+{
+  if (buffer != 0)
+  {
+    glDeleteBuffers(1, &buffer);
+  }
+}
+
+/**
+ * @brief DrawList::initialize Resolves the GL functions. Requires a current
+ * context.
+ */
+void DrawList::initialize()
+{
+  initializeOpenGLFunctions();
+  glGenBuffers(1, &buffer);
+
+  // Every draw binds its own range, which has to start at a multiple of this
+  GLint alignment = 256;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+  stride = (sizeof(DrawData) + alignment - 1) / alignment * alignment;
+}
+
+void DrawList::build(JobSystem &jobs, QVector<Actor> &actors, const QMatrix4x4 &view,
+                     const QMatrix4x4 &projection)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  GLsizeiptr size = GLsizeiptr(std::max(1, static_cast<int>(actors.size()))) * stride;
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  if (size > bufferSize)
+  {
+    bufferSize = size;
+  }
+  // Orphaning the buffer lets the driver hand out fresh storage while the
+  // previous frame may still read the old one
+  glBufferData(GL_UNIFORM_BUFFER, bufferSize, NULL, GL_STREAM_DRAW);
+  auto *data = static_cast<char *>(glMapBufferRange(
+      GL_UNIFORM_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+
+  if (data)
+  {
+    prepare(jobs, actors, view, projection, data, stride);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+  }
+  else
+  {
+    qWarning() << "DrawList: cannot map the draw data buffer";
+    items.clear();
+  }
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+  buildTime = timer.nsecsElapsed() / 1.0e6F;
+}
+
+void DrawList::prepare(JobSystem &jobs, QVector<Actor> &actors, const QMatrix4x4 &view,
+                       const QMatrix4x4 &projection, char *data, int dataStride)
+{
+  source = &actors;
+  QMatrix4x4 viewProjection = projection * view;
+  QVector3D camera = view.inverted().column(3).toVector3D();
+  // The normal matrix of view * model is the product of both normal matrices,
+  // and the actors cache theirs
+  QMatrix3x3 viewNormalMatrix = view.normalMatrix();
+  // Pixels per unit at distance 1, vertically
+  float pixelsPerUnit = projection(1, 1) * viewportHeight * 0.5F;
+  int count = actors.size();
+  keys.resize(count);
+  visible.resize(count);
+  hidden.resize(count);
+
+  // Matrices, culling and packing are independent per actor
+  jobs.parallelFor(0, count, [&](int begin, int end)
+  {
+    for (int i = begin; i < end; ++i)
+    {
+      Actor &actor = actors[i];
+      if (!actor.hasPreviousTransform)
+      {
+        actor.previousTransform = actor.transform;
+        actor.hasPreviousTransform = true;
+      }
+
+      DrawData &draw = *reinterpret_cast<DrawData *>(data + qint64(i) * dataStride);
+      std::memcpy(draw.model, actor.transform.constData(), sizeof(draw.model));
+      std::memcpy(draw.previousModel, actor.previousTransform.constData(),
+                  sizeof(draw.previousModel));
+      QMatrix3x3 normalMatrix = viewNormalMatrix * actor.normalMatrix;
+      for (int column = 0; column < 3; ++column)
+      {
+        for (int row = 0; row < 3; ++row)
+        {
+          draw.normalMatrix[column * 4 + row] = normalMatrix(row, column);
+        }
+        draw.normalMatrix[column * 4 + 3] = 0.0F;
+      }
+      draw.layers[0] = actor.diffuseLayer;
+      draw.layers[1] = actor.emissionLayer;
+      draw.layers[2] = actor.normalLayer;
+      draw.layers[3] = actor.specularLayer;
+
+      actor.previousTransform = actor.transform;
+
+      QMatrix4x4 modelViewProjection = viewProjection * actor.transform;
+      bool culled = actor.cullable &&
+                    outsideFrustum(modelViewProjection, actor.boundsMin, actor.boundsMax);
+      // An occluder would hide behind its own faces
+      hidden[i] = !culled && occlusion && actor.cullable && !actor.occluder &&
+                  actor.meshSize > 0 &&
+                  occlusion->isOccluded(modelViewProjection, actor.boundsMin, actor.boundsMax);
+      visible[i] = !culled && !hidden[i] && actor.meshSize > 0;
+      keys[i] = sortKey(actor);
+
+      if (visible[i] && actor.lods.size() > 1)
+      {
+        // Distance to the nearest point of the bounding sphere
+        QVector3D center = actor.transform.map((actor.boundsMin + actor.boundsMax) * 0.5F);
+        float scale = std::max({actor.transform.column(0).toVector3D().length(),
+                                actor.transform.column(1).toVector3D().length(),
+                                actor.transform.column(2).toVector3D().length()});
+        float radius = (actor.boundsMax - actor.boundsMin).length() * 0.5F * scale;
+        float distance = std::max((center - camera).length() - radius, 1e-3F);
+        actor.lod = selectLod(actor, pixelsPerUnit * scale / distance, lodThreshold);
+      }
+    }
+  }, 256);
+
+  items.clear();
+  items.reserve(count);
+  triangles = 0;
+  fullDetailTriangles = 0;
+  occluded = 0;
+  for (int i = 0; i < count; ++i)
+  {
+    occluded += hidden[i];
+    if (visible[i])
+    {
+      items.append({keys[i], i});
+      const Actor &actor = actors[i];
+      triangles += (actor.lods.isEmpty() ? actor.meshSize : actor.lods[actor.lod].count) / 3;
+      fullDetailTriangles += actor.meshSize / 3;
+    }
+  }
+
+  sortItems(jobs);
+}
+
+/**
+ * @brief DrawList::sortItems Sorts chunks of the list on all threads, then
+ * merges neighbouring chunks pairwise until one run is left.
+ */
+void DrawList::sortItems(JobSystem &jobs)
+{
+  int count = items.size();
+  int chunks = std::min(jobs.threadCount(), count / 2048);
+  if (chunks <= 1)
+  {
+    std::sort(items.begin(), items.end());
+    return;
+  }
+
+  Item *first = items.data();
+  int chunkSize = (count + chunks - 1) / chunks;
+  jobs.parallelFor(0, chunks, [&](int begin, int end)
+  {
+    for (int chunk = begin; chunk < end; ++chunk)
+    {
+      int from = std::min(count, chunk * chunkSize);
+      int to = std::min(count, from + chunkSize);
+      std::sort(first + from, first + to);
+    }
+  });
+
+  for (int width = chunkSize; width < count; width *= 2)
+  {
+    int pairs = (count + 2 * width - 1) / (2 * width);
+    jobs.parallelFor(0, pairs, [&](int begin, int end)
+    {
+      for (int pair = begin; pair < end; ++pair)
+      {
+        int from = pair * 2 * width;
+        int middle = std::min(count, from + width);
+        int to = std::min(count, from + 2 * width);
+        std::inplace_merge(first + from, first + middle, first + to);
+      }
+    });
+  }
+}
+
+void DrawList::submit(const std::function<bool(const Actor &)> &filter)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  QOpenGLShaderProgram *program = nullptr;
+  GLuint vao = 0;
+  GLuint textures[4] = {0, 0, 0, 0};
+
+  for (const Item &item : items)
+  {
+    const Actor &actor = (*source)[item.actor];
+    if (filter && !filter(actor))
+    {
+      continue;
+    }
+
+    if (&actor.shaderProgram != program)
+    {
+      program = &actor.shaderProgram;
+      program->bind();
+    }
+    if (actor.VAO != vao)
+    {
+      vao = actor.VAO;
+      glBindVertexArray(vao);
+    }
+
+    GLuint wanted[4] = {actor.hasDiffuseTex ? actor.texDiffuse : 0,
+                        actor.hasEmissionTex ? actor.texEmission : 0,
+                        actor.hasNormalTex ? actor.texNormal : 0,
+                        actor.hasSpecularTex ? actor.texSpecular : 0};
+    for (int map = 0; map < 4; ++map)
+    {
+      if (wanted[map] != textures[map])
+      {
+        textures[map] = wanted[map];
+        glActiveTexture(GL_TEXTURE0 + materialUnits[map]);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, textures[map]);
+      }
+    }
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, blockBinding, buffer,
+                      GLintptr(item.actor) * stride, sizeof(DrawData));
+    if (actor.lods.isEmpty())
+    {
+      glDrawArrays(GL_TRIANGLES, 0, actor.meshSize);
+    }
+    else
+    {
+      const MeshLod &lod = actor.lods[actor.lod];
+      glDrawArrays(GL_TRIANGLES, lod.first, lod.count);
+    }
+  }
+
+  glBindVertexArray(0);
+  glActiveTexture(GL_TEXTURE0);
+  if (program)
+  {
+    program->release();
+  }
+
+  submitTime = timer.nsecsElapsed() / 1.0e6F;
+}
+
+void DrawList::benchmark()
+{
+  const int side = 224; // ~50k actors
+  const int repeats = 20;
+
+  QOpenGLShaderProgram program;
+  QVector<Actor> actors;
+  actors.reserve(side * side);
+  for (int z = 0; z < side; ++z)
+  {
+    for (int x = 0; x < side; ++x)
+    {
+      Actor actor(program);
+      actor.meshSize = 36;
+      actor.VAO = 1 + (x * 7 + z) % 16; // a few shared meshes
+      actor.boundsMin = QVector3D(-0.5F, 0.0F, -0.5F);
+      actor.boundsMax = QVector3D(0.5F, 2.0F, 0.5F);
+      QMatrix4x4 transform;
+      transform.translate(x * 2.0F - side, 0.0F, -z * 2.0F);
+      transform.rotate(x * 13.0F + z * 7.0F, 0.0F, 1.0F, 0.0F);
+      actor.setTransform(transform);
+      actors.append(actor);
+    }
+  }
+
+  QMatrix4x4 view;
+  view.lookAt(QVector3D(0.0F, 20.0F, 10.0F), QVector3D(0.0F, 0.0F, -100.0F),
+              QVector3D(0.0F, 1.0F, 0.0F));
+  QMatrix4x4 projection;
+  projection.perspective(50.0F, 16.0F / 9.0F, 0.2F, 1000.0F);
+
+  int stride = (sizeof(DrawData) + 255) / 256 * 256;
+  std::vector<char> data(size_t(actors.size()) * stride);
+
+  qDebug() << ":: Draw list benchmark," << actors.size() << "actors";
+
+  int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  double singleThreaded = 0.0;
+  for (int threads = 1;; threads = std::min(threads * 2, maxThreads))
+  {
+    JobSystem jobs(threads - 1);
+    DrawList list;
+    list.prepare(jobs, actors, view, projection, data.data(), stride); // warm up
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < repeats; ++i)
+    {
+      list.prepare(jobs, actors, view, projection, data.data(), stride);
+    }
+    double ms = timer.nsecsElapsed() / 1.0e6 / repeats;
+    if (threads == 1)
+    {
+      singleThreaded = ms;
+    }
+
+    qDebug().noquote() << QString("  %1 threads: %2 ms per frame, %3 visible, %4x")
+                              .arg(threads, 2)
+                              .arg(ms, 0, 'f', 3)
+                              .arg(list.size())
+                              .arg(singleThreaded / ms, 0, 'f', 2);
+    if (threads == maxThreads)
+    {
+      break;
+    }
+  }
+}
+
+void DrawList::benchmarkLods(const QVector<Actor> &actors, const QMatrix4x4 &projection,
+                             int viewportHeight)
+{
+  QVector<Actor> copies = actors;
+  for (Actor &actor : copies)
+  {
+    actor.lod = 0;
+  }
+
+  // Bounds of the scene, to scale the path to it
+  QVector3D sceneMin(INFINITY, INFINITY, INFINITY);
+  QVector3D sceneMax = -sceneMin;
+  for (const Actor &actor : copies)
+  {
+    if (actor.meshSize == 0 || !actor.cullable)
+    {
+      continue;
+    }
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      QVector3D p = actor.transform.map(
+          QVector3D(corner & 1 ? actor.boundsMax.x() : actor.boundsMin.x(),
+                    corner & 2 ? actor.boundsMax.y() : actor.boundsMin.y(),
+                    corner & 4 ? actor.boundsMax.z() : actor.boundsMin.z()));
+      sceneMin = QVector3D(std::min(sceneMin.x(), p.x()), std::min(sceneMin.y(), p.y()),
+                           std::min(sceneMin.z(), p.z()));
+      sceneMax = QVector3D(std::max(sceneMax.x(), p.x()), std::max(sceneMax.y(), p.y()),
+                           std::max(sceneMax.z(), p.z()));
+    }
+  }
+  if (sceneMin.x() > sceneMax.x())
+  {
+    qDebug() << ":: LOD benchmark: no meshes";
+    return;
+  }
+  QVector3D center = (sceneMin + sceneMax) * 0.5F;
+  float size = std::max(1.0F, (sceneMax - sceneMin).length());
+
+  JobSystem &jobs = JobSystem::global();
+  DrawList list;
+  list.setViewportHeight(viewportHeight);
+  int stride = (sizeof(DrawData) + 255) / 256 * 256;
+  std::vector<char> data(size_t(std::max(1, static_cast<int>(copies.size()))) * stride);
+
+  // Walk in from far away at eye height, circle the scene close up, then fly
+  // out over it
+  const int frames = 600;
+  qint64 triangles = 0;
+  qint64 fullDetail = 0;
+  int switches = 0;
+  QVector<int> previous(copies.size(), 0);
+  for (int frame = 0; frame < frames; ++frame)
+  {
+    float t = float(frame) / (frames - 1);
+    float distance;
+    float angle;
+    float height;
+    if (t < 1.0F / 3.0F)
+    {
+      float s = t * 3.0F;
+      distance = size * (4.0F - 3.5F * s);
+      angle = 0.0F;
+      height = 1.7F;
+    }
+    else if (t < 2.0F / 3.0F)
+    {
+      float s = t * 3.0F - 1.0F;
+      distance = size * 0.5F;
+      angle = s * 2.0F * float(M_PI);
+      height = 1.7F;
+    }
+    else
+    {
+      float s = t * 3.0F - 2.0F;
+      distance = size * (0.5F + 3.5F * s);
+      angle = 0.0F;
+      height = 1.7F + s * size;
+    }
+
+    QVector3D eye = center + QVector3D(std::sin(angle) * distance, 0.0F, std::cos(angle) * distance);
+    eye.setY(sceneMin.y() + height);
+    QMatrix4x4 view;
+    view.lookAt(eye, center, QVector3D(0.0F, 1.0F, 0.0F));
+
+    list.prepare(jobs, copies, view, projection, data.data(), stride);
+    triangles += list.triangleCount();
+    fullDetail += list.fullDetailTriangleCount();
+    for (int i = 0; i < copies.size(); ++i)
+    {
+      switches += copies[i].lod != previous[i];
+      previous[i] = copies[i].lod;
+    }
+  }
+
+  qDebug().noquote() << QString(":: LOD benchmark, %1 frames: %2 triangles per frame instead "
+                                "of %3 (%4% saved), %5 level changes")
+                            .arg(frames)
+                            .arg(triangles / frames)
+                            .arg(fullDetail / frames)
+                            .arg(fullDetail > 0 ? 100.0 * (fullDetail - triangles) / fullDetail : 0.0,
+                                 0, 'f', 1)
+                            .arg(switches);
+}
@@ -0,0 +1,144 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include <QMatrix4x4>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector>
+
+#include <functional>
+
+#include "actor.h"
+#include "jobsystem.h"
+
+class OcclusionCuller;
+
+/**
+ * @brief Per draw data, laid out like the DrawData uniform block (std140) of
+ * the geometry pass shaders.
+ */
+struct DrawData
+{
+  float model[16];
+  float previousModel[16];
+  float normalMatrix[12]; // of view * model; mat3 columns are padded to vec4
+  qint32 layers[4]; // diffuse, emission, normal, specular layer in the texture arrays
+};
+
+/**
+ * @brief The DrawList class prepares the draws of the geometry pass on the job
+ * system, so the GL thread only has to issue them.
+ *
+ * Building a list computes the matrices of every actor, culls actors outside
+ * the view frustum or behind the occluders, picks each actor's level of detail, packs the per draw
+ * data straight into a mapped uniform buffer and sorts the visible actors by
+ * render state (program, texture arrays, mesh). Submitting then only changes state where the sorted list does and
+ * binds each draw's slice of the uniform buffer.
+ */
+class DrawList : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  // Uniform block binding point of DrawData
+  static const GLuint blockBinding = 0;
+
+  // Texture units of the diffuse, emission, normal and specular arrays; 2 to 7
+  // belong to the water and the static batches
+  static constexpr int materialUnits[4] = {0, 1, 8, 9};
+
+  DrawList() = default;
+  ~DrawList();
+
+  void initialize();
+
+  /**
+   * @brief Builds the list for this frame. Requires a current context.
+   */
+  void build(JobSystem &jobs, QVector<Actor> &actors, const QMatrix4x4 &view,
+             const QMatrix4x4 &projection);
+
+  /**
+   * @brief Issues the draws of the last built list that pass the filter, all
+   * of them without one. Textures go on the materialUnits.
+   */
+  void submit(const std::function<bool(const Actor &)> &filter = nullptr);
+
+  /**
+   * @brief The CPU part of build, without GL: writes the DrawData of actor i to
+   * data + i * stride.
+   */
+  void prepare(JobSystem &jobs, QVector<Actor> &actors, const QMatrix4x4 &view,
+               const QMatrix4x4 &projection, char *data, int stride);
+
+  /**
+   * @brief Height in pixels the list is rendered at, for the level of detail.
+   */
+  void setViewportHeight(int height) { viewportHeight = height; }
+
+  /**
+   * @brief Largest on screen error of a level of detail, in pixels.
+   */
+  void setLodThreshold(float pixels) { lodThreshold = pixels; }
+
+  /**
+   * @brief Also culls actors hidden behind the occluders the culler rendered,
+   * or none without one. The occluders themselves are only frustum culled.
+   */
+  void setOcclusion(const OcclusionCuller *culler) { occlusion = culler; }
+
+  int size() const { return items.size(); }
+  int actorCount() const { return keys.size(); }
+  bool isVisible(int actor) const { return visible[actor] != 0; }
+  // Actors in the frustum that the occlusion test culled
+  int occludedCount() const { return occluded; }
+  // Triangles of the visible actors at the chosen and at full detail
+  qint64 triangleCount() const { return triangles; }
+  qint64 fullDetailTriangleCount() const { return fullDetailTriangles; }
+  float buildMilliseconds() const { return buildTime; }
+  float submitMilliseconds() const { return submitTime; }
+
+  /**
+   * @brief Measures prepare() on a synthetic scene for 1 to all threads and
+   * logs the results. No GL.
+   */
+  static void benchmark();
+
+  /**
+   * @brief Flies a copy of the actors past the camera on a fixed path and logs
+   * the triangles drawn with and without levels of detail, and how often the
+   * level changed. No GL.
+   */
+  static void benchmarkLods(const QVector<Actor> &actors, const QMatrix4x4 &projection,
+                            int viewportHeight);
+
+private:
+  struct Item
+  {
+    quint64 key;
+    int actor;
+
+    bool operator<(const Item &other) const { return key < other.key; }
+  };
+
+  void sortItems(JobSystem &jobs);
+
+  QVector<Actor> *source = nullptr;
+  QVector<Item> items;
+  QVector<quint64> keys;    // per actor
+  QVector<quint8> visible;  // per actor
+  QVector<quint8> hidden;   // per actor, culled by the occlusion test
+
+  GLuint buffer = 0;
+  GLsizeiptr bufferSize = 0;
+  int stride = sizeof(DrawData);
+
+  int viewportHeight = 1080;
+  float lodThreshold = 1.0F;
+  const OcclusionCuller *occlusion = nullptr;
+  int occluded = 0;
+  qint64 triangles = 0;
+  qint64 fullDetailTriangles = 0;
+
+  float buildTime = 0.0F;
+  float submitTime = 0.0F;
+};
+
+#endif // DRAWLIST_H
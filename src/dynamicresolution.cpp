@@ -0,0 +1,83 @@
+#include "dynamicresolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  // Scales are multiples of this, so small timing noise cannot move them
+  const float scaleStep = 1.0F / 32.0F;
+
+  // Smallest scale change worth a switch
+  const float deadZone = 0.05F;
+
+  // Frames to wait after a change: the timer queries lag a few frames and the
+  // smoothed time needs a few samples at the new scale
+  const int cooldownFrames = 12;
+
+  // Results that may still come from frames rendered at the previous scale
+  const int staleFrames = 4;
+
+  const float smoothing = 0.1F;
+} // namespace
+
+void DynamicResolution::setEnabled(bool enable)
+{
+  enabled = enable;
+  smoothedMilliseconds = 0.0F;
+}
+
+void DynamicResolution::setScaleRange(float minimum, float maximum)
+{
+  minScale = std::clamp(minimum, scaleStep, 1.0F);
+  maxScale = std::clamp(maximum, minScale, 1.0F);
+  currentScale = std::clamp(currentScale, minScale, maxScale);
+}
+
+/**
+ * @brief DynamicResolution::update The GPU time is modelled as proportional to
+ * the pixel count, i.e. to scale^2, so the scale that hits the target is
+ * scale * sqrt(target / measured).
+ */
+bool DynamicResolution::update(float gpuMilliseconds)
+{
+  if (!enabled)
+  {
+    bool changed = currentScale != maxScale;
+    currentScale = maxScale;
+    return changed;
+  }
+
+  if (gpuMilliseconds <= 0.0F)
+  {
+    return false;
+  }
+
+  if (cooldown > 0 && --cooldown >= cooldownFrames - staleFrames)
+  {
+    return false;
+  }
+
+  smoothedMilliseconds = smoothedMilliseconds > 0.0F
+                             ? smoothedMilliseconds + smoothing * (gpuMilliseconds - smoothedMilliseconds)
+                             : gpuMilliseconds;
+
+  if (cooldown > 0)
+  {
+    return false;
+  }
+
+  float ideal = currentScale * std::sqrt(targetMilliseconds / smoothedMilliseconds);
+  ideal = std::clamp(std::floor(ideal / scaleStep) * scaleStep, minScale, maxScale);
+
+  if (std::abs(ideal - currentScale) < deadZone &&
+      !(ideal == maxScale && currentScale != maxScale))
+  {
+    return false;
+  }
+
+  currentScale = ideal;
+  smoothedMilliseconds = 0.0F;
+  cooldown = cooldownFrames;
+  return true;
+}
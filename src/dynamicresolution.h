@@ -0,0 +1,46 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+/**
+ * @brief The DynamicResolution class picks the internal render scale from the
+ * measured GPU frame time, so the G-buffer and lighting passes (whose cost,
+ * SSR in particular, grows with the pixel count) fit a frame time budget.
+ *
+ * The GPU time is smoothed, and the scale only moves in steps past a dead zone
+ * and after a cooldown, since timer queries report a few frames late and the
+ * scale should not oscillate.
+ */
+class DynamicResolution
+{
+public:
+  void setEnabled(bool enable);
+  bool isEnabled() const { return enabled; }
+
+  void setTargetMilliseconds(float milliseconds) { targetMilliseconds = milliseconds; }
+  float getTargetMilliseconds() const { return targetMilliseconds; }
+
+  void setScaleRange(float minimum, float maximum);
+
+  /**
+   * @brief Current scale of the internal resolution per axis, in (0, 1].
+   */
+  float scale() const { return currentScale; }
+
+  /**
+   * @brief Feeds the GPU time of a recent frame.
+   * @return Whether the scale changed.
+   */
+  bool update(float gpuMilliseconds);
+
+private:
+  bool enabled = true;
+  float targetMilliseconds = 12.0F;
+  float minScale = 0.5F;
+  float maxScale = 1.0F;
+
+  float currentScale = 1.0F;
+  float smoothedMilliseconds = 0.0F; // 0 until measured at the current scale
+  int cooldown = 0;                  // frames until the next change is allowed
+};
+
+#endif // DYNAMICRESOLUTION_H
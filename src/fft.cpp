@@ -0,0 +1,129 @@
+#include "fft.h"
+
+#include "parallel.h"
+
+#include <QDebug>
+
+#include <cmath>
+#include <utility>
+
+/**
+ * @brief FFT2D::FFT2D Precomputes the bit reversal table and twiddle factors.
+ * @param size Width and height of the field. Must be a power of two.
+ */
+FFT2D::FFT2D(int size) : n(size)
+{
+  if (n < 2 || (n & (n - 1)) != 0)
+  {
+    qWarning() << "FFT2D: size" << n << "is not a power of two";
+  }
+
+  int bits = 0;
+  while ((1 << bits) < n)
+  {
+    ++bits;
+  }
+
+  bitReverse.resize(n);
+  for (int i = 0; i < n; ++i)
+  {
+    int reversed = 0;
+    for (int b = 0; b < bits; ++b)
+    {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    bitReverse[i] = reversed;
+  }
+
+  twiddleRe.resize(n / 2);
+  twiddleIm.resize(n / 2);
+  for (int j = 0; j < n / 2; ++j)
+  {
+    double angle = 2.0 * M_PI * j / n;
+    twiddleRe[j] = static_cast<float>(std::cos(angle));
+    twiddleIm[j] = static_cast<float>(std::sin(angle));
+  }
+}
+
+void FFT2D::inverse(float *re, float *im) const
+{
+  // Columns are independent, so every pass splits them over the thread pool.
+  // 64 columns per chunk keeps each task's rows inside whole cache lines.
+  parallelFor(0, n, [&](int x0, int x1) { columnPass(re, im, x0, x1); }, 64);
+  parallelFor(0, n, [&](int y0, int y1)
+              {
+                transpose(re, y0, y1);
+                transpose(im, y0, y1); }, 16);
+  parallelFor(0, n, [&](int x0, int x1) { columnPass(re, im, x0, x1); }, 64);
+  parallelFor(0, n, [&](int y0, int y1)
+              {
+                transpose(re, y0, y1);
+                transpose(im, y0, y1); }, 16);
+}
+
+/**
+ * @brief FFT2D::columnPass Radix-2 decimation-in-time FFT along y for the
+ * columns [x0, x1).
+ */
+void FFT2D::columnPass(float *re, float *im, int x0, int x1) const
+{
+  int width = x1 - x0;
+
+  // Bit reversal permutes whole rows
+  for (int y = 0; y < n; ++y)
+  {
+    int r = bitReverse[y];
+    if (y < r)
+    {
+      float *aRe = re + y * n + x0, *bRe = re + r * n + x0;
+      float *aIm = im + y * n + x0, *bIm = im + r * n + x0;
+      for (int x = 0; x < width; ++x)
+      {
+        std::swap(aRe[x], bRe[x]);
+        std::swap(aIm[x], bIm[x]);
+      }
+    }
+  }
+
+  for (int length = 2; length <= n; length <<= 1)
+  {
+    int half = length / 2;
+    int step = n / length;
+    for (int start = 0; start < n; start += length)
+    {
+      for (int j = 0; j < half; ++j)
+      {
+        float wRe = twiddleRe[j * step];
+        float wIm = twiddleIm[j * step];
+        float *__restrict aRe = re + (start + j) * n + x0;
+        float *__restrict aIm = im + (start + j) * n + x0;
+        float *__restrict bRe = re + (start + j + half) * n + x0;
+        float *__restrict bIm = im + (start + j + half) * n + x0;
+        for (int x = 0; x < width; ++x)
+        {
+          float tRe = wRe * bRe[x] - wIm * bIm[x];
+          float tIm = wRe * bIm[x] + wIm * bRe[x];
+          bRe[x] = aRe[x] - tRe;
+          bIm[x] = aIm[x] - tIm;
+          aRe[x] += tRe;
+          aIm[x] += tIm;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief FFT2D::transpose In-place transpose, restricted to the rows [y0, y1).
+ * Row y owns the pairs (y, x) with x > y, so row ranges never overlap.
+ */
+void FFT2D::transpose(float *data, int y0, int y1) const
+{
+  for (int y = y0; y < y1; ++y)
+  {
+    for (int x = y + 1; x < n; ++x)
+    {
+      std::swap(data[y * n + x], data[x * n + y]);
+    }
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <QVector>
+
+/**
+ * @brief The FFT2D class computes unnormalized inverse 2D FFTs of square,
+ * power-of-two sized complex fields.
+ *
+ * The field is stored split (separate real and imaginary arrays, row-major).
+ * Both passes are done column-wise: a butterfly combines two whole rows with a
+ * single twiddle factor, so the inner loop runs over contiguous floats and
+ * vectorizes, and disjoint column ranges can be processed on separate threads
+ * without any synchronization. The row pass is a column pass on the transpose.
+ */
+class FFT2D
+{
+public:
+  explicit FFT2D(int size);
+
+  int size() const { return n; }
+
+  /**
+   * @brief Inverse transform in place: f(x, y) = sum F(kx, ky) e^(+i 2pi (kx x + ky y) / N).
+   * @param re Real parts, size * size floats.
+   * @param im Imaginary parts, size * size floats.
+   */
+  void inverse(float *re, float *im) const;
+
+private:
+  void columnPass(float *re, float *im, int x0, int x1) const;
+  void transpose(float *data, int y0, int y1) const;
+
+  int n;
+  QVector<int> bitReverse;
+  QVector<float> twiddleRe; // e^(+i 2pi j / N) for j < N / 2
+  QVector<float> twiddleIm;
+};
+
+#endif // FFT_H
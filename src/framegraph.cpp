@@ -0,0 +1,285 @@
+#include "framegraph.h"
+
+#include <QDebug>
+
+FrameGraph::~FrameGraph()
+{
+  qDeleteAll(timers);
+}
+
+/**
+ * @brief FrameGraph::initialize Resolves the GL functions. Requires a current
+ * context.
+ */
+void FrameGraph::initialize()
+{
+  initializeOpenGLFunctions();
+  pool.initialize();
+}
+
+void FrameGraph::reset()
+{
+  resources.clear();
+  passes.clear();
+}
+
+FrameGraph::Resource FrameGraph::createTexture(const QString &name, const TextureDesc &desc)
+{
+  ResourceNode node;
+  node.name = name;
+  node.desc = desc;
+  resources.append(node);
+  return resources.size() - 1;
+}
+
+FrameGraph::Resource FrameGraph::importTexture(const QString &name, GLuint texture)
+{
+  ResourceNode node;
+  node.name = name;
+  node.imported = true;
+  node.texture = texture;
+  resources.append(node);
+  return resources.size() - 1;
+}
+
+FrameGraph::Resource FrameGraph::importFramebuffer(const QString &name, GLuint framebuffer)
+{
+  ResourceNode node;
+  node.name = name;
+  node.imported = true;
+  node.framebuffer = framebuffer;
+  node.isFramebuffer = true;
+  resources.append(node);
+  return resources.size() - 1;
+}
+
+void FrameGraph::addPass(const QString &name, const QVector<Resource> &reads,
+                         const QVector<Resource> &writes,
+                         const std::function<void()> &execute)
+{
+  PassNode pass;
+  pass.name = name;
+  pass.reads = reads;
+  pass.writes = writes;
+  pass.execute = execute;
+  passes.append(pass);
+}
+
+/**
+ * @brief FrameGraph::compile Culls by reference counting: a pass is referenced
+ * once per output that some pass reads. Unreferenced passes that do not write
+ * imported resources are removed, which may in turn leave their inputs
+ * unread.
+ */
+void FrameGraph::compile()
+{
+  for (int p = 0; p < passes.size(); ++p)
+  {
+    for (Resource r : passes[p].writes)
+    {
+      resources[r].producer = p;
+      passes[p].keep = passes[p].keep || resources[r].imported;
+    }
+    for (Resource r : passes[p].reads)
+    {
+      resources[r].readers++;
+    }
+  }
+
+  for (PassNode &pass : passes)
+  {
+    for (Resource r : pass.writes)
+    {
+      pass.references += resources[r].readers;
+    }
+  }
+
+  QVector<int> unreferenced;
+  for (int p = 0; p < passes.size(); ++p)
+  {
+    if (passes[p].references == 0 && !passes[p].keep)
+    {
+      unreferenced.append(p);
+    }
+  }
+
+  while (!unreferenced.isEmpty())
+  {
+    PassNode &pass = passes[unreferenced.takeLast()];
+    pass.culled = true;
+    for (Resource r : pass.reads)
+    {
+      ResourceNode &resource = resources[r];
+      if (--resource.readers == 0 && resource.producer >= 0)
+      {
+        PassNode &producer = passes[resource.producer];
+        producer.references = 0;
+        for (Resource w : producer.writes)
+        {
+          producer.references += resources[w].readers;
+        }
+        if (producer.references == 0 && !producer.keep && !producer.culled)
+        {
+          unreferenced.append(resource.producer);
+        }
+      }
+    }
+  }
+
+  // Lifetimes over the remaining passes
+  for (int p = 0; p < passes.size(); ++p)
+  {
+    if (passes[p].culled)
+    {
+      continue;
+    }
+    for (const QVector<Resource> *list : {&passes[p].writes, &passes[p].reads})
+    {
+      for (Resource r : *list)
+      {
+        ResourceNode &resource = resources[r];
+        if (resource.firstUse < 0)
+        {
+          resource.firstUse = p;
+        }
+        resource.lastUse = p;
+      }
+    }
+  }
+}
+
+void FrameGraph::execute()
+{
+  for (int p = 0; p < passes.size(); ++p)
+  {
+    PassNode &pass = passes[p];
+    if (pass.culled)
+    {
+      continue;
+    }
+
+    for (ResourceNode &resource : resources)
+    {
+      if (!resource.imported && resource.firstUse == p)
+      {
+        resource.texture = pool.acquire(resource.desc);
+      }
+    }
+    pass.inUseBytes = pool.inUseBytes();
+
+    GpuTimer &passTimer = timer(pass.name);
+    passTimer.begin();
+    bindOutputs(pass);
+    pass.execute();
+    passTimer.end();
+
+    // Released textures can be handed to later passes of this frame
+    for (ResourceNode &resource : resources)
+    {
+      if (!resource.imported && resource.lastUse == p)
+      {
+        pool.release(resource.texture);
+      }
+    }
+  }
+
+  boundFramebuffer = 0;
+  pool.endFrame();
+}
+
+void FrameGraph::bindOutputs(const PassNode &pass)
+{
+  QVector<GLuint> colors;
+  GLuint depth = 0;
+  GLuint imported = 0;
+  bool hasImported = false;
+
+  for (Resource r : pass.writes)
+  {
+    const ResourceNode &resource = resources[r];
+    if (resource.isFramebuffer)
+    {
+      imported = resource.framebuffer;
+      hasImported = true;
+    }
+    else if (resource.imported && resource.texture == 0)
+    {
+      continue;
+    }
+    else if (RenderTargetPool::isDepthFormat(resource.desc.format))
+    {
+      depth = resource.texture;
+    }
+    else
+    {
+      colors.append(resource.texture);
+    }
+  }
+
+  if (!colors.isEmpty() || depth != 0)
+  {
+    boundFramebuffer = pool.framebuffer(colors, depth);
+  }
+  else if (hasImported)
+  {
+    boundFramebuffer = imported;
+  }
+  else
+  {
+    // Passes that only write textures produced outside the graph bind their
+    // own targets
+    return;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, boundFramebuffer);
+}
+
+GpuTimer &FrameGraph::timer(const QString &pass)
+{
+  GpuTimer *passTimer = timers.value(pass, nullptr);
+  if (!passTimer)
+  {
+    passTimer = new GpuTimer();
+    passTimer->initialize();
+    timers.insert(pass, passTimer);
+  }
+  return *passTimer;
+}
+
+float FrameGraph::milliseconds(const QString &prefix) const
+{
+  float total = 0.0F;
+  for (const PassNode &pass : passes)
+  {
+    GpuTimer *passTimer = timers.value(pass.name, nullptr);
+    if (!pass.culled && passTimer && pass.name.startsWith(prefix))
+    {
+      total += passTimer->milliseconds();
+    }
+  }
+  return total;
+}
+
+void FrameGraph::report() const
+{
+  const double megabyte = 1024.0 * 1024.0;
+
+  for (const PassNode &pass : passes)
+  {
+    if (pass.culled)
+    {
+      qDebug().noquote() << QString("  %1 culled").arg(pass.name, -14);
+      continue;
+    }
+
+    GpuTimer *passTimer = timers.value(pass.name, nullptr);
+    qDebug().noquote() << QString("  %1 %2 ms, %3 MB of render targets in use")
+                              .arg(pass.name, -14)
+                              .arg(passTimer ? passTimer->milliseconds() : 0.0F, 0, 'f', 3)
+                              .arg(pass.inUseBytes / megabyte, 0, 'f', 1);
+  }
+
+  qDebug().noquote() << QString("  render targets: %1 textures, %2 MB allocated, %3 MB peak in use")
+                            .arg(pool.textureCount())
+                            .arg(pool.allocatedBytes() / megabyte, 0, 'f', 1)
+                            .arg(pool.peakInUseBytes() / megabyte, 0, 'f', 1);
+}
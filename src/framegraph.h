@@ -0,0 +1,120 @@
+#ifndef FRAMEGRAPH_H
+#define FRAMEGRAPH_H
+
+#include <QHash>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+#include "gputimer.h"
+#include "rendertargetpool.h"
+
+/**
+ * @brief The FrameGraph class schedules the render passes of a frame.
+ *
+ * Every frame the passes are declared again, in execution order, together with
+ * the resources they read and write. Transient textures only exist from the
+ * pass that first writes them to the pass that last reads them and come from a
+ * RenderTargetPool, so targets with disjoint lifetimes share memory. Passes
+ * whose outputs are never read are culled. Passes that write imported
+ * resources (the window, textures owned elsewhere) are always kept.
+ *
+ * Before a pass runs, the framebuffer made of its output textures (or the
+ * imported framebuffer it writes) is bound; the pass sets its own viewport.
+ * Importing texture 0 declares a dependency on something a pass produces
+ * outside the graph, with targets it binds itself.
+ * Every pass is timed on the GPU, see report().
+ */
+class FrameGraph : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  using Resource = int;
+
+  FrameGraph() = default;
+  ~FrameGraph();
+
+  void initialize();
+
+  /**
+   * @brief Starts declaring a new frame.
+   */
+  void reset();
+
+  Resource createTexture(const QString &name, const TextureDesc &desc);
+  Resource importTexture(const QString &name, GLuint texture);
+  Resource importFramebuffer(const QString &name, GLuint framebuffer);
+
+  void addPass(const QString &name, const QVector<Resource> &reads,
+               const QVector<Resource> &writes, const std::function<void()> &execute);
+
+  /**
+   * @brief Culls unused passes and computes the lifetimes of the transient
+   * textures.
+   */
+  void compile();
+
+  void execute();
+
+  /**
+   * @brief The texture of a resource. Only valid while the resource is alive,
+   * i.e. inside the passes that use it.
+   */
+  GLuint texture(Resource resource) const { return resources[resource].texture; }
+
+  /**
+   * @brief The framebuffer bound for the pass that is executing.
+   */
+  GLuint currentFramebuffer() const { return boundFramebuffer; }
+
+  /**
+   * @brief Logs the passes of the last frame with their GPU time and the
+   * render target memory in use while they ran.
+   */
+  void report() const;
+
+  /**
+   * @brief GPU time of the passes of the last frame whose name starts with
+   * prefix, e.g. all steps of a blur chain.
+   */
+  float milliseconds(const QString &prefix) const;
+
+private:
+  struct ResourceNode
+  {
+    QString name;
+    TextureDesc desc;
+    bool imported = false;
+    GLuint texture = 0;
+    GLuint framebuffer = 0; // imported framebuffers only
+    bool isFramebuffer = false;
+    int producer = -1;
+    int readers = 0;
+    int firstUse = -1;
+    int lastUse = -1;
+  };
+
+  struct PassNode
+  {
+    QString name;
+    QVector<Resource> reads;
+    QVector<Resource> writes;
+    std::function<void()> execute;
+    bool keep = false; // writes an imported resource
+    bool culled = false;
+    int references = 0;
+    qint64 inUseBytes = 0;
+  };
+
+  GpuTimer &timer(const QString &pass);
+  void bindOutputs(const PassNode &pass);
+
+  QVector<ResourceNode> resources;
+  QVector<PassNode> passes;
+  QHash<QString, GpuTimer *> timers;
+  RenderTargetPool pool;
+  GLuint boundFramebuffer = 0;
+};
+
+#endif // FRAMEGRAPH_H
@@ -0,0 +1,11 @@
+#ifndef FRAMEMODE_H
+#define FRAMEMODE_H
+
+/**
+ * @brief How frames are scheduled: as fast as the display allows, capped to a
+ * target frame rate, only when something changed (water time paused), or
+ * capped with only the water redrawn over a cached G-buffer of the static scene.
+ */
+enum FrameMode { UNLIMITED = 0, CAPPED, ON_DEMAND, WATER_ONLY };
+
+#endif  // FRAMEMODE_H
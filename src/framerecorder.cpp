@@ -0,0 +1,438 @@
+#include "framerecorder.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+  void appendInt32(QByteArray &bytes, qint32 value)
+  {
+    for (int i = 0; i < 4; ++i)
+    {
+      bytes.append(char((quint32(value) >> (8 * i)) & 0xFF));
+    }
+  }
+
+  void appendUInt64(QByteArray &bytes, quint64 value)
+  {
+    for (int i = 0; i < 8; ++i)
+    {
+      bytes.append(char((value >> (8 * i)) & 0xFF));
+    }
+  }
+
+  void appendFloat(QByteArray &bytes, float value)
+  {
+    qint32 bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    appendInt32(bytes, bits);
+  }
+
+  // Name, type and size of an OpenEXR header attribute; the value follows
+  void appendAttribute(QByteArray &bytes, const char *name, const char *type, int size)
+  {
+    bytes.append(name);
+    bytes.append('\0');
+    bytes.append(type);
+    bytes.append('\0');
+    appendInt32(bytes, size);
+  }
+} // namespace
+
+FrameRecorder::~FrameRecorder()
+{
+  if (recording)
+  {
+    stop();
+  }
+  if (framebuffer != 0)
+  {
+    glDeleteFramebuffers(1, &framebuffer);
+  }
+  for (const Slot &slot : ring)
+  {
+    if (slot.buffer != 0)
+    {
+      glDeleteBuffers(1, &slot.buffer);
+    }
+  }
+}
+
+/**
+ * @brief FrameRecorder::initialize Requires a current context.
+ */
+void FrameRecorder::initialize()
+{
+  initializeOpenGLFunctions();
+  for (Slot &slot : ring)
+  {
+    glGenBuffers(1, &slot.buffer);
+  }
+  glGenFramebuffers(1, &framebuffer);
+}
+
+bool FrameRecorder::start(const QString &path, Format format)
+{
+  if (recording)
+  {
+    return true;
+  }
+  if (!QDir().mkpath(path))
+  {
+    qWarning() << "Recording: cannot create" << path;
+    return false;
+  }
+
+  directory = path;
+  imageFormat = format;
+  nextIndex = 0;
+  dropped = 0;
+  captureNanoseconds = 0;
+  peakQueued = 0;
+  written = 0;
+  failed = 0;
+  encodeNanoseconds = 0;
+  bytesWritten = 0;
+  stopping = false;
+
+  // Encoding takes several frames' worth of time, so it needs a few threads
+  int threads = std::max(2, static_cast<int>(std::thread::hardware_concurrency()) / 2);
+  for (int i = 0; i < threads; ++i)
+  {
+    writers.emplace_back(&FrameRecorder::writerLoop, this);
+  }
+  recording = true;
+  qDebug() << "Recording" << (format == EXR ? "EXR" : "PNG") << "frames to" << path << "on"
+           << threads << "threads";
+  return true;
+}
+
+void FrameRecorder::stop()
+{
+  if (!recording)
+  {
+    return;
+  }
+  collect(true);
+  // Readbacks the GPU did not finish in time are dropped, so no fence leaks
+  // and the next recording starts with an empty ring
+  if (pending > 0)
+  {
+    qWarning() << "Recording: gave up waiting for" << pending << "frames";
+  }
+  for (; pending > 0; pending--)
+  {
+    glDeleteSync(ring[first].fence);
+    ring[first].fence = nullptr;
+    first = (first + 1) % ringSize;
+    dropped++;
+  }
+  first = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &writer : writers)
+  {
+    writer.join();
+  }
+  writers.clear();
+  recording = false;
+  report();
+}
+
+void FrameRecorder::captureTexture(GLuint texture, int width, int height)
+{
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+  capture(framebuffer, width, height);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void FrameRecorder::capture(GLuint source, int width, int height)
+{
+  if (!recording)
+  {
+    return;
+  }
+  QElapsedTimer timer;
+  timer.start();
+
+  collect(false);
+
+  size_t queued;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queued = queue.size();
+  }
+  peakQueued = std::max(peakQueued, int(queued) + pending);
+  if (pending == ringSize || int(queued) + pending >= maxQueued)
+  {
+    // The GPU or the writers are behind; waiting for them would stall
+    dropped++;
+    nextIndex++;
+    captureNanoseconds += timer.nsecsElapsed();
+    return;
+  }
+
+  Slot &slot = ring[(first + pending) % ringSize];
+  bool half = imageFormat == EXR;
+  GLsizeiptr size = GLsizeiptr(width) * height * (half ? 8 : 4);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+  if (size > slot.size)
+  {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    slot.size = size;
+  }
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, source);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, width, height, GL_RGBA, half ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.width = width;
+  slot.height = height;
+  slot.index = nextIndex++;
+  pending++;
+
+  captureNanoseconds += timer.nsecsElapsed();
+}
+
+/**
+ * @brief FrameRecorder::collect Copies the frames whose readback finished out
+ * of their buffers, oldest first, and queues them for the writers.
+ * @param wait Whether to wait for the readbacks that are still in flight.
+ */
+void FrameRecorder::collect(bool wait)
+{
+  while (pending > 0)
+  {
+    Slot &slot = ring[first];
+    GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                     wait ? GLuint64(1000000000) : 0);
+    // Waiting keeps at it for a while, one second per call since drivers may
+    // cap the timeout; stop() gives up on what is left after that
+    for (int second = 1; wait && status == GL_TIMEOUT_EXPIRED && second < maxWaitSeconds;
+         ++second)
+    {
+      status = glClientWaitSync(slot.fence, 0, GLuint64(1000000000));
+    }
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+      break;
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    if (status == GL_WAIT_FAILED)
+    {
+      // The buffer may not hold the frame yet, so it is not read
+      qWarning() << "Recording: waiting for frame" << slot.index << "failed";
+      first = (first + 1) % ringSize;
+      pending--;
+      dropped++;
+      continue;
+    }
+
+    Frame frame{QByteArray(), slot.width, slot.height, slot.index};
+    GLsizeiptr size = GLsizeiptr(slot.width) * slot.height * (imageFormat == EXR ? 8 : 4);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (data)
+    {
+      frame.pixels = QByteArray(static_cast<const char *>(data), int(size));
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    first = (first + 1) % ringSize;
+    pending--;
+
+    if (frame.pixels.isEmpty())
+    {
+      failed++;
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(std::move(frame));
+    }
+    wake.notify_one();
+  }
+}
+
+void FrameRecorder::writerLoop()
+{
+  for (;;)
+  {
+    Frame frame;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty())
+      {
+        return; // stopping, and everything is written
+      }
+      frame = std::move(queue.front());
+      queue.pop_front();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    if (write(frame))
+    {
+      written++;
+    }
+    else
+    {
+      failed++;
+    }
+    encodeNanoseconds += timer.nsecsElapsed();
+  }
+}
+
+/**
+ * @brief FrameRecorder::write Encodes one frame, flipping it upright, and
+ * writes it. Runs on a writer thread.
+ */
+bool FrameRecorder::write(const Frame &frame)
+{
+  QString name = QString("frame_%1.%2")
+                     .arg(frame.index, 5, 10, QChar('0'))
+                     .arg(imageFormat == EXR ? "exr" : "png");
+  QString path = QDir(directory).filePath(name);
+
+  bool ok;
+  if (imageFormat == EXR)
+  {
+    ok = writeExr(path, frame);
+  }
+  else
+  {
+    // The alpha of the window is not meaningful
+    QImage image(reinterpret_cast<const uchar *>(frame.pixels.constData()), frame.width,
+                 frame.height, frame.width * 4, QImage::Format_RGBX8888);
+    ok = image.mirrored().save(path, "PNG");
+  }
+  if (ok)
+  {
+    bytesWritten += QFile(path).size();
+  }
+  return ok;
+}
+
+/**
+ * @brief FrameRecorder::writeExr Writes an uncompressed scanline OpenEXR file
+ * with half float R, G and B channels. The frame holds half float RGBA rows,
+ * bottom row first.
+ */
+bool FrameRecorder::writeExr(const QString &path, const Frame &frame)
+{
+  const int width = frame.width;
+  const int height = frame.height;
+
+  QByteArray bytes;
+  bytes.reserve(400 + height * (16 + width * 6));
+  appendInt32(bytes, 20000630); // magic number
+  appendInt32(bytes, 2);        // version 2, single part scanline file
+
+  // Channels are stored in alphabetical order
+  const char *channels[3] = {"B", "G", "R"};
+  appendAttribute(bytes, "channels", "chlist", 3 * 18 + 1);
+  for (const char *channel : channels)
+  {
+    bytes.append(channel);
+    bytes.append('\0');
+    appendInt32(bytes, 1); // HALF
+    appendInt32(bytes, 0); // pLinear and reserved
+    appendInt32(bytes, 1); // x sampling
+    appendInt32(bytes, 1); // y sampling
+  }
+  bytes.append('\0');
+  appendAttribute(bytes, "compression", "compression", 1);
+  bytes.append('\0'); // none
+  for (const char *window : {"dataWindow", "displayWindow"})
+  {
+    appendAttribute(bytes, window, "box2i", 16);
+    appendInt32(bytes, 0);
+    appendInt32(bytes, 0);
+    appendInt32(bytes, width - 1);
+    appendInt32(bytes, height - 1);
+  }
+  appendAttribute(bytes, "lineOrder", "lineOrder", 1);
+  bytes.append('\0'); // increasing y
+  appendAttribute(bytes, "pixelAspectRatio", "float", 4);
+  appendFloat(bytes, 1.0F);
+  appendAttribute(bytes, "screenWindowCenter", "v2f", 8);
+  appendFloat(bytes, 0.0F);
+  appendFloat(bytes, 0.0F);
+  appendAttribute(bytes, "screenWindowWidth", "float", 4);
+  appendFloat(bytes, 1.0F);
+  bytes.append('\0'); // end of the header
+
+  // One scanline per chunk, each with its offset in the file
+  const int lineSize = width * 3 * 2;
+  quint64 offset = quint64(bytes.size()) + quint64(height) * 8;
+  for (int y = 0; y < height; ++y)
+  {
+    appendUInt64(bytes, offset);
+    offset += 8 + lineSize;
+  }
+
+  const auto *pixels = reinterpret_cast<const quint16 *>(frame.pixels.constData());
+  QByteArray line(lineSize, '\0');
+  auto *out = reinterpret_cast<quint16 *>(line.data());
+  for (int y = 0; y < height; ++y)
+  {
+    // EXR rows go top down, GL rows bottom up
+    const quint16 *row = pixels + size_t(height - 1 - y) * width * 4;
+    for (int c = 0; c < 3; ++c)
+    {
+      int component = 2 - c; // B, G, R
+      for (int x = 0; x < width; ++x)
+      {
+        out[c * width + x] = row[x * 4 + component];
+      }
+    }
+    appendInt32(bytes, y);
+    appendInt32(bytes, lineSize);
+    bytes.append(line);
+  }
+
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+  return file.write(bytes) == bytes.size();
+}
+
+void FrameRecorder::report() const
+{
+  size_t queued;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queued = queue.size();
+  }
+  qDebug().noquote()
+      << QString("Recording: %1 frames written, %2 dropped, %3 failed, %4 queued (peak %5 of "
+                 "%6) | readback %7 ms per frame on the GL thread, encoding %8 ms per frame on "
+                 "the writers | %9 MB")
+             .arg(written.load())
+             .arg(dropped)
+             .arg(failed.load())
+             .arg(int(queued) + pending)
+             .arg(peakQueued)
+             .arg(maxQueued)
+             .arg(captureNanoseconds / 1.0e6 / std::max(1, nextIndex), 0, 'f', 3)
+             .arg(encodeNanoseconds.load() / 1.0e6 / std::max(1, written.load()), 0, 'f', 2)
+             .arg(bytesWritten.load() / (1024 * 1024));
+}
@@ -0,0 +1,134 @@
+#ifndef FRAMERECORDER_H
+#define FRAMERECORDER_H
+
+#include <QByteArray>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QString>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The FrameRecorder class records the rendered frames as an image
+ * sequence without stalling the GL thread.
+ *
+ * Every frame is read into one of a ring of pixel buffer objects, followed by
+ * a fence. Later frames check the fences without waiting and copy the frames
+ * whose readback finished out of their buffers. Writer threads then encode
+ * them, as PNG (the final 8 bit image) or as OpenEXR (the linear half float
+ * image before bloom and upscaling). The ring and the writers' queue have a
+ * fixed size: a frame that finds no free buffer or a full queue is dropped and
+ * counted instead of blocking, which keeps the memory use bounded.
+ */
+class FrameRecorder : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  enum Format
+  {
+    PNG,
+    EXR
+  };
+
+  // Readbacks in flight on the GPU
+  static const int ringSize = 4;
+  // Frames read back but not written yet, including the ones in flight
+  static const int maxQueued = 12;
+  // How long stop() waits for a readback in flight before dropping it
+  static const int maxWaitSeconds = 5;
+
+  FrameRecorder() = default;
+  ~FrameRecorder();
+
+  FrameRecorder(const FrameRecorder &) = delete;
+  FrameRecorder &operator=(const FrameRecorder &) = delete;
+
+  void initialize();
+
+  /**
+   * @brief Starts writing frames numbered from 0 into a directory, which is
+   * created if needed.
+   * @return Whether the directory could be created.
+   */
+  bool start(const QString &directory, Format format);
+
+  /**
+   * @brief Finishes the readbacks in flight, waits for the writers and logs
+   * the statistics. Readbacks the GPU does not finish within maxWaitSeconds
+   * each are dropped and counted. Requires a current context.
+   */
+  void stop();
+
+  bool isRecording() const { return recording; }
+  Format format() const { return imageFormat; }
+
+  /**
+   * @brief Starts reading back color attachment 0 of a framebuffer, in the
+   * format passed to start(), and hands finished earlier frames to the
+   * writers. Never waits for the GPU.
+   */
+  void capture(GLuint framebuffer, int width, int height);
+
+  /**
+   * @brief Like capture(), for the lower left part of a texture.
+   */
+  void captureTexture(GLuint texture, int width, int height);
+
+  /**
+   * @brief Logs the frames written and dropped, the time the GL thread spent
+   * on the readbacks and the writers on encoding.
+   */
+  void report() const;
+
+private:
+  struct Slot
+  {
+    GLuint buffer = 0;
+    GLsizeiptr size = 0;
+    GLsync fence = nullptr;
+    int width = 0;
+    int height = 0;
+    int index = 0;
+  };
+
+  struct Frame
+  {
+    QByteArray pixels; // bottom row first
+    int width;
+    int height;
+    int index;
+  };
+
+  void collect(bool wait);
+  void writerLoop();
+  bool write(const Frame &frame);
+  static bool writeExr(const QString &path, const Frame &frame);
+
+  Slot ring[ringSize];
+  int first = 0;   // oldest slot in flight
+  int pending = 0; // slots in flight
+  GLuint framebuffer = 0; // for captureTexture
+
+  bool recording = false;
+  Format imageFormat = PNG;
+  QString directory;
+  int nextIndex = 0;
+  int dropped = 0;
+  qint64 captureNanoseconds = 0; // on the GL thread
+  int peakQueued = 0;
+
+  std::vector<std::thread> writers;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Frame> queue;
+  bool stopping = false;
+  std::atomic<int> written{0};
+  std::atomic<int> failed{0};
+  std::atomic<qint64> encodeNanoseconds{0};
+  std::atomic<qint64> bytesWritten{0};
+};
+
+#endif // FRAMERECORDER_H
@@ -0,0 +1,199 @@
+#include "framescheduler.h"
+
+#include <QDebug>
+#include <QScreen>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  // Longest step the animation clock takes, so a stall (e.g. a hot reload)
+  // does not make the water jump
+  const float maxAnimationStep = 0.1F;
+} // namespace
+
+FrameScheduler::FrameScheduler(QWidget *view) : view(view)
+{
+  timer.setSingleShot(true);
+  timer.setTimerType(Qt::PreciseTimer);
+  connect(&timer, &QTimer::timeout, view, qOverload<>(&QWidget::update));
+
+  clock.start();
+  lastAccountCpu = std::clock();
+}
+
+void FrameScheduler::setMode(FrameMode newMode)
+{
+  account();
+  mode = newMode;
+  lastFrameStart = -1;
+  qDebug() << "Frame mode:" << modeName(mode);
+  requestFrame();
+}
+
+void FrameScheduler::setTargetFps(int fps)
+{
+  targetFps = std::max(1, fps);
+}
+
+void FrameScheduler::beginFrame()
+{
+  qint64 now = clock.nsecsElapsed();
+  Stats &s = stats[mode];
+  s.frames++;
+
+  if (lastFrameStart >= 0)
+  {
+    double interval = static_cast<double>(now - lastFrameStart) * 1e-6;
+    s.intervals++;
+    s.intervalSum += interval;
+    s.intervalSqSum += interval * interval;
+
+    if (mode != ON_DEMAND)
+    {
+      animationTime += std::min(static_cast<float>(interval) * 1e-3F, maxAnimationStep);
+    }
+  }
+
+  lastFrameStart = now;
+  account();
+}
+
+/**
+ * @brief FrameScheduler::endFrame Schedules the next frame. Capped modes aim at
+ * fixed deadlines so timer rounding does not accumulate. When the cap is at or
+ * above the refresh rate the buffer swap already waits for vsync, so the next
+ * frame is requested immediately instead of sleeping on top of that.
+ */
+void FrameScheduler::endFrame(float gpuMilliseconds)
+{
+  stats[mode].gpuSum += gpuMilliseconds;
+
+  switch (mode)
+  {
+  case UNLIMITED:
+    view->update();
+    break;
+  case CAPPED:
+  case WATER_ONLY:
+  {
+    if (vsyncPaced())
+    {
+      view->update();
+      break;
+    }
+
+    qint64 period = 1000000000LL / targetFps;
+    qint64 now = clock.nsecsElapsed();
+    nextDeadline += period;
+    if (nextDeadline < now - period)
+    {
+      // Fell more than a frame behind, do not try to catch up
+      nextDeadline = now;
+    }
+    int delay = static_cast<int>(std::max<qint64>(0, nextDeadline - now) / 1000000);
+    timer.start(delay);
+    break;
+  }
+  case ON_DEMAND:
+    break;
+  }
+}
+
+/**
+ * @brief FrameScheduler::requestFrame Marks that a frame is wanted. A frame
+ * that is already scheduled covers it; otherwise it is drawn right away, or by
+ * the timer once a frame interval at the target rate has passed since the last
+ * one, so bursts of requests (e.g. mouse moves) stay within the cap.
+ */
+void FrameScheduler::requestFrame()
+{
+  if (timer.isActive())
+  {
+    return;
+  }
+  qint64 period = 1000000000LL / targetFps;
+  qint64 wait = mode == UNLIMITED || lastFrameStart < 0
+                    ? 0
+                    : lastFrameStart + period - clock.nsecsElapsed();
+  if (wait <= 0)
+  {
+    view->update();
+  }
+  else
+  {
+    timer.start(static_cast<int>(wait / 1000000));
+  }
+}
+
+/**
+ * @brief FrameScheduler::account Adds the wall and process CPU time since the
+ * last call to the current mode. CPU time covers all threads, including the
+ * ocean FFT workers.
+ */
+void FrameScheduler::account()
+{
+  qint64 wall = clock.nsecsElapsed();
+  std::clock_t cpu = std::clock();
+
+  Stats &s = stats[mode];
+  s.wallSeconds += static_cast<double>(wall - lastAccountWall) * 1e-9;
+  s.cpuSeconds += static_cast<double>(cpu - lastAccountCpu) / CLOCKS_PER_SEC;
+
+  lastAccountWall = wall;
+  lastAccountCpu = cpu;
+}
+
+bool FrameScheduler::vsyncPaced() const
+{
+  QScreen *screen = view->screen();
+  return screen && targetFps >= std::floor(screen->refreshRate());
+}
+
+void FrameScheduler::report()
+{
+  account();
+
+  for (int m = UNLIMITED; m <= WATER_ONLY; ++m)
+  {
+    const Stats &s = stats[m];
+    if (s.frames == 0 || s.wallSeconds <= 0.0)
+    {
+      continue;
+    }
+
+    double meanInterval = s.intervals > 0 ? s.intervalSum / s.intervals : 0.0;
+    double variance = s.intervals > 0
+                          ? s.intervalSqSum / s.intervals - meanInterval * meanInterval
+                          : 0.0;
+    double fps = s.frames / s.wallSeconds;
+    double gpu = s.gpuSum / s.frames;
+
+    qDebug().noquote() << QString("%1: %2 fps, frame interval %3 ms +- %4 ms, CPU %5 %, "
+                                  "GPU %6 ms/frame (%7 %)")
+                              .arg(QString(modeName(static_cast<FrameMode>(m))), -10)
+                              .arg(fps, 0, 'f', 1)
+                              .arg(meanInterval, 0, 'f', 2)
+                              .arg(std::sqrt(std::max(0.0, variance)), 0, 'f', 2)
+                              .arg(100.0 * s.cpuSeconds / s.wallSeconds, 0, 'f', 1)
+                              .arg(gpu, 0, 'f', 2)
+                              .arg(0.1 * gpu * fps, 0, 'f', 1);
+  }
+}
+
+const char *FrameScheduler::modeName(FrameMode mode)
+{
+  switch (mode)
+  {
+  case UNLIMITED:
+    return "unlimited";
+  case CAPPED:
+    return "capped";
+  case ON_DEMAND:
+    return "on demand";
+  case WATER_ONLY:
+    return "water only";
+  }
+  return "";
+}
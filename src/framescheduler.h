@@ -0,0 +1,98 @@
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include <QWidget>
+
+#include <ctime>
+
+#include "framemode.h"
+
+/**
+ * @brief The FrameScheduler class decides when the next frame is drawn, instead
+ * of redrawing unconditionally at the end of every frame.
+ *
+ * It also owns the animation clock, which stops while nothing is animated
+ * (ON_DEMAND), and keeps per mode statistics: frame rate, frame interval jitter,
+ * process CPU utilization and GPU time per frame.
+ */
+class FrameScheduler : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit FrameScheduler(QWidget *view);
+
+  void setMode(FrameMode newMode);
+  FrameMode getMode() const { return mode; }
+
+  void setTargetFps(int fps);
+  int getTargetFps() const { return targetFps; }
+
+  /**
+   * @brief Animation time in seconds. Does not advance in ON_DEMAND mode and
+   * skips long stalls.
+   */
+  float time() const { return animationTime; }
+
+  /**
+   * @brief Called at the start of every frame.
+   */
+  void beginFrame();
+
+  /**
+   * @brief Called at the end of every frame; schedules the next one.
+   * @param gpuMilliseconds GPU time of a recent frame, see GpuTimer.
+   */
+  void endFrame(float gpuMilliseconds);
+
+  /**
+   * @brief Asks for a frame because something visible changed, e.g. input.
+   * Needed in ON_DEMAND mode, harmless in the others; never draws faster than
+   * the target frame rate outside UNLIMITED.
+   */
+  void requestFrame();
+
+  /**
+   * @brief Logs the statistics of every mode used so far.
+   */
+  void report();
+
+  static const char *modeName(FrameMode mode);
+
+private:
+  struct Stats
+  {
+    int frames = 0;
+    int intervals = 0;
+    double intervalSum = 0.0;   // ms
+    double intervalSqSum = 0.0; // ms^2
+    double wallSeconds = 0.0;
+    double cpuSeconds = 0.0;
+    double gpuSum = 0.0; // ms
+  };
+
+  void account();
+  bool vsyncPaced() const;
+
+  QWidget *view;
+  QTimer timer;
+  QElapsedTimer clock;
+
+  FrameMode mode = CAPPED;
+  int targetFps = 60;
+
+  float animationTime = 0.0F;
+  qint64 lastFrameStart = -1; // ns, -1 when the previous frame had another mode
+  qint64 nextDeadline = 0;    // ns
+
+  // Last point the wall and CPU time were accounted to a mode
+  qint64 lastAccountWall = 0;
+  std::clock_t lastAccountCpu = 0;
+
+  Stats stats[4];
+};
+
+#endif // FRAMESCHEDULER_H
@@ -0,0 +1,74 @@
+#include "gputimer.h"
+
+GpuTimer::~GpuTimer()
+{
+  if (initialized)
+  {
+    glDeleteQueries(2 * ringSize, queries);
+  }
+}
+
+/**
+ * @brief GpuTimer::initialize Creates the queries. Requires a current context.
+ */
+void GpuTimer::initialize()
+{
+  initializeOpenGLFunctions();
+  glGenQueries(2 * ringSize, queries);
+  initialized = true;
+}
+
+void GpuTimer::begin()
+{
+  collect();
+
+  // All queries still in flight: skip this range rather than wait
+  active = !pending[current];
+  if (active)
+  {
+    glQueryCounter(queries[2 * current], GL_TIMESTAMP);
+  }
+}
+
+void GpuTimer::end()
+{
+  if (!active)
+  {
+    return;
+  }
+
+  glQueryCounter(queries[2 * current + 1], GL_TIMESTAMP);
+  pending[current] = true;
+  current = (current + 1) % ringSize;
+  active = false;
+}
+
+/**
+ * @brief GpuTimer::collect Reads back finished queries, oldest first, without
+ * blocking.
+ */
+void GpuTimer::collect()
+{
+  for (int i = 0; i < ringSize; ++i)
+  {
+    int slot = (current + i) % ringSize;
+    if (!pending[slot])
+    {
+      continue;
+    }
+
+    // The end timestamp completes last
+    GLint available = 0;
+    glGetQueryObjectiv(queries[2 * slot + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+      break;
+    }
+
+    GLuint64 start = 0, stop = 0;
+    glGetQueryObjectui64v(queries[2 * slot], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(queries[2 * slot + 1], GL_QUERY_RESULT, &stop);
+    lastMilliseconds = static_cast<float>(stop - start) * 1e-6F;
+    pending[slot] = false;
+  }
+}
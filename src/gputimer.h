@@ -0,0 +1,49 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+/**
+ * @brief The GpuTimer class measures the GPU time of a range of commands with a
+ * pair of GL_TIMESTAMP queries.
+ *
+ * Queries are kept in a small ring and only read back once their result is
+ * available, so measuring never stalls the pipeline; the reported time lags a
+ * few frames behind. Unlike GL_TIME_ELAPSED queries, timestamps may overlap, so
+ * a frame timer can contain the timers of its passes.
+ */
+class GpuTimer : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  GpuTimer() = default;
+  ~GpuTimer();
+
+  void initialize();
+
+  void begin();
+  void end();
+
+  /**
+   * @brief Most recent measured duration in milliseconds, 0 until the first
+   * result is available.
+   */
+  float milliseconds() const { return lastMilliseconds; }
+
+  /**
+   * @brief Picks up finished measurements without starting a new one, for
+   * ranges that are not measured every frame.
+   */
+  void collect();
+
+private:
+  static const int ringSize = 4;
+
+  GLuint queries[2 * ringSize] = {}; // begin and end timestamp per slot
+  bool pending[ringSize] = {};
+  int current = 0;
+  bool active = false;
+  bool initialized = false;
+  float lastMilliseconds = 0.0F;
+};
+
+#endif // GPUTIMER_H
@@ -0,0 +1,173 @@
+#include "jobsystem.h"
+
+#include <algorithm>
+
+namespace
+{
+  // Which queue the current thread owns, per job system
+  thread_local const JobSystem *workerSystem = nullptr;
+  thread_local int workerIndex = -1;
+} // namespace
+
+JobSystem::JobSystem(int workers)
+{
+  if (workers < 0)
+  {
+    workers = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+  }
+
+  for (int i = 0; i <= workers; ++i)
+  {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (int i = 0; i < workers; ++i)
+  {
+    threads.emplace_back([this, i] { workerLoop(i); });
+  }
+}
+
+JobSystem::~JobSystem()
+{
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+}
+
+JobSystem &JobSystem::global()
+{
+  static JobSystem system;
+  return system;
+}
+
+void JobSystem::parallelFor(int begin, int end, const std::function<void(int, int)> &body,
+                            int minChunk)
+{
+  int count = end - begin;
+  if (count <= 0)
+  {
+    return;
+  }
+
+  // A few chunks per thread, so threads that finish early can steal the rest
+  int chunks = std::clamp(count / std::max(1, minChunk), 1, threadCount() * 4);
+  if (chunks == 1 || threads.empty())
+  {
+    body(begin, end);
+    return;
+  }
+
+  int chunkSize = (count + chunks - 1) / chunks;
+  std::atomic<int> pending{0};
+
+  // Chunk 0 runs right away on this thread, the rest are queued
+  Queue &queue = *queues[ownQueue()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    for (int chunkBegin = begin + chunkSize; chunkBegin < end; chunkBegin += chunkSize)
+    {
+      queue.jobs.push_back({&body, chunkBegin, std::min(end, chunkBegin + chunkSize), &pending});
+      pending++;
+    }
+  }
+  queued += pending.load();
+  {
+    std::lock_guard<std::mutex> lock(sleepMutex);
+  }
+  wake.notify_all();
+
+  body(begin, std::min(end, begin + chunkSize));
+
+  // Help out until the other chunks are done; this may run unrelated jobs
+  while (pending.load(std::memory_order_acquire) > 0)
+  {
+    Job job;
+    if (pop(job) || steal(job))
+    {
+      run(job);
+    }
+    else
+    {
+      std::this_thread::yield();
+    }
+  }
+}
+
+int JobSystem::ownQueue() const
+{
+  return workerSystem == this ? workerIndex : static_cast<int>(queues.size()) - 1;
+}
+
+/**
+ * @brief JobSystem::pop Takes the newest job of the own queue.
+ */
+bool JobSystem::pop(Job &job)
+{
+  Queue &queue = *queues[ownQueue()];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.jobs.empty())
+  {
+    return false;
+  }
+  job = queue.jobs.back();
+  queue.jobs.pop_back();
+  queued--;
+  return true;
+}
+
+/**
+ * @brief JobSystem::steal Takes the oldest job of another queue, starting with
+ * the next one so thieves spread over the victims.
+ */
+bool JobSystem::steal(Job &job)
+{
+  int own = ownQueue();
+  int count = static_cast<int>(queues.size());
+  for (int i = 1; i < count; ++i)
+  {
+    Queue &queue = *queues[(own + i) % count];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.jobs.empty())
+    {
+      job = queue.jobs.front();
+      queue.jobs.pop_front();
+      queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobSystem::run(const Job &job)
+{
+  (*job.body)(job.begin, job.end);
+  job.pending->fetch_sub(1, std::memory_order_release);
+}
+
+void JobSystem::workerLoop(int index)
+{
+  workerSystem = this;
+  workerIndex = index;
+
+  while (true)
+  {
+    Job job;
+    if (pop(job) || steal(job))
+    {
+      run(job);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(sleepMutex);
+    wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+    if (stopping)
+    {
+      return;
+    }
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief The JobSystem class runs jobs on a fixed set of worker threads with
+ * work stealing.
+ *
+ * Every worker has its own queue. A thread pushes the jobs it creates to the
+ * back of its queue and pops from there as well, so nested work stays on the
+ * thread (and in its cache). Idle threads steal from the front of the other
+ * queues, where the oldest jobs are. A thread waiting for its jobs keeps
+ * executing jobs instead of blocking, which makes nested parallelFor calls
+ * safe. Threads that are not workers, e.g. the GUI thread, share one extra
+ * queue.
+ */
+class JobSystem
+{
+public:
+  /**
+   * @param workers Number of worker threads besides the calling thread, which
+   * works as well. -1 starts one per remaining core.
+   */
+  explicit JobSystem(int workers = -1);
+  ~JobSystem();
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  /**
+   * @brief The job system shared by the whole application.
+   */
+  static JobSystem &global();
+
+  int threadCount() const { return static_cast<int>(threads.size()) + 1; }
+
+  /**
+   * @brief Splits [begin, end) into chunks, runs them on all threads and
+   * returns when every chunk is done.
+   * @param body Called as body(chunkBegin, chunkEnd) for each chunk.
+   * @param minChunk Smallest number of indices worth a job of its own.
+   */
+  void parallelFor(int begin, int end, const std::function<void(int, int)> &body,
+                   int minChunk = 1);
+
+private:
+  struct Job
+  {
+    const std::function<void(int, int)> *body;
+    int begin;
+    int end;
+    std::atomic<int> *pending;
+  };
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Job> jobs;
+  };
+
+  int ownQueue() const;
+  bool pop(Job &job);
+  bool steal(Job &job);
+  void run(const Job &job);
+  void workerLoop(int index);
+
+  std::vector<std::unique_ptr<Queue>> queues; // one per worker, then the shared one
+  std::vector<std::thread> threads;
+
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  std::atomic<int> queued{0};
+  bool stopping = false;
+};
+
+#endif // JOBSYSTEM_H
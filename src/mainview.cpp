@@ -1,12 +1,45 @@
 #include "mainview.h"
 
 #include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  /**
+   * @brief halton Element of the Halton low discrepancy sequence, in [0, 1).
+   * Bases 2 and 3 give well spread 2D sub-pixel offsets.
+   */
+  float halton(int index, int base)
+  {
+    float result = 0.0F;
+    float fraction = 1.0F / base;
+    for (; index > 0; index /= base)
+    {
+      result += fraction * (index % base);
+      fraction /= base;
+    }
+    return result;
+  }
+} // namespace
 
 MainView::MainView(QWidget *parent) : QOpenGLWidget(parent)
 {
   qDebug() << "MainView constructor";
 
   connect(&timer, SIGNAL(timeout()), this, SLOT(update()));
+  connect(&sceneWatcher, &QFileSystemWatcher::fileChanged, this,
+          &MainView::onSceneFileChanged);
+  connect(&shaders, &ShaderManager::sourceChanged, this,
+          &MainView::onShaderFileChanged);
+
+  // Scenes can be swapped without recompiling: SCENE_FILE points to a scene on
+  // disk, which is then also watched and hot reloaded.
+  scenePath = qEnvironmentVariable("SCENE_FILE", ":/scenes/harbor.json");
 }
 
 MainView::~MainView()
@@ -15,6 +48,11 @@ MainView::~MainView()
 
   makeCurrent();
 
+  recorder.stop();
+  streamingBenchmark.stop();
+  streamer.close();
+  sceneLoader.clear();
+  ocean.destroy();
   destroyModelBuffers();
 }
 
@@ -23,9 +61,29 @@ MainView::~MainView()
 void MainView::loadShaders(QOpenGLShaderProgram &program, const QString &vertPath,
                            const QString &fragPath)
 {
-  program.addShaderFromSourceFile(QOpenGLShader::Vertex, vertPath);
-  program.addShaderFromSourceFile(QOpenGLShader::Fragment, fragPath);
-  program.link();
+  loadShaders(program, QStringList{vertPath}, QStringList{fragPath});
+}
+
+/**
+ * @brief MainView::loadShaders Compiles and links a program from several shader
+ * objects per stage. This is how shared GLSL (e.g. waves.glsl) is linked into
+ * multiple programs, since GLSL 3.30 has no #include. Link errors are logged by
+ * the ShaderManager, which also hot reloads the program.
+ */
+void MainView::loadShaders(QOpenGLShaderProgram &program, const QStringList &vertPaths,
+                           const QStringList &fragPaths)
+{
+  shaders.load(program, vertPaths, fragPaths);
+}
+
+/**
+ * @brief MainView::geometryProgram The geometry pass variant for a combination
+ * of ShaderFeature bits, built on first use.
+ */
+QOpenGLShaderProgram &MainView::geometryProgram(int features)
+{
+  ShaderVariants &variants = (features & WATER_SURFACE) ? waterVariants : gBufferVariants;
+  return variants.get(shaders, features);
 }
 
 /**
@@ -62,125 +120,1014 @@ void MainView::initializeGL()
   // color.
   glClearColor(0.04f, 0.05f, 0.07f, 0.0f);
 
-  loadShaders(basicShader, ":/shaders/vertshader.glsl", ":/shaders/fragshader.glsl");
-  loadShaders(waterShader, ":/shaders/watervert.glsl", ":/shaders/g_buffer_frag.glsl");
+  loadShaders(waveTextureShader, {":/shaders/quad_vert.glsl"},
+              {":/shaders/wave_texture_frag.glsl", ":/shaders/waves.glsl"});
 
-  loadShaders(gBufferShader, ":/shaders/g_buffer_vert.glsl",
-              ":/shaders/g_buffer_frag.glsl");
   loadShaders(lightingShader, ":/shaders/quad_vert.glsl",
               ":/shaders/lighting_frag.glsl");
-
-  setupGBuffer(realWidth(), realHeight());
-
-  Actor cat(":/models/cat.obj", gBufferShader);
-  cat.transform.setToIdentity();
-  cat.transform.translate(0.0F, 0.0F, -10.0F);
-  // cat.transform.rotate(QQuaternion::fromEulerAngles(rotation));
-  // cat.transform.scale(scale);
-  // requires QImage
-  cat.setDiffuseTexture(QImage(":/textures/cat_diff.png"));
-  // actors.push_back(cat);
-
-  Actor water(":/models/water.obj", waterShader);
-  water.transform.setToIdentity();
-  // water.transform.translate(0.0F, -3.0F, -10.0F);
-  // water.transform.rotate(QQuaternion::fromEulerAngles(0, 0, 0));
-  // water.transform.scale(15.0f);
-  actors.push_back(water);
-
-  Actor sceneObj(":/models/sceneobj.obj", gBufferShader);
-  sceneObj.transform.setToIdentity();
-  sceneObj.setDiffuseTexture(QImage(":/textures/concrete_wall.png"));
-  // sceneObj.transform.translate(0.0F, -1.0F, -5.0F);
-  // sceneObj.transform.rotate(QQuaternion::fromEulerAngles(0, -90, 0));
-  // sceneObj.transform.scale(0.2f);
-
-  Actor sign(":/models/sign.obj", gBufferShader);
-  sign.transform.setToIdentity();
-  sign.setDiffuseTexture(QImage(":/textures/sign_diffuse.png"));
-  sign.setEmissionTexture(QImage(":/textures/sign_emission.png"));
-  actors.push_back(sign);
-
-  actors.push_back(sceneObj);
-
-  Actor lamps(":/models/lamps.obj", gBufferShader);
-  lamps.transform.setToIdentity();
-  lamps.setDiffuseTexture(QImage(":/textures/lamp_diffuse.png"));
-  lamps.setEmissionTexture(QImage(":/textures/lamp_emission.png"));
-  actors.push_back(lamps);
-
-  Actor apart(":/models/apart.obj", gBufferShader);
-  apart.transform.setToIdentity();
-  apart.setDiffuseTexture(QImage(":/textures/apart_diffuse.png"));
-  // apart.setEmissionTexture(QImage(":/textures/apart_emission.png"));
-
-  actors.push_back(apart);
-
-  startTimer.restart();
+  loadShaders(ssrShader, ":/shaders/quad_vert.glsl", ":/shaders/ssr_frag.glsl");
+  loadShaders(glossMaskShader, ":/shaders/quad_vert.glsl", ":/shaders/gloss_mask_frag.glsl");
+  loadShaders(upscaleShader, ":/shaders/quad_vert.glsl",
+              ":/shaders/upscale_frag.glsl");
+  loadShaders(gBufferDebugShader, ":/shaders/quad_vert.glsl",
+              ":/shaders/gbuffer_debug_frag.glsl");
+  loadShaders(taaShader, ":/shaders/quad_vert.glsl", ":/shaders/taa_frag.glsl");
+  loadShaders(bloomDownsampleShader, ":/shaders/quad_vert.glsl",
+              ":/shaders/bloom_downsample_frag.glsl");
+  loadShaders(bloomUpsampleShader, ":/shaders/quad_vert.glsl",
+              ":/shaders/bloom_upsample_frag.glsl");
+  loadShaders(probePrefilterShader, ":/shaders/quad_vert.glsl",
+              ":/shaders/probe_prefilter_frag.glsl");
+  loadShaders(shadowShader, ":/shaders/shadow_vert.glsl", ":/shaders/shadow_frag.glsl");
+
+  frameGraph.initialize();
+  drawList.initialize();
+  staticBatches.initialize();
+  reflectionProbe.initialize();
+  shadowMaps.initialize();
+  recorder.initialize();
+
+  setupRenderTargets(realWidth(), realHeight());
+  setupWaveTexture();
+  waves.setTileSize(waveTileSize);
+  ocean.initialize();
+
+  sceneLoader.initialize();
+  sceneLoader.setProgramSelector([this](int features) -> QOpenGLShaderProgram &
+                                 { return geometryProgram(features); });
+  streamer.initialize();
+  streamer.setProgramSelector([this](int features) -> QOpenGLShaderProgram &
+                              { return geometryProgram(features); });
+  loadScene();
+
+  frameTimer.initialize();
+
+  // Kiosk deployments pick the pacing through the environment
+  QString frameMode = qEnvironmentVariable("FRAME_MODE");
+  if (!frameMode.isEmpty())
+  {
+    scheduler.setMode(frameMode == "unlimited"  ? UNLIMITED
+                      : frameMode == "ondemand" ? ON_DEMAND
+                      : frameMode == "water"    ? WATER_ONLY
+                                                : CAPPED);
+  }
+  if (qEnvironmentVariableIsSet("TARGET_FPS"))
+  {
+    scheduler.setTargetFps(qEnvironmentVariableIntValue("TARGET_FPS"));
+  }
+  if (qEnvironmentVariableIsSet("TARGET_GPU_MS"))
+  {
+    dynamicResolution.setTargetMilliseconds(qEnvironmentVariable("TARGET_GPU_MS").toFloat());
+  }
 
   // Initialize transformations
   updateProjectionTransform();
 
-  update();
+  scheduler.requestFrame();
 }
 
 /**
  * @brief MainView::paintGL Actual function used for drawing to the screen.
- *
+ * Declares the passes of this frame to the frame graph and runs them.
  */
 void MainView::paintGL()
 {
+  scheduler.beginFrame();
+  frameTimer.begin();
+
+  float elapsedSeconds = scheduler.time();
+
+  if (dynamicResolution.update(frameTimer.milliseconds()))
+  {
+    staticGBufferValid = false;
+  }
+
+  updateStreaming(elapsedSeconds);
+  updateModelTransforms();
+
+  // A new sub-pixel offset every frame, cycling through 8 Halton points. The
+  // reference has no TAA, so the frame compared with it has neither jitter
+  // nor history. Neither has WATER_ONLY, whose cached static G-buffer would
+  // keep the offset of the frame it was drawn in.
+  bool temporal = temporalActive() && !referenceRequested &&
+                  scheduler.getMode() != WATER_ONLY;
+  if (temporal)
+  {
+    frameIndex++;
+    int sample = frameIndex % 8 + 1;
+    jitter = QVector2D(halton(sample, 2) - 0.5F, halton(sample, 3) - 0.5F);
+  }
+  else
+  {
+    jitter = QVector2D();
+    historyValid = false;
+  }
+  updateProjectionTransform();
+
+  // Matrices, culling and sorting of the geometry pass draws on all cores,
+  // after the occluders are rasterized for the occlusion test
+  if (occlusionEnabled)
+  {
+    occlusionCuller.render(JobSystem::global(), actors, projectionTransform * viewTransform);
+  }
+  drawList.setOcclusion(occlusionEnabled ? &occlusionCuller : nullptr);
+  drawList.setViewportHeight(renderHeight());
+  drawList.build(JobSystem::global(), actors, viewTransform, projectionTransform);
+
+  using Resource = FrameGraph::Resource;
+  frameGraph.reset();
+
+  // Produced by updateWaveTexture, which binds the current wave textures itself
+  Resource waveTextures = frameGraph.importTexture("waves", 0);
+  frameGraph.addPass("waves", {}, {waveTextures},
+                     [this, elapsedSeconds] { updateWaveTexture(elapsedSeconds); });
+
+  // Captured after scene changes, or periodically if the scene asks for it.
+  // Like the waves, the pass binds its own targets.
+  Resource probe = frameGraph.importTexture("probe", 0);
+  bool captureProbe = reflectionProbe.needsCapture(scene.probe, elapsedSeconds);
+  if (captureProbe)
+  {
+    frameGraph.addPass("probe", {}, {probe},
+                       [this, elapsedSeconds] { captureReflectionProbe(elapsedSeconds); });
+  }
+
+  // Only cascades whose projection or casters changed are rendered again; the
+  // pass binds its own targets as well
+  Resource shadows = frameGraph.importTexture("shadows", 0);
+  if (scene.shadows.enabled)
+  {
+    frameGraph.addPass("shadows", {}, {shadows}, [this] { renderShadows(); });
+  }
+
+  TextureDesc target{GL_RGB16F, targetWidth, targetHeight, GL_NEAREST};
+  Resource position = frameGraph.createTexture("gPosition", target);
+  Resource normal = frameGraph.createTexture("gNormal", target);
+  Resource emission = frameGraph.createTexture("gEmission", target);
+  target.format = GL_RGBA8;
+  Resource albedoSpec = frameGraph.createTexture("gAlbedoSpec", target);
+  target.format = GL_RG16F;
+  Resource velocity = frameGraph.createTexture("gVelocity", target);
+  // The stencil marks the reflective pixels for SSR
+  target.format = GL_DEPTH24_STENCIL8;
+  Resource depth = frameGraph.createTexture("gDepth", target);
+
+  // Color attachments in the order of the g_buffer_frag outputs
+  frameGraph.addPass("gbuffer", {waveTextures},
+                     {position, normal, albedoSpec, emission, velocity, depth},
+                     [this, elapsedSeconds] { renderGBuffer(elapsedSeconds); });
+
+  QVector<Resource> gBufferTextures = {position, normal, albedoSpec, emission};
+
+  // The resolved previous frame, reflected by SSR and blended into by TAA
+  Resource previousHistory =
+      frameGraph.importTexture("previousHistory", historyTextures[1 - historyIndex]);
+
+  TextureDesc color{GL_RGBA16F, targetWidth, targetHeight, GL_LINEAR};
+  Resource litColor = frameGraph.createTexture("sceneColor", color);
+  // The depth-stencil target is attached to the lighting pass as well, where
+  // it only limits the reflections to the reflective pixels
+  QVector<Resource> lightingInputs = gBufferTextures;
+  lightingInputs << depth;
+  if (temporal)
+  {
+    lightingInputs << velocity << previousHistory;
+  }
+  if (captureProbe)
+  {
+    lightingInputs << probe;
+  }
+  if (scene.shadows.enabled)
+  {
+    lightingInputs << shadows;
+  }
+  frameGraph.addPass("lighting", lightingInputs, {litColor, depth},
+                     [this, gBufferTextures, velocity]
+                     { renderLighting(gBufferTextures, velocity); });
+
+  // Read back before TAA and bloom, next to a CPU render of the same view
+  if (referenceRequested)
+  {
+    Resource referenceResult = frameGraph.importTexture("reference", 0);
+    frameGraph.addPass("reference", {litColor}, {referenceResult},
+                       [this, litColor, elapsedSeconds]
+                       { compareWithReference(litColor, elapsedSeconds); });
+    referenceRequested = false;
+  }
+
+  Resource debugColor = frameGraph.createTexture("gBufferDebug", color);
+  frameGraph.addPass("gbufferDebug", gBufferTextures, {debugColor},
+                     [this, gBufferTextures] { renderGBufferDebug(gBufferTextures); });
+
+  Resource resolved = litColor;
+  if (temporal)
+  {
+    resolved = frameGraph.importTexture("history", historyTextures[historyIndex]);
+    frameGraph.addPass("taa", {litColor, velocity, depth, previousHistory}, {resolved},
+                       [this, litColor, velocity, depth]
+                       { renderTemporalResolve(litColor, velocity, depth); });
+  }
+
+  // Only one of the two images above is shown, the other pass gets culled
+  Resource shown = gBufferView == 0 ? resolved : debugColor;
+  QVector<Resource> upscaleInputs = {shown};
+
+  Resource bloom = -1;
+  if (gBufferView == 0 && scene.bloom.enabled)
+  {
+    bloom = addBloomPasses(resolved);
+    upscaleInputs.append(bloom);
+  }
+
+  Resource window = frameGraph.importFramebuffer("window", defaultFramebufferObject());
+  frameGraph.addPass("upscale", upscaleInputs, {window},
+                     [this, shown, bloom] { renderUpscale(shown, bloom); });
+
+  // PNG records the window, EXR the linear image before bloom and upscaling
+  if (recorder.isRecording())
+  {
+    Resource image = recorder.format() == FrameRecorder::EXR ? resolved : window;
+    Resource capture = frameGraph.importTexture("capture", 0);
+    frameGraph.addPass("capture", {image}, {capture}, [this, image] { captureFrame(image); });
+  }
+
+  frameGraph.compile();
+  frameGraph.execute();
+
+  previousViewProjection = unjitteredProjection * viewTransform;
+  previousTime = elapsedSeconds;
+  if (temporal)
+  {
+    historyScale = renderScale();
+    historyValid = true;
+    historyIndex = 1 - historyIndex;
+  }
+
+  frameTimer.end();
+  scheduler.endFrame(frameTimer.milliseconds());
+}
+
+/**
+ * @brief MainView::captureReflectionProbe Renders the reflection probe's
+ * cubemap from the position given in the scene file.
+ */
+void MainView::captureReflectionProbe(float time)
+{
+  reflectionProbe.capture(
+      scene.probe, time,
+      [this](const QMatrix4x4 &view, const QMatrix4x4 &projection)
+      { renderProbeFace(view, projection); },
+      probePrefilterShader, [this] { renderQuad(); }, defaultFramebufferObject());
+}
+
+/**
+ * @brief MainView::renderProbeFace Draws the scene into one face of the
+ * reflection probe, forward shaded and at full detail. The water is left out,
+ * it is the surface that reflects the probe.
+ */
+void MainView::renderProbeFace(const QMatrix4x4 &view, const QMatrix4x4 &projection)
+{
+  QOpenGLShaderProgram *bound = nullptr;
+  for (const Actor &actor : actors)
+  {
+    if ((actor.shaderFeatures & WATER_SURFACE) || actor.lods.isEmpty())
+    {
+      continue;
+    }
+    QOpenGLShaderProgram &program =
+        probeVariants.get(shaders, actor.shaderFeatures & (DIFFUSE_MAP | EMISSION_MAP));
+    if (&program != bound)
+    {
+      program.bind();
+      program.setUniformValue("viewProjection", projection * view);
+      program.setUniformValue("lightDir", scene.light.direction);
+      program.setUniformValue("lightColor", scene.light.color);
+      program.setUniformValue("texDiffuse", 0);
+      program.setUniformValue("texEmission", 1);
+      bound = &program;
+    }
+    program.setUniformValue("model", actor.transform);
+    program.setUniformValue("normalMatrix", actor.normalMatrix);
+    program.setUniformValue("diffuseLayer", float(actor.diffuseLayer));
+    program.setUniformValue("emissionLayer", float(actor.emissionLayer));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, actor.hasDiffuseTex ? actor.texDiffuse : 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, actor.hasEmissionTex ? actor.texEmission : 0);
+
+    glBindVertexArray(actor.VAO);
+    glDrawArrays(GL_TRIANGLES, actor.lods.first().first, actor.lods.first().count);
+  }
+  glBindVertexArray(0);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  if (bound)
+  {
+    bound->release();
+  }
+}
+
+/**
+ * @brief MainView::renderShadows Brings the shadow maps up to date for this
+ * frame's view. The water receives shadows but casts none.
+ */
+void MainView::renderShadows()
+{
+  QVector3D casterMin(INFINITY, INFINITY, INFINITY);
+  QVector3D casterMax = -casterMin;
+  bool dynamicCasters = false;
+  for (const Actor &actor : actors)
+  {
+    if ((actor.shaderFeatures & WATER_SURFACE) || actor.lods.isEmpty())
+    {
+      continue;
+    }
+    if (actor.dynamic)
+    {
+      dynamicCasters = true;
+      continue;
+    }
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      QVector3D p = actor.transform.map(
+          QVector3D(corner & 1 ? actor.boundsMax.x() : actor.boundsMin.x(),
+                    corner & 2 ? actor.boundsMax.y() : actor.boundsMin.y(),
+                    corner & 4 ? actor.boundsMax.z() : actor.boundsMin.z()));
+      casterMin = QVector3D(std::min(casterMin.x(), p.x()), std::min(casterMin.y(), p.y()),
+                            std::min(casterMin.z(), p.z()));
+      casterMax = QVector3D(std::max(casterMax.x(), p.x()), std::max(casterMax.y(), p.y()),
+                            std::max(casterMax.z(), p.z()));
+    }
+  }
+  if (casterMin.x() > casterMax.x())
+  {
+    casterMin = casterMax = QVector3D();
+  }
+
+  shadowShader.bind();
+  shadowMaps.update(scene.shadows, scene.light.direction, viewTransform, unjitteredProjection,
+                    casterMin, casterMax, dynamicCasters,
+                    [this](const QMatrix4x4 &lightViewProjection, bool dynamic)
+                    { renderShadowCasters(lightViewProjection, dynamic); });
+  shadowShader.release();
+}
+
+/**
+ * @brief MainView::renderShadowCasters Draws the depth of the static or the
+ * dynamic casters inside one cascade. Static casters are cached, so they are
+ * drawn at full detail; dynamic ones at the level the camera sees.
+ */
+void MainView::renderShadowCasters(const QMatrix4x4 &lightViewProjection, bool dynamic)
+{
+  shadowShader.setUniformValue("lightViewProjection", lightViewProjection);
+  for (const Actor &actor : actors)
+  {
+    if ((actor.shaderFeatures & WATER_SURFACE) || actor.lods.isEmpty() ||
+        actor.dynamic != dynamic)
+    {
+      continue;
+    }
+
+    // The projection is orthographic and the depth clamped, so only the sides
+    // of the cascade cull
+    QMatrix4x4 modelViewProjection = lightViewProjection * actor.transform;
+    int outside[4] = {0, 0, 0, 0};
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      QVector3D p = modelViewProjection.map(
+          QVector3D(corner & 1 ? actor.boundsMax.x() : actor.boundsMin.x(),
+                    corner & 2 ? actor.boundsMax.y() : actor.boundsMin.y(),
+                    corner & 4 ? actor.boundsMax.z() : actor.boundsMin.z()));
+      outside[0] += p.x() < -1.0F;
+      outside[1] += p.x() > 1.0F;
+      outside[2] += p.y() < -1.0F;
+      outside[3] += p.y() > 1.0F;
+    }
+    if (std::find(outside, outside + 4, 8) != outside + 4)
+    {
+      continue;
+    }
+
+    const MeshLod &lod = dynamic ? actor.lods[qBound(0, actor.lod, int(actor.lods.size()) - 1)]
+                                 : actor.lods.first();
+    shadowShader.setUniformValue("model", actor.transform);
+    glBindVertexArray(actor.VAO);
+    glDrawArrays(GL_TRIANGLES, lod.first, lod.count);
+  }
+  glBindVertexArray(0);
+}
+
+/**
+ * @brief MainView::renderGBuffer Geometry pass into the G-buffer bound by the
+ * frame graph.
+ */
+void MainView::renderGBuffer(float time)
+{
+  GLuint gBuffer = frameGraph.currentFramebuffer();
 
-  glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glViewport(0, 0, renderWidth(), renderHeight());
   glEnable(GL_DEPTH_TEST);
 
-  float elapsedSeconds = static_cast<float>(startTimer.elapsed()) / 1000.0f;
+  // In WATER_ONLY mode everything but the water is drawn once into a cached
+  // copy of the G-buffer, which then replaces the static draws every frame.
+  bool waterOnly = scheduler.getMode() == WATER_ONLY;
+  auto isWater = [](const Actor &actor) { return (actor.shaderFeatures & WATER_SURFACE) != 0; };
+
+  // Per frame uniforms; the per draw ones come from the draw list's buffer.
+  // The block binding is set every frame since hot reloading relinks.
+  QMatrix4x4 viewProjection = unjitteredProjection * viewTransform;
+  for (QOpenGLShaderProgram *program : gBufferVariants.programs() + waterVariants.programs())
+  {
+    program->bind();
+    program->setUniformValue("view", viewTransform);
+    program->setUniformValue("projection", projectionTransform);
+    program->setUniformValue("time", time);
+    program->setUniformValue("texDiffuse", DrawList::materialUnits[0]);
+    program->setUniformValue("texEmission", DrawList::materialUnits[1]);
+    program->setUniformValue("texNormal", DrawList::materialUnits[2]);
+    program->setUniformValue("texSpecular", DrawList::materialUnits[3]);
+    program->setUniformValue("unjitteredViewProjection", viewProjection);
+    program->setUniformValue("previousViewProjection", previousViewProjection);
+    program->setUniformValue("drawData", StaticBatches::drawDataUnit);
+    GLuint block = glGetUniformBlockIndex(program->programId(), "DrawData");
+    if (block != GL_INVALID_INDEX)
+    {
+      glUniformBlockBinding(program->programId(), block, DrawList::blockBinding);
+    }
+    program->release();
+  }
+  // Batched actors are drawn by the static batches, unless batching is off
+  auto drawnAlone = [this, waterOnly, &isWater](const Actor &actor)
+  { return !(batchingEnabled && actor.batched) && !(waterOnly && isWater(actor)); };
 
-  // gBufferShader.bind();
+  // Every draw writes its stencil reference where it passes the depth test,
+  // so reflective pixels that get covered lose the bit again
+  glEnable(GL_STENCIL_TEST);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
 
-  // print elapsed time
+  if (waterOnly && staticGBufferValid)
+  {
+    copyGBuffer(staticGBuffer, gBuffer);
+  }
+  else
+  {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    // The background does not move
+    const GLfloat noVelocity[4] = {0.0F, 0.0F, 0.0F, 0.0F};
+    glClearBufferfv(GL_COLOR, 4, noVelocity);
+
+    glStencilFunc(GL_ALWAYS, 0, reflectiveStencil);
+    drawList.submit([&drawnAlone](const Actor &actor)
+                    { return drawnAlone(actor) && !actor.reflective; });
+    if (batchingEnabled)
+    {
+      staticBatches.submit(drawList, actors);
+    }
+    glStencilFunc(GL_ALWAYS, reflectiveStencil, reflectiveStencil);
+    drawList.submit([&drawnAlone](const Actor &actor)
+                    { return drawnAlone(actor) && actor.reflective; });
+
+    if (waterOnly)
+    {
+      if (staticGBuffer == 0)
+      {
+        setupStaticGBuffer(targetWidth, targetHeight);
+      }
+      copyGBuffer(gBuffer, staticGBuffer);
+      glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+      staticGBufferValid = true;
+    }
+  }
 
-  for (auto &actor : actors)
+  if (waterOnly)
   {
-    actor.paint(viewTransform, projectionTransform, elapsedSeconds);
+    glStencilFunc(GL_ALWAYS, reflectiveStencil, reflectiveStencil);
+    drawList.submit(isWater);
   }
+  glDisable(GL_STENCIL_TEST);
 
-  // gBufferShader.release();
+  for (int unit : DrawList::materialUnits)
+  {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  }
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-  glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
-  glViewport(0, 0, realWidth(), realHeight());
-  glDrawBuffer(GL_BACK);
-  glClear(GL_COLOR_BUFFER_BIT);
+/**
+ * @brief MainView::bindGBuffer Binds the G-buffer textures to units 0-3 of a
+ * full screen program.
+ */
+void MainView::bindGBuffer(QOpenGLShaderProgram &program,
+                           const QVector<FrameGraph::Resource> &gBufferTextures)
+{
+  const char *names[4] = {"gPosition", "gNormal", "gAlbedoSpec", "gEmission"};
+  for (int i = 0; i < 4; ++i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, frameGraph.texture(gBufferTextures[i]));
+    program.setUniformValue(names[i], i);
+  }
+  program.setUniformValue("gBufferScale", renderScale());
+}
+
+/**
+ * @brief MainView::renderLighting Lighting and SSR, at the internal resolution
+ * as well. The lighting covers every pixel; the reflections are a second draw
+ * that the stencil limits to the reflective pixels.
+ */
+void MainView::renderLighting(const QVector<FrameGraph::Resource> &gBufferTextures,
+                              FrameGraph::Resource velocity)
+{
+  glViewport(0, 0, renderWidth(), renderHeight());
+  // The depth-stencil target is attached, but only for the stencil
+  glDisable(GL_DEPTH_TEST);
 
   lightingShader.bind();
+  bindGBuffer(lightingShader, gBufferTextures);
+
+  lightingShader.setUniformValue("lightDir", scene.light.direction);
+  lightingShader.setUniformValue("lightColor", scene.light.color);
+
+  // The cascades map world space, the G-buffer holds view space positions
+  bool useShadows = scene.shadows.enabled && shadowMaps.isValid();
+  lightingShader.setUniformValue("useShadows", useShadows);
+  lightingShader.setUniformValue("shadowMap", 4);
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, useShadows ? shadowMaps.texture() : 0);
+  if (useShadows)
+  {
+    QMatrix4x4 viewToWorld = viewTransform.inverted();
+    QMatrix4x4 matrices[ShadowMaps::maxCascades];
+    QVector4D splits;
+    QVector4D texels;
+    for (int i = 0; i < shadowMaps.cascadeCount(); ++i)
+    {
+      matrices[i] = shadowMaps.textureMatrix(i) * viewToWorld;
+      splits[i] = shadowMaps.splitDistance(i);
+      texels[i] = shadowMaps.texelSize(i);
+    }
+    lightingShader.setUniformValueArray("cascadeMatrices", matrices, ShadowMaps::maxCascades);
+    lightingShader.setUniformValue("cascadeCount", shadowMaps.cascadeCount());
+    lightingShader.setUniformValue("cascadeSplits", splits);
+    lightingShader.setUniformValue("cascadeTexels", texels);
+    lightingShader.setUniformValue("shadowTexelSize", 1.0F / shadowMaps.mapSize());
+  }
 
+  // Render screen quad
+  renderQuad();
+
+  lightingShader.release();
+  glActiveTexture(GL_TEXTURE4);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  renderReflections(gBufferTextures, velocity);
+
+  glEnable(GL_DEPTH_TEST);
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, gPosition);
-  lightingShader.setUniformValue("gPosition", 0);
+}
 
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, gNormal);
-  lightingShader.setUniformValue("gNormal", 1);
+/**
+ * @brief MainView::renderReflections Blends the screen space reflections over
+ * the lit pixels whose stencil bit the geometry pass set, unless their
+ * reflectiveness is 0. The rest of the screen is rejected by the stencil test
+ * before the shader runs.
+ */
+void MainView::renderReflections(const QVector<FrameGraph::Resource> &gBufferTextures,
+                                 FrameGraph::Resource velocity)
+{
+  glEnable(GL_STENCIL_TEST);
+  glStencilFunc(GL_EQUAL, reflectiveStencil, reflectiveStencil);
+
+  // Actors with a specular map are only glossy in places. Their pixels
+  // without reflectiveness lose the stencil bit before any ray is traced.
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+  glStencilMask(reflectiveStencil);
+  glossMaskShader.bind();
+  bindGBuffer(glossMaskShader, gBufferTextures);
+  glossMaskShader.setUniformValue("minReflectiveness", 0.01F);
+  renderQuad();
+  glossMaskShader.release();
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+
+  glStencilMask(0);
+  // mix(lit, reflection, alpha), keeping the lit alpha
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ZERO, GL_ONE);
+
+  ssrShader.bind();
+  bindGBuffer(ssrShader, gBufferTextures);
+  ssrShader.setUniformValue("projection", projectionTransform);
+
+  // SSR accumulates over frames together with the TAA history
+  bool useHistory = temporalActive() && historyValid;
+  ssrShader.setUniformValue("useHistory", useHistory);
+  if (useHistory)
+  {
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, frameGraph.texture(velocity));
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_2D, historyTextures[1 - historyIndex]);
+    ssrShader.setUniformValue("gVelocity", 4);
+    ssrShader.setUniformValue("history", 5);
+    ssrShader.setUniformValue("historyScale", historyScale);
+    ssrShader.setUniformValue("frameIndex", frameIndex);
+  }
 
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
-  lightingShader.setUniformValue("gAlbedoSpec", 2);
+  // Rays that leave the screen or miss reflect the probe. The sampler always
+  // gets its own unit, a cubemap may not share one with the 2D samplers.
+  bool useProbe = scene.probe.enabled && reflectionProbe.isValid();
+  ssrShader.setUniformValue("useProbe", useProbe);
+  ssrShader.setUniformValue("probe", 7);
+  glActiveTexture(GL_TEXTURE7);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, useProbe ? reflectionProbe.texture() : 0);
+  if (useProbe)
+  {
+    // The view has no scale, so this is the inverse of its rotation
+    ssrShader.setUniformValue("viewToWorld", viewTransform.inverted().normalMatrix());
+    ssrShader.setUniformValue(
+        "probeLod", std::min(scene.probe.blur, float(reflectionProbe.mipLevels() - 1)));
+  }
 
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, gEmission);
-  lightingShader.setUniformValue("gEmission", 3);
+  renderQuad();
 
-  lightingShader.setUniformValue("projection", projectionTransform);
+  ssrShader.release();
+  glDisable(GL_BLEND);
+  glStencilMask(0xFF);
+  glDisable(GL_STENCIL_TEST);
+}
 
-  // Render screen quad
+/**
+ * @brief MainView::renderTemporalResolve Blends the jittered lit image into the
+ * history, which then stands in for the lit image.
+ */
+void MainView::renderTemporalResolve(FrameGraph::Resource color, FrameGraph::Resource velocity,
+                                     FrameGraph::Resource depth)
+{
+  glViewport(0, 0, renderWidth(), renderHeight());
+
+  taaShader.bind();
+  GLuint textures[4] = {frameGraph.texture(color), frameGraph.texture(velocity),
+                        frameGraph.texture(depth), historyTextures[1 - historyIndex]};
+  const char *names[4] = {"sceneColor", "gVelocity", "gDepth", "history"};
+  for (int i = 0; i < 4; ++i)
+  {
+    glActiveTexture(GL_TEXTURE0 + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+    taaShader.setUniformValue(names[i], i);
+  }
+  taaShader.setUniformValue("colorScale", renderScale());
+  taaShader.setUniformValue("historyScale", historyScale);
+  taaShader.setUniformValue("historyValid", historyValid);
+  taaShader.setUniformValue("feedback", 0.1F);
   renderQuad();
+  taaShader.release();
 
-  lightingShader.release();
+  glActiveTexture(GL_TEXTURE0);
+}
+
+/**
+ * @brief MainView::renderGBufferDebug Shows one G-buffer channel instead of the
+ * lit image.
+ */
+void MainView::renderGBufferDebug(const QVector<FrameGraph::Resource> &gBufferTextures)
+{
+  glViewport(0, 0, renderWidth(), renderHeight());
+
+  gBufferDebugShader.bind();
+  bindGBuffer(gBufferDebugShader, gBufferTextures);
+  gBufferDebugShader.setUniformValue("view", gBufferView);
+  renderQuad();
+  gBufferDebugShader.release();
+}
+
+/**
+ * @brief MainView::addBloomPasses Declares the bloom chain: the lit image is
+ * thresholded and halved repeatedly (dual filter downsample), then upsampled
+ * back, adding each level on the way. All levels are R11F_G11F_B10F and the
+ * largest is half the internal resolution, so the chain touches a fraction of
+ * the memory a full resolution Gaussian would.
+ * @return The blurred image at half the internal resolution.
+ */
+FrameGraph::Resource MainView::addBloomPasses(FrameGraph::Resource litColor)
+{
+  using Resource = FrameGraph::Resource;
+
+  struct Level
+  {
+    Resource down;
+    TextureDesc desc;
+    QSize viewport;  // rendered part
+    QVector2D scale; // rendered part in texture coordinates
+  };
+  QVector<Level> levels;
+
+  // Like the other targets the levels are sized for the largest internal
+  // resolution and only partially rendered, so they stay in the pool while
+  // the render scale changes
+  QSize capacity(targetWidth, targetHeight);
+  QSize viewport(renderWidth(), renderHeight());
+  Resource source = litColor;
+  QVector2D sourceScale = renderScale();
+
+  int levelCount = std::clamp(scene.bloom.levels, 1, 8);
+  for (int i = 0; i < levelCount; ++i)
+  {
+    capacity = QSize((capacity.width() + 1) / 2, (capacity.height() + 1) / 2);
+    viewport = QSize((viewport.width() + 1) / 2, (viewport.height() + 1) / 2);
+    if (i > 0 && (viewport.width() < 4 || viewport.height() < 4))
+    {
+      break;
+    }
+
+    Level level;
+    level.desc = {GL_R11F_G11F_B10F, capacity.width(), capacity.height(), GL_LINEAR};
+    level.down = frameGraph.createTexture(QString("bloomDown%1").arg(i), level.desc);
+    level.viewport = viewport;
+    level.scale = QVector2D(static_cast<float>(viewport.width()) / capacity.width(),
+                            static_cast<float>(viewport.height()) / capacity.height());
+
+    bool prefilter = i == 0;
+    frameGraph.addPass(QString("bloomDown%1").arg(i), {source}, {level.down},
+                       [this, source, sourceScale, viewport, prefilter]
+                       { renderBloomDownsample(source, sourceScale, viewport, prefilter); });
+
+    levels.append(level);
+    source = level.down;
+    sourceScale = level.scale;
+  }
+
+  Resource blurred = levels.last().down;
+  for (int i = levels.size() - 2; i >= 0; --i)
+  {
+    const Level &level = levels[i];
+    Resource up = frameGraph.createTexture(QString("bloomUp%1").arg(i), level.desc);
+
+    QVector2D blurredScale = levels[i + 1].scale;
+    frameGraph.addPass(QString("bloomUp%1").arg(i), {blurred, level.down}, {up},
+                       [this, blurred, blurredScale, level]
+                       {
+                         renderBloomUpsample(blurred, blurredScale, level.down,
+                                             level.scale, level.viewport);
+                       });
+    blurred = up;
+  }
+
+  // Every level adds roughly the thresholded brightness, normalize the sum
+  bloomScale = levels.first().scale;
+  bloomIntensity = scene.bloom.intensity / levels.size();
+  return blurred;
+}
+
+/**
+ * @brief MainView::renderBloomDownsample One downsample step of the bloom
+ * chain. The first step also applies the threshold of the scene.
+ */
+void MainView::renderBloomDownsample(FrameGraph::Resource source, QVector2D sourceScale,
+                                     QSize viewport, bool prefilter)
+{
+  glViewport(0, 0, viewport.width(), viewport.height());
 
-  update();
+  bloomDownsampleShader.bind();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, frameGraph.texture(source));
+  bloomDownsampleShader.setUniformValue("source", 0);
+  bloomDownsampleShader.setUniformValue("sourceScale", sourceScale);
+  bloomDownsampleShader.setUniformValue("prefilter", prefilter);
+  bloomDownsampleShader.setUniformValue("threshold", scene.bloom.threshold);
+  bloomDownsampleShader.setUniformValue("knee", std::max(scene.bloom.knee, 0.0F));
+  renderQuad();
+  bloomDownsampleShader.release();
+}
+
+/**
+ * @brief MainView::renderBloomUpsample One upsample step of the bloom chain,
+ * adding the downsampled level of the same size.
+ */
+void MainView::renderBloomUpsample(FrameGraph::Resource source, QVector2D sourceScale,
+                                   FrameGraph::Resource detail, QVector2D detailScale,
+                                   QSize viewport)
+{
+  glViewport(0, 0, viewport.width(), viewport.height());
+
+  bloomUpsampleShader.bind();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, frameGraph.texture(source));
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, frameGraph.texture(detail));
+  bloomUpsampleShader.setUniformValue("source", 0);
+  bloomUpsampleShader.setUniformValue("sourceScale", sourceScale);
+  bloomUpsampleShader.setUniformValue("detail", 1);
+  bloomUpsampleShader.setUniformValue("detailScale", detailScale);
+  renderQuad();
+  bloomUpsampleShader.release();
+
+  glActiveTexture(GL_TEXTURE0);
+}
+
+/**
+ * @brief MainView::renderUpscale Upscales the internal resolution image to the
+ * window and adds the bloom.
+ * @param bloom Result of addBloomPasses, or -1 for none.
+ */
+void MainView::renderUpscale(FrameGraph::Resource image, FrameGraph::Resource bloom)
+{
+  glViewport(0, 0, realWidth(), realHeight());
+  glClear(GL_COLOR_BUFFER_BIT);
+
+  upscaleShader.bind();
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, frameGraph.texture(image));
+  upscaleShader.setUniformValue("sceneColor", 0);
+  upscaleShader.setUniformValue("colorScale", renderScale());
+  // TAA softens the image a little, sharpen it back
+  float sharpness = dynamicResolution.scale() < 1.0F ? 0.5F : temporalActive() ? 0.25F : 0.0F;
+  upscaleShader.setUniformValue("sharpness", sharpness);
+
+  if (bloom >= 0)
+  {
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, frameGraph.texture(bloom));
+    upscaleShader.setUniformValue("bloom", 1);
+    upscaleShader.setUniformValue("bloomScale", bloomScale);
+  }
+  upscaleShader.setUniformValue("bloomIntensity", bloom >= 0 ? bloomIntensity : 0.0F);
+  renderQuad();
+  upscaleShader.release();
+
+  glActiveTexture(GL_TEXTURE0);
+}
+
+/**
+ * @brief MainView::captureFrame Starts reading back the window or, in EXR
+ * recordings, the resolved image at the internal resolution.
+ */
+void MainView::captureFrame(FrameGraph::Resource image)
+{
+  if (recorder.format() == FrameRecorder::EXR)
+  {
+    recorder.captureTexture(frameGraph.texture(image), renderWidth(), renderHeight());
+  }
+  else
+  {
+    recorder.capture(defaultFramebufferObject(), realWidth(), realHeight());
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+}
+
+/**
+ * @brief MainView::toggleRecording Starts recording into a new directory
+ * under captures/, or stops the running recording.
+ */
+void MainView::toggleRecording(FrameRecorder::Format format)
+{
+  if (recorder.isRecording())
+  {
+    makeCurrent();
+    recorder.stop();
+    doneCurrent();
+    return;
+  }
+  QString directory =
+      QString("captures/%1").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+  recorder.start(directory, format);
+}
+
+/**
+ * @brief MainView::prepareReference Loads the scene into the reference
+ * renderer if it changed since the last time and sets the water time.
+ * @return Whether the reference renderer has a scene.
+ */
+bool MainView::prepareReference(float time)
+{
+  if (!referenceLoaded)
+  {
+    // Only the streamed actors that are resident, like the GL frame
+    SceneDescription visible = scene;
+    if (streamer.isOpen())
+    {
+      visible.actors.clear();
+      for (const ActorDescription &description : scene.actors)
+      {
+        if (!SceneStreamer::isStreamed(description))
+        {
+          visible.actors.append(description);
+        }
+      }
+      visible.actors += streamer.residentDescriptions();
+    }
+    // Where the scene graph placed them, parents included; like the actors,
+    // only the first of several entries with a name takes its node
+    QSet<int> placed;
+    for (ActorDescription &description : visible.actors)
+    {
+      int node = sceneGraph.nodeOf(description.name);
+      if (node >= 0 && !placed.contains(node))
+      {
+        placed.insert(node);
+        description.transform = sceneGraph.world(node);
+        description.parent.clear();
+      }
+    }
+    referenceLoaded = reference.load(visible);
+  }
+  reference.setWaves(&waves, time);
+  return referenceLoaded;
+}
+
+/**
+ * @brief MainView::referenceShadows The cascades of the last lighting pass,
+ * fitted again on the CPU. None if that pass had no shadow maps.
+ */
+ReferenceRenderer::Shadows MainView::referenceShadows() const
+{
+  if (!shadowMaps.isValid())
+  {
+    return ReferenceRenderer::Shadows();
+  }
+  ReferenceRenderer::Camera camera{viewTransform, unjitteredProjection, renderWidth(),
+                                   renderHeight()};
+  return reference.fitShadows(scene.shadows, camera);
+}
+
+/**
+ * @brief MainView::compareWithReference Reads back the lit image of this frame,
+ * renders the same view with the reference renderer and logs how far apart
+ * they are. Both images and their difference go to a new directory under
+ * captures/. Waits for the GPU and the CPU render, it is a debugging aid.
+ */
+void MainView::compareWithReference(FrameGraph::Resource litColor, float time)
+{
+  int width = renderWidth();
+  int height = renderHeight();
+  QVector<float> rgba(targetWidth * targetHeight * 4);
+  glBindTexture(GL_TEXTURE_2D, frameGraph.texture(litColor));
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, rgba.data());
+  glBindTexture(GL_TEXTURE_2D, 0);
+  QVector<QVector3D> gl(width * height);
+  for (int y = 0; y < height; ++y)
+  {
+    for (int x = 0; x < width; ++x)
+    {
+      const float *texel = rgba.constData() + (y * targetWidth + x) * 4;
+      gl[y * width + x] = QVector3D(texel[0], texel[1], texel[2]);
+    }
+  }
+
+  if (!prepareReference(time))
+  {
+    qWarning() << "Reference: no scene to render";
+    return;
+  }
+  ReferenceRenderer::Camera camera{viewTransform, projectionTransform, width, height};
+  reference.render(JobSystem::global(), camera, referenceShadows());
+  reference.report();
+
+  ReferenceRenderer::Difference difference =
+      ReferenceRenderer::compare(gl, reference.color(), 2.0F / 255.0F);
+  qDebug().noquote() << QString("Reference: RMSE %1, PSNR %2 dB, max error %3, %4 of %5 pixels "
+                                "differ by more than 2/255")
+                            .arg(difference.rmse, 0, 'f', 5)
+                            .arg(difference.psnr, 0, 'f', 2)
+                            .arg(difference.maxError, 0, 'f', 3)
+                            .arg(difference.differing)
+                            .arg(difference.pixels);
+  if (waveMode != PER_VERTEX)
+  {
+    qDebug() << "Reference: the water only matches in the per vertex wave mode (W)";
+  }
+
+  QString directory =
+      QString("captures/reference-%1")
+          .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+  if (QDir().mkpath(directory))
+  {
+    ReferenceRenderer::toImage(gl, width, height).save(directory + "/gl.png");
+    ReferenceRenderer::toImage(reference.color(), width, height).save(directory + "/cpu.png");
+    ReferenceRenderer::differenceImage(gl, reference.color(), width, height, 10.0F)
+        .save(directory + "/difference.png");
+    qDebug() << "Reference: images written to" << directory;
+  }
+}
+
+/**
+ * @brief MainView::benchmarkReference Renders the current view with the
+ * reference renderer on 1 up to all cores.
+ */
+void MainView::benchmarkReference()
+{
+  if (!prepareReference(scheduler.time()))
+  {
+    qWarning() << "Reference: no scene to render";
+    return;
+  }
+  ReferenceRenderer::Camera camera{viewTransform, unjitteredProjection, renderWidth(),
+                                   renderHeight()};
+  reference.benchmark(camera, referenceShadows());
 }
 
 void MainView::renderQuad()
@@ -248,38 +1195,67 @@ void MainView::resizeGL(int newWidth, int newHeight)
   Q_UNUSED(newHeight)
   updateProjectionTransform();
 
-  setupGBuffer(realWidth(), realHeight());
+  setupRenderTargets(realWidth(), realHeight());
+  staticGBufferValid = false;
 }
 
 /**
  * @brief MainView::updateProjectionTransform Updates the projection transform
- * matrix taking into consideration the current aspect ratio.
+ * matrix taking into consideration the current aspect ratio, and offsets it by
+ * the sub-pixel jitter of this frame.
  */
 void MainView::updateProjectionTransform()
 {
   float aspectRatio =
       static_cast<float>(realWidth()) / static_cast<float>(realHeight());
-  projectionTransform.setToIdentity();
-  projectionTransform.perspective(50.0F, aspectRatio, 0.2F, 1000.0F);
+  unjitteredProjection.setToIdentity();
+  unjitteredProjection.perspective(50.0F, aspectRatio, 0.2F, 1000.0F);
+
+  // A pixel of the internal resolution is 2 / size wide in NDC
+  QMatrix4x4 offset;
+  offset.translate(2.0F * jitter.x() / renderWidth(), 2.0F * jitter.y() / renderHeight());
+  projectionTransform = offset * unjitteredProjection;
 
   viewTransform.setToIdentity();
 }
 
 /**
- * @brief MainView::updateModelTransforms Updates the model transform matrix of
- * the mesh to reflect the current rotation and scale values.
+ * @brief MainView::updateModelTransforms Recomputes the scene graph nodes
+ * whose local transform changed, and the nodes below them, and hands their
+ * matrices to their actors. Static actors are cached in the static G-buffer,
+ * the shadow cascades, the reflection probe and the batches, so moving one
+ * renders all of those again.
  */
 void MainView::updateModelTransforms()
 {
-  // for (auto &actor : actors)
-  // {
-  //   actor.transform.setToIdentity();
-  //   actor.transform.translate(0.0F, 0.0F, -10.0F);
-  //   actor.transform.rotate(QQuaternion::fromEulerAngles(rotation));
-  //   actor.transform.scale(scale);
-  // }
+  bool staticMoved = false;
+  bool batchedMoved = false;
+  for (int node : sceneGraph.update(JobSystem::global()))
+  {
+    int index = actorOfNode.value(node, -1);
+    if (index < 0)
+    {
+      continue;
+    }
+    Actor &actor = actors[index];
+    actor.transform = sceneGraph.world(node);
+    actor.normalMatrix = sceneGraph.normalMatrix(node);
+    // The reference renderer copies the transforms when it loads
+    referenceLoaded = false;
+    staticMoved |= !actor.dynamic;
+    batchedMoved |= actor.batched;
+  }
 
-  update();
+  if (batchedMoved)
+  {
+    buildStaticBatches();
+  }
+  if (staticMoved)
+  {
+    staticGBufferValid = false;
+    reflectionProbe.invalidate();
+    shadowMaps.invalidate();
+  }
 }
 
 /**
@@ -287,6 +1263,10 @@ void MainView::updateModelTransforms()
  */
 void MainView::destroyModelBuffers()
 {
+  staticBatches.clear(actors);
+  glDeleteFramebuffers(1, &staticGBuffer);
+  glDeleteRenderbuffers(6, staticAttachments);
+  glDeleteTextures(2, historyTextures);
 }
 
 /**
@@ -299,68 +1279,129 @@ void MainView::onMessageLogged(QOpenGLDebugMessage Message)
   qDebug() << " → Log:" << Message;
 }
 
-void MainView::setupGBuffer(int width, int height)
+/**
+ * @brief MainView::setupRenderTargets Makes sure the render targets can hold
+ * width x height pixels. The size only grows, rounded up, so the frame graph's
+ * pooled targets are reused: the internal resolution changes every few seconds
+ * under dynamic resolution and the window may be resized continuously, but
+ * both just render into a smaller part of the same targets.
+ */
+void MainView::setupRenderTargets(int width, int height)
 {
-  // 1. Generate FBO (only needs to be done once)
-  if (gBuffer == 0)
+  if (width <= targetWidth && height <= targetHeight)
   {
-    glGenFramebuffers(1, &gBuffer);
-    glGenTextures(1, &gPosition);
-    glGenTextures(1, &gNormal);
-    glGenTextures(1, &gAlbedoSpec);
-    glGenTextures(1, &gDepth);
-    glGenTextures(1, &gEmission);
+    return;
   }
 
-  glBindFramebuffer(GL_FRAMEBUFFER, gBuffer);
+  const int granularity = 128;
+  targetWidth = std::max(targetWidth, (width + granularity - 1) / granularity * granularity);
+  targetHeight = std::max(targetHeight, (height + granularity - 1) / granularity * granularity);
 
-  // 2. Attachments (Dimensions must match the viewport)
+  setupHistory(targetWidth, targetHeight);
+  if (staticGBuffer != 0)
+  {
+    setupStaticGBuffer(targetWidth, targetHeight);
+  }
+}
 
-  // Position Color Buffer (e.g., View-space coordinates)
-  glBindTexture(GL_TEXTURE_2D, gPosition);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gPosition, 0);
+/**
+ * @brief MainView::setupHistory (Re)allocates the two TAA history textures.
+ * They outlive a frame, so unlike the other targets they are not pooled.
+ */
+void MainView::setupHistory(int width, int height)
+{
+  if (historyTextures[0] == 0)
+  {
+    glGenTextures(2, historyTextures);
+  }
 
-  // Normal Color Buffer (e.g., View-space normals)
-  glBindTexture(GL_TEXTURE_2D, gNormal);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gNormal, 0);
+  for (GLuint texture : historyTextures)
+  {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+  historyValid = false;
+}
 
-  // Albedo + Specular Color Buffer (Albedo: RGB, Specular: A)
-  glBindTexture(GL_TEXTURE_2D, gAlbedoSpec);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, gAlbedoSpec, 0);
+/**
+ * @brief MainView::temporalActive Whether this frame uses TAA. The G-buffer
+ * debug views show the raw channels.
+ */
+bool MainView::temporalActive() const
+{
+  return taaEnabled && gBufferView == 0;
+}
+
+/**
+ * @brief MainView::setupStaticGBuffer Creates the cached copy of the G-buffer
+ * used by WATER_ONLY frames. Renderbuffers suffice since it is only blitted.
+ */
+void MainView::setupStaticGBuffer(int width, int height)
+{
+  if (staticGBuffer == 0)
+  {
+    glGenFramebuffers(1, &staticGBuffer);
+    glGenRenderbuffers(6, staticAttachments);
+  }
 
-  // 3. Depth Buffer (Used for Depth Testing in Geometry Pass)
-  glBindTexture(GL_TEXTURE_2D, gDepth);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, gDepth, 0);
-  // You can also use GL_DEPTH24_STENCIL8 if you need a stencil buffer.
+  glBindFramebuffer(GL_FRAMEBUFFER, staticGBuffer);
 
-  glBindTexture(GL_TEXTURE_2D, gEmission);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, gEmission, 0);
+  // Same channels as the G-buffer; RGB16F is not a required renderbuffer format
+  const GLenum formats[5] = {GL_RGBA16F, GL_RGBA16F, GL_RGBA8, GL_RGBA16F, GL_RG16F};
+  for (int i = 0; i < 5; ++i)
+  {
+    glBindRenderbuffer(GL_RENDERBUFFER, staticAttachments[i]);
+    glRenderbufferStorage(GL_RENDERBUFFER, formats[i], width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_RENDERBUFFER, staticAttachments[i]);
+  }
 
-  // 4. Tell OpenGL which color attachments we'll use (Color Attachments 0-2)
-  GLenum attachments[4] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3};
-  glDrawBuffers(4, attachments);
+  glBindRenderbuffer(GL_RENDERBUFFER, staticAttachments[5]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+                            staticAttachments[5]);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
-  // 5. Check for FBO completeness
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-    qWarning() << "G-Buffer FBO not complete!";
+    qWarning() << "Static G-Buffer FBO not complete!";
 
-  // 6. Bind default framebuffer again
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+/**
+ * @brief MainView::copyGBuffer Copies all G-buffer attachments, depth and
+ * stencil between the G-buffer and its static copy, leaving the destination
+ * bound.
+ */
+void MainView::copyGBuffer(GLuint from, GLuint to)
+{
+  int width = renderWidth();
+  int height = renderHeight();
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, from);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, to);
+
+  for (int i = 0; i < 5; ++i)
+  {
+    glReadBuffer(GL_COLOR_ATTACHMENT0 + i);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0 + i);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  }
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                    GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+
+  GLenum attachments[5] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2,
+                           GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4};
+  glDrawBuffers(5, attachments);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, to);
+}
+
 int MainView::realWidth() const
 {
   return width() * devicePixelRatioF();
@@ -370,3 +1411,354 @@ int MainView::realHeight() const
 {
   return height() * devicePixelRatioF();
 }
+
+/**
+ * @brief MainView::renderWidth Width of the internal resolution the G-buffer and
+ * lighting passes render at.
+ */
+int MainView::renderWidth() const
+{
+  return std::max(1, static_cast<int>(std::lround(realWidth() * dynamicResolution.scale())));
+}
+
+int MainView::renderHeight() const
+{
+  return std::max(1, static_cast<int>(std::lround(realHeight() * dynamicResolution.scale())));
+}
+
+/**
+ * @brief MainView::renderScale Part of the render targets covered by the
+ * internal resolution, in texture coordinates.
+ */
+QVector2D MainView::renderScale() const
+{
+  return QVector2D(static_cast<float>(renderWidth()) / targetWidth,
+                   static_cast<float>(renderHeight()) / targetHeight);
+}
+
+/**
+ * @brief MainView::loadScene Parses the scene file and brings the actors and
+ * water in line with it. On a parse error the current scene stays untouched.
+ */
+void MainView::loadScene()
+{
+  SceneDescription next;
+  QString error;
+  if (!next.load(scenePath, &error))
+  {
+    qWarning() << "Scene: failed to load" << error;
+    return;
+  }
+
+  scene = next;
+
+  // With streaming, the SceneLoader only gets the actors that are always loaded
+  actors = actors.mid(0, baseActorCount);
+  SceneDescription loaded = scene;
+  if (scene.streaming.enabled)
+  {
+    loaded.actors = streamer.open(scene);
+  }
+  else
+  {
+    streamer.close();
+  }
+  sceneLoader.apply(loaded, actors);
+  baseActorCount = actors.size();
+  sceneGraph.build(JobSystem::global(), scene.actors);
+  attachActors();
+  buildStaticBatches();
+  applyWaterSettings(scene.water);
+  staticGBufferValid = false;
+  reflectionProbe.invalidate();
+  shadowMaps.invalidate();
+  referenceLoaded = false;
+
+  // Resources cannot change, only files on disk are watched
+  QStringList watched = sceneLoader.texturePaths();
+  watched.append(scenePath);
+  for (const QString &path : watched)
+  {
+    if (!path.startsWith(":") && !sceneWatcher.files().contains(path))
+    {
+      sceneWatcher.addPath(path);
+    }
+  }
+}
+
+/**
+ * @brief MainView::updateStreaming Lets the streamer follow the camera and
+ * replaces the streamed actors when its tiles changed. Everything cached from
+ * the static actors is rendered again then.
+ */
+void MainView::updateStreaming(float time)
+{
+  if (streamingBenchmark.isRunning())
+  {
+    streamingBenchmark.step();
+    scheduler.requestFrame();
+  }
+  if (!streamer.isOpen())
+  {
+    return;
+  }
+
+  QVector3D camera = viewTransform.inverted().column(3).toVector3D();
+  float seconds = time - streamingTime;
+  QVector3D velocity = seconds > 0.0F ? (camera - streamingCamera) / seconds : QVector3D();
+  streamingCamera = camera;
+  streamingTime = time;
+
+  if (streamer.update(camera, velocity))
+  {
+    // Actors cannot be assigned, so the list is rebuilt instead of shrunk
+    QVector<Actor> next = actors.mid(0, baseActorCount);
+    streamer.appendActors(next);
+    actors.swap(next);
+    attachActors();
+    staticGBufferValid = false;
+    reflectionProbe.invalidate();
+    shadowMaps.invalidate();
+    referenceLoaded = false;
+  }
+  // Keep drawing until the tiles being read are uploaded
+  if (streamer.isBusy())
+  {
+    scheduler.requestFrame();
+  }
+}
+
+/**
+ * @brief MainView::attachActors Looks up the scene graph node of every actor by
+ * its name and takes its world and normal matrices, which differ from the
+ * transform of its entry for actors with a parent. A node belongs to one actor
+ * only; later actors with the same name keep the transform of their own entry.
+ */
+void MainView::attachActors()
+{
+  actorOfNode.fill(-1, sceneGraph.size());
+  for (int i = 0; i < actors.size(); ++i)
+  {
+    Actor &actor = actors[i];
+    actor.node = sceneGraph.nodeOf(actor.name);
+    if (actor.node >= 0 && actorOfNode[actor.node] >= 0)
+    {
+      actor.node = -1;
+    }
+    if (actor.node >= 0)
+    {
+      actorOfNode[actor.node] = i;
+      actor.transform = sceneGraph.world(actor.node);
+      actor.normalMatrix = sceneGraph.normalMatrix(actor.node);
+    }
+  }
+}
+
+/**
+ * @brief MainView::buildStaticBatches Batches the actors of the SceneLoader.
+ * Streamed actors come and go with their tiles, so they are left out.
+ */
+void MainView::buildStaticBatches()
+{
+  // Actors cannot be assigned, so the list is rebuilt around the batched part
+  QVector<Actor> batched = actors.mid(0, baseActorCount);
+  // Everything but the reflective and dynamic actors can be batched, with the
+  // batch variant of its material; the batches are drawn without the stencil
+  // bit and keep the transforms they were built with
+  staticBatches.build(batched,
+                      [this](const Actor &actor) -> QOpenGLShaderProgram *
+                      {
+                        if (actor.reflective || actor.dynamic)
+                        {
+                          return nullptr;
+                        }
+                        return &geometryProgram(actor.shaderFeatures | STATIC_BATCH);
+                      });
+  for (int i = baseActorCount; i < actors.size(); ++i)
+  {
+    batched.append(actors[i]);
+  }
+  actors.swap(batched);
+}
+
+/**
+ * @brief MainView::applyWaterSettings Hands the water parameters of the scene to
+ * the wave model and the ocean. The ocean spectrum is only regenerated when its
+ * settings actually changed.
+ */
+void MainView::applyWaterSettings(const WaterDescription &water)
+{
+  waveMode = water.mode;
+  if (!water.waves.isEmpty())
+  {
+    waves.setComponents(water.waves);
+  }
+  waves.setDepth(water.depth);
+  waves.setHeightScale(water.heightScale);
+
+  if (water.ocean != ocean.getSettings())
+  {
+    ocean.setSettings(water.ocean);
+  }
+}
+
+/**
+ * @brief MainView::onSceneFileChanged Hot reloads the scene file or one of its
+ * textures. Many editors save by replacing the file, which drops it from the
+ * watcher, so loadScene adds it again.
+ */
+void MainView::onSceneFileChanged(const QString &path)
+{
+  makeCurrent();
+  if (path == scenePath)
+  {
+    loadScene();
+  }
+  else
+  {
+    staticGBufferValid = !sceneLoader.reloadTexture(path) && staticGBufferValid;
+    reflectionProbe.invalidate();
+    referenceLoaded = false;
+    if (QFileInfo::exists(path) && !sceneWatcher.files().contains(path))
+    {
+      sceneWatcher.addPath(path);
+    }
+  }
+  doneCurrent();
+  scheduler.requestFrame();
+}
+
+/**
+ * @brief MainView::onShaderFileChanged Rebuilds the programs using a changed
+ * shader source. Programs that fail to build keep their last good version.
+ */
+void MainView::onShaderFileChanged(const QString &path)
+{
+  makeCurrent();
+  if (shaders.reload(path))
+  {
+    staticGBufferValid = false;
+    reflectionProbe.invalidate();
+    shadowMaps.invalidate();
+  }
+  doneCurrent();
+  scheduler.requestFrame();
+}
+
+/**
+ * @brief MainView::setupWaveTexture Creates the tiling wave texture and the FBO
+ * used to render into it. The texture repeats every waveTileSize world units;
+ * the wave vectors are snapped to that lattice in waves.glsl.
+ */
+void MainView::setupWaveTexture()
+{
+  glGenFramebuffers(1, &waveFBO);
+  glGenTextures(2, waveTextures);
+
+  for (GLuint texture : waveTextures)
+  {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, waveTextureSize, waveTextureSize, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, waveFBO);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, waveTextures[0], 0);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    qWarning() << "Wave texture FBO not complete!";
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * @brief MainView::updateWaveTexture Produces this frame's wave texture and hands
+ * it to the water shader. In TEXTURE mode the wave model is evaluated once per
+ * texel on the GPU, replacing the five waveHeight evaluations per water vertex
+ * with a single texture fetch. In FFT mode the ocean spectrum is synthesized on
+ * the CPU instead. The waves of the previous frame stay bound as well, for the
+ * velocity of the water.
+ * @param time Current scene time in seconds.
+ */
+void MainView::updateWaveTexture(float time)
+{
+  GLuint heightTexture = waveTextures[waveTextureIndex];
+  GLuint displacementTexture = ocean.displacementTexture();
+  GLuint previousHeight = heightTexture;
+  GLuint previousDisplacement = displacementTexture;
+  float tileSize = waveTileSize;
+
+  // The previous waves only describe the previous frame if it used this mode
+  bool continuous = previousWaveMode == waveMode;
+  previousWaveMode = waveMode;
+
+  if (waveMode == TEXTURE)
+  {
+    waveTextureIndex = 1 - waveTextureIndex;
+    heightTexture = waveTextures[waveTextureIndex];
+    if (continuous)
+    {
+      previousHeight = waveTextures[1 - waveTextureIndex];
+    }
+    else
+    {
+      previousHeight = heightTexture;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, waveFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, heightTexture, 0);
+    glViewport(0, 0, waveTextureSize, waveTextureSize);
+    glDisable(GL_DEPTH_TEST);
+
+    waveTextureShader.bind();
+    waveTextureShader.setUniformValue("time", time);
+    waveTextureShader.setUniformValue("waveTileSize", waveTileSize);
+    waves.setUniforms(waveTextureShader);
+    renderQuad();
+    waveTextureShader.release();
+
+    glBindTexture(GL_TEXTURE_2D, heightTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+  else if (waveMode == FFT)
+  {
+    ocean.update(time);
+    heightTexture = ocean.heightTexture();
+    displacementTexture = ocean.displacementTexture();
+    previousHeight = continuous ? ocean.previousHeightTexture() : heightTexture;
+    previousDisplacement = continuous ? ocean.previousDisplacementTexture() : displacementTexture;
+    tileSize = ocean.getSettings().tileSize;
+  }
+
+  for (QOpenGLShaderProgram *waterShader : waterVariants.programs())
+  {
+    waterShader->bind();
+    waterShader->setUniformValue("useWaveTexture", waveMode != PER_VERTEX);
+    waterShader->setUniformValue("useWaveDisplacement", waveMode == FFT);
+    waterShader->setUniformValue("waveTileSize", tileSize);
+    waterShader->setUniformValue("waveTexture", 2);
+    waterShader->setUniformValue("waveDisplacement", 3);
+    waterShader->setUniformValue("previousWaveTexture", 4);
+    waterShader->setUniformValue("previousWaveDisplacement", 5);
+    waterShader->setUniformValue("previousTime", continuous ? previousTime : time);
+    waves.setUniforms(*waterShader);
+    waterShader->release();
+  }
+
+  // The wave textures go on units 2 to 5 for the geometry pass, which no other
+  // draw of that pass touches: materials use DrawList::materialUnits (0, 1, 8
+  // and 9) and the static batches their draw data on unit 6.
+  GLuint textures[4] = {heightTexture, displacementTexture, previousHeight, previousDisplacement};
+  for (int i = 0; i < 4; ++i)
+  {
+    glActiveTexture(GL_TEXTURE2 + i);
+    glBindTexture(GL_TEXTURE_2D, textures[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
@@ -9,16 +9,39 @@
 #include <QOpenGLShaderProgram>
 #include <QOpenGLWidget>
 #include <QTimer>
+#include <QVector2D>
 #include <QVector3D>
 #include <QElapsedTimer>
+#include <QFileSystemWatcher>
 
 // for GLuint
 #include <QOpenGLFunctions_3_3_Core>
 
 #include "model.h"
+#include "ocean.h"
+#include "scenedescription.h"
+#include "sceneloader.h"
+#include "shaderfeatures.h"
+#include "shadermanager.h"
 #include "shadingmode.h"
+#include "wavemode.h"
+#include "waves.h"
 
 #include "actor.h"
+#include "drawlist.h"
+#include "dynamicresolution.h"
+#include "framegraph.h"
+#include "framerecorder.h"
+#include "framescheduler.h"
+#include "gputimer.h"
+#include "occlusionculler.h"
+#include "referencerenderer.h"
+#include "reflectionprobe.h"
+#include "scenegraph.h"
+#include "scenestreamer.h"
+#include "streamingbenchmark.h"
+#include "shadowmaps.h"
+#include "staticbatches.h"
 
 /**
  * @brief The MainView class is resonsible for the actual content of the main
@@ -42,6 +65,9 @@ protected:
 
   int realWidth() const;
   int realHeight() const;
+  int renderWidth() const;
+  int renderHeight() const;
+  QVector2D renderScale() const;
 
   // Functions for keyboard input events
   void keyPressEvent(QKeyEvent *ev) override;
@@ -56,6 +82,8 @@ protected:
 
 private slots:
   void onMessageLogged(QOpenGLDebugMessage Message);
+  void onSceneFileChanged(const QString &path);
+  void onShaderFileChanged(const QString &path);
 
 private:
   void destroyModelBuffers();
@@ -63,37 +91,202 @@ private:
   void updateModelTransforms();
   void loadShaders(QOpenGLShaderProgram &program, const QString &vertPath,
                    const QString &fragPath);
+  void loadShaders(QOpenGLShaderProgram &program, const QStringList &vertPaths,
+                   const QStringList &fragPaths);
+  QOpenGLShaderProgram &geometryProgram(int features);
 
-  void setupGBuffer(int width, int height);
+  void setupRenderTargets(int width, int height);
+  void setupHistory(int width, int height);
+  void setupStaticGBuffer(int width, int height);
+  void copyGBuffer(GLuint from, GLuint to);
+
+  void loadScene();
+  void applyWaterSettings(const WaterDescription &water);
+  void updateStreaming(float time);
+  void attachActors();
+  void buildStaticBatches();
+
+  void setupWaveTexture();
+  void updateWaveTexture(float time);
+
+  void captureReflectionProbe(float time);
+  void renderProbeFace(const QMatrix4x4 &view, const QMatrix4x4 &projection);
+  void renderShadows();
+  void renderShadowCasters(const QMatrix4x4 &lightViewProjection, bool dynamic);
+  void renderGBuffer(float time);
+  void bindGBuffer(QOpenGLShaderProgram &program,
+                   const QVector<FrameGraph::Resource> &gBufferTextures);
+  void renderLighting(const QVector<FrameGraph::Resource> &gBufferTextures,
+                      FrameGraph::Resource velocity);
+  void renderReflections(const QVector<FrameGraph::Resource> &gBufferTextures,
+                         FrameGraph::Resource velocity);
+  void renderGBufferDebug(const QVector<FrameGraph::Resource> &gBufferTextures);
+  FrameGraph::Resource addBloomPasses(FrameGraph::Resource litColor);
+  void renderBloomDownsample(FrameGraph::Resource source, QVector2D sourceScale,
+                             QSize viewport, bool prefilter);
+  void renderBloomUpsample(FrameGraph::Resource source, QVector2D sourceScale,
+                           FrameGraph::Resource detail, QVector2D detailScale,
+                           QSize viewport);
+  void renderTemporalResolve(FrameGraph::Resource color, FrameGraph::Resource velocity,
+                             FrameGraph::Resource depth);
+  void renderUpscale(FrameGraph::Resource image, FrameGraph::Resource bloom);
+  void captureFrame(FrameGraph::Resource image);
+  void toggleRecording(FrameRecorder::Format format);
+  bool prepareReference(float time);
+  ReferenceRenderer::Shadows referenceShadows() const;
+  void compareWithReference(FrameGraph::Resource litColor, float time);
+  void benchmarkReference();
+  bool temporalActive() const;
 
   void renderQuad();
 
   QOpenGLDebugLogger debugLogger;
   QTimer timer; // timer used for animation
 
-  GLuint gBuffer;
-  GLuint gPosition, gNormal, gAlbedoSpec, gEmission;
-  GLuint gDepth;
+  // Schedules the passes of a frame and owns their render targets
+  FrameGraph frameGraph;
+
+  // Geometry pass draws, prepared on the job system every frame
+  DrawList drawList;
+
+  // Depth of the occluders on the CPU, culls the draw list behind them
+  OcclusionCuller occlusionCuller;
+  bool occlusionEnabled = true;
+
+  // Static actors, merged into a few multi-draw calls
+  StaticBatches staticBatches;
+  bool batchingEnabled = true;
+
+  // Cubemap the reflections fall back to where SSR finds nothing
+  ReflectionProbe reflectionProbe;
+
+  // Cascaded shadow maps of the light, static casters cached
+  ShadowMaps shadowMaps;
+
+  // Writes the frames to image files while recording
+  FrameRecorder recorder;
+
+  // CPU ground truth of the lit image, compared with the next frame on request
+  ReferenceRenderer reference;
+  bool referenceLoaded = false;
+  bool referenceRequested = false;
+
+  // Size the render targets are allocated at; the internal resolution uses
+  // the lower left renderWidth() x renderHeight() pixels
+  int targetWidth = 0;
+  int targetHeight = 0;
+
+  // G-buffer of everything but the water, reused by WATER_ONLY frames until
+  // the scene, a shader or the size changes
+  GLuint staticGBuffer = 0;
+  GLuint staticAttachments[6] = {}; // 5 color renderbuffers + depth-stencil
+  bool staticGBufferValid = false;
+
+  // Stencil bit of the G-buffer set by reflective actors; SSR only runs there
+  static const GLuint reflectiveStencil = 0x01;
+
+  // Builds the programs below and hot reloads them
+  ShaderManager shaders;
+
+  // Geometry pass programs, one per combination of ShaderFeature bits
+  ShaderVariants gBufferVariants{{":/shaders/g_buffer_vert.glsl"},
+                                 {":/shaders/g_buffer_frag.glsl"}};
+  ShaderVariants waterVariants{{":/shaders/watervert.glsl", ":/shaders/waves.glsl"},
+                               {":/shaders/g_buffer_frag.glsl"}};
+  ShaderVariants probeVariants{{":/shaders/probe_vert.glsl"},
+                               {":/shaders/probe_frag.glsl"}}; // Faces of the reflection probe
 
   // Shaders for the two passes
-  QOpenGLShaderProgram gBufferShader;  // For Geometry Pass
   QOpenGLShaderProgram lightingShader; // For Lighting Pass (Post-Process Quad)
+  QOpenGLShaderProgram ssrShader;      // Reflections, over the reflective pixels
+  QOpenGLShaderProgram glossMaskShader; // Unmarks reflective pixels that are not glossy
+  QOpenGLShaderProgram upscaleShader;  // Internal resolution to window
+  QOpenGLShaderProgram gBufferDebugShader;
+  QOpenGLShaderProgram taaShader;
+  QOpenGLShaderProgram bloomDownsampleShader;
+  QOpenGLShaderProgram bloomUpsampleShader;
+  QOpenGLShaderProgram probePrefilterShader;
+  QOpenGLShaderProgram shadowShader; // Depth of the shadow casters
+
+  // Rendered part of the largest bloom level and the weight it is added with,
+  // set by addBloomPasses for the upscale pass
+  QVector2D bloomScale;
+  float bloomIntensity = 0.0F;
+
+  // G-buffer channel shown instead of the lit image, 0 for none
+  int gBufferView = 0;
+
+  DynamicResolution dynamicResolution;
+
+  // Temporal anti-aliasing: every frame is rendered with a different sub-pixel
+  // jitter and blended into the history, the resolved previous frames
+  bool taaEnabled = true;
+  int frameIndex = 0;
+  QVector2D jitter; // of this frame, in pixels
+  GLuint historyTextures[2] = {0, 0};
+  int historyIndex = 0; // the one written this frame
+  bool historyValid = false;
+  QVector2D historyScale; // rendered part of the previous history
 
   // // A simple VAO/VBO for drawing the screen quad
   GLuint quadVAO = 0;
   GLuint quadVBO = 0;
 
-  QOpenGLShaderProgram basicShader;
-  QOpenGLShaderProgram waterShader;
+  // Precomputed wave height/normal texture, rendered once per frame and
+  // sampled by the water shaders instead of evaluating the waves per vertex.
+  WaveMode waveMode = FFT;
+  QOpenGLShaderProgram waveTextureShader;
+  GLuint waveFBO = 0;
+  // Written alternately, so the previous waves are available for the velocity
+  GLuint waveTextures[2] = {0, 0};
+  int waveTextureIndex = 0;
+  int previousWaveMode = -1; // none yet
+  const int waveTextureSize = 512;  // texels per side
+  const float waveTileSize = 16.0F; // world units covered by one tile
+
+  // Analytic waves, shared by the water shaders and CPU height queries
+  WaveModel waves;
+
+  // Spectrum based water surface synthesized with the CPU FFT
+  Ocean ocean;
+
   QVector<Actor> actors = {};
 
-  QElapsedTimer startTimer;
+  // Scene file the actors are built from, reloaded (together with the
+  // textures it references) when it changes on disk
+  QString scenePath;
+  SceneDescription scene;
+  SceneLoader sceneLoader;
+  QFileSystemWatcher sceneWatcher;
+
+  // Static actors of scenes with streaming, loaded in tiles around the camera.
+  // Their actors follow the baseActorCount ones of the SceneLoader.
+  SceneStreamer streamer;
+  int baseActorCount = 0;
+  QVector3D streamingCamera;
+  float streamingTime = 0.0F;
+  // Flies over a synthetic world of its own while running (Z)
+  StreamingBenchmark streamingBenchmark;
+
+  // Places every entry of the scene, streamed or not, relative to its parent.
+  // Actors take their matrices from their node, found by name.
+  SceneGraph sceneGraph;
+  QVector<int> actorOfNode; // -1 for nodes without a loaded actor
+
+  // Decides when frames are drawn and owns the animation clock
+  FrameScheduler scheduler{this};
+  GpuTimer frameTimer;
 
   // Transforms
   float scale = 1.0F;
   QVector3D rotation;
-  QMatrix4x4 projectionTransform;
+  QMatrix4x4 projectionTransform; // jittered
+  QMatrix4x4 unjitteredProjection;
   QMatrix4x4 viewTransform;
+
+  // Of the previous frame, for the velocity buffer
+  QMatrix4x4 previousViewProjection; // unjittered
+  float previousTime = 0.0F;
 };
 
 #endif // MAINVIEW_H
@@ -0,0 +1,400 @@
+#include "meshsimplifier.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <vector>
+
+namespace
+{
+  // Weight of the planes that keep borders and seams in place, relative to
+  // the triangle planes (which are weighted by area)
+  const double constraintWeight = 10.0;
+
+  /**
+   * @brief Symmetric 4x4 matrix summing squared distances to planes.
+   */
+  struct Quadric
+  {
+    double q[10] = {};
+    double weight = 0.0; // area the distances are averaged over
+
+    void addPlane(const QVector3D &n, double d, double w)
+    {
+      double a = n.x(), b = n.y(), c = n.z();
+      double terms[10] = {a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d};
+      for (int i = 0; i < 10; ++i)
+      {
+        q[i] += w * terms[i];
+      }
+    }
+
+    void add(const Quadric &other)
+    {
+      for (int i = 0; i < 10; ++i)
+      {
+        q[i] += other.q[i];
+      }
+      weight += other.weight;
+    }
+
+    double evaluate(const QVector3D &p) const
+    {
+      double x = p.x(), y = p.y(), z = p.z();
+      return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x +
+             q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y + q[7] * z * z +
+             2.0 * q[8] * z + q[9];
+    }
+  };
+
+  struct Candidate
+  {
+    double cost;
+    int from;
+    int to;
+    int fromVersion;
+    int toVersion;
+
+    bool operator>(const Candidate &other) const { return cost > other.cost; }
+  };
+
+  struct Edge
+  {
+    int count = 0;
+    int triangle = -1;
+    quint64 wedges = 0; // of the first triangle, in position order
+    bool seam = false;
+  };
+
+  quint64 edgeKey(int a, int b)
+  {
+    return quint64(std::min(a, b)) << 32 | quint64(std::max(a, b));
+  }
+} // namespace
+
+MeshSimplifier::MeshSimplifier(const QVector<QVector3D> &positions,
+                               const QVector<QVector3D> &normals, const QVector<QVector2D> &uvs)
+    : positions(positions), normals(normals), uvs(uvs)
+{
+  // Weld vertices that only differ in normal or UV by sorting them by position
+  int count = positions.size();
+  std::vector<int> order(count);
+  std::iota(order.begin(), order.end(), 0);
+  auto less = [&positions](int a, int b)
+  {
+    const QVector3D &p = positions[a];
+    const QVector3D &q = positions[b];
+    return std::make_tuple(p.x(), p.y(), p.z()) < std::make_tuple(q.x(), q.y(), q.z());
+  };
+  std::sort(order.begin(), order.end(), less);
+
+  wedgePosition.resize(count);
+  for (int i = 0; i < count; ++i)
+  {
+    if (i == 0 || positions[order[i]] != positions[order[i - 1]])
+    {
+      points.append(positions[order[i]]);
+      positionWedges.append(QVector<int>());
+    }
+    wedgePosition[order[i]] = points.size() - 1;
+    positionWedges.last().append(order[i]);
+  }
+}
+
+QVector<quint32> MeshSimplifier::simplify(const QVector<quint32> &indices, int targetTriangles,
+                                          float *error) const
+{
+  int triangleCount = indices.size() / 3;
+  int pointCount = points.size();
+
+  std::vector<std::array<int, 3>> corners(triangleCount); // welded positions
+  std::vector<bool> alive(triangleCount, false);
+  std::vector<Quadric> quadrics(pointCount);
+  std::vector<std::vector<int>> adjacency(pointCount);
+  int live = 0;
+
+  for (int t = 0; t < triangleCount; ++t)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      corners[t][k] = wedgePosition[indices[3 * t + k]];
+    }
+    const std::array<int, 3> &c = corners[t];
+    if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2])
+    {
+      continue;
+    }
+
+    QVector3D normal = QVector3D::crossProduct(points[c[1]] - points[c[0]],
+                                               points[c[2]] - points[c[0]]);
+    float length = normal.length();
+    if (length > 0.0F)
+    {
+      normal /= length;
+      double d = -QVector3D::dotProduct(normal, points[c[0]]);
+      for (int k = 0; k < 3; ++k)
+      {
+        quadrics[c[k]].addPlane(normal, d, 0.5 * length);
+        quadrics[c[k]].weight += 0.5 * length;
+      }
+    }
+
+    alive[t] = true;
+    live++;
+    for (int k = 0; k < 3; ++k)
+    {
+      adjacency[c[k]].push_back(t);
+    }
+  }
+
+  // Edges used by one triangle are borders; edges whose two triangles use
+  // different vertices at the same positions are UV or normal seams
+  QHash<quint64, Edge> edges;
+  for (int t = 0; t < triangleCount; ++t)
+  {
+    if (!alive[t])
+    {
+      continue;
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      int a = corners[t][k];
+      int b = corners[t][(k + 1) % 3];
+      quint64 wa = indices[3 * t + k];
+      quint64 wb = indices[3 * t + (k + 1) % 3];
+      quint64 wedges = a < b ? wa << 32 | wb : wb << 32 | wa;
+
+      Edge &edge = edges[edgeKey(a, b)];
+      if (edge.count++ == 0)
+      {
+        edge.triangle = t;
+        edge.wedges = wedges;
+      }
+      else if (edge.wedges != wedges)
+      {
+        edge.seam = true;
+      }
+    }
+  }
+
+  for (auto it = edges.constBegin(); it != edges.constEnd(); ++it)
+  {
+    const Edge &edge = it.value();
+    if (edge.count != 1 && !edge.seam)
+    {
+      continue;
+    }
+    int a = int(it.key() >> 32);
+    int b = int(it.key() & 0xFFFFFFFFu);
+    const std::array<int, 3> &c = corners[edge.triangle];
+    QVector3D faceNormal = QVector3D::crossProduct(points[c[1]] - points[c[0]],
+                                                   points[c[2]] - points[c[0]]);
+    QVector3D direction = points[b] - points[a];
+    QVector3D normal = QVector3D::crossProduct(direction, faceNormal).normalized();
+    double d = -QVector3D::dotProduct(normal, points[a]);
+    double w = constraintWeight * direction.lengthSquared();
+    quadrics[a].addPlane(normal, d, w);
+    quadrics[b].addPlane(normal, d, w);
+  }
+
+  std::vector<int> version(pointCount, 0);
+  std::vector<bool> removed(pointCount, false);
+  std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> heap;
+
+  // Queues the cheaper direction of collapsing the edge a-b
+  auto push = [&](int a, int b)
+  {
+    Quadric sum = quadrics[a];
+    sum.add(quadrics[b]);
+    double ab = sum.evaluate(points[b]);
+    double ba = sum.evaluate(points[a]);
+    if (ab <= ba)
+    {
+      heap.push({ab, a, b, version[a], version[b]});
+    }
+    else
+    {
+      heap.push({ba, b, a, version[b], version[a]});
+    }
+  };
+  for (auto it = edges.constBegin(); it != edges.constEnd(); ++it)
+  {
+    push(int(it.key() >> 32), int(it.key() & 0xFFFFFFFFu));
+  }
+
+  auto contains = [&corners](int t, int point)
+  { return corners[t][0] == point || corners[t][1] == point || corners[t][2] == point; };
+
+  double maxError = 0.0;
+  std::vector<int> neighbours;
+  while (live > targetTriangles && !heap.empty())
+  {
+    Candidate candidate = heap.top();
+    heap.pop();
+    int from = candidate.from;
+    int to = candidate.to;
+    if (removed[from] || removed[to] || version[from] != candidate.fromVersion ||
+        version[to] != candidate.toVersion)
+    {
+      continue;
+    }
+
+    // Moving from onto to must not turn any remaining triangle around
+    bool flips = false;
+    for (int t : adjacency[from])
+    {
+      if (!alive[t] || contains(t, to))
+      {
+        continue;
+      }
+      std::array<QVector3D, 3> p = {points[corners[t][0]], points[corners[t][1]],
+                                    points[corners[t][2]]};
+      QVector3D before = QVector3D::crossProduct(p[1] - p[0], p[2] - p[0]);
+      for (int k = 0; k < 3; ++k)
+      {
+        if (corners[t][k] == from)
+        {
+          p[k] = points[to];
+        }
+      }
+      QVector3D after = QVector3D::crossProduct(p[1] - p[0], p[2] - p[0]);
+      if (QVector3D::dotProduct(before, after) <= 0.2F * before.length() * after.length() ||
+          after.lengthSquared() == 0.0F)
+      {
+        flips = true;
+        break;
+      }
+    }
+    if (flips)
+    {
+      continue;
+    }
+
+    Quadric &target = quadrics[to];
+    target.add(quadrics[from]);
+    maxError = std::max(maxError,
+                        std::sqrt(std::max(candidate.cost, 0.0) / std::max(target.weight, 1e-12)));
+
+    for (int t : adjacency[from])
+    {
+      if (!alive[t])
+      {
+        continue;
+      }
+      if (contains(t, to))
+      {
+        alive[t] = false;
+        live--;
+        continue;
+      }
+      for (int &corner : corners[t])
+      {
+        corner = corner == from ? to : corner;
+      }
+      adjacency[to].push_back(t);
+    }
+    removed[from] = true;
+    adjacency[from].clear();
+    version[to]++;
+
+    std::vector<int> &around = adjacency[to];
+    around.erase(std::remove_if(around.begin(), around.end(), [&alive](int t) { return !alive[t]; }),
+                 around.end());
+
+    neighbours.clear();
+    for (int t : around)
+    {
+      for (int corner : corners[t])
+      {
+        if (corner != to)
+        {
+          neighbours.push_back(corner);
+        }
+      }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    for (int neighbour : neighbours)
+    {
+      push(to, neighbour);
+    }
+  }
+
+  QVector<quint32> result;
+  result.reserve(live * 3);
+  for (int t = 0; t < triangleCount; ++t)
+  {
+    if (!alive[t])
+    {
+      continue;
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      int wedge = indices[3 * t + k];
+      if (wedgePosition[wedge] != corners[t][k])
+      {
+        wedge = nearestWedge(wedge, corners[t][k]);
+      }
+      result.append(wedge);
+    }
+  }
+
+  if (error)
+  {
+    *error = float(maxError);
+  }
+  return result;
+}
+
+/**
+ * @brief MeshSimplifier::nearestWedge Picks the vertex at a position whose
+ * normal and UV are closest to those of another vertex, which a collapse moved
+ * there.
+ */
+int MeshSimplifier::nearestWedge(int wedge, int position) const
+{
+  int best = positionWedges[position].first();
+  float bestScore = INFINITY;
+  for (int candidate : positionWedges[position])
+  {
+    float score = 1.0F - QVector3D::dotProduct(normals[wedge], normals[candidate]) +
+                  (uvs[wedge] - uvs[candidate]).lengthSquared();
+    if (score < bestScore)
+    {
+      bestScore = score;
+      best = candidate;
+    }
+  }
+  return best;
+}
+
+QVector<MeshSimplifier::Level> MeshSimplifier::lodChain(const QVector<quint32> &indices,
+                                                         int maxLevels, int minTriangles) const
+{
+  QVector<Level> levels = {{indices, 0.0F}};
+  while (levels.size() < maxLevels)
+  {
+    const Level &last = levels.last();
+    int triangles = last.indices.size() / 3;
+    if (triangles / 2 < minTriangles)
+    {
+      break;
+    }
+
+    float error = 0.0F;
+    QVector<quint32> next = simplify(last.indices, triangles / 2, &error);
+    if (next.size() / 3 > triangles * 4 / 5)
+    {
+      break; // mostly borders and seams left
+    }
+    // Each level is simplified from the previous one, so the errors add up
+    float total = last.error + error;
+    levels.append({next, total});
+  }
+  return levels;
+}
@@ -0,0 +1,63 @@
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector>
+
+/**
+ * @brief The MeshSimplifier class reduces indexed triangle meshes with quadric
+ * error metrics (Garland and Heckbert).
+ *
+ * Edges are collapsed cheapest first, where the cost of moving a vertex onto a
+ * neighbour is the summed squared distance to the planes of all triangles that
+ * were merged into the two. Only half-edge collapses are done (the surviving
+ * vertex stays where it is), so every simplified mesh indexes into the vertices
+ * of the original one and all levels can share one vertex buffer. Vertices are
+ * welded by position first; mesh borders and UV or normal seams get extra
+ * planes that keep them in place, and collapses that would flip a triangle are
+ * skipped.
+ */
+class MeshSimplifier
+{
+public:
+  struct Level
+  {
+    QVector<quint32> indices;
+    float error; // largest distance to the original surface, in object units
+  };
+
+  MeshSimplifier(const QVector<QVector3D> &positions, const QVector<QVector3D> &normals,
+                 const QVector<QVector2D> &uvs);
+
+  /**
+   * @brief Collapses edges until at most targetTriangles are left or no valid
+   * collapse remains.
+   * @param indices Triangle list into the vertices given to the constructor.
+   * @param error Set to the error of the result.
+   * @return Triangle list into the same vertices.
+   */
+  QVector<quint32> simplify(const QVector<quint32> &indices, int targetTriangles,
+                            float *error) const;
+
+  /**
+   * @brief Builds levels of detail, each with about half the triangles of the
+   * previous one, starting with the unchanged mesh. Stops at maxLevels, below
+   * minTriangles or when the mesh cannot be reduced any further.
+   */
+  QVector<Level> lodChain(const QVector<quint32> &indices, int maxLevels = 5,
+                          int minTriangles = 64) const;
+
+private:
+  int nearestWedge(int wedge, int position) const;
+
+  QVector<QVector3D> positions;
+  QVector<QVector3D> normals;
+  QVector<QVector2D> uvs;
+
+  QVector<int> wedgePosition;             // vertex -> welded position
+  QVector<QVector3D> points;              // welded positions
+  QVector<QVector<int>> positionWedges;   // welded position -> vertices
+};
+
+#endif // MESHSIMPLIFIER_H
@@ -1,9 +1,79 @@
 #include "model.h"
 
 #include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
+#include <QHash>
 #include <QTextStream>
-#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <utility>
+
+#include "parallel.h"
+
+namespace {
+
+// The attributes of an aligned vertex: position, normal and texture
+// coordinates, compared and hashed by value
+struct VertexKey {
+  float values[8];
+
+  bool operator==(const VertexKey& other) const {
+    return std::memcmp(values, other.values, sizeof(values)) == 0;
+  }
+};
+
+size_t qHash(const VertexKey& key, size_t seed = 0) {
+  return qHashBits(key.values, sizeof(key.values), seed);
+}
+
+// One value per index, for glDrawArrays()
+template <typename T>
+QVector<T> unpack(const QVector<T>& values, const QVector<unsigned>& indices) {
+  if (values.isEmpty()) return {};
+  QVector<T> unpacked(indices.size());
+  for (int i = 0; i != indices.size(); ++i) {
+    unpacked[i] = values[indices[i]];
+  }
+  return unpacked;
+}
+
+// A field of /proc/self/status in bytes, such as the resident size (VmRSS) or
+// its high-water mark (VmHWM), or -1 where there is no such file
+qint64 processStatus(const char* field) {
+  QFile status("/proc/self/status");
+  if (!status.open(QIODevice::ReadOnly)) return -1;
+  // Files in /proc report a size of 0, so no atEnd() here
+  QTextStream in(&status);
+  QString line;
+  while (in.readLineInto(&line)) {
+    // "VmHWM:     1234 kB"
+    if (line.startsWith(field)) {
+      return line.mid(int(std::strlen(field))).trimmed().split(" ").first().toLongLong() * 1024;
+    }
+  }
+  return -1;
+}
+
+// Resets the high-water mark of the resident size to the current size
+bool resetPeakResident() {
+  QFile clearRefs("/proc/self/clear_refs");
+  return clearRefs.open(QIODevice::WriteOnly) && clearRefs.write("5") == 1;
+}
+
+// Colors with random components, as many as asked for
+QVector<QVector3D> randomColors(int size) {
+  QVector<QVector3D> colors(size);
+  for (int i = 0; i < size; ++i) {
+    colors[i] = QVector3D{static_cast<float>(rand()) / static_cast<float>(RAND_MAX),
+                          static_cast<float>(rand()) / static_cast<float>(RAND_MAX),
+                          static_cast<float>(rand()) / static_cast<float>(RAND_MAX)};
+  }
+  return colors;
+}
+
+}  // namespace
 
 /**
  * @brief Model::Model Constructs a new model from a Wavefront .obj file.
@@ -44,11 +114,10 @@ Model::Model(const QString& filename) {
 
     file.close();
 
-    // create an array version of the data
-    unpackIndexes();
-
     // Allign all vertex indices with the right normal/texturecoord indices
     alignData();
+
+    computeTangents();
   }
 }
 
@@ -124,12 +193,10 @@ void Model::alignData() {
   norms.reserve(vertices_indexed.size());
   QVector<QVector2D> texcs;
   texcs.reserve(vertices_indexed.size());
-  QVector<std::tuple<QVector3D, QVector3D, QVector2D>> vs;
-
-  QVector<unsigned> ind;
-  ind.reserve(indices.size());
+  QHash<VertexKey, unsigned> vs;
+  vs.reserve(vertices_indexed.size());
 
-  unsigned currentIndex = 0;
+  QVector<unsigned> ind(indices.size());
 
   for (int i = 0; i != indices.size(); ++i) {
     QVector3D v = vertices_indexed[indices[i]];
@@ -144,53 +211,123 @@ void Model::alignData() {
       t = tex[texcoord_indices[i]];
     }
 
-    std::tuple<QVector3D, QVector3D, QVector2D> k(v, n, t);
-    if (vs.contains(k)) {
+    // Adding 0 turns -0 into 0, which compare equal as floats
+    VertexKey k{{v.x() + 0.0f, v.y() + 0.0f, v.z() + 0.0f, n.x() + 0.0f,
+                 n.y() + 0.0f, n.z() + 0.0f, t.x() + 0.0f, t.y() + 0.0f}};
+    auto found = vs.constFind(k);
+    if (found != vs.constEnd()) {
       // Vertex already exists, use that index
-      ind.append(vs.indexOf(k));
+      ind[i] = *found;
     } else {
       // Create a new vertex
+      ind[i] = verts.size();
+      vs.insert(k, ind[i]);
       verts.append(v);
       norms.append(n);
       texcs.append(t);
-      vs.append(k);
-      ind.append(currentIndex);
-      ++currentIndex;
     }
   }
-  // Remove old data
-  vertices_indexed.clear();
-  normals_indexed.clear();
-  textureCoords_indexed.clear();
-  indices.clear();
-
-  // Set the new data
-  vertices_indexed = verts;
-  normals_indexed = norms;
-  textureCoords_indexed = texcs;
-  indices = ind;
+
+  // Release the old data and the parsing storage. Assigning empty vectors,
+  // since clear() keeps the memory.
+  vs = {};
+  norm = {};
+  tex = {};
+  normal_indices = {};
+  texcoord_indices = {};
+
+  // Set the new data, without the spare capacity of appending
+  vertices_indexed = std::move(verts);
+  normals_indexed = std::move(norms);
+  textureCoords_indexed = std::move(texcs);
+  indices = std::move(ind);
+  vertices_indexed.squeeze();
+  normals_indexed.squeeze();
+  textureCoords_indexed.squeeze();
 }
 
 /**
- * @brief Model::unpackIndexes Unpack indices so that they are available for
- * glDrawArrays()
+ * @brief Model::computeTangents Computes a tangent per indexed vertex for
+ * normal mapping: the direction of increasing u, orthogonal to the normal,
+ * with the handedness of the UV mapping in w (the bitangent is
+ * w * cross(normal, tangent)).
  *
+ * The tangents of the triangles are computed in parallel. Every vertex then
+ * sums the area weighted tangents of its own triangles, also in parallel, so
+ * no two threads ever write the same vertex. Small meshes stay on the calling
+ * thread.
  */
-void Model::unpackIndexes() {
-  vertices.clear();
-  normals.clear();
-  textureCoords.clear();
-  for (int i = 0; i != indices.size(); ++i) {
-    vertices.append(vertices_indexed[indices[i]]);
-
-    if (hNorms) {
-      normals.append(norm[normal_indices[i]]);
-    }
+void Model::computeTangents() {
+  const int triangleCount = indices.size() / 3;
+  const int vertexCount = vertices_indexed.size();
+  const int minChunk = 4096;
+
+  // Unnormalized, so larger triangles weigh more
+  QVector<QVector3D> faceTangents(triangleCount);
+  QVector<QVector3D> faceBitangents(triangleCount);
+  if (hTexs) {
+    parallelFor(
+        0, triangleCount,
+        [&](int begin, int end) {
+          for (int t = begin; t < end; ++t) {
+            unsigned a = indices[3 * t], b = indices[3 * t + 1], c = indices[3 * t + 2];
+            QVector3D e1 = vertices_indexed[b] - vertices_indexed[a];
+            QVector3D e2 = vertices_indexed[c] - vertices_indexed[a];
+            QVector2D d1 = textureCoords_indexed[b] - textureCoords_indexed[a];
+            QVector2D d2 = textureCoords_indexed[c] - textureCoords_indexed[a];
+            float det = d1.x() * d2.y() - d2.x() * d1.y();
+            if (std::fabs(det) < 1e-12f) {
+              continue;  // degenerate UVs, no direction to follow
+            }
+            // Scaled by |det| instead of divided by det, keeping the area weight
+            float sign = det < 0.0f ? -1.0f : 1.0f;
+            faceTangents[t] = sign * (e1 * d2.y() - e2 * d1.y());
+            faceBitangents[t] = sign * (e2 * d1.x() - e1 * d2.x());
+          }
+        },
+        minChunk);
+  }
 
-    if (hTexs) {
-      textureCoords.append(tex[texcoord_indices[i]]);
-    }
+  // Triangles of every vertex, grouped by vertex (counting sort)
+  QVector<int> first(vertexCount + 1, 0);
+  for (unsigned index : indices) {
+    first[index + 1]++;
+  }
+  for (int v = 0; v < vertexCount; ++v) {
+    first[v + 1] += first[v];
   }
+  QVector<int> fill = first;
+  QVector<int> vertexTriangles(indices.size());
+  for (int i = 0; i < indices.size(); ++i) {
+    vertexTriangles[fill[indices[i]]++] = i / 3;
+  }
+
+  tangents_indexed.resize(vertexCount);
+  parallelFor(
+      0, vertexCount,
+      [&](int begin, int end) {
+        for (int v = begin; v < end; ++v) {
+          QVector3D tangent, bitangent;
+          for (int i = first[v]; i < first[v + 1]; ++i) {
+            tangent += faceTangents[vertexTriangles[i]];
+            bitangent += faceBitangents[vertexTriangles[i]];
+          }
+
+          // Gram-Schmidt against the normal
+          QVector3D n = normals_indexed[v];
+          tangent = (tangent - n * QVector3D::dotProduct(n, tangent)).normalized();
+          if (tangent.isNull()) {
+            // No UV direction: any vector orthogonal to the normal will do
+            QVector3D axis = std::fabs(n.x()) < 0.9f ? QVector3D(1, 0, 0) : QVector3D(0, 1, 0);
+            tangent = QVector3D::crossProduct(axis, n).normalized();
+          }
+          float w = QVector3D::dotProduct(QVector3D::crossProduct(n, tangent), bitangent) < 0.0f
+                        ? -1.0f
+                        : 1.0f;
+          tangents_indexed[v] = QVector4D(tangent, w);
+        }
+      },
+      minChunk);
 }
 
 /**
@@ -208,7 +345,9 @@ void Model::unitize() { qDebug() << "Implement this yourself (optional)"; }
  * c3, c4, etc.
  * @return The coordinates in the mesh.
  */
-QVector<QVector3D> Model::getCoords() { return vertices; }
+QVector<QVector3D> Model::getCoords() {
+  return unpack(vertices_indexed, indices);
+}
 
 /**
  * @brief Model::getCoords Get all normals in the mesh. The normals are
@@ -217,7 +356,9 @@ QVector<QVector3D> Model::getCoords() { return vertices; }
  * n4, etc.
  * @return The normals in the mesh.
  */
-QVector<QVector3D> Model::getNormals() { return normals; }
+QVector<QVector3D> Model::getNormals() {
+  return hNorms ? unpack(normals_indexed, indices) : QVector<QVector3D>();
+}
 
 /**
  * @brief Model::getCoords Get all texture coordinates in the mesh. The texture
@@ -226,7 +367,9 @@ QVector<QVector3D> Model::getNormals() { return normals; }
  * tx3, tx2, tx3, tx4, etc.
  * @return The texture coordinates in the mesh.
  */
-QVector<QVector2D> Model::getTextureCoords() { return textureCoords; }
+QVector<QVector2D> Model::getTextureCoords() {
+  return hTexs ? unpack(textureCoords_indexed, indices) : QVector<QVector2D>();
+}
 
 /**
  * @brief Model::getCoords Get all unique coordinates in the mesh. The
@@ -260,6 +403,14 @@ QVector<QVector2D> Model::getTextureCoordsIndexed() {
   return textureCoords_indexed;
 }
 
+/**
+ * @brief Model::getTangentsIndexed Get the tangents of the unique vertices,
+ * matching getCoordsIndexed(). The w component is the handedness of the UV
+ * mapping.
+ * @return The tangents of the unique vertices.
+ */
+QVector<QVector4D> Model::getTangentsIndexed() { return tangents_indexed; }
+
 /**
  * @brief Model::getIndices Retrieves a list of indices in such a way that these
  * describe the topology of the mesh. In other words, these indices describe how
@@ -278,20 +429,7 @@ QVector<unsigned> Model::getIndices() { return indices; }
  * @return A list of float values containing the coordinates and normals.
  */
 QVector<float> Model::getVNInterleaved() {
-  QVector<float> buffer;
-
-  for (int i = 0; i != vertices.size(); ++i) {
-    QVector3D vertex = vertices.at(i);
-    QVector3D normal = normals.at(i);
-    buffer.append(vertex.x());
-    buffer.append(vertex.y());
-    buffer.append(vertex.z());
-    buffer.append(normal.x());
-    buffer.append(normal.y());
-    buffer.append(normal.z());
-  }
-
-  return buffer;
+  return buildInterleaved(POSITION | NORMAL, false);
 }
 
 /**
@@ -303,23 +441,7 @@ QVector<float> Model::getVNInterleaved() {
  * @return A list of float values containing the coordinates and normals.
  */
 QVector<float> Model::getVNTInterleaved() {
-  QVector<float> buffer;
-
-  for (int i = 0; i != vertices.size(); ++i) {
-    QVector3D vertex = vertices.at(i);
-    QVector3D normal = normals.at(i);
-    QVector2D uv = textureCoords.at(i);
-    buffer.append(vertex.x());
-    buffer.append(vertex.y());
-    buffer.append(vertex.z());
-    buffer.append(normal.x());
-    buffer.append(normal.y());
-    buffer.append(normal.z());
-    buffer.append(uv.x());
-    buffer.append(uv.y());
-  }
-
-  return buffer;
+  return buildInterleaved(POSITION | NORMAL | TEXCOORD, false);
 }
 
 /**
@@ -331,20 +453,7 @@ QVector<float> Model::getVNTInterleaved() {
  * @return A list of float values containing the coordinates and normals.
  */
 QVector<float> Model::getVNInterleavedIndexed() {
-  QVector<float> buffer;
-
-  for (int i = 0; i != vertices_indexed.size(); ++i) {
-    QVector3D vertex = vertices_indexed.at(i);
-    QVector3D normal = normals_indexed.at(i);
-    buffer.append(vertex.x());
-    buffer.append(vertex.y());
-    buffer.append(vertex.z());
-    buffer.append(normal.x());
-    buffer.append(normal.y());
-    buffer.append(normal.z());
-  }
-
-  return buffer;
+  return buildInterleaved(POSITION | NORMAL, true);
 }
 
 /**
@@ -356,43 +465,218 @@ QVector<float> Model::getVNInterleavedIndexed() {
  * @return A list of float values containing the coordinates and normals.
  */
 QVector<float> Model::getVNTInterleavedIndexed() {
-  QVector<float> buffer;
-
-  for (int i = 0; i != vertices_indexed.size(); ++i) {
-    QVector3D vertex = vertices_indexed.at(i);
-    QVector3D normal = normals_indexed.at(i);
-    QVector2D uv = textureCoords_indexed.at(i);
-    buffer.append(vertex.x());
-    buffer.append(vertex.y());
-    buffer.append(vertex.z());
-    buffer.append(normal.x());
-    buffer.append(normal.y());
-    buffer.append(normal.z());
-    buffer.append(uv.x());
-    buffer.append(uv.y());
+  return buildInterleaved(POSITION | NORMAL | TEXCOORD, true);
+}
+
+/**
+ * @brief Model::buildInterleaved Interleaves any combination of attributes
+ * into a single buffer, in the order of the Attribute enum: 3 floats for the
+ * coordinate, 3 for the normal, 2 for the texture coordinate and 4 for the
+ * tangent. The buffer is allocated once, at its final size.
+ * @param attributes The Attribute flags to include.
+ * @param indexed Whether to write the unique vertices, for glDrawElements(),
+ * or one vertex per index, for glDrawArrays().
+ * @return A list of float values, or an empty list if an attribute was taken.
+ */
+QVector<float> Model::buildInterleaved(int attributes, bool indexed) const {
+  const bool position = attributes & POSITION;
+  const bool normal = attributes & NORMAL;
+  const bool texcoord = attributes & TEXCOORD;
+  const bool tangent = attributes & TANGENT;
+  const int vertexCount = vertices_indexed.size();
+  if ((normal && normals_indexed.size() != vertexCount) ||
+      (texcoord && textureCoords_indexed.size() != vertexCount) ||
+      (tangent && tangents_indexed.size() != vertexCount) ||
+      (!indexed && vertexCount == 0 && !indices.isEmpty())) {
+    qWarning() << "Model: cannot interleave attributes that were taken";
+    return {};
+  }
+
+  const int stride = (position ? 3 : 0) + (normal ? 3 : 0) +
+                     (texcoord ? 2 : 0) + (tangent ? 4 : 0);
+  const int count = indexed ? vertexCount : indices.size();
+  QVector<float> buffer(count * stride);
+  float* out = buffer.data();
+  for (int i = 0; i != count; ++i) {
+    const int v = indexed ? i : int(indices[i]);
+    if (position) {
+      const QVector3D& p = vertices_indexed[v];
+      *out++ = p.x();
+      *out++ = p.y();
+      *out++ = p.z();
+    }
+    if (normal) {
+      const QVector3D& n = normals_indexed[v];
+      *out++ = n.x();
+      *out++ = n.y();
+      *out++ = n.z();
+    }
+    if (texcoord) {
+      const QVector2D& t = textureCoords_indexed[v];
+      *out++ = t.x();
+      *out++ = t.y();
+    }
+    if (tangent) {
+      const QVector4D& t = tangents_indexed[v];
+      *out++ = t.x();
+      *out++ = t.y();
+      *out++ = t.z();
+      *out++ = t.w();
+    }
   }
 
   return buffer;
 }
 
+/**
+ * @brief Model::takeCoordsIndexed Moves the unique coordinates out of the
+ * model, like getCoordsIndexed() but without keeping them. The take functions
+ * are meant for handing the loaded data to its final owner.
+ * @return The unique coordinates in the mesh.
+ */
+QVector<QVector3D> Model::takeCoordsIndexed() {
+  return std::exchange(vertices_indexed, {});
+}
+
+/**
+ * @brief Model::takeNormalsIndexed Moves the unique normals out of the model.
+ * @return The unique normals in the mesh.
+ */
+QVector<QVector3D> Model::takeNormalsIndexed() {
+  return std::exchange(normals_indexed, {});
+}
+
+/**
+ * @brief Model::takeTextureCoordsIndexed Moves the unique texture coordinates
+ * out of the model.
+ * @return The unique texture coordinates in the mesh.
+ */
+QVector<QVector2D> Model::takeTextureCoordsIndexed() {
+  return std::exchange(textureCoords_indexed, {});
+}
+
+/**
+ * @brief Model::takeTangentsIndexed Moves the tangents of the unique vertices
+ * out of the model.
+ * @return The tangents of the unique vertices.
+ */
+QVector<QVector4D> Model::takeTangentsIndexed() {
+  return std::exchange(tangents_indexed, {});
+}
+
+/**
+ * @brief Model::takeIndices Moves the indices out of the model.
+ * @return A list of indices.
+ */
+QVector<unsigned> Model::takeIndices() { return std::exchange(indices, {}); }
+
 /**
  * @brief Model::getNumTriangles Retrieves the number of triangles in this mesh.
  * @return The number of triangles in this mesh.
  */
-int Model::getNumTriangles() { return vertices.size() / 3; }
+int Model::getNumTriangles() { return indices.size() / 3; }
 
 QVector<QVector3D> Model::getRandomColors() {
-    auto size = vertices.size();
+  return randomColors(indices.size());
+}
 
-    QVector<QVector3D> colors(size);
+/**
+ * @brief Model::getRandomColorsIndexed Random colors for the unique vertices,
+ * matching getCoordsIndexed().
+ * @return One random color per unique vertex.
+ */
+QVector<QVector3D> Model::getRandomColorsIndexed() {
+  return randomColors(vertices_indexed.size());
+}
 
-    for (int i = 0; i < size; ++i) {
-        colors[i] = QVector3D{
-            static_cast<float>(rand()) / static_cast<float>(RAND_MAX),
-            static_cast<float>(rand()) / static_cast<float>(RAND_MAX),
-            static_cast<float>(rand()) / static_cast<float>(RAND_MAX)
-        };
+/**
+ * @brief Model::benchmark Writes a large height field to a temporary .obj
+ * file, loads it and takes its data, and logs the time and the peak resident
+ * memory of every step over the memory before it, against the bytes of the
+ * data that is kept. The peak comes from /proc (Linux), so it includes the
+ * allocator's own overhead.
+ */
+void Model::benchmark() {
+  const int side = 400;  // vertices per side
+  const QString path = QDir::temp().filePath("model_benchmark.obj");
+  {
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+      qWarning() << "Model benchmark: cannot write" << path;
+      return;
     }
+    QTextStream out(&file);
+    for (int z = 0; z != side; ++z) {
+      for (int x = 0; x != side; ++x) {
+        float h = std::sin(0.1f * x) * std::cos(0.1f * z);
+        QVector3D n = QVector3D(-0.1f * std::cos(0.1f * x) * std::cos(0.1f * z),
+                                1.0f,
+                                0.1f * std::sin(0.1f * x) * std::sin(0.1f * z))
+                          .normalized();
+        out << "v " << x << ' ' << h << ' ' << z << '\n';
+        out << "vn " << n.x() << ' ' << n.y() << ' ' << n.z() << '\n';
+        out << "vt " << float(x) / (side - 1) << ' ' << float(z) / (side - 1)
+            << '\n';
+      }
+    }
+    for (int z = 0; z + 1 != side; ++z) {
+      for (int x = 0; x + 1 != side; ++x) {
+        int a = z * side + x + 1;  // .obj counts from 1
+        int b = a + 1, c = a + side, d = c + 1;
+        out << "f " << a << '/' << a << '/' << a << ' ' << c << '/' << c << '/'
+            << c << ' ' << b << '/' << b << '/' << b << '\n';
+        out << "f " << b << '/' << b << '/' << b << ' ' << c << '/' << c << '/'
+            << c << ' ' << d << '/' << d << '/' << d << '\n';
+      }
+    }
+  }
 
-    return colors;
+  const bool peakAvailable = resetPeakResident();
+  if (!peakAvailable) {
+    qWarning() << "Model benchmark: no peak resident memory on this system";
+  }
+  const double mb = 1024.0 * 1024.0;
+  auto peakOver = [&](qint64 baseline) {
+    return peakAvailable ? (processStatus("VmHWM:") - baseline) / mb : -1.0;
+  };
+
+  QElapsedTimer timer;
+  qint64 baseline = processStatus("VmRSS:");
+  timer.start();
+  Model model(path);
+  float loadTime = timer.nsecsElapsed() / 1.0e6f;
+  double loadPeak = peakOver(baseline);
+
+  QVector<float> interleaved;
+  resetPeakResident();
+  baseline = processStatus("VmRSS:");
+  timer.restart();
+  interleaved = model.buildInterleaved(POSITION | NORMAL | TEXCOORD | TANGENT, true);
+  float buildTime = timer.nsecsElapsed() / 1.0e6f;
+  double buildPeak = peakOver(baseline);
+  double buildBytes = interleaved.size() * sizeof(float) / mb;
+  interleaved = {};
+
+  resetPeakResident();
+  baseline = processStatus("VmRSS:");
+  timer.restart();
+  QVector<QVector3D> coords = model.takeCoordsIndexed();
+  QVector<QVector3D> normals = model.takeNormalsIndexed();
+  QVector<QVector2D> uvs = model.takeTextureCoordsIndexed();
+  QVector<QVector4D> tangents = model.takeTangentsIndexed();
+  QVector<unsigned> indices = model.takeIndices();
+  float takeTime = timer.nsecsElapsed() / 1.0e6f;
+  double takePeak = peakOver(baseline);
+
+  double keptBytes = (coords.size() * (2 * sizeof(QVector3D) + sizeof(QVector2D) +
+                                       sizeof(QVector4D)) +
+                      indices.size() * sizeof(unsigned)) / mb;
+  qDebug() << "Model benchmark:" << coords.size() << "vertices,"
+           << indices.size() / 3 << "triangles," << keptBytes << "MB kept";
+  qDebug() << "  load" << loadTime << "ms, peak" << loadPeak << "MB over the"
+           << "baseline," << loadPeak / keptBytes << "x the kept data";
+  qDebug() << "  interleave all attributes" << buildTime << "ms, peak"
+           << buildPeak << "MB for a" << buildBytes << "MB buffer";
+  qDebug() << "  take" << takeTime << "ms, peak" << takePeak << "MB";
+  QFile::remove(path);
 }
@@ -5,6 +5,7 @@
 #include <QStringList>
 #include <QVector2D>
 #include <QVector3D>
+#include <QVector4D>
 #include <QVector>
 
 /**
@@ -17,9 +18,17 @@
  */
 class Model {
  public:
+  // Attributes of buildInterleaved(), interleaved in this order
+  enum Attribute {
+    POSITION = 1,  // 3 floats
+    NORMAL = 2,    // 3 floats
+    TEXCOORD = 4,  // 2 floats
+    TANGENT = 8    // 4 floats
+  };
+
   Model(const QString& filename);
 
-  // Used for glDrawArrays()
+  // Used for glDrawArrays(), unpacked from the indexed data on every call
   QVector<QVector3D> getCoords();
   QVector<QVector3D> getNormals();
   QVector<QVector2D> getTextureCoords();
@@ -33,18 +42,37 @@ class Model {
   QVector<QVector3D> getCoordsIndexed();
   QVector<QVector3D> getNormalsIndexed();
   QVector<QVector2D> getTextureCoordsIndexed();
+  QVector<QVector4D> getTangentsIndexed();
   QVector<unsigned> getIndices();
 
   // Used for interleaving into one buffer for glDrawElements()
   QVector<float> getVNInterleavedIndexed();
   QVector<float> getVNTInterleavedIndexed();
 
+  // Any combination of attributes, written into one buffer allocated once
+  QVector<float> buildInterleaved(int attributes, bool indexed) const;
+
+  // Move the data for glDrawElements() out of the model, without copying.
+  // The model no longer has it afterwards.
+  QVector<QVector3D> takeCoordsIndexed();
+  QVector<QVector3D> takeNormalsIndexed();
+  QVector<QVector2D> takeTextureCoordsIndexed();
+  QVector<QVector4D> takeTangentsIndexed();
+  QVector<unsigned> takeIndices();
+
+  // One random color per unique vertex, matching getCoordsIndexed()
+  QVector<QVector3D> getRandomColorsIndexed();
+
   bool hasNormals();
   bool hasTextureCoords();
   int getNumTriangles();
 
   void unitize();
 
+  // Loads a large generated .obj file and logs the time and the peak resident
+  // memory of loading it, against the size of the data that is kept
+  static void benchmark();
+
  private:
   // OBJ parsing
   void parseVertex(QStringList tokens);
@@ -54,19 +82,16 @@ class Model {
 
   // Alignment of data
   void alignData();
-  void unpackIndexes();
+  void computeTangents();
 
   // Intermediate storage of values
   QVector<QVector3D> vertices_indexed;
   QVector<QVector3D> normals_indexed;
   QVector<QVector2D> textureCoords_indexed;
+  QVector<QVector4D> tangents_indexed;
   QVector<unsigned> indices;
 
-  QVector<QVector3D> vertices;
-  QVector<QVector3D> normals;
-  QVector<QVector2D> textureCoords;
-
-  // Utility storage
+  // Utility storage, released once the data is aligned
   QVector<unsigned> normal_indices;
   QVector<unsigned> texcoord_indices;
   QVector<QVector3D> norm;
@@ -0,0 +1,359 @@
+#include "occlusionculler.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QOpenGLShaderProgram>
+#include <QVector4D>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "drawlist.h"
+
+namespace
+{
+  /**
+   * @brief boxMesh Triangles of a box, every face split into n x n quads, with
+   * counterclockwise front faces.
+   */
+  QVector<QVector3D> boxMesh(const QVector3D &min, const QVector3D &max, int n)
+  {
+    QVector<QVector3D> mesh;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+      int u = (axis + 1) % 3;
+      int v = (axis + 2) % 3;
+      for (int side = 0; side < 2; ++side)
+      {
+        auto point = [&](int i, int j)
+        {
+          QVector3D p;
+          p[axis] = side ? max[axis] : min[axis];
+          p[u] = min[u] + (max[u] - min[u]) * i / n;
+          p[v] = min[v] + (max[v] - min[v]) * j / n;
+          return p;
+        };
+        for (int i = 0; i < n; ++i)
+        {
+          for (int j = 0; j < n; ++j)
+          {
+            QVector3D quad[4] = {point(i, j), point(i + 1, j), point(i + 1, j + 1),
+                                 point(i, j + 1)};
+            // u x v points along +axis, so the max side keeps the order
+            int order[6] = {0, 1, 2, 0, 2, 3};
+            if (!side)
+            {
+              std::swap(order[1], order[2]);
+              std::swap(order[4], order[5]);
+            }
+            for (int k : order)
+            {
+              mesh.append(quad[k]);
+            }
+          }
+        }
+      }
+    }
+    return mesh;
+  }
+} // namespace
+
+OcclusionCuller::OcclusionCuller()
+    : depth(width * height, 1.0F), blockMax((width / blockSize) * (height / blockSize), 1.0F)
+{
+}
+
+void OcclusionCuller::render(JobSystem &jobs, const QVector<Actor> &actors,
+                             const QMatrix4x4 &viewProjection)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  occluders.clear();
+  firstTriangle.clear();
+  int count = 0;
+  for (int i = 0; i < actors.size(); ++i)
+  {
+    if (actors[i].occluder && !actors[i].occluderMesh.isEmpty())
+    {
+      occluders.append(i);
+      firstTriangle.append(count);
+      count += actors[i].occluderMesh.size() / 3;
+    }
+  }
+  triangles.resize(count);
+
+  // Screen space triangles; the ones that cannot be drawn get an empty box
+  jobs.parallelFor(0, count, [&](int begin, int end)
+  {
+    int occluder = int(std::upper_bound(firstTriangle.cbegin(), firstTriangle.cend(), begin) -
+                       firstTriangle.cbegin()) - 1;
+    QMatrix4x4 modelViewProjection = viewProjection * actors[occluders[occluder]].transform;
+    for (int t = begin; t < end; ++t)
+    {
+      while (occluder + 1 < firstTriangle.size() && t >= firstTriangle[occluder + 1])
+      {
+        occluder++;
+        modelViewProjection = viewProjection * actors[occluders[occluder]].transform;
+      }
+      const QVector3D *corners =
+          actors[occluders[occluder]].occluderMesh.constData() + 3 * (t - firstTriangle[occluder]);
+
+      // Clipped triangles keep an empty range
+      Triangle &triangle = triangles[t];
+      triangle.minX = triangle.minY = 0;
+      triangle.maxX = triangle.maxY = -1;
+      bool clipped = false;
+      for (int k = 0; k < 3; ++k)
+      {
+        QVector4D p = modelViewProjection * QVector4D(corners[k], 1.0F);
+        if (p.w() <= 0.0F || p.z() < -p.w())
+        {
+          clipped = true;
+          break;
+        }
+        triangle.x[k] = (p.x() / p.w() * 0.5F + 0.5F) * width;
+        triangle.y[k] = (p.y() / p.w() * 0.5F + 0.5F) * height;
+        triangle.z[k] = p.z() / p.w() * 0.5F + 0.5F;
+      }
+      if (clipped)
+      {
+        continue;
+      }
+      // Back faces are hidden behind the front faces of a closed mesh
+      Rasterizer::setup(triangle, width, height);
+    }
+  }, 1024);
+
+  // Every tile clears and rasterizes its own pixels
+  int tilesX = width / tileWidth;
+  int tilesY = height / tileHeight;
+  jobs.parallelFor(0, tilesX * tilesY, [&](int begin, int end)
+  {
+    for (int tile = begin; tile < end; ++tile)
+    {
+      int x0 = tile % tilesX * tileWidth;
+      int y0 = tile / tilesX * tileHeight;
+      int x1 = x0 + tileWidth - 1;
+      int y1 = y0 + tileHeight - 1;
+      for (int y = y0; y <= y1; ++y)
+      {
+        std::fill_n(depth.data() + y * width + x0, tileWidth, 1.0F);
+      }
+
+      for (const Triangle &triangle : triangles)
+      {
+        int minX = std::max(triangle.minX, x0);
+        int maxX = std::min(triangle.maxX, x1);
+        int minY = std::max(triangle.minY, y0);
+        int maxY = std::min(triangle.maxY, y1);
+        if (minX <= maxX && minY <= maxY)
+        {
+          rasterize(triangle, minX, minY, maxX, maxY);
+        }
+      }
+
+      for (int by = y0 / blockSize; by <= y1 / blockSize; ++by)
+      {
+        for (int bx = x0 / blockSize; bx <= x1 / blockSize; ++bx)
+        {
+          float farthest = 0.0F;
+          for (int y = by * blockSize; y < (by + 1) * blockSize; ++y)
+          {
+            const float *row = depth.constData() + y * width + bx * blockSize;
+            farthest = std::max(farthest, *std::max_element(row, row + blockSize));
+          }
+          blockMax[by * (width / blockSize) + bx] = farthest;
+        }
+      }
+    }
+  }, 1);
+
+  rasterized = 0;
+  for (const Triangle &triangle : triangles)
+  {
+    rasterized += triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY;
+  }
+  renderTime = timer.nsecsElapsed() / 1.0e6F;
+}
+
+/**
+ * @brief OcclusionCuller::rasterize Keeps the nearer of the triangle and the
+ * buffer in the pixels of a rectangle whose centers the triangle covers. The
+ * rectangle starts at any column and is widened to whole blocks, which stay
+ * inside the tile since tiles are made of whole blocks.
+ */
+void OcclusionCuller::rasterize(const Triangle &triangle, int minX, int minY, int maxX, int maxY)
+{
+  float *buffer = depth.data();
+  Rasterizer::rasterize(triangle, minX, minY, maxX, maxY,
+                        [buffer](int x, int y, float z, bool covered)
+                        {
+                          float &pixel = buffer[y * width + x];
+                          pixel = covered && z < pixel ? z : pixel;
+                        });
+}
+
+bool OcclusionCuller::isOccluded(const QMatrix4x4 &modelViewProjection, const QVector3D &min,
+                                 const QVector3D &max) const
+{
+  float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+  float nearest = INFINITY;
+  for (int corner = 0; corner < 8; ++corner)
+  {
+    QVector4D p = modelViewProjection *
+                  QVector4D(corner & 1 ? max.x() : min.x(), corner & 2 ? max.y() : min.y(),
+                            corner & 4 ? max.z() : min.z(), 1.0F);
+    if (p.w() <= 0.0F || p.z() < -p.w())
+    {
+      return false;
+    }
+    float x = (p.x() / p.w() * 0.5F + 0.5F) * width;
+    float y = (p.y() / p.w() * 0.5F + 0.5F) * height;
+    minX = std::min(minX, x);
+    maxX = std::max(maxX, x);
+    minY = std::min(minY, y);
+    maxY = std::max(maxY, y);
+    nearest = std::min(nearest, p.z() / p.w() * 0.5F + 0.5F);
+  }
+
+  // Every pixel the rectangle touches
+  int x0 = std::max(0, int(std::floor(std::max(minX, -1.0F))));
+  int x1 = std::min(width - 1, int(std::floor(std::min(maxX, float(width)))));
+  int y0 = std::max(0, int(std::floor(std::max(minY, -1.0F))));
+  int y1 = std::min(height - 1, int(std::floor(std::min(maxY, float(height)))));
+  if (x0 > x1 || y0 > y1)
+  {
+    return false; // off screen, left to the frustum test
+  }
+
+  int blocksX = width / blockSize;
+  for (int by = y0 / blockSize; by <= y1 / blockSize; ++by)
+  {
+    for (int bx = x0 / blockSize; bx <= x1 / blockSize; ++bx)
+    {
+      if (blockMax[by * blocksX + bx] < nearest)
+      {
+        continue;
+      }
+      int fromY = std::max(y0, by * blockSize), toY = std::min(y1, (by + 1) * blockSize - 1);
+      int fromX = std::max(x0, bx * blockSize), toX = std::min(x1, (bx + 1) * blockSize - 1);
+      for (int y = fromY; y <= toY; ++y)
+      {
+        const float *row = depth.constData() + y * width;
+        for (int x = fromX; x <= toX; ++x)
+        {
+          if (row[x] >= nearest)
+          {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+void OcclusionCuller::benchmark()
+{
+  const int blocks = 12;     // buildings per side
+  const int crates = 4;      // small actors per side of every street crossing
+  const int subdivision = 6; // quads per building face side
+  const int repeats = 20;
+
+  QOpenGLShaderProgram program;
+  QVector<Actor> actors;
+  QVector<QVector3D> building = boxMesh(QVector3D(-4.0F, 0.0F, -4.0F),
+                                        QVector3D(4.0F, 20.0F, 4.0F), subdivision);
+  for (int z = 0; z < blocks; ++z)
+  {
+    for (int x = 0; x < blocks; ++x)
+    {
+      Actor actor(program);
+      actor.meshSize = building.size();
+      actor.VAO = 1;
+      actor.boundsMin = QVector3D(-4.0F, 0.0F, -4.0F);
+      actor.boundsMax = QVector3D(4.0F, 20.0F, 4.0F);
+      actor.transform.translate((x - blocks / 2) * 12.0F, 0.0F, -z * 12.0F);
+      actor.occluder = true;
+      actor.occluderMesh = building;
+      actors.append(actor);
+
+      for (int i = 0; i < crates * crates; ++i)
+      {
+        Actor crate(program);
+        crate.meshSize = 36;
+        crate.VAO = 2 + i % 8;
+        crate.boundsMin = QVector3D(-0.4F, 0.0F, -0.4F);
+        crate.boundsMax = QVector3D(0.4F, 0.8F, 0.4F);
+        crate.transform.translate((x - blocks / 2) * 12.0F + 4.5F + (i % crates) * 0.8F,
+                                  0.0F, -z * 12.0F + 4.5F + (i / crates) * 0.8F);
+        actors.append(crate);
+      }
+    }
+  }
+
+  // Standing at a street corner, looking across the blocks
+  QMatrix4x4 view;
+  view.lookAt(QVector3D(-2.0F, 1.7F, 8.0F), QVector3D(20.0F, 1.5F, -60.0F),
+              QVector3D(0.0F, 1.0F, 0.0F));
+  QMatrix4x4 projection;
+  projection.perspective(50.0F, 16.0F / 9.0F, 0.2F, 1000.0F);
+  QMatrix4x4 viewProjection = projection * view;
+
+  int stride = (sizeof(DrawData) + 255) / 256 * 256;
+  std::vector<char> data(size_t(actors.size()) * stride);
+
+  qDebug() << ":: Occlusion culling benchmark," << actors.size() << "actors,"
+           << blocks * blocks * building.size() / 3 << "occluder triangles";
+
+  int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  double singleThreaded = 0.0;
+  for (int threads = 1;; threads = std::min(threads * 2, maxThreads))
+  {
+    JobSystem jobs(threads - 1);
+    OcclusionCuller culler;
+    DrawList list;
+    list.prepare(jobs, actors, view, projection, data.data(), stride);
+    int frustumVisible = list.size();
+
+    culler.render(jobs, actors, viewProjection); // warm up
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < repeats; ++i)
+    {
+      culler.render(jobs, actors, viewProjection);
+    }
+    double renderMs = timer.nsecsElapsed() / 1.0e6 / repeats;
+
+    list.setOcclusion(&culler);
+    timer.restart();
+    for (int i = 0; i < repeats; ++i)
+    {
+      list.prepare(jobs, actors, view, projection, data.data(), stride);
+    }
+    double prepareMs = timer.nsecsElapsed() / 1.0e6 / repeats;
+    if (threads == 1)
+    {
+      singleThreaded = renderMs;
+    }
+
+    qDebug().noquote()
+        << QString("  %1 threads: raster %2 ms (%3 triangles, %4x), prepare with tests %5 ms, "
+                   "%6 of %7 in the frustum culled (%8%)")
+               .arg(threads, 2)
+               .arg(renderMs, 0, 'f', 3)
+               .arg(culler.triangleCount())
+               .arg(singleThreaded / renderMs, 0, 'f', 2)
+               .arg(prepareMs, 0, 'f', 3)
+               .arg(list.occludedCount())
+               .arg(frustumVisible)
+               .arg(100.0 * list.occludedCount() / std::max(1, frustumVisible), 0, 'f', 1);
+    if (threads == maxThreads)
+    {
+      break;
+    }
+  }
+}
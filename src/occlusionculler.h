@@ -0,0 +1,84 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QVector>
+
+#include "actor.h"
+#include "jobsystem.h"
+#include "rasterizer.h"
+
+/**
+ * @brief The OcclusionCuller class rasterizes the occluder meshes of a scene
+ * into a small depth buffer on the CPU, so the draw list can skip actors that
+ * are entirely hidden behind them, e.g. everything behind the apartments.
+ *
+ * Rendering transforms the occluder triangles on all threads, then splits the
+ * buffer into tiles that are rasterized in parallel, each thread only writing
+ * the pixels of its own tile. The inner loop evaluates the edge functions and
+ * the depth plane for a fixed-size block of pixels at once, which the compiler
+ * vectorizes. Triangles crossing the near plane are left out, so the buffer
+ * never claims more coverage than the occluders have.
+ *
+ * A test projects the corners of a bounding box and reports it occluded when
+ * every pixel of its screen rectangle holds an occluder nearer than the
+ * nearest corner. A maximum depth per block of pixels lets most rectangles be
+ * decided without looking at single pixels. Needs no GL.
+ */
+class OcclusionCuller
+{
+public:
+  // Resolution of the depth buffer; the width is a multiple of blockSize
+  static const int width = 256;
+  static const int height = 128;
+
+  OcclusionCuller();
+
+  /**
+   * @brief Rasterizes the occluders among the actors, seen through
+   * viewProjection, replacing the previous depth buffer.
+   */
+  void render(JobSystem &jobs, const QVector<Actor> &actors, const QMatrix4x4 &viewProjection);
+
+  /**
+   * @brief Whether a box is hidden behind the occluders of the last render.
+   * Boxes crossing the near plane are never occluded. Safe to call from
+   * several threads.
+   */
+  bool isOccluded(const QMatrix4x4 &modelViewProjection, const QVector3D &min,
+                  const QVector3D &max) const;
+
+  // Occluder triangles rasterized by the last render
+  int triangleCount() const { return rasterized; }
+  float renderMilliseconds() const { return renderTime; }
+
+  /**
+   * @brief Renders a synthetic city of box buildings hiding small actors, for
+   * 1 to all threads, and logs the timings and how many actors were culled.
+   * No GL.
+   */
+  static void benchmark();
+
+private:
+  // Pixels evaluated together by the inner loop, and the squares of blockMax
+  static const int blockSize = Rasterizer::blockSize;
+  // Pixels rasterized by one job
+  static const int tileWidth = 64;
+  static const int tileHeight = 32;
+
+  using Triangle = Rasterizer::Triangle;
+
+  void rasterize(const Triangle &triangle, int minX, int minY, int maxX, int maxY);
+
+  QVector<float> depth;    // width * height, 0 near to 1 far
+  QVector<float> blockMax; // farthest depth of each blockSize square
+  QVector<Triangle> triangles;
+  QVector<int> occluders;     // actor indices
+  QVector<int> firstTriangle; // per occluder, into triangles
+
+  int rasterized = 0;
+  float renderTime = 0.0F;
+};
+
+#endif // OCCLUSIONCULLER_H
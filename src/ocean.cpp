@@ -0,0 +1,440 @@
+#include "ocean.h"
+
+#include "jobsystem.h"
+#include "parallel.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace
+{
+  const float gravity = 9.8F;
+
+  /**
+   * @brief dispersionOmega Angular frequency of a wave with wavenumber k in
+   * water of the given depth: omega = sqrt(g k tanh(k d)).
+   */
+  float dispersionOmega(float k, float depth)
+  {
+    return std::sqrt(gravity * k * std::tanh(k * depth));
+  }
+
+  /**
+   * @brief dispersionSlope d(omega)/dk of the finite depth dispersion relation.
+   */
+  float dispersionSlope(float k, float depth)
+  {
+    float omega = dispersionOmega(k, depth);
+    float kd = k * depth;
+    float sech = 1.0F / std::cosh(std::min(kd, 20.0F));
+    return gravity * (std::tanh(kd) + kd * sech * sech) / (2.0F * omega);
+  }
+
+  /**
+   * @brief jonswap JONSWAP frequency spectrum S(omega) for the given wind
+   * speed and fetch.
+   */
+  float jonswap(float omega, const OceanSettings &s)
+  {
+    float u = std::max(s.windSpeed, 0.1F);
+    float alpha = 0.076F * std::pow(u * u / (s.fetch * gravity), 0.22F);
+    float omegaPeak = 22.0F * std::cbrt(gravity * gravity / (u * s.fetch));
+    float sigma = omega <= omegaPeak ? 0.07F : 0.09F;
+    float r = std::exp(-(omega - omegaPeak) * (omega - omegaPeak) /
+                       (2.0F * sigma * sigma * omegaPeak * omegaPeak));
+    float ratio = omegaPeak / omega;
+    return alpha * gravity * gravity / std::pow(omega, 5.0F) *
+           std::exp(-1.25F * ratio * ratio * ratio * ratio) *
+           std::pow(s.peakEnhancement, r);
+  }
+
+  /**
+   * @brief spectrumDensity Directional wavenumber spectrum S(kx, kz), i.e. the
+   * height variance per unit of wavenumber area.
+   */
+  float spectrumDensity(float kx, float kz, const OceanSettings &s)
+  {
+    float k = std::sqrt(kx * kx + kz * kz);
+    QVector2D wind = s.windDirection.normalized();
+    float cosTheta = (kx * wind.x() + kz * wind.y()) / k;
+
+    float density = 0.0F;
+    if (s.spectrum == WaveSpectrum::Phillips)
+    {
+      // P(k) = A exp(-1 / (k L)^2) / k^4 |k.w|^2 with L = V^2 / g
+      float L = s.windSpeed * s.windSpeed / gravity;
+      float phillipsConstant = 0.0081F / (2.0F * static_cast<float>(M_PI));
+      density = phillipsConstant * std::exp(-1.0F / (k * L * k * L)) /
+                (k * k * k * k) * cosTheta * cosTheta;
+      if (cosTheta < 0.0F)
+      {
+        density *= 0.07F; // waves running against the wind are mostly damped
+      }
+    }
+    else
+    {
+      // S(k, theta) = S(omega) d(omega)/dk D(theta), divided by k for the
+      // polar to cartesian Jacobian. D is a cos^2 spread around the wind.
+      float omega = dispersionOmega(k, s.depth);
+      float spread = cosTheta > 0.0F
+                         ? 2.0F / static_cast<float>(M_PI) * cosTheta * cosTheta
+                         : 0.0F;
+      density = jonswap(omega, s) * dispersionSlope(k, s.depth) / k * spread;
+    }
+
+    return density * std::exp(-k * k * s.smallWaveCutoff * s.smallWaveCutoff);
+  }
+} // namespace
+
+bool OceanSettings::operator==(const OceanSettings &other) const
+{
+  return spectrum == other.spectrum && gridSize == other.gridSize &&
+         tileSize == other.tileSize && windSpeed == other.windSpeed &&
+         windDirection == other.windDirection && fetch == other.fetch &&
+         peakEnhancement == other.peakEnhancement && depth == other.depth &&
+         amplitude == other.amplitude && choppiness == other.choppiness &&
+         smallWaveCutoff == other.smallWaveCutoff && seed == other.seed;
+}
+
+Ocean::Ocean() : fft(settings.gridSize)
+{
+  generateSpectrum();
+}
+
+/**
+ * @brief Ocean::initialize Creates the GL resources. Requires a current context.
+ */
+void Ocean::initialize()
+{
+  initializeOpenGLFunctions();
+  initialized = true;
+  createTextures();
+}
+
+/**
+ * @brief Ocean::setSettings Applies new spectrum parameters and regenerates the
+ * initial spectrum. Textures are only recreated when the grid size changes.
+ */
+void Ocean::setSettings(const OceanSettings &newSettings)
+{
+  bool resized = newSettings.gridSize != settings.gridSize;
+  settings = newSettings;
+
+  if (resized)
+  {
+    fft = FFT2D(settings.gridSize);
+    if (initialized)
+    {
+      destroyTextures();
+      createTextures();
+    }
+  }
+
+  generateSpectrum();
+}
+
+/**
+ * @brief Ocean::generateSpectrum Draws the random initial amplitudes h0(k)
+ * from the spectrum. Only depends on the settings, not on time.
+ */
+void Ocean::generateSpectrum()
+{
+  int n = settings.gridSize;
+  int count = n * n;
+  float dk = 2.0F * static_cast<float>(M_PI) / settings.tileSize;
+  // The FFT samples the surface at x = i L / N, but texel i is centered at
+  // (i + 0.5) L / N, so every wave is shifted by half a texel.
+  float halfTexel = 0.5F * settings.tileSize / n;
+
+  for (QVector<float> *field : {&h0Re, &h0Im, &h0MinusRe, &h0MinusIm, &omega,
+                                &kx, &kz, &kLength, &heightDispXRe, &heightDispXIm,
+                                &slopeRe, &slopeIm, &dispZRe, &dispZIm})
+  {
+    field->fill(0.0F, count);
+  }
+
+  std::mt19937 rng(settings.seed);
+  std::normal_distribution<float> gaussian;
+
+  for (int row = 0; row < n; ++row)
+  {
+    // Frequencies are stored in FFT order: 0 .. N/2 - 1, then -N/2 .. -1
+    int m = row < n / 2 ? row : row - n;
+    for (int col = 0; col < n; ++col)
+    {
+      int l = col < n / 2 ? col : col - n;
+      int i = row * n + col;
+      kx[i] = l * dk;
+      kz[i] = m * dk;
+      kLength[i] = std::sqrt(kx[i] * kx[i] + kz[i] * kz[i]);
+
+      float xiRe = gaussian(rng);
+      float xiIm = gaussian(rng);
+
+      // The Nyquist row/column has no negative partner, leave it empty to
+      // keep the packed real fields from leaking into each other.
+      if (kLength[i] == 0.0F || m == -n / 2 || l == -n / 2)
+      {
+        continue;
+      }
+
+      omega[i] = dispersionOmega(kLength[i], settings.depth);
+      float amplitude = settings.amplitude *
+                        std::sqrt(spectrumDensity(kx[i], kz[i], settings) * dk * dk * 0.5F);
+      h0Re[i] = xiRe * amplitude;
+      h0Im[i] = xiIm * amplitude;
+    }
+  }
+
+  for (int row = 0; row < n; ++row)
+  {
+    for (int col = 0; col < n; ++col)
+    {
+      int mirrored = ((n - row) % n) * n + (n - col) % n;
+      h0MinusRe[row * n + col] = h0Re[mirrored];
+      h0MinusIm[row * n + col] = h0Im[mirrored];
+    }
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    float shift = (kx[i] + kz[i]) * halfTexel;
+    float c = std::cos(shift);
+    float s = std::sin(shift);
+
+    // h0'(k) = h0(k) e^(i k.d) and h0'(-k) = h0(-k) e^(-i k.d)
+    float re = h0Re[i], im = h0Im[i];
+    float mRe = h0MinusRe[i], mIm = h0MinusIm[i];
+    h0Re[i] = re * c - im * s;
+    h0Im[i] = re * s + im * c;
+    h0MinusRe[i] = mRe * c + mIm * s;
+    h0MinusIm[i] = mIm * c - mRe * s;
+  }
+}
+
+/**
+ * @brief Ocean::synthesize Advances the spectrum to the given time and
+ * transforms it into height, normals and horizontal displacement.
+ */
+void Ocean::synthesize(float time, float *heightNormal, float *displacement)
+{
+  int n = settings.gridSize;
+
+  parallelFor(0, n * n, [&](int begin, int end)
+              {
+    for (int i = begin; i < end; ++i)
+    {
+      float c = std::cos(omega[i] * time);
+      float s = std::sin(omega[i] * time);
+
+      // h(k, t) = h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t)
+      float hRe = h0Re[i] * c - h0Im[i] * s + h0MinusRe[i] * c - h0MinusIm[i] * s;
+      float hIm = h0Re[i] * s + h0Im[i] * c - h0MinusRe[i] * s - h0MinusIm[i] * c;
+
+      float k = kLength[i];
+      float dirX = k > 0.0F ? kx[i] / k : 0.0F;
+      float dirZ = k > 0.0F ? kz[i] / k : 0.0F;
+
+      // Each real output field has a hermitian spectrum, so two of them fit in
+      // one complex FFT as A + iB: slopes are i k h, displacements -i k/|k| h.
+      float slopeXRe = -kx[i] * hIm, slopeXIm = kx[i] * hRe;
+      float slopeZRe = -kz[i] * hIm, slopeZIm = kz[i] * hRe;
+      float dispXRe = dirX * hIm, dispXIm = -dirX * hRe;
+
+      heightDispXRe[i] = hRe - dispXIm;
+      heightDispXIm[i] = hIm + dispXRe;
+      slopeRe[i] = slopeXRe - slopeZIm;
+      slopeIm[i] = slopeXIm + slopeZRe;
+      dispZRe[i] = dirZ * hIm;
+      dispZIm[i] = -dirZ * hRe;
+    } }, 4096);
+
+  fft.inverse(heightDispXRe.data(), heightDispXIm.data());
+  fft.inverse(slopeRe.data(), slopeIm.data());
+  fft.inverse(dispZRe.data(), dispZIm.data());
+
+  float choppiness = settings.choppiness;
+  parallelFor(0, n * n, [&](int begin, int end)
+              {
+    for (int i = begin; i < end; ++i)
+    {
+      float nx = -slopeRe[i];
+      float nz = -slopeIm[i];
+      float invLength = 1.0F / std::sqrt(nx * nx + 1.0F + nz * nz);
+
+      heightNormal[4 * i + 0] = nx * invLength;
+      heightNormal[4 * i + 1] = invLength;
+      heightNormal[4 * i + 2] = nz * invLength;
+      heightNormal[4 * i + 3] = heightDispXRe[i];
+
+      displacement[2 * i + 0] = choppiness * heightDispXIm[i];
+      displacement[2 * i + 1] = choppiness * dispZRe[i];
+    } }, 4096);
+}
+
+/**
+ * @brief Ocean::update Synthesizes the surface for this frame directly into
+ * the next pixel buffer of the ring and uploads it to the textures.
+ * @param time Current scene time in seconds.
+ */
+void Ocean::update(float time)
+{
+  int n = settings.gridSize;
+  GLsizeiptr heightBytes = GLsizeiptr(n) * n * 4 * sizeof(float);
+  GLsizeiptr totalBytes = heightBytes + GLsizeiptr(n) * n * 2 * sizeof(float);
+
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbos[pboIndex]);
+  // Invalidating lets the driver hand out fresh storage instead of waiting
+  // for an upload that may still be reading this buffer.
+  auto *mapped = static_cast<float *>(glMapBufferRange(
+      GL_PIXEL_UNPACK_BUFFER, 0, totalBytes,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+
+  if (mapped)
+  {
+    synthesize(time, mapped, mapped + heightBytes / sizeof(float));
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    current = 1 - current;
+    previous = hasPrevious ? 1 - current : current;
+    hasPrevious = true;
+
+    glBindTexture(GL_TEXTURE_2D, texHeightNormal[current]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, n, GL_RGBA, GL_FLOAT,
+                    reinterpret_cast<GLvoid *>(0));
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindTexture(GL_TEXTURE_2D, texDisplacement[current]);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, n, n, GL_RG, GL_FLOAT,
+                    reinterpret_cast<GLvoid *>(heightBytes));
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  // Texture uploads elsewhere pass client pointers, so never leave a PBO bound
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  pboIndex = (pboIndex + 1) % pboCount;
+}
+
+void Ocean::createTextures()
+{
+  int n = settings.gridSize;
+
+  glGenTextures(2, texHeightNormal);
+  glGenTextures(2, texDisplacement);
+  for (int i = 0; i < 2; ++i)
+  {
+    glBindTexture(GL_TEXTURE_2D, texHeightNormal[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, n, n, 0, GL_RGBA, GL_FLOAT, NULL);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindTexture(GL_TEXTURE_2D, texDisplacement[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, n, n, 0, GL_RG, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  // The first update has no previous surface, it reuses its own
+  hasPrevious = false;
+
+  GLsizeiptr bytes = GLsizeiptr(n) * n * 6 * sizeof(float);
+  glGenBuffers(pboCount, pbos);
+  for (GLuint pbo : pbos)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/**
+ * @brief Ocean::destroy Releases the GL resources. Requires a current context.
+ * The CPU synthesis keeps working.
+ */
+void Ocean::destroy()
+{
+  destroyTextures();
+  initialized = false;
+}
+
+void Ocean::destroyTextures()
+{
+  if (!initialized)
+  {
+    return;
+  }
+
+  glDeleteBuffers(pboCount, pbos);
+  glDeleteTextures(2, texHeightNormal);
+  glDeleteTextures(2, texDisplacement);
+  texHeightNormal[0] = texHeightNormal[1] = 0;
+  texDisplacement[0] = texDisplacement[1] = 0;
+}
+
+/**
+ * @brief Ocean::benchmark Measures the CPU synthesis throughput for grid sizes
+ * 128 to 1024 and logs the results. Runs on the global JobSystem, no GL.
+ */
+void Ocean::benchmark()
+{
+  qDebug() << ":: Ocean FFT benchmark," << JobSystem::global().threadCount() << "threads";
+
+  for (int n : {128, 256, 512, 1024})
+  {
+    OceanSettings s;
+    s.gridSize = n;
+    Ocean ocean;
+    ocean.setSettings(s);
+
+    QVector<float> heightNormal(n * n * 4);
+    QVector<float> displacement(n * n * 2);
+    // The transform works in place and is not normalized, so every iteration
+    // starts again from the spectrum instead of growing the last result
+    QVector<float> re(n * n), im(n * n);
+
+    // Enough iterations for roughly a quarter second at 10 ns per point
+    int iterations = std::max(4, (1 << 24) / (n * n));
+
+    ocean.synthesize(0.0F, heightNormal.data(), displacement.data());
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < iterations; ++i)
+    {
+      ocean.synthesize(i / 60.0F, heightNormal.data(), displacement.data());
+    }
+    double synthesisMs = timer.nsecsElapsed() / 1e6 / iterations;
+
+    qint64 fftNanoseconds = 0;
+    for (int i = 0; i < iterations; ++i)
+    {
+      std::copy(ocean.h0Re.cbegin(), ocean.h0Re.cend(), re.begin());
+      std::copy(ocean.h0Im.cbegin(), ocean.h0Im.cend(), im.begin());
+      timer.restart();
+      ocean.fft.inverse(re.data(), im.data());
+      fftNanoseconds += timer.nsecsElapsed();
+    }
+    double fftMs = fftNanoseconds / 1e6 / iterations;
+
+    // The usual 5 N log2(N) flop estimate for a complex FFT of N points
+    double points = double(n) * n;
+    double mflops = 5.0 * points * std::log2(points) / (fftMs * 1e3);
+
+    qDebug().nospace() << "   " << n << "x" << n << ": synthesis "
+                       << synthesisMs << " ms/frame, single FFT " << fftMs
+                       << " ms (" << mflops << " MFLOP/s, "
+                       << points / (fftMs * 1e3) << " Mpoints/s)";
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef OCEAN_H
+#define OCEAN_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector2D>
+#include <QVector>
+
+#include "fft.h"
+
+/**
+ * @brief Directional wave spectra the ocean can be synthesized from.
+ */
+enum class WaveSpectrum
+{
+  Phillips, // Tessendorf's fully developed sea, driven by wind speed only
+  Jonswap   // Fetch-limited sea (JONSWAP), better for canals and harbors
+};
+
+/**
+ * @brief Parameters of the FFT ocean. Changing any of them requires a call to
+ * Ocean::setSettings(), which regenerates the initial spectrum.
+ */
+struct OceanSettings
+{
+  WaveSpectrum spectrum = WaveSpectrum::Jonswap;
+  int gridSize = 256;                    // FFT resolution, power of two
+  float tileSize = 16.0F;                // world units covered by one tile
+  float windSpeed = 6.0F;                // m/s at 10 m above the water
+  QVector2D windDirection{1.0F, 0.0F};   // direction the wind blows to
+  float fetch = 2000.0F;                 // m of open water upwind (JONSWAP)
+  float peakEnhancement = 3.3F;          // JONSWAP gamma
+  float depth = 5.0F;                    // m, used by the dispersion relation
+  float amplitude = 0.35F;               // artistic scale on the wave heights
+  float choppiness = 0.6F;               // horizontal displacement strength
+  float smallWaveCutoff = 0.02F;         // m, suppresses waves shorter than this
+  unsigned seed = 1337;
+
+  bool operator==(const OceanSettings &other) const;
+  bool operator!=(const OceanSettings &other) const { return !(*this == other); }
+};
+
+/**
+ * @brief The Ocean class synthesizes a tiling water surface from a wave
+ * spectrum with a CPU FFT and uploads it for the water shaders.
+ *
+ * Each frame the spectrum is advanced in time and three inverse FFTs produce
+ * height, slopes and horizontal displacement. The results are written straight
+ * into a mapped pixel buffer from a small ring and uploaded from there, so the
+ * upload never waits on the GPU. The textures use the same layout as the wave
+ * texture pass: normal.xyz + height, plus a displacement texture (dx, dz).
+ * The surface of the previous update is kept as well.
+ */
+class Ocean : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  Ocean();
+
+  void initialize();
+  void destroy();
+  void setSettings(const OceanSettings &newSettings);
+  const OceanSettings &getSettings() const { return settings; }
+
+  void update(float time);
+
+  GLuint heightTexture() const { return texHeightNormal[current]; }
+  GLuint displacementTexture() const { return texDisplacement[current]; }
+
+  // The surface of the update before the last one, for motion vectors
+  GLuint previousHeightTexture() const { return texHeightNormal[previous]; }
+  GLuint previousDisplacementTexture() const { return texDisplacement[previous]; }
+
+  /**
+   * @brief Synthesizes the surface on the CPU only.
+   * @param heightNormal gridSize^2 RGBA texels: normal.xyz, height.
+   * @param displacement gridSize^2 RG texels: dx, dz.
+   */
+  void synthesize(float time, float *heightNormal, float *displacement);
+
+  static void benchmark();
+
+private:
+  void generateSpectrum();
+  void createTextures();
+  void destroyTextures();
+
+  OceanSettings settings;
+  FFT2D fft;
+
+  // Time independent spectrum: h0(k) and h0(-k), plus the angular frequency
+  QVector<float> h0Re, h0Im, h0MinusRe, h0MinusIm, omega;
+  QVector<float> kx, kz, kLength;
+
+  // Scratch fields for the three packed inverse FFTs
+  QVector<float> heightDispXRe, heightDispXIm;
+  QVector<float> slopeRe, slopeIm;
+  QVector<float> dispZRe, dispZIm;
+
+  static const int pboCount = 3;
+  GLuint pbos[pboCount] = {0, 0, 0};
+  int pboIndex = 0;
+  // Two sets, written alternately, so the previous surface stays available
+  GLuint texHeightNormal[2] = {0, 0};
+  GLuint texDisplacement[2] = {0, 0};
+  int current = 0;
+  int previous = 0;
+  bool hasPrevious = false;
+  bool initialized = false;
+};
+
+#endif // OCEAN_H
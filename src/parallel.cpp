@@ -0,0 +1,9 @@
+#include "parallel.h"
+
+#include "jobsystem.h"
+
+void parallelFor(int begin, int end, const std::function<void(int, int)> &body,
+                 int minChunk)
+{
+  JobSystem::global().parallelFor(begin, end, body, minChunk);
+}
@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <functional>
+
+/**
+ * @brief parallelFor Splits [begin, end) into contiguous chunks and runs them on
+ * the global JobSystem, blocking until every chunk is done. The calling thread
+ * works on the chunks as well and never sleeps while waiting, so it is safe to
+ * call from inside another parallelFor.
+ * @param begin First index.
+ * @param end One past the last index.
+ * @param body Called as body(chunkBegin, chunkEnd) for each chunk.
+ * @param minChunk Smallest number of indices worth handing to another thread.
+ */
+void parallelFor(int begin, int end, const std::function<void(int, int)> &body,
+                 int minChunk = 1);
+
+#endif // PARALLEL_H
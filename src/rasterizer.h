@@ -0,0 +1,102 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief The triangle rasterizer shared by the occlusion culler and the CPU
+ * reference renderer. It only finds the pixels a triangle covers and its depth
+ * there; what happens to a pixel (depth test, clamping, storing an id) is up to
+ * a write callback, which is inlined into the loop.
+ */
+namespace Rasterizer
+{
+// Pixels evaluated together by the inner loop. Rows of a target are padded to
+// whole blocks, since the loop widens rectangles to them.
+constexpr int blockSize = 8;
+
+// Window coordinates of a triangle, counterclockwise
+struct Triangle
+{
+  float x[3];
+  float y[3];
+  float z[3];                 // 0 near to 1 far
+  int minX, minY, maxX, maxY; // pixels whose centers may be covered
+};
+
+/**
+ * @brief Finds the pixels of a width x height target whose centers a triangle
+ * with window coordinates may cover. Back faces (clockwise, as GL culls) get
+ * an empty range.
+ * @return Whether any pixel may be covered.
+ */
+inline bool setup(Triangle &triangle, int width, int height)
+{
+  triangle.minX = triangle.minY = 0;
+  triangle.maxX = triangle.maxY = -1;
+  float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) -
+               (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+  if (!(area > 0.0F))
+  {
+    return false;
+  }
+  auto range = [](const float *v, int size, int &first, int &last)
+  {
+    float low = std::min({v[0], v[1], v[2]});
+    float high = std::max({v[0], v[1], v[2]});
+    first = std::max(0, int(std::ceil(std::max(low, -1.0F) - 0.5F)));
+    last = std::min(size - 1, int(std::floor(std::min(high, float(size + 1)) - 0.5F)));
+  };
+  range(triangle.x, width, triangle.minX, triangle.maxX);
+  range(triangle.y, height, triangle.minY, triangle.maxY);
+  return triangle.minX <= triangle.maxX && triangle.minY <= triangle.maxY;
+}
+
+/**
+ * @brief Calls write(x, y, z, covered) for the pixels of a rectangle, widened
+ * to whole blocks on the left and right, with the depth of the triangle's plane
+ * at each pixel center and whether the triangle covers it. The edge functions
+ * and depth are evaluated for a block of pixels at once, which the compiler
+ * vectorizes together with an inlined callback that selects instead of
+ * branching.
+ */
+template <typename Write>
+inline void rasterize(const Triangle &triangle, int minX, int minY, int maxX, int maxY,
+                      Write &&write)
+{
+  // Edge i runs from vertex i to the next one and is non-negative inside
+  float a[3], b[3], c[3];
+  for (int i = 0; i < 3; ++i)
+  {
+    int j = (i + 1) % 3;
+    a[i] = triangle.y[i] - triangle.y[j];
+    b[i] = triangle.x[j] - triangle.x[i];
+    c[i] = -(a[i] * triangle.x[i] + b[i] * triangle.y[i]);
+  }
+  // Depth is linear in screen space: weight each vertex by the edge opposite it
+  float area = c[0] + c[1] + c[2];
+  float za = (a[1] * triangle.z[0] + a[2] * triangle.z[1] + a[0] * triangle.z[2]) / area;
+  float zb = (b[1] * triangle.z[0] + b[2] * triangle.z[1] + b[0] * triangle.z[2]) / area;
+  float zc = (c[1] * triangle.z[0] + c[2] * triangle.z[1] + c[0] * triangle.z[2]) / area;
+
+  int firstX = minX / blockSize * blockSize;
+  for (int y = minY; y <= maxY; ++y)
+  {
+    float py = y + 0.5F;
+    for (int x = firstX; x <= maxX; x += blockSize)
+    {
+      for (int k = 0; k < blockSize; ++k)
+      {
+        float px = x + k + 0.5F;
+        float e0 = a[0] * px + b[0] * py + c[0];
+        float e1 = a[1] * px + b[1] * py + c[1];
+        float e2 = a[2] * px + b[2] * py + c[2];
+        write(x + k, y, za * px + zb * py + zc, e0 >= 0.0F && e1 >= 0.0F && e2 >= 0.0F);
+      }
+    }
+  }
+}
+} // namespace Rasterizer
+
+#endif // RASTERIZER_H
@@ -0,0 +1,1135 @@
+#include "referencerenderer.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "model.h"
+#include "texturearrays.h"
+#include "waves.h"
+
+namespace
+{
+  /**
+   * @brief forEachRun Splits the triangles of several meshes (counts given per
+   * mesh) into chunks of about the same size and calls body(chunk, mesh,
+   * first, end) on all threads for every run of one mesh's triangles inside a
+   * chunk.
+   */
+  void forEachRun(JobSystem &jobs, const QVector<int> &counts, int chunks,
+                  const std::function<void(int, int, int, int)> &body)
+  {
+    QVector<int> first(counts.size() + 1, 0);
+    for (int i = 0; i < counts.size(); ++i)
+    {
+      first[i + 1] = first[i] + counts[i];
+    }
+    qint64 total = first.last();
+    jobs.parallelFor(0, chunks, [&](int begin, int end)
+    {
+      for (int chunk = begin; chunk < end; ++chunk)
+      {
+        int from = int(total * chunk / chunks);
+        int to = int(total * (chunk + 1) / chunks);
+        int mesh = int(std::upper_bound(first.cbegin(), first.cend(), from) - first.cbegin()) - 1;
+        while (from < to)
+        {
+          int runEnd = std::min(to, first[mesh + 1]);
+          if (runEnd > from)
+          {
+            body(chunk, mesh, from - first[mesh], runEnd - first[mesh]);
+          }
+          from = runEnd;
+          mesh++;
+        }
+      }
+    }, 1);
+  }
+
+  QVector3D reflect(const QVector3D &incident, const QVector3D &normal)
+  {
+    return incident - 2.0F * QVector3D::dotProduct(normal, incident) * normal;
+  }
+
+  // Stored like the RGBA8 G-buffer target
+  float unorm8(float value)
+  {
+    return std::round(std::clamp(value, 0.0F, 1.0F) * 255.0F) / 255.0F;
+  }
+} // namespace
+
+bool ReferenceRenderer::load(const SceneDescription &scene)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  meshes.clear();
+  textures.clear();
+  instances.clear();
+  casterMin = QVector3D(INFINITY, INFINITY, INFINITY);
+  casterMax = -casterMin;
+
+  QHash<QString, int> meshIndices;
+  QHash<QString, int> textureIndices;
+  auto texture = [&](const QString &path) -> int
+  {
+    if (path.isEmpty())
+    {
+      return -1;
+    }
+    auto found = textureIndices.constFind(path);
+    if (found != textureIndices.constEnd())
+    {
+      return found.value();
+    }
+
+    int index = -1;
+    QImage image(path);
+    if (image.isNull())
+    {
+      qWarning() << "Reference: cannot load texture" << path;
+    }
+    else
+    {
+      // The same texels as the array layer the GL path samples
+      int width = TextureArrays::layerSize(image.width());
+      int height = TextureArrays::layerSize(image.height());
+      if (image.width() != width || image.height() != height)
+      {
+        image = image.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+      }
+      image = image.mirrored().convertToFormat(QImage::Format_RGBA8888);
+
+      Texture result;
+      result.width = width;
+      result.height = height;
+      result.texels.resize(width * height * 4);
+      for (int y = 0; y < height; ++y)
+      {
+        std::memcpy(result.texels.data() + y * width * 4, image.constScanLine(y), width * 4);
+      }
+      index = textures.size();
+      textures.append(result);
+    }
+    textureIndices.insert(path, index);
+    return index;
+  };
+
+  for (const ActorDescription &description : scene.actors)
+  {
+    int mesh = meshIndices.value(description.mesh, -2);
+    if (mesh == -2)
+    {
+      Model model(description.mesh);
+      Mesh loaded;
+      loaded.positions = model.takeCoordsIndexed();
+      loaded.normals = model.takeNormalsIndexed();
+      loaded.uvs = model.takeTextureCoordsIndexed();
+      loaded.tangents = model.takeTangentsIndexed();
+      loaded.indices = model.takeIndices();
+      mesh = -1;
+      if (loaded.indices.isEmpty())
+      {
+        qWarning() << "Reference: cannot load mesh" << description.mesh;
+      }
+      else
+      {
+        mesh = meshes.size();
+        meshes.append(loaded);
+      }
+      meshIndices.insert(description.mesh, mesh);
+    }
+    if (mesh < 0)
+    {
+      continue;
+    }
+
+    Instance instance;
+    instance.mesh = mesh;
+    instance.transform = description.transform;
+    instance.water = description.shader == "water";
+    if (!instance.water)
+    {
+      instance.diffuse = texture(description.material.diffuse);
+      instance.emission = texture(description.material.emission);
+      instance.normal = texture(description.material.normal);
+      instance.specular = texture(description.material.specular);
+    }
+    // The same actors as SceneLoader marks reflective
+    instance.reflective = instance.water || instance.specular >= 0;
+    instances.append(instance);
+
+    // Like the GL path, the box of the mesh bounds in world space
+    if (!instance.water && !description.dynamic)
+    {
+      const QVector<QVector3D> &positions = meshes[mesh].positions;
+      QVector3D low = positions.first();
+      QVector3D high = low;
+      for (const QVector3D &p : positions)
+      {
+        low = QVector3D(std::min(low.x(), p.x()), std::min(low.y(), p.y()),
+                        std::min(low.z(), p.z()));
+        high = QVector3D(std::max(high.x(), p.x()), std::max(high.y(), p.y()),
+                         std::max(high.z(), p.z()));
+      }
+      for (int corner = 0; corner < 8; ++corner)
+      {
+        QVector3D p = instance.transform.map(QVector3D(corner & 1 ? high.x() : low.x(),
+                                                       corner & 2 ? high.y() : low.y(),
+                                                       corner & 4 ? high.z() : low.z()));
+        casterMin = QVector3D(std::min(casterMin.x(), p.x()), std::min(casterMin.y(), p.y()),
+                              std::min(casterMin.z(), p.z()));
+        casterMax = QVector3D(std::max(casterMax.x(), p.x()), std::max(casterMax.y(), p.y()),
+                              std::max(casterMax.z(), p.z()));
+      }
+    }
+  }
+  if (casterMin.x() > casterMax.x())
+  {
+    casterMin = casterMax = QVector3D();
+  }
+
+  lightDirection = scene.light.direction;
+  lightColor = scene.light.color;
+
+  qDebug() << "Reference:" << instances.size() << "actors," << meshes.size() << "meshes,"
+           << textures.size() << "textures loaded in" << timer.elapsed() << "ms";
+  return !instances.isEmpty();
+}
+
+ReferenceRenderer::Shadows ReferenceRenderer::fitShadows(const ShadowDescription &settings,
+                                                        const Camera &camera) const
+{
+  Shadows shadows;
+  if (!settings.enabled)
+  {
+    return shadows;
+  }
+  ShadowCascades::Cascade cascades[maxCascades];
+  ShadowCascades::fit(settings, lightDirection, camera.view, camera.projection, casterMin,
+                      casterMax, cascades);
+  shadows.cascades = ShadowCascades::cascadeCount(settings);
+  shadows.size = ShadowCascades::mapSize(settings);
+  for (int i = 0; i < shadows.cascades; ++i)
+  {
+    shadows.textureMatrix[i] = ShadowCascades::textureMatrix(cascades[i]);
+    shadows.split[i] = cascades[i].split;
+    shadows.texel[i] = cascades[i].texel;
+  }
+  return shadows;
+}
+
+void ReferenceRenderer::setWaves(const WaveModel *model, float time)
+{
+  waves = model;
+  waveTime = time;
+}
+
+void ReferenceRenderer::render(JobSystem &jobs, const Camera &camera, const Shadows &shadows)
+{
+  QElapsedTimer timer;
+  timer.start();
+  frameWidth = std::max(1, camera.width);
+  frameHeight = std::max(1, camera.height);
+
+  transform(jobs, camera);
+  setupTriangles(jobs, frameWidth, frameHeight);
+  transformTime = timer.nsecsElapsed() / 1.0e6F;
+
+  timer.restart();
+  renderShadows(jobs, shadows);
+  shadowTime = timer.nsecsElapsed() / 1.0e6F;
+
+  timer.restart();
+  allocate(frame, frameWidth, frameHeight, tileSize, true);
+  rasterize(jobs, rasters, frame, tileSize, false);
+  rasterTime = timer.nsecsElapsed() / 1.0e6F;
+
+  timer.restart();
+  resolveGBuffer(jobs);
+  gBufferTime = timer.nsecsElapsed() / 1.0e6F;
+
+  timer.restart();
+  shade(jobs, camera, shadows);
+  shadeTime = timer.nsecsElapsed() / 1.0e6F;
+}
+
+void ReferenceRenderer::allocate(Target &target, int width, int height, int tile, bool withIds)
+{
+  target.width = width;
+  target.height = height;
+  target.stride = (width + tile - 1) / tile * tile;
+  target.rows = (height + tile - 1) / tile * tile;
+  // Every tile clears its own pixels when it is rasterized
+  target.depth.resize(target.stride * target.rows);
+  target.ids.resize(withIds ? target.stride * target.rows : 0);
+}
+
+/**
+ * @brief ReferenceRenderer::transform Runs the vertex shaders: view space
+ * attributes and clip positions of every vertex of every instance. The water
+ * is displaced and gets its normals from the waves, like watervert.
+ */
+void ReferenceRenderer::transform(JobSystem &jobs, const Camera &camera)
+{
+  firstVertex.resize(instances.size());
+  int count = 0;
+  for (int i = 0; i < instances.size(); ++i)
+  {
+    firstVertex[i] = count;
+    count += meshes[instances[i].mesh].positions.size();
+  }
+  vertices.resize(count);
+
+  auto transformRun = [&](int instanceIndex, int begin, int end)
+  {
+    const Instance &instance = instances[instanceIndex];
+    const Mesh &mesh = meshes[instance.mesh];
+    QMatrix4x4 modelView = camera.view * instance.transform;
+    QMatrix4x4 normalMatrix = modelView.inverted().transposed();
+    int offset = begin - firstVertex[instanceIndex];
+    int n = end - begin;
+
+    QVector<QVector3D> world;
+    QVector<float> heights;
+    QVector<QVector3D> waveNormals;
+    bool displaced = instance.water && waves;
+    if (displaced)
+    {
+      world.resize(n);
+      QVector<QVector2D> coords(n);
+      for (int k = 0; k < n; ++k)
+      {
+        world[k] = instance.transform.map(mesh.positions[offset + k]);
+        coords[k] = QVector2D(world[k].x(), world[k].z());
+      }
+      heights.resize(n);
+      waveNormals.resize(n);
+      waves->sample(coords.constData(), n, waveTime, heights.data(), waveNormals.data());
+    }
+
+    for (int k = 0; k < n; ++k)
+    {
+      int index = offset + k;
+      QVector3D position;
+      QVector3D normal;
+      QVector4D tangent;
+      if (displaced)
+      {
+        position = camera.view.map(world[k] + QVector3D(0.0F, heights[k], 0.0F));
+        normal = camera.view.mapVector(waveNormals[k]).normalized();
+      }
+      else
+      {
+        position = modelView.map(mesh.positions[index]);
+        if (index < mesh.normals.size())
+        {
+          normal = normalMatrix.mapVector(mesh.normals[index]);
+        }
+        if (index < mesh.tangents.size())
+        {
+          const QVector4D &t = mesh.tangents[index];
+          tangent = QVector4D(modelView.mapVector(t.toVector3D()), t.w());
+        }
+      }
+      QVector2D uv = index < mesh.uvs.size() ? mesh.uvs[index] : QVector2D();
+
+      ClipVertex &vertex = vertices[begin + k];
+      vertex.clip = camera.projection * QVector4D(position, 1.0F);
+      float *attributes = vertex.attributes;
+      for (int c = 0; c < 3; ++c)
+      {
+        attributes[positionAttribute + c] = position[c];
+        attributes[normalAttribute + c] = normal[c];
+      }
+      attributes[uvAttribute] = uv.x();
+      attributes[uvAttribute + 1] = uv.y();
+      for (int c = 0; c < 4; ++c)
+      {
+        attributes[tangentAttribute + c] = tangent[c];
+      }
+    }
+  };
+
+  jobs.parallelFor(0, count, [&](int begin, int end)
+  {
+    int instance = int(std::upper_bound(firstVertex.cbegin(), firstVertex.cend(), begin) -
+                       firstVertex.cbegin()) - 1;
+    while (begin < end)
+    {
+      int instanceEnd = instance + 1 < firstVertex.size() ? firstVertex[instance + 1] : count;
+      int runEnd = std::min(end, instanceEnd);
+      if (runEnd > begin)
+      {
+        transformRun(instance, begin, runEnd);
+      }
+      begin = runEnd;
+      instance++;
+    }
+  }, 1024);
+}
+
+/**
+ * @brief ReferenceRenderer::clipNear Clips a triangle at the near plane, where
+ * z = -w, into a polygon of up to four vertices.
+ * @return The number of vertices of the polygon.
+ */
+int ReferenceRenderer::clipNear(const ClipVertex *triangle, ClipVertex *polygon)
+{
+  int count = 0;
+  for (int i = 0; i < 3; ++i)
+  {
+    const ClipVertex &a = triangle[i];
+    const ClipVertex &b = triangle[(i + 1) % 3];
+    float da = a.clip.z() + a.clip.w();
+    float db = b.clip.z() + b.clip.w();
+    if (da >= 0.0F)
+    {
+      polygon[count++] = a;
+    }
+    if ((da >= 0.0F) != (db >= 0.0F))
+    {
+      float t = da / (da - db);
+      ClipVertex &vertex = polygon[count++];
+      vertex.clip = a.clip + (b.clip - a.clip) * t;
+      for (int c = 0; c < attributeCount; ++c)
+      {
+        vertex.attributes[c] = a.attributes[c] + (b.attributes[c] - a.attributes[c]) * t;
+      }
+    }
+  }
+  return count;
+}
+
+/**
+ * @brief ReferenceRenderer::setupRaster Window coordinates and the pixel
+ * bounds of a triangle in clip space.
+ * @return False for back faces and triangles that cover no pixel center.
+ */
+bool ReferenceRenderer::setupRaster(Raster &raster, const QVector4D *clip, int width, int height)
+{
+  for (int k = 0; k < 3; ++k)
+  {
+    raster.x[k] = (clip[k].x() / clip[k].w() * 0.5F + 0.5F) * width;
+    raster.y[k] = (clip[k].y() / clip[k].w() * 0.5F + 0.5F) * height;
+    raster.z[k] = clip[k].z() / clip[k].w() * 0.5F + 0.5F;
+  }
+  // Counterclockwise front faces, as GL culls
+  return Rasterizer::setup(raster, width, height);
+}
+
+/**
+ * @brief ReferenceRenderer::setupTriangles Assembles the transformed vertices
+ * into triangles, drops the ones outside the view and the back faces and clips
+ * the rest at the near plane. Keeps the scene order.
+ */
+void ReferenceRenderer::setupTriangles(JobSystem &jobs, int width, int height)
+{
+  QVector<int> counts(instances.size());
+  for (int i = 0; i < instances.size(); ++i)
+  {
+    counts[i] = meshes[instances[i].mesh].indices.size() / 3;
+  }
+  int chunks = jobs.threadCount() * 4;
+  std::vector<QVector<Raster>> chunkRasters(chunks);
+  std::vector<QVector<Shading>> chunkShading(chunks);
+
+  forEachRun(jobs, counts, chunks, [&](int chunk, int instance, int first, int end)
+  {
+    const quint32 *indices = meshes[instances[instance].mesh].indices.constData();
+    const ClipVertex *base = vertices.constData() + firstVertex[instance];
+    QVector<Raster> &outRasters = chunkRasters[chunk];
+    QVector<Shading> &outShading = chunkShading[chunk];
+
+    auto output = [&](const ClipVertex &a, const ClipVertex &b, const ClipVertex &c)
+    {
+      const ClipVertex *corners[3] = {&a, &b, &c};
+      QVector4D clip[3] = {a.clip, b.clip, c.clip};
+      Raster raster;
+      if (!setupRaster(raster, clip, width, height))
+      {
+        return;
+      }
+      Shading shading;
+      shading.instance = instance;
+      for (int k = 0; k < 3; ++k)
+      {
+        shading.invW[k] = 1.0F / clip[k].w();
+        std::copy(corners[k]->attributes, corners[k]->attributes + attributeCount,
+                  shading.attributes[k]);
+      }
+      outRasters.append(raster);
+      outShading.append(shading);
+    };
+
+    for (int t = first; t < end; ++t)
+    {
+      ClipVertex triangle[3] = {base[indices[3 * t]], base[indices[3 * t + 1]],
+                                base[indices[3 * t + 2]]};
+
+      // Entirely outside one side of the view volume
+      bool outside = false;
+      int behind = 0;
+      for (int axis = 0; axis < 3 && !outside; ++axis)
+      {
+        int below = 0;
+        int above = 0;
+        for (const ClipVertex &vertex : triangle)
+        {
+          below += vertex.clip[axis] < -vertex.clip.w();
+          above += vertex.clip[axis] > vertex.clip.w();
+        }
+        outside = below == 3 || above == 3;
+        behind = below; // z, in the last round
+      }
+      if (outside)
+      {
+        continue;
+      }
+      if (behind == 0)
+      {
+        output(triangle[0], triangle[1], triangle[2]);
+        continue;
+      }
+      ClipVertex polygon[4];
+      int count = clipNear(triangle, polygon);
+      for (int k = 1; k + 1 < count; ++k)
+      {
+        output(polygon[0], polygon[k], polygon[k + 1]);
+      }
+    }
+  });
+
+  rasters.clear();
+  shading.clear();
+  for (int chunk = 0; chunk < chunks; ++chunk)
+  {
+    rasters += chunkRasters[chunk];
+    shading += chunkShading[chunk];
+  }
+}
+
+/**
+ * @brief ReferenceRenderer::renderShadows Rasterizes the depth of the casters
+ * (everything but the water) into every cascade, with the depth clamp, the
+ * back face culling and the polygon offset of ShadowMaps.
+ */
+void ReferenceRenderer::renderShadows(JobSystem &jobs, const Shadows &shadows)
+{
+  shadowMaps.resize(shadows.cascades);
+  if (shadows.cascades == 0)
+  {
+    return;
+  }
+
+  QVector<int> counts(instances.size());
+  for (int i = 0; i < instances.size(); ++i)
+  {
+    counts[i] = instances[i].water ? 0 : meshes[instances[i].mesh].indices.size() / 3;
+  }
+  int chunks = jobs.threadCount() * 4;
+
+  // Shadow map coordinates back to clip space
+  QMatrix4x4 toClip;
+  toClip.translate(-1.0F, -1.0F, -1.0F);
+  toClip.scale(2.0F);
+
+  for (int cascade = 0; cascade < shadows.cascades; ++cascade)
+  {
+    QMatrix4x4 lightViewProjection = toClip * shadows.textureMatrix[cascade];
+    std::vector<QVector<Raster>> chunkRasters(chunks);
+    forEachRun(jobs, counts, chunks, [&](int chunk, int instance, int first, int end)
+    {
+      const Mesh &mesh = meshes[instances[instance].mesh];
+      QMatrix4x4 modelViewProjection = lightViewProjection * instances[instance].transform;
+      for (int t = first; t < end; ++t)
+      {
+        QVector4D clip[3];
+        for (int k = 0; k < 3; ++k)
+        {
+          clip[k] = modelViewProjection * QVector4D(mesh.positions[mesh.indices[3 * t + k]], 1.0F);
+        }
+        Raster raster;
+        if (!setupRaster(raster, clip, shadows.size, shadows.size))
+        {
+          continue;
+        }
+        // glPolygonOffset(2, 4): twice the depth slope per texel plus four
+        // steps of the 24 bit depth buffer
+        float a[3], b[3];
+        float area = 0.0F;
+        for (int i = 0; i < 3; ++i)
+        {
+          int j = (i + 1) % 3;
+          a[i] = raster.y[i] - raster.y[j];
+          b[i] = raster.x[j] - raster.x[i];
+          area -= a[i] * raster.x[i] + b[i] * raster.y[i];
+        }
+        float dzdx = (a[1] * raster.z[0] + a[2] * raster.z[1] + a[0] * raster.z[2]) / area;
+        float dzdy = (b[1] * raster.z[0] + b[2] * raster.z[1] + b[0] * raster.z[2]) / area;
+        float offset = 2.0F * std::max(std::abs(dzdx), std::abs(dzdy)) + 4.0F / 16777216.0F;
+        for (float &z : raster.z)
+        {
+          z += offset;
+        }
+        chunkRasters[chunk].append(raster);
+      }
+    });
+
+    QVector<Raster> casters;
+    for (const QVector<Raster> &chunk : chunkRasters)
+    {
+      casters += chunk;
+    }
+    allocate(shadowMaps[cascade], shadows.size, shadows.size, shadowTileSize, false);
+    rasterize(jobs, casters, shadowMaps[cascade], shadowTileSize, true);
+  }
+}
+
+/**
+ * @brief ReferenceRenderer::rasterize Bins the triangles into tiles, in chunks
+ * on all threads, and rasterizes the tiles in parallel. Each tile clears its
+ * pixels and then draws the triangles of every chunk in turn, i.e. in the
+ * order they were given, so it only writes its own pixels.
+ */
+void ReferenceRenderer::rasterize(JobSystem &jobs, const QVector<Raster> &triangles,
+                                  Target &target, int tile, bool clampDepth) const
+{
+  int tilesX = target.stride / tile;
+  int tilesY = target.rows / tile;
+  int tiles = tilesX * tilesY;
+  int chunks = std::max(1, std::min(jobs.threadCount() * 4, int(triangles.size() / 256)));
+  std::vector<std::vector<int>> bins(size_t(chunks) * tiles);
+
+  jobs.parallelFor(0, chunks, [&](int begin, int end)
+  {
+    for (int chunk = begin; chunk < end; ++chunk)
+    {
+      int first = int(qint64(triangles.size()) * chunk / chunks);
+      int last = int(qint64(triangles.size()) * (chunk + 1) / chunks);
+      std::vector<int> *chunkBins = bins.data() + size_t(chunk) * tiles;
+      for (int t = first; t < last; ++t)
+      {
+        const Raster &triangle = triangles[t];
+        for (int ty = triangle.minY / tile; ty <= triangle.maxY / tile; ++ty)
+        {
+          for (int tx = triangle.minX / tile; tx <= triangle.maxX / tile; ++tx)
+          {
+            chunkBins[ty * tilesX + tx].push_back(t);
+          }
+        }
+      }
+    }
+  }, 1);
+
+  jobs.parallelFor(0, tiles, [&](int begin, int end)
+  {
+    for (int index = begin; index < end; ++index)
+    {
+      int x0 = index % tilesX * tile;
+      int y0 = index / tilesX * tile;
+      int x1 = x0 + tile - 1;
+      int y1 = y0 + tile - 1;
+      for (int y = y0; y <= y1; ++y)
+      {
+        std::fill_n(target.depth.data() + y * target.stride + x0, tile, 1.0F);
+        if (!target.ids.isEmpty())
+        {
+          std::fill_n(target.ids.data() + y * target.stride + x0, tile, -1);
+        }
+      }
+
+      for (int chunk = 0; chunk < chunks; ++chunk)
+      {
+        for (int t : bins[size_t(chunk) * tiles + index])
+        {
+          const Raster &triangle = triangles[t];
+          rasterizeTriangle(triangle, t, target, std::max(triangle.minX, x0),
+                            std::max(triangle.minY, y0), std::min(triangle.maxX, x1),
+                            std::min(triangle.maxY, y1), clampDepth);
+        }
+      }
+    }
+  }, 1);
+}
+
+/**
+ * @brief ReferenceRenderer::rasterizeTriangle Depth tests (GL_LEQUAL) the
+ * pixels of a rectangle whose centers the triangle covers, keeping its depth
+ * and index where it passes. The rectangle is widened to whole blocks, which
+ * stay inside the tile.
+ */
+void ReferenceRenderer::rasterizeTriangle(const Raster &triangle, int index, Target &target,
+                                          int minX, int minY, int maxX, int maxY,
+                                          bool clampDepth)
+{
+  // Depth clamp keeps what lies outside the depth range; otherwise it is
+  // clipped, which the depth test against the cleared 1 does at the far plane
+  float low = clampDepth ? 0.0F : -INFINITY;
+  float high = clampDepth ? 1.0F : INFINITY;
+  float *depth = target.depth.data();
+  int stride = target.stride;
+  if (target.ids.isEmpty())
+  {
+    Rasterizer::rasterize(triangle, minX, minY, maxX, maxY,
+                          [=](int x, int y, float z, bool covered)
+                          {
+                            float &pixel = depth[y * stride + x];
+                            z = std::min(std::max(z, low), high);
+                            pixel = covered && z <= pixel ? z : pixel;
+                          });
+    return;
+  }
+  int *ids = target.ids.data();
+  Rasterizer::rasterize(triangle, minX, minY, maxX, maxY,
+                        [=](int x, int y, float z, bool covered)
+                        {
+                          float &pixel = depth[y * stride + x];
+                          int &id = ids[y * stride + x];
+                          z = std::min(std::max(z, low), high);
+                          bool passed = covered && z <= pixel;
+                          pixel = passed ? z : pixel;
+                          id = passed ? index : id;
+                        });
+}
+
+/**
+ * @brief ReferenceRenderer::sample Bilinear filtering with repeat wrapping,
+ * like the texture arrays without mipmaps.
+ */
+QVector4D ReferenceRenderer::sample(const Texture &texture, const QVector2D &uv)
+{
+  float u = uv.x() * texture.width - 0.5F;
+  float v = uv.y() * texture.height - 0.5F;
+  float fu = std::floor(u);
+  float fv = std::floor(v);
+  float s = u - fu;
+  float t = v - fv;
+  auto wrap = [](int i, int size) { return ((i % size) + size) % size; };
+  int x0 = wrap(int(fu), texture.width);
+  int x1 = wrap(int(fu) + 1, texture.width);
+  int y0 = wrap(int(fv), texture.height);
+  int y1 = wrap(int(fv) + 1, texture.height);
+
+  auto texel = [&](int x, int y)
+  {
+    const quint8 *p = texture.texels.constData() + (y * texture.width + x) * 4;
+    return QVector4D(p[0], p[1], p[2], p[3]) / 255.0F;
+  };
+  return (texel(x0, y0) * (1.0F - s) + texel(x1, y0) * s) * (1.0F - t) +
+         (texel(x0, y1) * (1.0F - s) + texel(x1, y1) * s) * t;
+}
+
+/**
+ * @brief ReferenceRenderer::resolveGBuffer Runs g_buffer_frag for the triangle
+ * visible in every pixel.
+ */
+void ReferenceRenderer::resolveGBuffer(JobSystem &jobs)
+{
+  int size = frameWidth * frameHeight;
+  gPosition.resize(size);
+  gNormal.resize(size);
+  gAlbedoSpec.resize(size);
+  gEmission.resize(size);
+  gReflective.resize(size);
+
+  jobs.parallelFor(0, frameHeight, [&](int begin, int end)
+  {
+    for (int y = begin; y < end; ++y)
+    {
+      for (int x = 0; x < frameWidth; ++x)
+      {
+        int pixel = y * frameWidth + x;
+        int id = frame.ids[y * frame.stride + x];
+        if (id < 0)
+        {
+          // Cleared to 0, like the GL targets
+          gPosition[pixel] = QVector3D();
+          gNormal[pixel] = QVector3D();
+          gAlbedoSpec[pixel] = QVector4D();
+          gEmission[pixel] = QVector3D();
+          gReflective[pixel] = 0;
+          continue;
+        }
+
+        // Perspective correct barycentric coordinates at the pixel center
+        const Raster &raster = rasters[id];
+        const Shading &triangle = shading[id];
+        float px = x + 0.5F;
+        float py = y + 0.5F;
+        float edge[3];
+        for (int i = 0; i < 3; ++i)
+        {
+          int j = (i + 1) % 3;
+          edge[i] = (raster.y[i] - raster.y[j]) * (px - raster.x[i]) +
+                    (raster.x[j] - raster.x[i]) * (py - raster.y[i]);
+        }
+        float weights[3] = {edge[1] * triangle.invW[0], edge[2] * triangle.invW[1],
+                            edge[0] * triangle.invW[2]};
+        float sum = weights[0] + weights[1] + weights[2];
+        float attributes[attributeCount];
+        for (int c = 0; c < attributeCount; ++c)
+        {
+          attributes[c] = (weights[0] * triangle.attributes[0][c] +
+                           weights[1] * triangle.attributes[1][c] +
+                           weights[2] * triangle.attributes[2][c]) / sum;
+        }
+
+        const Instance &instance = instances[triangle.instance];
+        QVector3D position(attributes[positionAttribute], attributes[positionAttribute + 1],
+                           attributes[positionAttribute + 2]);
+        QVector3D normal = QVector3D(attributes[normalAttribute], attributes[normalAttribute + 1],
+                                     attributes[normalAttribute + 2]).normalized();
+        QVector2D uv(attributes[uvAttribute], attributes[uvAttribute + 1]);
+
+        if (instance.normal >= 0)
+        {
+          // Tangent space to view space, re-orthogonalized after interpolation
+          QVector3D tangent(attributes[tangentAttribute], attributes[tangentAttribute + 1],
+                            attributes[tangentAttribute + 2]);
+          QVector3D T =
+              (tangent - normal * QVector3D::dotProduct(normal, tangent)).normalized();
+          QVector3D B = attributes[tangentAttribute + 3] * QVector3D::crossProduct(normal, T);
+          QVector3D mapped =
+              sample(textures[instance.normal], uv).toVector3D() * 2.0F - QVector3D(1, 1, 1);
+          normal = (T * mapped.x() + B * mapped.y() + normal * mapped.z()).normalized();
+        }
+
+        // Vertex colors: the water's in watervert, gray for the random ones
+        QVector3D albedo = instance.water ? QVector3D(0.0F, 0.3F, 0.5F) * 0.3F
+                                          : QVector3D(0.5F, 0.5F, 0.5F);
+        if (instance.diffuse >= 0)
+        {
+          albedo = sample(textures[instance.diffuse], uv).toVector3D();
+        }
+        QVector3D emission;
+        if (instance.emission >= 0)
+        {
+          emission = sample(textures[instance.emission], uv).toVector3D();
+        }
+        float reflectiveness = instance.water ? 0.45F : 0.0F;
+        if (instance.specular >= 0)
+        {
+          reflectiveness = sample(textures[instance.specular], uv).x();
+        }
+
+        gPosition[pixel] = position;
+        gNormal[pixel] = normal;
+        gAlbedoSpec[pixel] = QVector4D(unorm8(albedo.x()), unorm8(albedo.y()),
+                                       unorm8(albedo.z()), unorm8(reflectiveness));
+        gEmission[pixel] = emission;
+        // The stencil bit of reflective actors, minus what the gloss mask
+        // clears
+        gReflective[pixel] = instance.reflective && gAlbedoSpec[pixel].w() >= 0.01F;
+      }
+    }
+  }, 4);
+}
+
+/**
+ * @brief ReferenceRenderer::shadow The shadow function of lighting_frag.
+ */
+float ReferenceRenderer::shadow(const Shadows &shadows, const QMatrix4x4 *matrices,
+                                const QVector3D &position, const QVector3D &normal) const
+{
+  int cascade = 0;
+  while (cascade < shadows.cascades && -position.z() > shadows.split[cascade])
+  {
+    cascade++;
+  }
+  if (cascade == shadows.cascades)
+  {
+    return 1.0F;
+  }
+
+  QVector3D offset = normal * shadows.texel[cascade] * 1.5F;
+  QVector4D coords = matrices[cascade] * QVector4D(position + offset, 1.0F);
+  float depth = std::min(coords.z(), 1.0F);
+
+  // Every tap compares 2x2 texels and filters the results bilinearly; the
+  // border reads as the far plane
+  const Target &map = shadowMaps[cascade];
+  int size = shadows.size;
+  auto lit = [&](int x, int y)
+  {
+    float stored = x < 0 || y < 0 || x >= size || y >= size ? 1.0F
+                                                            : map.depth[y * map.stride + x];
+    return depth <= stored ? 1.0F : 0.0F;
+  };
+  float texel = 1.0F / size;
+  float sum = 0.0F;
+  for (int y = -1; y <= 1; ++y)
+  {
+    for (int x = -1; x <= 1; ++x)
+    {
+      float u = (coords.x() + x * texel) * size - 0.5F;
+      float v = (coords.y() + y * texel) * size - 0.5F;
+      float fu = std::floor(u);
+      float fv = std::floor(v);
+      float s = u - fu;
+      float t = v - fv;
+      int x0 = int(fu);
+      int y0 = int(fv);
+      sum += (lit(x0, y0) * (1.0F - s) + lit(x0 + 1, y0) * s) * (1.0F - t) +
+             (lit(x0, y0 + 1) * (1.0F - s) + lit(x0 + 1, y0 + 1) * s) * t;
+    }
+  }
+  return sum / 9.0F;
+}
+
+/**
+ * @brief ReferenceRenderer::raycast ssrRaycast of ssr_frag, without the
+ * history (rays start at the origin) and reading the G-buffer like its
+ * nearest filtered targets. The clip position of the ray is linear in its
+ * length, so it is stepped instead of projected every step.
+ */
+QVector4D ReferenceRenderer::raycast(const QMatrix4x4 &projection, const QVector3D &origin,
+                                     const QVector3D &direction) const
+{
+  const int maxSteps = 1000;
+  const float stepSize = 0.1F;
+
+  if (direction.z() > 0.0F)
+  {
+    return QVector4D();
+  }
+
+  // stepsOnScreen
+  float rayEnd = float(maxSteps) * stepSize;
+  QVector4D a = projection * QVector4D(origin, 1.0F);
+  QVector4D b = projection * QVector4D(origin + rayEnd * direction, 1.0F);
+  QVector2D screenA(a.x() / a.w(), a.y() / a.w());
+  QVector2D screenB(b.x() / b.w(), b.y() / b.w());
+  QVector2D delta = screenB - screenA;
+  float exits[2];
+  for (int c = 0; c < 2; ++c)
+  {
+    float d = std::abs(delta[c]) < 1e-6F ? 1e-6F : delta[c];
+    float border = d >= 0.0F ? 1.0F : -1.0F;
+    exits[c] = (border - screenA[c]) / d;
+  }
+  float s = std::clamp(std::min(exits[0], exits[1]), 0.0F, 1.0F);
+  float u = s * a.w() / (b.w() * (1.0F - s) + a.w() * s);
+  float steps = std::min(u * rayEnd / stepSize, float(maxSteps));
+  if (!(steps >= 2.0F))
+  {
+    return QVector4D();
+  }
+
+  QVector4D step = projection * QVector4D(direction, 0.0F);
+  float rayLength = 0.0F;
+  for (int i = 0; i < int(steps) + 1; i++)
+  {
+    rayLength += stepSize;
+    QVector4D clip = a + rayLength * step;
+    float sx = clip.x() / clip.w() * 0.5F + 0.5F;
+    float sy = clip.y() / clip.w() * 0.5F + 0.5F;
+    if (!(sx >= 0.0F && sx <= 1.0F && sy >= 0.0F && sy <= 1.0F))
+    {
+      return QVector4D(); // Reflection ray left the screen
+    }
+
+    int x = std::min(int(sx * frameWidth), frameWidth - 1);
+    int y = std::min(int(sy * frameHeight), frameHeight - 1);
+    int pixel = y * frameWidth + x;
+    float sceneDepth = -gPosition[pixel].z();
+    float rayDepth = -(origin.z() + rayLength * direction.z());
+    const float bias = 1.0F;
+    if (rayDepth > sceneDepth + bias)
+    {
+      QVector3D reflected = gAlbedoSpec[pixel].toVector3D() * 0.1F + gEmission[pixel];
+      float border = std::min(std::min(sx, 1.0F - sx), std::min(sy, 1.0F - sy));
+      float fade = std::clamp(border * 10.0F, 0.0F, 1.0F);
+      return QVector4D(reflected, fade);
+    }
+  }
+  return QVector4D();
+}
+
+/**
+ * @brief ReferenceRenderer::shade Runs lighting_frag for every pixel and blends
+ * the reflections of ssr_frag over the reflective ones.
+ */
+void ReferenceRenderer::shade(JobSystem &jobs, const Camera &camera, const Shadows &shadows)
+{
+  pixels.resize(frameWidth * frameHeight);
+
+  // The cascades map world space, the G-buffer holds view space positions
+  QMatrix4x4 viewToWorld = camera.view.inverted();
+  QMatrix4x4 matrices[maxCascades];
+  for (int i = 0; i < shadows.cascades; ++i)
+  {
+    matrices[i] = shadows.textureMatrix[i] * viewToWorld;
+  }
+  QVector3D L = (-lightDirection).normalized();
+  std::atomic<int> reflected{0};
+
+  jobs.parallelFor(0, frameHeight, [&](int begin, int end)
+  {
+    int rays = 0;
+    for (int y = begin; y < end; ++y)
+    {
+      for (int x = 0; x < frameWidth; ++x)
+      {
+        int pixel = y * frameWidth + x;
+        const QVector3D &position = gPosition[pixel];
+        QVector3D normal = gNormal[pixel].normalized();
+        QVector3D albedo = gAlbedoSpec[pixel].toVector3D();
+
+        QVector3D diffuseLight =
+            std::max(QVector3D::dotProduct(normal, -lightDirection), 0.0F) * lightColor;
+        QVector3D V = (-position).normalized();
+        QVector3D R = reflect(-L, normal);
+        float spec = std::pow(std::max(QVector3D::dotProduct(R, V), 0.0F), 32.0F);
+        float lit = shadows.cascades > 0 ? shadow(shadows, matrices, position, normal) : 1.0F;
+        QVector3D color = (QVector3D(0.1F, 0.1F, 0.1F) +
+                           lit * (diffuseLight + QVector3D(spec, spec, spec))) * albedo +
+                          gEmission[pixel];
+
+        if (gReflective[pixel])
+        {
+          QVector3D direction = reflect(-V, gNormal[pixel]).normalized();
+          QVector4D ssr = raycast(camera.projection, position, direction);
+          float alpha = gAlbedoSpec[pixel].w() * ssr.w();
+          color = color * (1.0F - alpha) + ssr.toVector3D() * alpha;
+          rays++;
+        }
+        pixels[pixel] = color;
+      }
+    }
+    reflected += rays;
+  }, 4);
+  reflectedPixels = reflected;
+}
+
+ReferenceRenderer::Difference ReferenceRenderer::compare(const QVector<QVector3D> &a,
+                                                         const QVector<QVector3D> &b,
+                                                         float tolerance)
+{
+  Difference difference;
+  difference.pixels = std::min(a.size(), b.size());
+  double sum = 0.0;
+  for (int i = 0; i < difference.pixels; ++i)
+  {
+    float pixelError = 0.0F;
+    for (int c = 0; c < 3; ++c)
+    {
+      float error = std::abs(std::clamp(a[i][c], 0.0F, 1.0F) - std::clamp(b[i][c], 0.0F, 1.0F));
+      sum += double(error) * error;
+      pixelError = std::max(pixelError, error);
+    }
+    difference.maxError = std::max(difference.maxError, pixelError);
+    difference.differing += pixelError > tolerance;
+  }
+  difference.rmse = std::sqrt(sum / std::max(1, 3 * difference.pixels));
+  difference.psnr = difference.rmse > 0.0 ? 20.0 * std::log10(1.0 / difference.rmse) : INFINITY;
+  return difference;
+}
+
+QImage ReferenceRenderer::toImage(const QVector<QVector3D> &image, int width, int height)
+{
+  QImage result(width, height, QImage::Format_RGB888);
+  for (int y = 0; y < height; ++y)
+  {
+    uchar *line = result.scanLine(height - 1 - y);
+    for (int x = 0; x < width; ++x)
+    {
+      for (int c = 0; c < 3; ++c)
+      {
+        line[3 * x + c] = uchar(std::lround(std::clamp(image[y * width + x][c], 0.0F, 1.0F) * 255.0F));
+      }
+    }
+  }
+  return result;
+}
+
+QImage ReferenceRenderer::differenceImage(const QVector<QVector3D> &a,
+                                          const QVector<QVector3D> &b, int width, int height,
+                                          float scale)
+{
+  QVector<QVector3D> difference(width * height);
+  for (int i = 0; i < difference.size(); ++i)
+  {
+    for (int c = 0; c < 3; ++c)
+    {
+      difference[i][c] =
+          std::abs(std::clamp(a[i][c], 0.0F, 1.0F) - std::clamp(b[i][c], 0.0F, 1.0F)) * scale;
+    }
+  }
+  return toImage(difference, width, height);
+}
+
+void ReferenceRenderer::report() const
+{
+  qDebug().noquote() << QString("Reference render %1x%2: transform %3 ms, shadows %4 ms, raster "
+                                "%5 ms (%6 triangles), G-buffer %7 ms, lighting and SSR %8 ms "
+                                "(%9 reflective pixels)")
+                            .arg(frameWidth)
+                            .arg(frameHeight)
+                            .arg(transformTime, 0, 'f', 1)
+                            .arg(shadowTime, 0, 'f', 1)
+                            .arg(rasterTime, 0, 'f', 1)
+                            .arg(rasters.size())
+                            .arg(gBufferTime, 0, 'f', 1)
+                            .arg(shadeTime, 0, 'f', 1)
+                            .arg(reflectedPixels);
+}
+
+void ReferenceRenderer::benchmark(const Camera &camera, const Shadows &shadows)
+{
+  const int repeats = 3;
+
+  qDebug() << ":: Reference renderer benchmark," << camera.width << "x" << camera.height << ","
+           << instances.size() << "actors," << shadows.cascades << "shadow cascades";
+
+  int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  double singleThreaded = 0.0;
+  for (int threads = 1;; threads = std::min(threads * 2, maxThreads))
+  {
+    JobSystem jobs(threads - 1);
+    render(jobs, camera, shadows); // warm up
+
+    float stages[5] = {};
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < repeats; ++i)
+    {
+      render(jobs, camera, shadows);
+      float times[5] = {transformTime, shadowTime, rasterTime, gBufferTime, shadeTime};
+      for (int s = 0; s < 5; ++s)
+      {
+        stages[s] += times[s] / repeats;
+      }
+    }
+    double ms = timer.nsecsElapsed() / 1.0e6 / repeats;
+    if (threads == 1)
+    {
+      singleThreaded = ms;
+    }
+
+    qDebug().noquote()
+        << QString("  %1 threads: %2 ms (%3x), %4 Mpixels/s | transform %5, shadows %6, raster "
+                   "%7, G-buffer %8, lighting and SSR %9 ms")
+               .arg(threads, 2)
+               .arg(ms, 0, 'f', 1)
+               .arg(singleThreaded / ms, 0, 'f', 2)
+               .arg(camera.width * camera.height / (ms * 1000.0), 0, 'f', 2)
+               .arg(stages[0], 0, 'f', 1)
+               .arg(stages[1], 0, 'f', 1)
+               .arg(stages[2], 0, 'f', 1)
+               .arg(stages[3], 0, 'f', 1)
+               .arg(stages[4], 0, 'f', 1);
+    if (threads == maxThreads)
+    {
+      break;
+    }
+  }
+}
@@ -0,0 +1,269 @@
+#ifndef REFERENCERENDERER_H
+#define REFERENCERENDERER_H
+
+#include <QImage>
+#include <QMatrix4x4>
+#include <QString>
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector4D>
+#include <QVector>
+
+#include "jobsystem.h"
+#include "rasterizer.h"
+#include "scenedescription.h"
+#include "shadowcascades.h"
+
+class WaveModel;
+
+/**
+ * @brief The ReferenceRenderer class renders the lit image of a scene on the
+ * CPU, as ground truth for the GL path. It needs no GL context: meshes come
+ * from the .obj files and the material maps from the images of a
+ * SceneDescription, scaled like TextureArrays does.
+ *
+ * A frame goes through the stages of the GL pipeline, each spread over the
+ * job system:
+ * - The vertices are transformed and the triangles clipped at the near plane
+ *   and back face culled, in chunks.
+ * - Every chunk bins its triangles into screen tiles. The tiles are then
+ *   rasterized in parallel into a depth and triangle index buffer, evaluating
+ *   the edge functions for a fixed-size block of pixels at once, which the
+ *   compiler vectorizes. Chunks are visited in order, so ties resolve the same
+ *   way every run.
+ * - Every pixel interpolates the attributes of its triangle (perspective
+ *   correct) and samples the material, filling a G-buffer like g_buffer_frag.
+ * - The lighting, the cascaded shadow lookups and the screen space
+ *   reflections port lighting_frag and ssr_frag line by line.
+ *
+ * The shadow cascades are fitted by ShadowCascades like the GL path does, and
+ * their depth is rasterized here the same way. Not covered: the reflection
+ * probe, the wave textures of the texture and FFT wave modes (the water uses
+ * the analytic waves, as in the per vertex mode), the random vertex colors of
+ * meshes without a diffuse map (gray here), levels of detail (always full
+ * detail) and temporal anti-aliasing. The result matches a GL frame without
+ * TAA, before bloom.
+ */
+class ReferenceRenderer
+{
+public:
+  static const int maxCascades = ShadowCascades::maxCascades;
+
+  struct Camera
+  {
+    QMatrix4x4 view;
+    QMatrix4x4 projection;
+    int width = 0;
+    int height = 0;
+  };
+
+  /**
+   * @brief The shadow cascades to render and look up, as the lighting pass
+   * gets them. No cascades renders without shadows.
+   */
+  struct Shadows
+  {
+    int cascades = 0;
+    int size = 0;                            // texels per cascade side
+    QMatrix4x4 textureMatrix[maxCascades];   // world to shadow map coordinates
+    float split[maxCascades] = {};           // view space distance of the end
+    float texel[maxCascades] = {};           // world size of a texel
+  };
+
+  /**
+   * @brief How far two images are apart, after clamping both to [0, 1].
+   */
+  struct Difference
+  {
+    double rmse = 0.0;
+    double psnr = 0.0; // dB, infinite for equal images
+    float maxError = 0.0F;
+    int differing = 0; // pixels with a channel off by more than the tolerance
+    int pixels = 0;
+  };
+
+  ReferenceRenderer() = default;
+
+  /**
+   * @brief Loads the meshes and material maps of a scene, replacing the
+   * previous one. The transforms are taken as world space, parents are not
+   * resolved. No GL.
+   * @return Whether any actor could be loaded.
+   */
+  bool load(const SceneDescription &scene);
+
+  /**
+   * @brief Fits the shadow cascades to a view like ShadowMaps does, with the
+   * depth range of the loaded static casters. No cascades if the settings
+   * disable shadows.
+   */
+  Shadows fitShadows(const ShadowDescription &settings, const Camera &camera) const;
+
+  /**
+   * @brief Displaces the water by these waves at this time, or not at all for
+   * a null model.
+   */
+  void setWaves(const WaveModel *model, float time);
+
+  /**
+   * @brief Renders the lit image, including the reflections.
+   */
+  void render(JobSystem &jobs, const Camera &camera, const Shadows &shadows);
+
+  // Linear color of the last render, bottom row first like GL
+  const QVector<QVector3D> &color() const { return pixels; }
+  int width() const { return frameWidth; }
+  int height() const { return frameHeight; }
+
+  static Difference compare(const QVector<QVector3D> &a, const QVector<QVector3D> &b,
+                            float tolerance);
+
+  /**
+   * @brief Converts a bottom-up linear image to an upright 8 bit one, clamped.
+   */
+  static QImage toImage(const QVector<QVector3D> &image, int width, int height);
+
+  /**
+   * @brief The absolute difference of two images, amplified by scale.
+   */
+  static QImage differenceImage(const QVector<QVector3D> &a, const QVector<QVector3D> &b,
+                                int width, int height, float scale);
+
+  /**
+   * @brief Logs the time of every stage of the last render.
+   */
+  void report() const;
+
+  /**
+   * @brief Renders the loaded scene for 1 to all threads and logs the time
+   * and the speedup of every stage.
+   */
+  void benchmark(const Camera &camera, const Shadows &shadows);
+
+private:
+  // Interpolated per vertex: view space position, normal and tangent (w:
+  // handedness) and the texture coordinates
+  static const int attributeCount = 12;
+  static const int positionAttribute = 0;
+  static const int normalAttribute = 3;
+  static const int uvAttribute = 6;
+  static const int tangentAttribute = 8;
+
+  // Pixels evaluated together by the inner loop
+  static const int blockSize = Rasterizer::blockSize;
+  // Pixels rasterized by one job, a multiple of blockSize
+  static const int tileSize = 32;
+  static const int shadowTileSize = 64;
+
+  struct Mesh
+  {
+    QVector<QVector3D> positions;
+    QVector<QVector3D> normals;
+    QVector<QVector2D> uvs;
+    QVector<QVector4D> tangents;
+    QVector<quint32> indices;
+  };
+
+  struct Texture
+  {
+    int width = 0;
+    int height = 0;
+    QVector<quint8> texels; // RGBA, bottom row first
+  };
+
+  struct Instance
+  {
+    int mesh = -1;
+    QMatrix4x4 transform;
+    int diffuse = -1; // textures, -1 for none
+    int emission = -1;
+    int normal = -1;
+    int specular = -1;
+    bool water = false;
+    bool reflective = false;
+  };
+
+  struct ClipVertex
+  {
+    QVector4D clip;
+    float attributes[attributeCount];
+  };
+
+  // Window coordinates of a triangle, counterclockwise
+  using Raster = Rasterizer::Triangle;
+
+  struct Shading
+  {
+    float invW[3];
+    float attributes[3][attributeCount];
+    int instance;
+  };
+
+  // A depth buffer, optionally with the triangle covering each pixel. Rows
+  // are padded to whole tiles.
+  struct Target
+  {
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+    int rows = 0;
+    QVector<float> depth;
+    QVector<int> ids;
+  };
+
+  static QVector4D sample(const Texture &texture, const QVector2D &uv);
+  static int clipNear(const ClipVertex *triangle, ClipVertex *polygon);
+  static bool setupRaster(Raster &raster, const QVector4D *clip, int width, int height);
+  static void allocate(Target &target, int width, int height, int tile, bool withIds);
+
+  void transform(JobSystem &jobs, const Camera &camera);
+  void setupTriangles(JobSystem &jobs, int width, int height);
+  void renderShadows(JobSystem &jobs, const Shadows &shadows);
+  void rasterize(JobSystem &jobs, const QVector<Raster> &triangles, Target &target,
+                 int tile, bool clampDepth) const;
+  static void rasterizeTriangle(const Raster &triangle, int index, Target &target, int minX,
+                                int minY, int maxX, int maxY, bool clampDepth);
+  void resolveGBuffer(JobSystem &jobs);
+  void shade(JobSystem &jobs, const Camera &camera, const Shadows &shadows);
+  float shadow(const Shadows &shadows, const QMatrix4x4 *matrices, const QVector3D &position,
+               const QVector3D &normal) const;
+  QVector4D raycast(const QMatrix4x4 &projection, const QVector3D &origin,
+                    const QVector3D &direction) const;
+
+  QVector<Mesh> meshes;
+  QVector<Texture> textures;
+  QVector<Instance> instances;
+  QVector3D lightDirection;
+  QVector3D lightColor;
+  QVector3D casterMin; // world space bounds of the static casters
+  QVector3D casterMax;
+  const WaveModel *waves = nullptr;
+  float waveTime = 0.0F;
+
+  // Per frame
+  QVector<ClipVertex> vertices;
+  QVector<int> firstVertex; // per instance, into vertices
+  QVector<Raster> rasters;
+  QVector<Shading> shading;
+  Target frame;
+  QVector<Target> shadowMaps;
+
+  int frameWidth = 0;
+  int frameHeight = 0;
+  QVector<QVector3D> gPosition;
+  QVector<QVector3D> gNormal;
+  QVector<QVector4D> gAlbedoSpec; // 8 bit, like the GL target
+  QVector<QVector3D> gEmission;
+  QVector<quint8> gReflective; // the stencil bit of the GL path
+  QVector<QVector3D> pixels;
+
+  // Milliseconds of the stages of the last render
+  float transformTime = 0.0F;
+  float shadowTime = 0.0F;
+  float rasterTime = 0.0F;
+  float gBufferTime = 0.0F;
+  float shadeTime = 0.0F;
+  int reflectedPixels = 0;
+};
+
+#endif // REFERENCERENDERER_H
@@ -0,0 +1,131 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QMatrix4x4>
+
+#include <cmath>
+
+#include "jobsystem.h"
+#include "referencerenderer.h"
+#include "scenedescription.h"
+#include "scenegraph.h"
+#include "waves.h"
+
+namespace
+{
+  /**
+   * @brief parseVector Reads "x,y,z" into a vector.
+   * @return Whether the text held three numbers.
+   */
+  bool parseVector(const QString &text, QVector3D &vector)
+  {
+    QStringList parts = text.split(',');
+    if (parts.size() != 3)
+    {
+      return false;
+    }
+    bool ok[3];
+    vector = QVector3D(parts[0].toFloat(&ok[0]), parts[1].toFloat(&ok[1]),
+                       parts[2].toFloat(&ok[2]));
+    return ok[0] && ok[1] && ok[2];
+  }
+} // namespace
+
+/**
+ * @brief main Renders a still of a scene with the CPU reference renderer and
+ * writes it as a PNG. Needs neither a GPU nor a display, so stills can be
+ * rendered on servers. The camera looks down -z from the origin by default,
+ * with the projection of the GL view; the water uses the analytic waves at the
+ * given time, like the per vertex wave mode.
+ */
+int main(int argc, char *argv[])
+{
+  QCoreApplication application(argc, argv);
+  QCoreApplication::setApplicationName("ReferenceTool");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Renders a scene on the CPU and writes a PNG.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("scene", "Scene file, default :/scenes/harbor.json.");
+  parser.addPositionalArgument("output", "PNG to write, default reference.png.");
+  QCommandLineOption sizeOption("size", "Image size, default 1280x720.", "WxH", "1280x720");
+  QCommandLineOption eyeOption("eye", "Camera position, default 0,0,0.", "x,y,z", "0,0,0");
+  QCommandLineOption targetOption("target", "Point the camera looks at, default 0,0,-1.",
+                                  "x,y,z", "0,0,-1");
+  QCommandLineOption timeOption("time", "Seconds into the wave animation, default 0.",
+                                "seconds", "0");
+  parser.addOptions({sizeOption, eyeOption, targetOption, timeOption});
+  parser.process(application);
+
+  QStringList positional = parser.positionalArguments();
+  QString scenePath = positional.value(0, ":/scenes/harbor.json");
+  QString outputPath = positional.value(1, "reference.png");
+
+  QStringList size = parser.value(sizeOption).split('x');
+  int width = size.value(0).toInt();
+  int height = size.value(1).toInt();
+  QVector3D eye, target;
+  bool timeOk = false;
+  float time = parser.value(timeOption).toFloat(&timeOk);
+  if (size.size() != 2 || width <= 0 || height <= 0 ||
+      !parseVector(parser.value(eyeOption), eye) ||
+      !parseVector(parser.value(targetOption), target) || eye == target || !timeOk)
+  {
+    qWarning() << "ReferenceTool: invalid size, camera or time";
+    return 1;
+  }
+
+  SceneDescription scene;
+  QString error;
+  if (!scene.load(scenePath, &error))
+  {
+    qWarning() << "ReferenceTool: cannot load" << scenePath << ":" << error;
+    return 1;
+  }
+  // The renderer takes world transforms, placed like the GL view places them
+  SceneGraph graph;
+  graph.build(JobSystem::global(), scene.actors);
+  for (int i = 0; i < scene.actors.size(); ++i)
+  {
+    scene.actors[i].transform = graph.world(graph.nodeOfEntry(i));
+    scene.actors[i].parent.clear();
+  }
+
+  ReferenceRenderer renderer;
+  if (!renderer.load(scene))
+  {
+    qWarning() << "ReferenceTool: no actor of" << scenePath << "could be loaded";
+    return 1;
+  }
+
+  // The wave model of the GL view, whose wave vectors are snapped to its
+  // 16 unit wave texture tile
+  WaveModel waves;
+  waves.setTileSize(16.0F);
+  if (!scene.water.waves.isEmpty())
+  {
+    waves.setComponents(scene.water.waves);
+  }
+  waves.setDepth(scene.water.depth);
+  waves.setHeightScale(scene.water.heightScale);
+  renderer.setWaves(&waves, time);
+
+  ReferenceRenderer::Camera camera;
+  QVector3D forward = (target - eye).normalized();
+  camera.view.lookAt(eye, target, std::abs(forward.y()) > 0.99F ? QVector3D(0.0F, 0.0F, 1.0F)
+                                                                 : QVector3D(0.0F, 1.0F, 0.0F));
+  camera.projection.perspective(50.0F, float(width) / height, 0.2F, 1000.0F);
+  camera.width = width;
+  camera.height = height;
+
+  renderer.render(JobSystem::global(), camera, renderer.fitShadows(scene.shadows, camera));
+  renderer.report();
+
+  if (!ReferenceRenderer::toImage(renderer.color(), width, height).save(outputPath, "PNG"))
+  {
+    qWarning() << "ReferenceTool: cannot write" << outputPath;
+    return 1;
+  }
+  qDebug() << "ReferenceTool: wrote" << outputPath;
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include "reflectionprobe.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  // Viewing direction and up vector of each face, in the order of
+  // GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+  const QVector3D faceDirections[6][2] = {
+      {{1.0F, 0.0F, 0.0F}, {0.0F, -1.0F, 0.0F}},  {{-1.0F, 0.0F, 0.0F}, {0.0F, -1.0F, 0.0F}},
+      {{0.0F, 1.0F, 0.0F}, {0.0F, 0.0F, 1.0F}},   {{0.0F, -1.0F, 0.0F}, {0.0F, 0.0F, -1.0F}},
+      {{0.0F, 0.0F, 1.0F}, {0.0F, -1.0F, 0.0F}},  {{0.0F, 0.0F, -1.0F}, {0.0F, -1.0F, 0.0F}},
+  };
+} // namespace
+
+ReflectionProbe::~ReflectionProbe()
+{
+  destroy();
+}
+
+/**
+ * @brief ReflectionProbe::initialize Requires a current context. The textures
+ * are only created by the first capture.
+ */
+void ReflectionProbe::initialize()
+{
+  initializeOpenGLFunctions();
+  // Filtering across face edges, for the prefilter and the reflections
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+}
+
+void ReflectionProbe::destroy()
+{
+  if (framebuffer == 0)
+  {
+    return;
+  }
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteRenderbuffers(1, &depthBuffer);
+  GLuint textures[2] = {sceneTexture, filteredTexture};
+  glDeleteTextures(2, textures);
+  framebuffer = depthBuffer = sceneTexture = filteredTexture = 0;
+  size = levels = 0;
+}
+
+/**
+ * @brief ReflectionProbe::allocate Creates both cubemaps with a full mip chain
+ * and the depth buffer of the face renders.
+ */
+void ReflectionProbe::allocate(int newSize)
+{
+  destroy();
+  size = newSize;
+  levels = int(std::log2(float(size))) + 1;
+
+  glGenTextures(1, &sceneTexture);
+  glGenTextures(1, &filteredTexture);
+  for (GLuint texture : {sceneTexture, filteredTexture})
+  {
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    for (int level = 0; level < levels; ++level)
+    {
+      int levelSize = std::max(size >> level, 1);
+      for (int face = 0; face < 6; ++face)
+      {
+        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA16F, levelSize,
+                     levelSize, 0, GL_RGBA, GL_FLOAT, nullptr);
+      }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+  glGenRenderbuffers(1, &depthBuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  glGenFramebuffers(1, &framebuffer);
+}
+
+bool ReflectionProbe::needsCapture(const ProbeDescription &probe, float time) const
+{
+  if (!probe.enabled)
+  {
+    return false;
+  }
+  // The clock restarts when the frame mode changes
+  return !captured || size != probe.size ||
+         (probe.interval > 0.0F && (time - captureTime >= probe.interval || time < captureTime));
+}
+
+/**
+ * @brief ReflectionProbe::capture Renders the scene into the six faces with a
+ * 90 degree field of view, then writes every mip of the filtered cubemap from
+ * the matching mip of the captured one.
+ */
+void ReflectionProbe::capture(const ProbeDescription &probe, float time,
+                              const DrawScene &drawScene, QOpenGLShaderProgram &prefilter,
+                              const std::function<void()> &drawQuad, GLuint targetFramebuffer)
+{
+  int newSize = std::max(probe.size, 4);
+  if (newSize != size)
+  {
+    allocate(newSize);
+  }
+
+  QMatrix4x4 projection;
+  projection.perspective(90.0F, 1.0F, 0.2F, 1000.0F);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+  glViewport(0, 0, size, size);
+  glEnable(GL_DEPTH_TEST);
+
+  for (int face = 0; face < 6; ++face)
+  {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, sceneTexture, 0);
+    if (face == 0 && glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+      qWarning() << "Reflection probe FBO not complete!";
+      glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+      return;
+    }
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    QMatrix4x4 view;
+    view.lookAt(probe.position, probe.position + faceDirections[face][0],
+                faceDirections[face][1]);
+    drawScene(view, projection);
+  }
+
+  glBindTexture(GL_TEXTURE_CUBE_MAP, sceneTexture);
+  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+  // Prefilter: the cone covers about two texels of the level it is written to
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+  glDisable(GL_DEPTH_TEST);
+  glActiveTexture(GL_TEXTURE0);
+  prefilter.bind();
+  prefilter.setUniformValue("source", 0);
+  for (int level = 0; level < levels; ++level)
+  {
+    int levelSize = std::max(size >> level, 1);
+    float texelAngle = 1.5708F / levelSize;
+    glViewport(0, 0, levelSize, levelSize);
+    prefilter.setUniformValue("coneAngle", level == 0 ? 0.0F : std::min(2.0F * texelAngle, 1.2F));
+    prefilter.setUniformValue("sourceLod", float(level));
+    for (int face = 0; face < 6; ++face)
+    {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, filteredTexture, level);
+      prefilter.setUniformValue("face", face);
+      drawQuad();
+    }
+  }
+  prefilter.release();
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  glEnable(GL_DEPTH_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+
+  captured = true;
+  captureTime = time;
+}
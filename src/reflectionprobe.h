@@ -0,0 +1,76 @@
+#ifndef REFLECTIONPROBE_H
+#define REFLECTIONPROBE_H
+
+#include <QMatrix4x4>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+
+#include <functional>
+
+#include "scenedescription.h"
+
+/**
+ * @brief The ReflectionProbe class is a cubemap of the scene seen from one
+ * point. The screen space reflections fall back to it where a ray leaves the
+ * screen or hits nothing.
+ *
+ * A capture renders the six faces into an RGBA16F cubemap and builds its mip
+ * chain. That cubemap is then prefiltered into a second one, whose every mip
+ * averages a cone of directions around each texel, twice as wide per level.
+ * Sampling a higher level gives a blurrier reflection without aliasing.
+ * Captures happen when the scene changes and, if the scene asks for it,
+ * periodically.
+ */
+class ReflectionProbe : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  // Draws the scene for one face; the face's framebuffer is bound
+  using DrawScene = std::function<void(const QMatrix4x4 &view, const QMatrix4x4 &projection)>;
+
+  ReflectionProbe() = default;
+  ~ReflectionProbe();
+
+  void initialize();
+
+  /**
+   * @brief Forces a capture before the probe is used again, e.g. after the
+   * scene changed.
+   */
+  void invalidate() { captured = false; }
+
+  /**
+   * @brief Whether the probe has to be captured (again) at the given time.
+   */
+  bool needsCapture(const ProbeDescription &probe, float time) const;
+
+  /**
+   * @brief Renders the six faces and prefilters them. Changes the viewport.
+   * @param prefilter Program of probe_prefilter_frag.glsl.
+   * @param drawQuad Draws a full screen quad.
+   * @param targetFramebuffer Bound when done, e.g. the widget's
+   * defaultFramebufferObject(), which is not framebuffer 0.
+   */
+  void capture(const ProbeDescription &probe, float time, const DrawScene &drawScene,
+               QOpenGLShaderProgram &prefilter, const std::function<void()> &drawQuad,
+               GLuint targetFramebuffer);
+
+  bool isValid() const { return filteredTexture != 0 && captured; }
+  GLuint texture() const { return filteredTexture; }
+  int mipLevels() const { return levels; }
+
+private:
+  void allocate(int newSize);
+  void destroy();
+
+  int size = 0;
+  int levels = 0;
+  GLuint sceneTexture = 0;    // the captured faces, mipmapped
+  GLuint filteredTexture = 0; // prefiltered, sampled by the lighting pass
+  GLuint depthBuffer = 0;
+  GLuint framebuffer = 0;
+
+  bool captured = false;
+  float captureTime = 0.0F;
+};
+
+#endif // REFLECTIONPROBE_H
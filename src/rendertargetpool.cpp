@@ -0,0 +1,226 @@
+#include "rendertargetpool.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+namespace
+{
+  // Frames a released texture is kept around for reuse
+  const int maxIdleFrames = 120;
+
+  qint64 textureBytes(const TextureDesc &desc)
+  {
+    return RenderTargetPool::bytesPerPixel(desc.format) * desc.width * desc.height;
+  }
+} // namespace
+
+bool TextureDesc::operator==(const TextureDesc &other) const
+{
+  return format == other.format && width == other.width && height == other.height &&
+         filter == other.filter;
+}
+
+RenderTargetPool::~RenderTargetPool()
+{
+  if (!initialized)
+  {
+    return;
+  }
+
+  for (GLuint framebuffer : framebuffers)
+  {
+    glDeleteFramebuffers(1, &framebuffer);
+  }
+  for (const Texture &texture : textures)
+  {
+    glDeleteTextures(1, &texture.id);
+  }
+}
+
+/**
+ * @brief RenderTargetPool::initialize Resolves the GL functions. Requires a
+ * current context.
+ */
+void RenderTargetPool::initialize()
+{
+  initializeOpenGLFunctions();
+  initialized = true;
+}
+
+GLuint RenderTargetPool::acquire(const TextureDesc &desc)
+{
+  for (Texture &texture : textures)
+  {
+    if (!texture.used && texture.desc == desc)
+    {
+      texture.used = true;
+      texture.idleFrames = 0;
+      inUse += textureBytes(desc);
+      peakInUse = std::max(peakInUse, inUse);
+      return texture.id;
+    }
+  }
+
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+  // No data is uploaded, the format and type only have to be valid
+  GLenum format = isDepthFormat(desc.format) ? GL_DEPTH_COMPONENT : GL_RGBA;
+  GLenum type = GL_FLOAT;
+  if (hasStencil(desc.format))
+  {
+    format = GL_DEPTH_STENCIL;
+    type = GL_UNSIGNED_INT_24_8;
+  }
+  glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, format, type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  textures.append({id, desc, true, 0});
+  allocated += textureBytes(desc);
+  inUse += textureBytes(desc);
+  peakInUse = std::max(peakInUse, inUse);
+  return id;
+}
+
+void RenderTargetPool::release(GLuint texture)
+{
+  for (Texture &entry : textures)
+  {
+    if (entry.id == texture && entry.used)
+    {
+      entry.used = false;
+      inUse -= textureBytes(entry.desc);
+      return;
+    }
+  }
+  qWarning() << "RenderTargetPool: releasing unknown texture" << texture;
+}
+
+GLuint RenderTargetPool::framebuffer(const QVector<GLuint> &colors, GLuint depth)
+{
+  QVector<GLuint> key = colors;
+  key.append(depth);
+
+  auto it = framebuffers.constFind(key);
+  if (it != framebuffers.constEnd())
+  {
+    return it.value();
+  }
+
+  GLuint fbo;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+  QVector<GLenum> drawBuffers;
+  for (int i = 0; i < colors.size(); ++i)
+  {
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colors[i], 0);
+    drawBuffers.append(GL_COLOR_ATTACHMENT0 + i);
+  }
+  if (depth != 0)
+  {
+    GLenum attachment = GL_DEPTH_ATTACHMENT;
+    for (const Texture &texture : textures)
+    {
+      if (texture.id == depth && hasStencil(texture.desc.format))
+      {
+        attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+      }
+    }
+    glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, depth, 0);
+  }
+
+  if (drawBuffers.isEmpty())
+  {
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  }
+  else
+  {
+    glDrawBuffers(drawBuffers.size(), drawBuffers.constData());
+  }
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    qWarning() << "RenderTargetPool: framebuffer not complete!";
+
+  framebuffers.insert(key, fbo);
+  return fbo;
+}
+
+void RenderTargetPool::endFrame()
+{
+  for (int i = textures.size() - 1; i >= 0; --i)
+  {
+    Texture &texture = textures[i];
+    if (!texture.used && ++texture.idleFrames > maxIdleFrames)
+    {
+      destroy(i);
+    }
+  }
+}
+
+/**
+ * @brief RenderTargetPool::destroy Deletes a texture and every framebuffer it is
+ * attached to.
+ */
+void RenderTargetPool::destroy(int index)
+{
+  GLuint id = textures[index].id;
+
+  for (auto it = framebuffers.begin(); it != framebuffers.end();)
+  {
+    if (it.key().contains(id))
+    {
+      glDeleteFramebuffers(1, &it.value());
+      it = framebuffers.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  allocated -= textureBytes(textures[index].desc);
+  glDeleteTextures(1, &id);
+  textures.removeAt(index);
+}
+
+/**
+ * @brief RenderTargetPool::bytesPerPixel Estimated storage per pixel. Three
+ * channel formats are counted as four, which is how drivers store them.
+ */
+qint64 RenderTargetPool::bytesPerPixel(GLenum format)
+{
+  switch (format)
+  {
+  case GL_R8:
+    return 1;
+  case GL_R16F:
+    return 2;
+  case GL_RGB16F:
+  case GL_RGBA16F:
+    return 8;
+  case GL_RGB32F:
+  case GL_RGBA32F:
+    return 16;
+  default:
+    // GL_RGBA8, GL_R11F_G11F_B10F, GL_RG16F, GL_R32F, depth formats
+    return 4;
+  }
+}
+
+bool RenderTargetPool::isDepthFormat(GLenum format)
+{
+  return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 ||
+         format == GL_DEPTH_COMPONENT32F || hasStencil(format);
+}
+
+bool RenderTargetPool::hasStencil(GLenum format)
+{
+  return format == GL_DEPTH24_STENCIL8;
+}
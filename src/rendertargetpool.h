@@ -0,0 +1,85 @@
+#ifndef RENDERTARGETPOOL_H
+#define RENDERTARGETPOOL_H
+
+#include <QHash>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector>
+
+/**
+ * @brief Format and size of a pooled render target texture.
+ */
+struct TextureDesc
+{
+  GLenum format = GL_RGBA8; // sized internal format
+  int width = 0;
+  int height = 0;
+  GLenum filter = GL_NEAREST;
+
+  bool operator==(const TextureDesc &other) const;
+};
+
+/**
+ * @brief The RenderTargetPool class hands out render target textures and the
+ * framebuffers that combine them.
+ *
+ * A released texture goes back to the pool and is handed out again to the next
+ * request with the same description, in the same frame (aliasing targets whose
+ * lifetimes do not overlap) or in later frames (so nothing is reallocated from
+ * frame to frame). Textures that stay unused for a while, e.g. after the render
+ * targets grew, are deleted, which keeps the memory bounded by what a frame
+ * actually needs.
+ */
+class RenderTargetPool : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  RenderTargetPool() = default;
+  ~RenderTargetPool();
+
+  void initialize();
+
+  GLuint acquire(const TextureDesc &desc);
+  void release(GLuint texture);
+
+  /**
+   * @brief Returns a framebuffer with the given attachments, creating it on
+   * first use. Color attachments are enabled as draw buffers in order.
+   * @param depth Depth texture, or 0. Formats with stencil are attached as
+   * depth-stencil.
+   */
+  GLuint framebuffer(const QVector<GLuint> &colors, GLuint depth);
+
+  /**
+   * @brief Ages the unused textures and deletes those idle for too long.
+   */
+  void endFrame();
+
+  qint64 allocatedBytes() const { return allocated; }
+  qint64 inUseBytes() const { return inUse; }
+  qint64 peakInUseBytes() const { return peakInUse; }
+  int textureCount() const { return textures.size(); }
+
+  static qint64 bytesPerPixel(GLenum format);
+  static bool isDepthFormat(GLenum format);
+  static bool hasStencil(GLenum format);
+
+private:
+  struct Texture
+  {
+    GLuint id;
+    TextureDesc desc;
+    bool used;
+    int idleFrames;
+  };
+
+  void destroy(int index);
+
+  QVector<Texture> textures;
+  QHash<QVector<GLuint>, GLuint> framebuffers; // key: colors..., depth
+
+  qint64 allocated = 0;
+  qint64 inUse = 0;
+  qint64 peakInUse = 0;
+  bool initialized = false;
+};
+
+#endif // RENDERTARGETPOOL_H
@@ -0,0 +1,274 @@
+#include "scenedescription.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQuaternion>
+
+namespace
+{
+  QVector3D toVector3D(const QJsonValue &value, const QVector3D &fallback)
+  {
+    QJsonArray array = value.toArray();
+    if (array.size() != 3)
+    {
+      return fallback;
+    }
+    return QVector3D(array[0].toDouble(), array[1].toDouble(), array[2].toDouble());
+  }
+
+  QVector2D toVector2D(const QJsonValue &value, const QVector2D &fallback)
+  {
+    QJsonArray array = value.toArray();
+    if (array.size() != 2)
+    {
+      return fallback;
+    }
+    return QVector2D(array[0].toDouble(), array[1].toDouble());
+  }
+
+  /**
+   * @brief resolvePath Makes asset paths relative to the scene file. Qt resource
+   * paths (":/...") and absolute paths are used as they are.
+   */
+  QString resolvePath(const QString &path, const QString &sceneDir)
+  {
+    if (path.isEmpty() || path.startsWith(":") || !QFileInfo(path).isRelative())
+    {
+      return path;
+    }
+    return QDir::cleanPath(sceneDir + "/" + path);
+  }
+
+  /**
+   * @brief parseTransform Builds translate * rotate * scale from
+   * {"translate": [x, y, z], "rotate": [pitch, yaw, roll], "scale": s or [x, y, z]}.
+   * Rotations are Euler angles in degrees.
+   */
+  QMatrix4x4 parseTransform(const QJsonObject &object)
+  {
+    QMatrix4x4 transform;
+    transform.setToIdentity();
+    transform.translate(toVector3D(object["translate"], QVector3D(0.0F, 0.0F, 0.0F)));
+    transform.rotate(QQuaternion::fromEulerAngles(
+        toVector3D(object["rotate"], QVector3D(0.0F, 0.0F, 0.0F))));
+
+    QJsonValue scale = object["scale"];
+    if (scale.isDouble())
+    {
+      transform.scale(static_cast<float>(scale.toDouble()));
+    }
+    else
+    {
+      transform.scale(toVector3D(scale, QVector3D(1.0F, 1.0F, 1.0F)));
+    }
+    return transform;
+  }
+
+  OceanSettings parseOcean(const QJsonObject &object)
+  {
+    OceanSettings s;
+    s.spectrum = object["spectrum"].toString("jonswap") == "phillips"
+                     ? WaveSpectrum::Phillips
+                     : WaveSpectrum::Jonswap;
+    s.gridSize = object["gridSize"].toInt(s.gridSize);
+    s.tileSize = object["tileSize"].toDouble(s.tileSize);
+    s.windSpeed = object["windSpeed"].toDouble(s.windSpeed);
+    s.windDirection = toVector2D(object["windDirection"], s.windDirection);
+    s.fetch = object["fetch"].toDouble(s.fetch);
+    s.peakEnhancement = object["peakEnhancement"].toDouble(s.peakEnhancement);
+    s.depth = object["depth"].toDouble(s.depth);
+    s.amplitude = object["amplitude"].toDouble(s.amplitude);
+    s.choppiness = object["choppiness"].toDouble(s.choppiness);
+    s.smallWaveCutoff = object["smallWaveCutoff"].toDouble(s.smallWaveCutoff);
+    s.seed = static_cast<unsigned>(object["seed"].toInt(static_cast<int>(s.seed)));
+    return s;
+  }
+
+  BloomDescription parseBloom(const QJsonObject &object)
+  {
+    BloomDescription bloom;
+    bloom.enabled = object["enabled"].toBool(bloom.enabled);
+    bloom.threshold = object["threshold"].toDouble(bloom.threshold);
+    bloom.knee = object["knee"].toDouble(bloom.knee);
+    bloom.intensity = object["intensity"].toDouble(bloom.intensity);
+    bloom.levels = object["levels"].toInt(bloom.levels);
+    return bloom;
+  }
+
+  ProbeDescription parseProbe(const QJsonObject &object)
+  {
+    ProbeDescription probe;
+    probe.enabled = !object.isEmpty() && object["enabled"].toBool(true);
+    probe.position = toVector3D(object["position"], probe.position);
+    probe.size = object["size"].toInt(probe.size);
+    probe.interval = object["interval"].toDouble(probe.interval);
+    probe.blur = object["blur"].toDouble(probe.blur);
+    return probe;
+  }
+
+  ShadowDescription parseShadows(const QJsonObject &object)
+  {
+    ShadowDescription shadows;
+    shadows.enabled = !object.isEmpty() && object["enabled"].toBool(true);
+    shadows.cascades = object["cascades"].toInt(shadows.cascades);
+    shadows.size = object["size"].toInt(shadows.size);
+    shadows.distance = object["distance"].toDouble(shadows.distance);
+    shadows.splitLambda = object["splitLambda"].toDouble(shadows.splitLambda);
+    return shadows;
+  }
+
+  StreamingDescription parseStreaming(const QJsonObject &object, const QString &filename)
+  {
+    StreamingDescription streaming;
+    streaming.enabled = !object.isEmpty() && object["enabled"].toBool(true);
+    streaming.tileSize = object["tileSize"].toDouble(streaming.tileSize);
+    streaming.radius = object["radius"].toDouble(streaming.radius);
+    streaming.lookahead = object["lookahead"].toDouble(streaming.lookahead);
+    streaming.budget = object["budget"].toInt(streaming.budget);
+    // Resources are read-only, their cache goes into the working directory
+    QFileInfo info(filename);
+    QString cache = object["cache"].toString(".cache/" + info.completeBaseName());
+    streaming.cache =
+        filename.startsWith(":") ? cache : resolvePath(cache, info.absolutePath());
+    return streaming;
+  }
+
+  WaterDescription parseWater(const QJsonObject &object)
+  {
+    WaterDescription water;
+    QString mode = object["mode"].toString("fft");
+    water.mode = mode == "vertex" ? PER_VERTEX : mode == "texture" ? TEXTURE : FFT;
+    water.depth = object["depth"].toDouble(water.depth);
+    water.heightScale = object["heightScale"].toDouble(water.heightScale);
+
+    for (const QJsonValue &value : object["waves"].toArray())
+    {
+      QJsonObject wave = value.toObject();
+      water.waves.append({static_cast<float>(wave["amplitude"].toDouble()),
+                          static_cast<float>(wave["wavenumber"].toDouble()),
+                          toVector2D(wave["direction"], QVector2D(1.0F, 0.0F)),
+                          static_cast<float>(wave["phase"].toDouble())});
+    }
+
+    water.ocean = parseOcean(object["ocean"].toObject());
+    return water;
+  }
+} // namespace
+
+bool MaterialDescription::operator==(const MaterialDescription &other) const
+{
+  return diffuse == other.diffuse && emission == other.emission && normal == other.normal &&
+         specular == other.specular;
+}
+
+bool ActorDescription::operator==(const ActorDescription &other) const
+{
+  return name == other.name && mesh == other.mesh && shader == other.shader &&
+         material == other.material && transform == other.transform && parent == other.parent &&
+         occluder == other.occluder && dynamic == other.dynamic;
+}
+
+bool SceneDescription::load(const QString &filename, QString *error)
+{
+  QFile file(filename);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    if (error)
+      *error = "cannot open " + filename;
+    return false;
+  }
+
+  QJsonParseError parseError;
+  QJsonDocument document = QJsonDocument::fromJson(file.readAll(), &parseError);
+  if (!document.isObject())
+  {
+    if (error)
+      *error = filename + ": " + parseError.errorString();
+    return false;
+  }
+
+  QJsonObject root = document.object();
+  QString sceneDir = QFileInfo(filename).absolutePath();
+
+  actors.clear();
+  materials.clear();
+
+  QJsonObject materialObjects = root["materials"].toObject();
+  for (const QString &key : materialObjects.keys())
+  {
+    QJsonObject object = materialObjects[key].toObject();
+    MaterialDescription material;
+    material.diffuse = resolvePath(object["diffuse"].toString(), sceneDir);
+    material.emission = resolvePath(object["emission"].toString(), sceneDir);
+    material.normal = resolvePath(object["normal"].toString(), sceneDir);
+    material.specular = resolvePath(object["specular"].toString(), sceneDir);
+    materials.insert(key, material);
+  }
+
+  for (const QJsonValue &value : root["actors"].toArray())
+  {
+    QJsonObject object = value.toObject();
+    if (!object["enabled"].toBool(true))
+    {
+      continue;
+    }
+
+    ActorDescription actor;
+    actor.name = object["name"].toString();
+    actor.mesh = resolvePath(object["mesh"].toString(), sceneDir);
+    actor.shader = object["shader"].toString("gbuffer");
+    actor.transform = parseTransform(object["transform"].toObject());
+    actor.parent = object["parent"].toString();
+    actor.occluder = object["occluder"].toBool(false);
+    actor.dynamic = object["dynamic"].toBool(false);
+
+    QString material = object["material"].toString();
+    if (!material.isEmpty())
+    {
+      if (!materials.contains(material))
+      {
+        qWarning() << "Scene: actor" << actor.name << "uses unknown material" << material;
+      }
+      actor.material = materials.value(material);
+    }
+
+    if (actor.name.isEmpty() || actor.mesh.isEmpty())
+    {
+      qWarning() << "Scene: skipping actor without name or mesh";
+      continue;
+    }
+    actors.append(actor);
+  }
+
+  // The lighting pass has a single directional light
+  QJsonArray lights = root["lights"].toArray();
+  light = LightDescription();
+  for (const QJsonValue &value : lights)
+  {
+    QJsonObject object = value.toObject();
+    if (object["type"].toString("directional") != "directional")
+    {
+      qWarning() << "Scene: only directional lights are supported";
+      continue;
+    }
+    light.direction = toVector3D(object["direction"], light.direction).normalized();
+    light.color = toVector3D(object["color"], light.color);
+    if (lights.size() > 1)
+    {
+      qWarning() << "Scene: using the first of" << lights.size() << "lights";
+    }
+    break;
+  }
+
+  bloom = parseBloom(root["bloom"].toObject());
+  probe = parseProbe(root["probe"].toObject());
+  shadows = parseShadows(root["shadows"].toObject());
+  water = parseWater(root["water"].toObject());
+  streaming = parseStreaming(root["streaming"].toObject(), filename);
+  return true;
+}
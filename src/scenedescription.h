@@ -0,0 +1,147 @@
+#ifndef SCENEDESCRIPTION_H
+#define SCENEDESCRIPTION_H
+
+#include <QHash>
+#include <QMatrix4x4>
+#include <QString>
+#include <QVector3D>
+#include <QVector>
+
+#include "ocean.h"
+#include "wavemode.h"
+#include "waves.h"
+
+/**
+ * @brief Textures of a material. Empty paths mean "not used".
+ */
+struct MaterialDescription
+{
+  QString diffuse;
+  QString emission;
+  QString normal;   // tangent space normal map
+  QString specular; // reflectiveness in the red channel
+
+  bool operator==(const MaterialDescription &other) const;
+};
+
+/**
+ * @brief One drawable entry of the scene file.
+ */
+struct ActorDescription
+{
+  QString name;   // unique, used to match entries when reloading
+  QString mesh;   // path of the .obj file
+  QString shader; // "gbuffer" or "water"
+  MaterialDescription material; // resolved copy of the referenced material
+  QMatrix4x4 transform; // relative to the parent, if any
+  QString parent;       // name of the entry this one is placed on, empty for none
+  bool occluder = false; // large and closed, hides what is behind it
+
+  bool dynamic = false;  // moves at runtime, its shadow is rendered every frame
+
+  bool operator==(const ActorDescription &other) const;
+  bool operator!=(const ActorDescription &other) const { return !(*this == other); }
+};
+
+/**
+ * @brief The directional light used by the lighting pass.
+ */
+struct LightDescription
+{
+  QVector3D direction{-0.2F, -1.0F, -0.3F};
+  QVector3D color{0.6F, 0.6F, 0.6F};
+};
+
+/**
+ * @brief Glow around bright pixels such as the lamps and the sign.
+ */
+struct BloomDescription
+{
+  bool enabled = true;
+  float threshold = 0.8F; // brightness of the lit image where the glow starts
+  float knee = 0.4F;      // soft transition below the threshold
+  float intensity = 0.6F;
+  int levels = 6; // downsample steps, each halves the resolution
+};
+
+/**
+ * @brief Cubemap of the scene that the reflections fall back to where the
+ * screen space rays find nothing.
+ */
+struct ProbeDescription
+{
+  bool enabled = false;
+  QVector3D position;   // where the cubemap is captured, ideally near the water
+  int size = 128;       // texels per face side
+  float interval = 0.0F; // seconds between captures, 0 to only capture on load
+  float blur = 1.0F;     // mip level of the prefiltered cubemap that is reflected
+};
+
+/**
+ * @brief Cascaded shadow maps of the directional light.
+ */
+struct ShadowDescription
+{
+  bool enabled = false;
+  int cascades = 3;           // 1 to ShadowMaps::maxCascades
+  int size = 2048;            // texels per cascade side
+  float distance = 60.0F;     // from the camera, beyond it nothing is shadowed
+  float splitLambda = 0.75F;  // 0 splits the distance evenly, 1 logarithmically
+};
+
+/**
+ * @brief Streaming of the static actors in spatial tiles around the camera,
+ * for scenes that do not fit into memory at once.
+ */
+struct StreamingDescription
+{
+  bool enabled = false;
+  float tileSize = 64.0F;  // side of the square tiles on the ground plane
+  float radius = 150.0F;   // tiles closer to the camera than this are loaded
+  float lookahead = 1.5F;  // seconds of camera motion to prefetch along
+  int budget = 256;        // MB of vertex and texture data resident at most
+  QString cache;           // directory of the tile files, next to the scene by default
+};
+
+/**
+ * @brief Water surface parameters: which wave source to use and its settings.
+ */
+struct WaterDescription
+{
+  WaveMode mode = FFT;
+  QVector<WaveComponent> waves; // empty keeps the WaveModel defaults
+  float depth = 5.0F;
+  float heightScale = 0.2F;
+  OceanSettings ocean;
+};
+
+/**
+ * @brief The SceneDescription class is the parsed content of a scene file:
+ * meshes, materials, transforms, the light, bloom, the reflection probe, the
+ * shadows, the water parameters and how the actors are streamed.
+ * It holds no GL resources, SceneLoader turns it into actors.
+ *
+ * Scene files are JSON, see scenes/harbor.json for the format.
+ */
+class SceneDescription
+{
+public:
+  QVector<ActorDescription> actors;
+  QHash<QString, MaterialDescription> materials;
+  LightDescription light;
+  BloomDescription bloom;
+  ProbeDescription probe;
+  ShadowDescription shadows;
+  WaterDescription water;
+  StreamingDescription streaming;
+
+  /**
+   * @brief Parses a scene file.
+   * @param filename Path of the scene file, may be a Qt resource.
+   * @param error Receives a description of the problem on failure.
+   * @return Whether the file could be parsed.
+   */
+  bool load(const QString &filename, QString *error = nullptr);
+};
+
+#endif // SCENEDESCRIPTION_H
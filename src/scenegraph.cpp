@@ -0,0 +1,488 @@
+#include "scenegraph.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+// Above this share of dirty nodes, update() recomputes every node instead of
+// walking the subtrees one by one
+const int bulkDivisor = 8;
+
+/**
+ * @brief out = a * b for column major 4x4 matrices. The inner loops run over
+ * the four rows of a column at once, which the compiler vectorizes.
+ */
+inline void multiply(const float *a, const float *b, float *out)
+{
+  for (int column = 0; column < 4; ++column)
+  {
+    float result[4];
+    for (int row = 0; row < 4; ++row)
+    {
+      result[row] = a[row] * b[column * 4];
+    }
+    for (int k = 1; k < 4; ++k)
+    {
+      for (int row = 0; row < 4; ++row)
+      {
+        result[row] += a[k * 4 + row] * b[column * 4 + k];
+      }
+    }
+    for (int row = 0; row < 4; ++row)
+    {
+      out[column * 4 + row] = result[row];
+    }
+  }
+}
+
+/**
+ * @brief Writes the inverse transpose of the upper 3x3 of a column major 4x4
+ * matrix to a column major 3x3 one. Its columns are the cross products of the
+ * other two axes over the determinant. Singular matrices give the identity,
+ * like QMatrix4x4::normalMatrix().
+ */
+inline void normalMatrixOf(const float *m, float *out)
+{
+  const float *x = m;
+  const float *y = m + 4;
+  const float *z = m + 8;
+  float yz[3] = {y[1] * z[2] - y[2] * z[1], y[2] * z[0] - y[0] * z[2], y[0] * z[1] - y[1] * z[0]};
+  float zx[3] = {z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0]};
+  float xy[3] = {x[1] * y[2] - x[2] * y[1], x[2] * y[0] - x[0] * y[2], x[0] * y[1] - x[1] * y[0]};
+  float det = x[0] * yz[0] + x[1] * yz[1] + x[2] * yz[2];
+  if (std::fabs(det) <= 0.00001F)
+  {
+    for (int i = 0; i < 9; ++i)
+    {
+      out[i] = i % 4 == 0 ? 1.0F : 0.0F;
+    }
+    return;
+  }
+  float inverse = 1.0F / det;
+  for (int row = 0; row < 3; ++row)
+  {
+    out[row] = yz[row] * inverse;
+    out[3 + row] = zx[row] * inverse;
+    out[6 + row] = xy[row] * inverse;
+  }
+}
+} // namespace
+
+void SceneGraph::clear()
+{
+  parents.clear();
+  firstChild.clear();
+  lastChild.clear();
+  nextSibling.clear();
+  depths.clear();
+  locals.clear();
+  worlds.clear();
+  normals.clear();
+  dirty.clear();
+  stamps.clear();
+  dirtyNodes.clear();
+  changed.clear();
+  entryNodes.clear();
+  names.clear();
+  byDepthValid = false;
+}
+
+void SceneGraph::reserve(int nodes)
+{
+  parents.reserve(nodes);
+  firstChild.reserve(nodes);
+  lastChild.reserve(nodes);
+  nextSibling.reserve(nodes);
+  depths.reserve(nodes);
+  locals.reserve(nodes);
+  worlds.reserve(nodes);
+  normals.reserve(nodes);
+  dirty.reserve(nodes);
+  stamps.reserve(nodes);
+}
+
+int SceneGraph::addNode(const QMatrix4x4 &local, int parent)
+{
+  if (parent >= size())
+  {
+    qWarning() << "Scene graph: no parent node" << parent;
+    parent = -1;
+  }
+
+  int node = size();
+  parents.append(parent);
+  firstChild.append(-1);
+  lastChild.append(-1);
+  nextSibling.append(-1);
+  depths.append(parent < 0 ? 0 : depths[parent] + 1);
+  locals.append(local);
+  worlds.append(local);
+  normals.append(QMatrix3x3());
+  dirty.append(1);
+  stamps.append(0);
+  dirtyNodes.append(node);
+  byDepthValid = false;
+
+  // Children in the order they were added
+  if (parent >= 0)
+  {
+    if (lastChild[parent] < 0)
+    {
+      firstChild[parent] = node;
+    }
+    else
+    {
+      nextSibling[lastChild[parent]] = node;
+    }
+    lastChild[parent] = node;
+  }
+  return node;
+}
+
+void SceneGraph::build(JobSystem &jobs, const QVector<ActorDescription> &entries)
+{
+  clear();
+  reserve(entries.size());
+
+  QHash<QString, int> entryOf;
+  for (int i = 0; i < entries.size(); ++i)
+  {
+    if (entryOf.contains(entries[i].name))
+    {
+      qWarning() << "Scene: duplicate actor name" << entries[i].name;
+      continue;
+    }
+    entryOf.insert(entries[i].name, i);
+  }
+
+  // Nodes follow the entries, but a parent has to be added first
+  entryNodes.fill(-1, entries.size());
+  QVector<int> path;
+  for (int i = 0; i < entries.size(); ++i)
+  {
+    // Walk up to the first ancestor that already has a node
+    path.clear();
+    int entry = i;
+    while (entry >= 0 && entryNodes[entry] < 0)
+    {
+      if (path.contains(entry))
+      {
+        qWarning() << "Scene: the parents of" << entries[path.last()].name
+                   << "form a cycle, placing it at the root";
+        break;
+      }
+      path.append(entry);
+      const QString &parentName = entries[entry].parent;
+      if (parentName.isEmpty())
+      {
+        entry = -1;
+      }
+      else if (!entryOf.contains(parentName))
+      {
+        qWarning() << "Scene: actor" << entries[entry].name << "has unknown parent"
+                   << parentName;
+        entry = -1;
+      }
+      else
+      {
+        entry = entryOf.value(parentName);
+      }
+    }
+
+    // And add the path back down, nearest to the root first
+    int parent = entry >= 0 && entryNodes[entry] >= 0 ? entryNodes[entry] : -1;
+    for (int p = path.size() - 1; p >= 0; --p)
+    {
+      parent = addNode(entries[path[p]].transform, parent);
+      entryNodes[path[p]] = parent;
+    }
+  }
+  for (auto it = entryOf.constBegin(); it != entryOf.constEnd(); ++it)
+  {
+    names.insert(it.key(), entryNodes[it.value()]);
+  }
+  update(jobs);
+}
+
+void SceneGraph::setLocal(int node, const QMatrix4x4 &local)
+{
+  locals[node] = local;
+  if (!dirty[node])
+  {
+    dirty[node] = 1;
+    dirtyNodes.append(node);
+  }
+}
+
+const QVector<int> &SceneGraph::update(JobSystem &jobs)
+{
+  changed.clear();
+  stamp++;
+  if (dirtyNodes.isEmpty())
+  {
+    return changed;
+  }
+
+  if (dirtyNodes.size() > size() / bulkDivisor)
+  {
+    updateAll(jobs);
+  }
+  else
+  {
+    // Ancestors have smaller indices, so their subtrees go first and cover
+    // the dirty nodes below them
+    std::sort(dirtyNodes.begin(), dirtyNodes.end());
+    for (int node : dirtyNodes)
+    {
+      if (stamps[node] != stamp)
+      {
+        updateSubtree(node);
+      }
+    }
+  }
+
+  for (int node : dirtyNodes)
+  {
+    dirty[node] = 0;
+  }
+  dirtyNodes.clear();
+  return changed;
+}
+
+void SceneGraph::updateNode(int node)
+{
+  int parent = parents[node];
+  if (parent < 0)
+  {
+    worlds[node] = locals[node];
+  }
+  else
+  {
+    multiply(worlds[parent].constData(), locals[node].constData(), worlds[node].data());
+  }
+  normalMatrixOf(worlds[node].constData(), normals[node].data());
+  stamps[node] = stamp;
+}
+
+/**
+ * @brief SceneGraph::updateSubtree Recomputes a node and its descendants in
+ * depth first order, parents before their children, without recursion.
+ */
+void SceneGraph::updateSubtree(int root)
+{
+  int node = root;
+  while (node >= 0)
+  {
+    updateNode(node);
+    changed.append(node);
+
+    // Down to the first child, else to the next sibling of the node or of the
+    // nearest ancestor below the root that has one
+    if (firstChild[node] >= 0)
+    {
+      node = firstChild[node];
+      continue;
+    }
+    while (node != root && nextSibling[node] < 0)
+    {
+      node = parents[node];
+    }
+    node = node == root ? -1 : nextSibling[node];
+  }
+}
+
+/**
+ * @brief SceneGraph::updateAll Recomputes every node, one depth after the
+ * other, since the nodes of one depth only read the depth above.
+ */
+void SceneGraph::updateAll(JobSystem &jobs)
+{
+  if (!byDepthValid)
+  {
+    sortByDepth();
+  }
+
+  for (int depth = 0; depth + 1 < depthStarts.size(); ++depth)
+  {
+    jobs.parallelFor(depthStarts[depth], depthStarts[depth + 1], [&](int begin, int end)
+    {
+      for (int i = begin; i < end; ++i)
+      {
+        updateNode(byDepth[i]);
+      }
+    }, 1024);
+  }
+
+  changed.resize(size());
+  for (int node = 0; node < size(); ++node)
+  {
+    changed[node] = node;
+  }
+}
+
+/**
+ * @brief SceneGraph::sortByDepth Orders the nodes by depth (counting sort),
+ * keeping the node order within a depth.
+ */
+void SceneGraph::sortByDepth()
+{
+  int maxDepth = 0;
+  for (int depth : depths)
+  {
+    maxDepth = std::max(maxDepth, depth);
+  }
+  depthStarts.fill(0, maxDepth + 2);
+  for (int depth : depths)
+  {
+    depthStarts[depth + 1]++;
+  }
+  for (int depth = 0; depth <= maxDepth; ++depth)
+  {
+    depthStarts[depth + 1] += depthStarts[depth];
+  }
+  QVector<int> fill = depthStarts;
+  byDepth.resize(size());
+  for (int node = 0; node < size(); ++node)
+  {
+    byDepth[fill[depths[node]]++] = node;
+  }
+  byDepthValid = true;
+}
+
+void SceneGraph::benchmark()
+{
+  // 1,000 objects of a root, 7 parts and 6 pieces per part
+  const int objects = 1000;
+  const int parts = 7;
+  const int pieces = 6;
+  const int moved = 10; // nodes animated per frame
+  const int frames = 200;
+
+  auto localMatrix = [](int node, float time)
+  {
+    QMatrix4x4 local;
+    local.translate(float(node % 97) * 0.5F, float(node % 13) * 0.25F, float(node % 89) * 0.5F);
+    local.rotate(float(node % 360) + time * 30.0F, 0.0F, 1.0F, 0.0F);
+    local.scale(1.0F + float(node % 5) * 0.1F);
+    return local;
+  };
+
+  JobSystem single(0);
+  SceneGraph graph;
+  QVector<int> roots;
+  QVector<int> leaves;
+  for (int o = 0; o < objects; ++o)
+  {
+    int root = graph.addNode(localMatrix(graph.size(), 0.0F));
+    roots.append(root);
+    for (int p = 0; p < parts; ++p)
+    {
+      int part = graph.addNode(localMatrix(graph.size(), 0.0F), root);
+      for (int l = 0; l < pieces; ++l)
+      {
+        leaves.append(graph.addNode(localMatrix(graph.size(), 0.0F), part));
+      }
+    }
+  }
+  graph.update(single);
+
+  qDebug() << ":: Scene graph benchmark," << graph.size() << "nodes," << moved
+           << "moved per frame";
+
+  // Moving a few subtrees (or single leaves) per frame
+  auto animate = [&](const QVector<int> &candidates, const char *label)
+  {
+    qint64 touched = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int frame = 0; frame < frames; ++frame)
+    {
+      for (int i = 0; i < moved; ++i)
+      {
+        int node = candidates[(frame * 7919 + i * 104729) % candidates.size()];
+        graph.setLocal(node, localMatrix(node, frame / 60.0F));
+      }
+      touched += graph.update(single).size();
+    }
+    qDebug().noquote() << QString("  move %1 %2: %3 ms per frame, %4 nodes recomputed")
+                              .arg(moved)
+                              .arg(label)
+                              .arg(timer.nsecsElapsed() / 1.0e6 / frames, 0, 'f', 4)
+                              .arg(touched / frames);
+  };
+  animate(roots, "objects");
+  animate(leaves, "pieces");
+
+  // What recomputing every transform and normal matrix costs without the graph
+  QVector<QMatrix4x4> flatWorlds(graph.size());
+  QVector<QMatrix3x3> flatNormals(graph.size());
+  QElapsedTimer timer;
+  timer.start();
+  for (int frame = 0; frame < frames / 10; ++frame)
+  {
+    for (int node = 0; node < graph.size(); ++node)
+    {
+      int parent = graph.parent(node);
+      flatWorlds[node] =
+          parent < 0 ? graph.local(node) : flatWorlds[parent] * graph.local(node);
+      flatNormals[node] = flatWorlds[node].normalMatrix();
+    }
+  }
+  double flatMs = timer.nsecsElapsed() / 1.0e6 / (frames / 10);
+  qDebug().noquote() << QString("  every node with QMatrix4x4: %1 ms per frame")
+                            .arg(flatMs, 0, 'f', 3);
+
+  // The cached matrices must match that
+  float maxError = 0.0F;
+  for (int node = 0; node < graph.size(); ++node)
+  {
+    for (int i = 0; i < 16; ++i)
+    {
+      maxError = std::max(maxError, std::fabs(graph.world(node).constData()[i] -
+                                              flatWorlds[node].constData()[i]));
+    }
+    for (int i = 0; i < 9; ++i)
+    {
+      maxError = std::max(maxError, std::fabs(graph.normalMatrix(node).constData()[i] -
+                                              flatNormals[node].constData()[i]));
+    }
+  }
+  qDebug() << "  largest difference to QMatrix4x4:" << maxError;
+
+  // Every local matrix set, so every node is recomputed depth by depth
+  int maxThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  double singleThreaded = 0.0;
+  for (int threads = 1;; threads = std::min(threads * 2, maxThreads))
+  {
+    JobSystem jobs(threads - 1);
+    timer.restart();
+    for (int frame = 0; frame < frames / 10; ++frame)
+    {
+      for (int node = 0; node < graph.size(); ++node)
+      {
+        graph.setLocal(node, localMatrix(node, frame / 60.0F));
+      }
+      graph.update(jobs);
+    }
+    double bulkMs = timer.nsecsElapsed() / 1.0e6 / (frames / 10);
+    if (threads == 1)
+    {
+      singleThreaded = bulkMs;
+    }
+    qDebug().noquote() << QString("  %1 threads: every node %2 ms per frame (%3x, %4x the flat "
+                                  "list)")
+                              .arg(threads, 2)
+                              .arg(bulkMs, 0, 'f', 3)
+                              .arg(singleThreaded / bulkMs, 0, 'f', 2)
+                              .arg(flatMs / bulkMs, 0, 'f', 2);
+    if (threads == maxThreads)
+    {
+      break;
+    }
+  }
+}
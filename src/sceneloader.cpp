@@ -0,0 +1,312 @@
+#include "sceneloader.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QSet>
+
+#include "shaderfeatures.h"
+
+SceneLoader::~SceneLoader()
+{
+  qDeleteAll(meshes);
+}
+
+/**
+ * @brief SceneLoader::initialize Resolves the GL functions. Requires a current
+ * context.
+ */
+void SceneLoader::initialize()
+{
+  initializeOpenGLFunctions();
+  textures.initialize();
+}
+
+/**
+ * @brief SceneLoader::apply Rebuilds the actor list in scene order. Actors are
+ * matched to their previous entry by name; an actor is reused as is when its
+ * entry is unchanged, so only new or edited entries touch the disk or the GPU.
+ */
+void SceneLoader::apply(const SceneDescription &scene, QVector<Actor> &actors)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  QHash<QString, int> previous;
+  for (int i = 0; i < current.size() && i < actors.size(); ++i)
+  {
+    previous.insert(current[i].name, i);
+  }
+
+  QVector<Actor> next;
+  next.reserve(scene.actors.size());
+  QSet<QString> names;
+  int reused = 0;
+
+  for (const ActorDescription &description : scene.actors)
+  {
+    if (names.contains(description.name))
+    {
+      qWarning() << "Scene: duplicate actor name" << description.name;
+    }
+    names.insert(description.name);
+
+    int index = previous.value(description.name, -1);
+    if (index >= 0 && current[index] == description)
+    {
+      next.append(actors[index]);
+      ++reused;
+    }
+    else
+    {
+      next.append(createActor(description));
+    }
+  }
+
+  actors.swap(next);
+  current = scene.actors;
+  releaseUnused(current, actors);
+
+  // Rebaking moves layers around, so reused actors are reassigned as well
+  if (texturesChanged)
+  {
+    textures.bake(images);
+    texturesChanged = false;
+  }
+  for (int i = 0; i < actors.size(); ++i)
+  {
+    assignTextures(actors[i], current[i].material, textures);
+  }
+
+  qDebug() << "Scene:" << actors.size() - reused << "actors created," << reused
+           << "reused in" << timer.elapsed() << "ms";
+}
+
+bool SceneLoader::reloadTexture(const QString &path)
+{
+  if (!images.contains(path))
+  {
+    return false;
+  }
+
+  QImage image(path);
+  if (image.isNull())
+  {
+    qWarning() << "Scene: cannot reload texture" << path;
+    return false;
+  }
+
+  images.insert(path, image);
+  textures.update(path, image);
+  qDebug() << "Scene: reloaded texture" << path;
+  return true;
+}
+
+void SceneLoader::clear()
+{
+  for (Actor *prototype : meshes)
+  {
+    prototype->destroyMesh();
+  }
+  qDeleteAll(meshes);
+  meshes.clear();
+
+  textures.clear();
+  images.clear();
+  current.clear();
+}
+
+Actor SceneLoader::createActor(const ActorDescription &description)
+{
+  const MaterialDescription &material = description.material;
+  bool diffuse = texture(material.diffuse);
+  bool emission = texture(material.emission);
+  bool normal = texture(material.normal);
+  bool specular = texture(material.specular);
+
+  int features = shaderFeatures(description, diffuse, emission, normal, specular);
+  Actor actor(mesh(description.mesh, features), programFor(features));
+  configure(actor, description, features);
+  return actor;
+}
+
+/**
+ * @brief SceneLoader::shaderFeatures The ShaderFeature bits of an entry whose
+ * material has the given maps.
+ */
+int SceneLoader::shaderFeatures(const ActorDescription &description, bool diffuse,
+                                bool emission, bool normal, bool specular)
+{
+  if (description.shader == "water")
+  {
+    return WATER_SURFACE;
+  }
+  if (description.shader != "gbuffer")
+  {
+    qWarning() << "Scene: actor" << description.name << "uses unknown shader"
+               << description.shader;
+  }
+  int features = 0;
+  features |= diffuse ? DIFFUSE_MAP : 0;
+  features |= emission ? EMISSION_MAP : 0;
+  features |= normal ? NORMAL_MAP : 0;
+  features |= specular ? SPECULAR_MAP : 0;
+  return features;
+}
+
+/**
+ * @brief SceneLoader::configure Copies the settings of an entry to an actor
+ * drawn with the given features.
+ */
+void SceneLoader::configure(Actor &actor, const ActorDescription &description, int features)
+{
+  actor.name = description.name;
+  actor.setTransform(description.transform);
+  actor.shaderFeatures = features;
+  // Waves displace the water surface in the vertex shader, beyond its bounds
+  // (and its mesh has no coarser levels, see usesLods). Besides the water, only
+  // materials with a specular map reflect, where the map says so.
+  if (features & WATER_SURFACE)
+  {
+    actor.cullable = false;
+  }
+  actor.reflective = (features & (WATER_SURFACE | SPECULAR_MAP)) != 0;
+  actor.occluder = description.occluder && actor.cullable;
+  actor.dynamic = description.dynamic;
+}
+
+/**
+ * @brief SceneLoader::assignTextures Points an actor at the array layers of its
+ * material's maps.
+ */
+void SceneLoader::assignTextures(Actor &actor, const MaterialDescription &material,
+                                 const TextureArrays &textures)
+{
+  TextureArrays::Layer diffuse = textures.layer(material.diffuse);
+  if (diffuse.texture != 0)
+  {
+    actor.setDiffuseTexture(diffuse.texture, diffuse.layer);
+  }
+  TextureArrays::Layer emission = textures.layer(material.emission);
+  if (emission.texture != 0)
+  {
+    actor.setEmissionTexture(emission.texture, emission.layer);
+  }
+  TextureArrays::Layer normal = textures.layer(material.normal);
+  if (normal.texture != 0)
+  {
+    actor.setNormalTexture(normal.texture, normal.layer);
+  }
+  TextureArrays::Layer specular = textures.layer(material.specular);
+  if (specular.texture != 0)
+  {
+    actor.setSpecularTexture(specular.texture, specular.layer);
+  }
+}
+
+/**
+ * @brief SceneLoader::usesLods Whether an actor drawn with these features gets
+ * levels of detail, decided from the same ShaderFeature bits that select its
+ * program. The water surface needs its full grid however flat it is, so the
+ * waves have vertices to displace.
+ */
+bool SceneLoader::usesLods(int features)
+{
+  return (features & WATER_SURFACE) == 0;
+}
+
+/**
+ * @brief SceneLoader::meshKey The key of a prototype in the mesh cache. A file
+ * loaded with and without levels of detail gets two prototypes.
+ */
+QString SceneLoader::meshKey(const QString &path, int features)
+{
+  return usesLods(features) ? path : path + "#full";
+}
+
+/**
+ * @brief SceneLoader::mesh Returns the prototype actor owning the buffers of a
+ * mesh file for an actor drawn with these features, loading it on first use.
+ */
+const Actor &SceneLoader::mesh(const QString &path, int features)
+{
+  QString key = meshKey(path, features);
+  Actor *prototype = meshes.value(key, nullptr);
+  if (!prototype)
+  {
+    // The program only matters for drawing, prototypes are never drawn
+    prototype = new Actor(path, programFor(0), usesLods(features));
+    meshes.insert(key, prototype);
+  }
+  return *prototype;
+}
+
+/**
+ * @brief SceneLoader::texture Loads an image file on first use; it gets its
+ * array layer with the next bake. Returns false for empty paths and unreadable
+ * images.
+ */
+bool SceneLoader::texture(const QString &path)
+{
+  if (path.isEmpty())
+  {
+    return false;
+  }
+  if (images.contains(path))
+  {
+    return true;
+  }
+
+  QImage image(path);
+  if (image.isNull())
+  {
+    qWarning() << "Scene: cannot load texture" << path;
+    return false;
+  }
+
+  images.insert(path, image);
+  texturesChanged = true;
+  return true;
+}
+
+/**
+ * @brief SceneLoader::releaseUnused Frees meshes and textures that none of the
+ * given entries and their actors reference anymore.
+ */
+void SceneLoader::releaseUnused(const QVector<ActorDescription> &used,
+                                const QVector<Actor> &actors)
+{
+  QSet<QString> usedMeshes, usedTextures;
+  for (int i = 0; i < used.size(); ++i)
+  {
+    const ActorDescription &description = used[i];
+    usedMeshes.insert(meshKey(description.mesh, actors[i].shaderFeatures));
+    usedTextures.insert(description.material.diffuse);
+    usedTextures.insert(description.material.emission);
+    usedTextures.insert(description.material.normal);
+    usedTextures.insert(description.material.specular);
+  }
+
+  for (auto it = meshes.begin(); it != meshes.end();)
+  {
+    if (usedMeshes.contains(it.key()))
+    {
+      ++it;
+      continue;
+    }
+    it.value()->destroyMesh();
+    delete it.value();
+    it = meshes.erase(it);
+  }
+
+  for (auto it = images.begin(); it != images.end();)
+  {
+    if (usedTextures.contains(it.key()))
+    {
+      ++it;
+      continue;
+    }
+    it = images.erase(it);
+    texturesChanged = true;
+  }
+}
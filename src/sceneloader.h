@@ -0,0 +1,96 @@
+#ifndef SCENELOADER_H
+#define SCENELOADER_H
+
+#include <QHash>
+#include <QImage>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <functional>
+
+#include "actor.h"
+#include "scenedescription.h"
+#include "texturearrays.h"
+
+/**
+ * @brief The SceneLoader class turns a SceneDescription into actors.
+ *
+ * Meshes and textures are cached by path, so assets shared by several actors
+ * are loaded and uploaded once. The textures are baked into texture arrays
+ * whenever the set of textures in use changes, and every actor refers to the
+ * layers of its material's maps. Applying a new description to an existing actor
+ * list keeps every actor whose entry did not change, creates only new or edited
+ * entries and releases assets that are no longer referenced. This makes hot
+ * reloading a scene file about as cheap as the edit itself.
+ */
+class SceneLoader : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  SceneLoader() = default;
+  ~SceneLoader();
+
+  void initialize();
+
+  // Returns the program variant for a combination of ShaderFeature bits
+  using ProgramSelector = std::function<QOpenGLShaderProgram &(int features)>;
+
+  /**
+   * @brief Sets where actors get their program from. Each actor picks the
+   * variant for its shader ("gbuffer" or "water") and material once, when it
+   * is created.
+   */
+  void setProgramSelector(const ProgramSelector &selector) { programFor = selector; }
+
+  /**
+   * @brief Updates actors to match the scene.
+   * @param scene The new scene.
+   * @param actors Actor list previously built by this loader (or empty).
+   */
+  void apply(const SceneDescription &scene, QVector<Actor> &actors);
+
+  /**
+   * @brief Re-reads a cached texture into the same array layer, so every actor
+   * using it picks up the change. Requires a current context.
+   * @return Whether the path is a cached texture and could be read.
+   */
+  bool reloadTexture(const QString &path);
+
+  QStringList texturePaths() const { return images.keys(); }
+
+  /**
+   * @brief Deletes all cached meshes and textures. Requires a current context.
+   */
+  void clear();
+
+  static int shaderFeatures(const ActorDescription &description, bool diffuse, bool emission,
+                            bool normal, bool specular);
+  static void configure(Actor &actor, const ActorDescription &description, int features);
+  static void assignTextures(Actor &actor, const MaterialDescription &material,
+                             const TextureArrays &textures);
+
+private:
+  const Actor &mesh(const QString &path, int features);
+  static bool usesLods(int features);
+  static QString meshKey(const QString &path, int features);
+  bool texture(const QString &path);
+  Actor createActor(const ActorDescription &description);
+  void releaseUnused(const QVector<ActorDescription> &used, const QVector<Actor> &actors);
+
+  ProgramSelector programFor;
+
+  // One prototype actor per mesh file and level of detail choice, owning the
+  // vertex buffers
+  QHash<QString, Actor *> meshes;
+  // Images by path, kept to rebake the arrays when the set of textures changes
+  QHash<QString, QImage> images;
+  TextureArrays textures;
+  bool texturesChanged = false;
+
+  // The entries the current actor list was built from, in the same order
+  QVector<ActorDescription> current;
+};
+
+#endif // SCENELOADER_H
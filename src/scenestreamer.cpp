@@ -0,0 +1,1174 @@
+#include "scenestreamer.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QSet>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "jobsystem.h"
+#include "mainview.h"
+
+namespace
+{
+  // Changes whenever the layout of the cache files does
+  const quint32 cacheMagic = 0x5354524D; // "STRM"
+  const qint32 cacheVersion = 1;
+
+  template <typename T> void writeArray(QDataStream &stream, const QVector<T> &array)
+  {
+    stream << qint32(array.size());
+    stream.writeRawData(reinterpret_cast<const char *>(array.constData()),
+                        int(array.size() * sizeof(T)));
+  }
+
+  template <typename T> bool readArray(QDataStream &stream, QVector<T> &array)
+  {
+    qint32 size = 0;
+    stream >> size;
+    // A corrupt or truncated file must not make the loader thread allocate
+    // more than the file still holds
+    qint64 bytes = qint64(size) * qint64(sizeof(T));
+    if (size < 0 || stream.status() != QDataStream::Ok ||
+        bytes > stream.device()->bytesAvailable())
+    {
+      return false;
+    }
+    array.resize(size);
+    return stream.readRawData(reinterpret_cast<char *>(array.data()), int(bytes)) == bytes;
+  }
+
+  QByteArray serializeMesh(const MeshData &mesh)
+  {
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    writeArray(stream, mesh.coords);
+    writeArray(stream, mesh.colors);
+    writeArray(stream, mesh.uvs);
+    writeArray(stream, mesh.normals);
+    writeArray(stream, mesh.tangents);
+    writeArray(stream, mesh.lods);
+    writeArray(stream, QVector<QVector3D>{mesh.boundsMin, mesh.boundsMax});
+    writeArray(stream, mesh.occluderMesh);
+    return bytes;
+  }
+
+  bool deserializeMesh(const QByteArray &bytes, MeshData &mesh)
+  {
+    QDataStream stream(bytes);
+    QVector<QVector3D> bounds;
+    bool ok = readArray(stream, mesh.coords) && readArray(stream, mesh.colors) &&
+              readArray(stream, mesh.uvs) && readArray(stream, mesh.normals) &&
+              readArray(stream, mesh.tangents) && readArray(stream, mesh.lods) &&
+              readArray(stream, bounds) && readArray(stream, mesh.occluderMesh);
+    if (!ok || bounds.size() != 2)
+    {
+      return false;
+    }
+    mesh.boundsMin = bounds[0];
+    mesh.boundsMax = bounds[1];
+    return true;
+  }
+
+  QByteArray serializeImage(int width, int height, const QVector<quint8> &texels)
+  {
+    QByteArray bytes;
+    QDataStream stream(&bytes, QIODevice::WriteOnly);
+    stream << qint32(width) << qint32(height);
+    writeArray(stream, texels);
+    return bytes;
+  }
+
+  bool readAssets(const QString &path, QVector<QPair<QString, QByteArray>> &assets,
+                  qint64 &bytesRead)
+  {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+      return false;
+    }
+    QByteArray content = file.readAll();
+    bytesRead += content.size();
+    QDataStream stream(content);
+    qint32 count = 0;
+    stream >> count;
+    for (int i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+    {
+      QPair<QString, QByteArray> asset;
+      stream >> asset.first >> asset.second;
+      assets.append(asset);
+    }
+    return stream.status() == QDataStream::Ok;
+  }
+
+  /**
+   * @brief groundDistance Distance from a point to a box, ignoring the height.
+   */
+  float groundDistance(const QVector3D &point, const QVector3D &boundsMin,
+                       const QVector3D &boundsMax)
+  {
+    float dx = std::max({boundsMin.x() - point.x(), 0.0F, point.x() - boundsMax.x()});
+    float dz = std::max({boundsMin.z() - point.z(), 0.0F, point.z() - boundsMax.z()});
+    return std::sqrt(dx * dx + dz * dz);
+  }
+
+  /**
+   * @brief syntheticBlock A city block of boxes with random heights on a
+   * size x size square, every face divided into a grid like a facade.
+   */
+  MeshData syntheticBlock(std::mt19937 &random, float size)
+  {
+    const int buildings = 12;
+    const int grid = 4;
+    std::uniform_real_distribution<float> position(0.1F * size, 0.9F * size);
+    std::uniform_real_distribution<float> extent(2.0F, 0.08F * size);
+    std::uniform_real_distribution<float> height(5.0F, 40.0F);
+
+    MeshData mesh;
+    for (int b = 0; b < buildings; ++b)
+    {
+      QVector3D center(position(random), 0.0F, position(random));
+      QVector3D half(extent(random), 0.0F, extent(random));
+      QVector3D low = center - half;
+      QVector3D high = center + half + QVector3D(0.0F, height(random), 0.0F);
+      QVector3D corner[2] = {low, high};
+
+      // A face spans the axes u and v with the normal n, at side 0 or 1
+      for (int axis = 0; axis < 3; ++axis)
+      {
+        for (int side = 0; side < 2; ++side)
+        {
+          int u = (axis + 1) % 3;
+          int v = (axis + 2) % 3;
+          if (side == 0)
+          {
+            std::swap(u, v);
+          }
+          QVector3D normal;
+          normal[axis] = side == 0 ? -1.0F : 1.0F;
+          QVector3D tangent;
+          tangent[u] = 1.0F;
+
+          auto vertex = [&](int i, int j)
+          {
+            QVector3D point;
+            point[axis] = corner[side][axis];
+            point[u] = low[u] + (high[u] - low[u]) * float(i) / grid;
+            point[v] = low[v] + (high[v] - low[v]) * float(j) / grid;
+            mesh.coords.append(point);
+            mesh.colors.append(QVector3D(0.5F, 0.5F, 0.5F));
+            mesh.uvs.append(QVector2D(float(i) / grid, float(j) / grid));
+            mesh.normals.append(normal);
+            mesh.tangents.append(QVector4D(tangent, 1.0F));
+          };
+          for (int i = 0; i < grid; ++i)
+          {
+            for (int j = 0; j < grid; ++j)
+            {
+              vertex(i, j);
+              vertex(i + 1, j);
+              vertex(i + 1, j + 1);
+              vertex(i, j);
+              vertex(i + 1, j + 1);
+              vertex(i, j + 1);
+            }
+          }
+        }
+      }
+    }
+
+    mesh.lods.append({0, GLsizei(mesh.coords.size()), 0.0F});
+    mesh.boundsMin = mesh.coords.first();
+    mesh.boundsMax = mesh.boundsMin;
+    for (const QVector3D &coord : mesh.coords)
+    {
+      mesh.boundsMin = QVector3D(std::min(mesh.boundsMin.x(), coord.x()),
+                                 std::min(mesh.boundsMin.y(), coord.y()),
+                                 std::min(mesh.boundsMin.z(), coord.z()));
+      mesh.boundsMax = QVector3D(std::max(mesh.boundsMax.x(), coord.x()),
+                                 std::max(mesh.boundsMax.y(), coord.y()),
+                                 std::max(mesh.boundsMax.z(), coord.z()));
+    }
+    return mesh;
+  }
+
+  /**
+   * @brief syntheticGround A flat size x size square, divided into a grid.
+   */
+  MeshData syntheticGround(float size)
+  {
+    const int grid = 8;
+    MeshData mesh;
+    auto vertex = [&](int i, int j)
+    {
+      mesh.coords.append(QVector3D(size * i / grid, 0.0F, size * j / grid));
+      mesh.colors.append(QVector3D(0.5F, 0.5F, 0.5F));
+      mesh.uvs.append(QVector2D(float(i), float(j)));
+      mesh.normals.append(QVector3D(0.0F, 1.0F, 0.0F));
+      mesh.tangents.append(QVector4D(1.0F, 0.0F, 0.0F, 1.0F));
+    };
+    for (int i = 0; i < grid; ++i)
+    {
+      for (int j = 0; j < grid; ++j)
+      {
+        vertex(i, j);
+        vertex(i, j + 1);
+        vertex(i + 1, j + 1);
+        vertex(i, j);
+        vertex(i + 1, j + 1);
+        vertex(i + 1, j);
+      }
+    }
+    mesh.lods.append({0, GLsizei(mesh.coords.size()), 0.0F});
+    mesh.boundsMin = QVector3D(0.0F, 0.0F, 0.0F);
+    mesh.boundsMax = QVector3D(size, 0.0F, size);
+    return mesh;
+  }
+
+  QVector<quint8> syntheticTexture(std::mt19937 &random, int size)
+  {
+    std::uniform_int_distribution<int> channel(40, 220);
+    quint8 wall[3] = {quint8(channel(random)), quint8(channel(random)),
+                      quint8(channel(random))};
+    QVector<quint8> texels(size * size * 4);
+    for (int y = 0; y < size; ++y)
+    {
+      for (int x = 0; x < size; ++x)
+      {
+        bool window = (x % 32) > 8 && (y % 32) > 10;
+        quint8 *texel = texels.data() + (y * size + x) * 4;
+        for (int c = 0; c < 3; ++c)
+        {
+          texel[c] = window ? quint8(wall[c] / 4) : wall[c];
+        }
+        texel[3] = 255;
+      }
+    }
+    return texels;
+  }
+} // namespace
+
+SceneStreamer::SceneStreamer()
+{
+  clock.start();
+}
+
+SceneStreamer::~SceneStreamer()
+{
+  stopLoaders();
+  // The GL resources are released by close(), with a current context
+  for (const MeshEntry &entry : meshes)
+  {
+    delete entry.prototype;
+  }
+}
+
+/**
+ * @brief SceneStreamer::initialize Resolves the GL functions, after which
+ * resident tiles get actors. Requires a current context.
+ */
+void SceneStreamer::initialize()
+{
+  initializeOpenGLFunctions();
+  textures.initialize();
+  glEnabled = true;
+}
+
+bool SceneStreamer::isStreamed(const ActorDescription &description)
+{
+  return description.shader == "gbuffer" && !description.dynamic && description.parent.isEmpty();
+}
+
+QVector<ActorDescription> SceneStreamer::open(const SceneDescription &scene)
+{
+  close();
+
+  QVector<ActorDescription> kept;
+  for (const ActorDescription &description : scene.actors)
+  {
+    if (isStreamed(description))
+    {
+      streamed.append(description);
+    }
+    else
+    {
+      kept.append(description);
+    }
+  }
+  settings = scene.streaming;
+  if (streamed.isEmpty())
+  {
+    return kept;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray key = cacheKey(scene, streamed);
+  QString index = QDir(settings.cache).filePath("index.bin");
+  if (readIndex(index, key))
+  {
+    qDebug() << "Streaming:" << tiles.size() << "tiles of" << streamed.size()
+             << "actors from" << settings.cache;
+  }
+  else if (bake() && writeIndex(index, key))
+  {
+    qDebug() << "Streaming: baked" << tiles.size() << "tiles of" << streamed.size()
+             << "actors into" << settings.cache << "in" << timer.elapsed() << "ms";
+  }
+  else
+  {
+    qWarning() << "Streaming: cannot write the tile cache" << settings.cache
+               << ", loading the actors at once";
+    tiles.clear();
+    kept += streamed;
+    streamed.clear();
+    return kept;
+  }
+
+  startLoaders();
+  return kept;
+}
+
+void SceneStreamer::close()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.clear();
+    finished.clear();
+  }
+  // Loads in flight finish for nothing
+  generation++;
+  ready.clear();
+
+  for (int tile = 0; tile < tiles.size(); ++tile)
+  {
+    if (tiles[tile].state == RESIDENT)
+    {
+      unload(tile);
+    }
+  }
+  textures.clear();
+  tiles.clear();
+  streamed.clear();
+
+  frames = hitches = missingTiles = missingFrames = 0;
+  loads = unloads = discarded = 0;
+  updateTime = maxUpdateTime = 0.0F;
+  bytesRead = loadNanoseconds = maxLoadNanoseconds = peakBytes = 0;
+}
+
+bool SceneStreamer::isBusy() const
+{
+  return !ready.empty() ||
+         std::any_of(tiles.cbegin(), tiles.cend(),
+                     [](const Tile &tile) { return tile.state == REQUESTED; });
+}
+
+/**
+ * @brief SceneStreamer::cacheKey Identifies the streamed entries, the tile size
+ * and the state of their files. The cache is rebaked when it changes.
+ */
+QByteArray SceneStreamer::cacheKey(const SceneDescription &scene,
+                                   const QVector<ActorDescription> &streamed)
+{
+  QByteArray bytes;
+  QDataStream stream(&bytes, QIODevice::WriteOnly);
+  stream << cacheVersion << scene.streaming.tileSize;
+
+  QSet<QString> files;
+  for (const ActorDescription &description : streamed)
+  {
+    const MaterialDescription &material = description.material;
+    stream << description.name << description.mesh << material.diffuse << material.emission
+           << material.normal << material.specular << description.occluder;
+    stream.writeRawData(reinterpret_cast<const char *>(description.transform.constData()),
+                        16 * sizeof(float));
+    files << description.mesh << material.diffuse << material.emission << material.normal
+          << material.specular;
+  }
+
+  QStringList sorted = files.values();
+  std::sort(sorted.begin(), sorted.end());
+  for (const QString &file : sorted)
+  {
+    QFileInfo info(file);
+    stream << file << info.size() << info.lastModified().toMSecsSinceEpoch();
+  }
+  return QCryptographicHash::hash(bytes, QCryptographicHash::Sha1);
+}
+
+QString SceneStreamer::tileFile(int tile, const char *extension) const
+{
+  return QDir(settings.cache)
+      .filePath(QString("tile_%1_%2.%3").arg(tiles[tile].x).arg(tiles[tile].z).arg(extension));
+}
+
+bool SceneStreamer::readIndex(const QString &path, const QByteArray &key)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    return false;
+  }
+  QDataStream stream(&file);
+  quint32 magic = 0;
+  QByteArray fileKey;
+  qint32 count = 0;
+  stream >> magic >> fileKey >> count;
+  if (magic != cacheMagic || fileKey != key)
+  {
+    return false;
+  }
+
+  tiles.clear();
+  for (int i = 0; i < count && stream.status() == QDataStream::Ok; ++i)
+  {
+    Tile tile;
+    stream >> tile.x >> tile.z >> tile.boundsMin >> tile.boundsMax >> tile.bytes >> tile.actors;
+    tiles.append(tile);
+  }
+  if (stream.status() != QDataStream::Ok)
+  {
+    tiles.clear();
+    return false;
+  }
+  return true;
+}
+
+bool SceneStreamer::writeIndex(const QString &path, const QByteArray &key) const
+{
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+  QDataStream stream(&file);
+  stream << cacheMagic << key << qint32(tiles.size());
+  for (const Tile &tile : tiles)
+  {
+    stream << tile.x << tile.z << tile.boundsMin << tile.boundsMax << tile.bytes << tile.actors;
+  }
+  return stream.status() == QDataStream::Ok;
+}
+
+bool SceneStreamer::writeAssets(const QString &path,
+                                const QVector<QPair<QString, QByteArray>> &assets)
+{
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly))
+  {
+    return false;
+  }
+  QDataStream stream(&file);
+  stream << qint32(assets.size());
+  for (const QPair<QString, QByteArray> &asset : assets)
+  {
+    stream << asset.first << asset.second;
+  }
+  return stream.status() == QDataStream::Ok;
+}
+
+/**
+ * @brief SceneStreamer::bake Builds the tile files of the streamed entries.
+ * Every mesh and image is read and converted once, on all cores, into a
+ * temporary file, so only a few of them are in memory at any time. The tiles
+ * are then assembled from those files.
+ */
+bool SceneStreamer::bake()
+{
+  QDir cache(settings.cache);
+  QDir assets(cache.filePath("assets"));
+  if (!cache.mkpath(".") || !assets.mkpath("."))
+  {
+    return false;
+  }
+
+  QStringList meshPaths, imagePaths;
+  QHash<QString, int> meshIndex, imageIndex;
+  for (const ActorDescription &description : streamed)
+  {
+    const MaterialDescription &material = description.material;
+    if (!meshIndex.contains(description.mesh))
+    {
+      meshIndex.insert(description.mesh, meshPaths.size());
+      meshPaths.append(description.mesh);
+    }
+    for (const QString &path :
+         {material.diffuse, material.emission, material.normal, material.specular})
+    {
+      if (!path.isEmpty() && !imageIndex.contains(path))
+      {
+        imageIndex.insert(path, imagePaths.size());
+        imagePaths.append(path);
+      }
+    }
+  }
+
+  JobSystem &jobs = JobSystem::global();
+  QVector<QVector3D> meshMin(meshPaths.size()), meshMax(meshPaths.size());
+  QVector<qint64> meshSizes(meshPaths.size());
+  QVector<quint8> written(meshPaths.size() + imagePaths.size());
+  jobs.parallelFor(0, meshPaths.size(),
+                   [&](int begin, int end)
+                   {
+                     for (int i = begin; i < end; ++i)
+                     {
+                       MeshData mesh = Actor::loadMesh(meshPaths[i]);
+                       meshMin[i] = mesh.boundsMin;
+                       meshMax[i] = mesh.boundsMax;
+                       meshSizes[i] = mesh.bytes();
+                       QFile file(assets.filePath(QString("mesh%1").arg(i)));
+                       written[i] = file.open(QIODevice::WriteOnly) &&
+                                    file.write(serializeMesh(mesh)) >= 0;
+                     }
+                   });
+
+  QVector<qint64> imageSizes(imagePaths.size());
+  jobs.parallelFor(0, imagePaths.size(),
+                   [&](int begin, int end)
+                   {
+                     for (int i = begin; i < end; ++i)
+                     {
+                       QImage image(imagePaths[i]);
+                       if (image.isNull())
+                       {
+                         qWarning() << "Streaming: cannot load texture" << imagePaths[i];
+                         continue;
+                       }
+                       int width = TextureArrays::layerSize(image.width());
+                       int height = TextureArrays::layerSize(image.height());
+                       image = image.scaled(width, height, Qt::IgnoreAspectRatio,
+                                            Qt::SmoothTransformation);
+                       imageSizes[i] = qint64(width) * height * 4;
+                       QFile file(assets.filePath(QString("image%1").arg(i)));
+                       written[meshPaths.size() + i] =
+                           file.open(QIODevice::WriteOnly) &&
+                           file.write(serializeImage(width, height,
+                                                     MainView::imageToBytes(image))) >= 0;
+                     }
+                   });
+
+  // Every entry goes to the tile under the center of its world space bounds
+  QMap<QPair<int, int>, Tile> byCoordinates;
+  for (int a = 0; a < streamed.size(); ++a)
+  {
+    int mesh = meshIndex.value(streamed[a].mesh);
+    QVector3D boundsMin, boundsMax;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      QVector3D local((corner & 1) ? meshMax[mesh].x() : meshMin[mesh].x(),
+                      (corner & 2) ? meshMax[mesh].y() : meshMin[mesh].y(),
+                      (corner & 4) ? meshMax[mesh].z() : meshMin[mesh].z());
+      QVector3D world = streamed[a].transform.map(local);
+      boundsMin = corner == 0 ? world : QVector3D(std::min(boundsMin.x(), world.x()),
+                                                  std::min(boundsMin.y(), world.y()),
+                                                  std::min(boundsMin.z(), world.z()));
+      boundsMax = corner == 0 ? world : QVector3D(std::max(boundsMax.x(), world.x()),
+                                                  std::max(boundsMax.y(), world.y()),
+                                                  std::max(boundsMax.z(), world.z()));
+    }
+    QVector3D center = 0.5F * (boundsMin + boundsMax);
+    QPair<int, int> coordinates(int(std::floor(center.x() / settings.tileSize)),
+                                int(std::floor(center.z() / settings.tileSize)));
+    auto it = byCoordinates.find(coordinates);
+    if (it == byCoordinates.end())
+    {
+      Tile tile;
+      tile.x = coordinates.first;
+      tile.z = coordinates.second;
+      tile.boundsMin = boundsMin;
+      tile.boundsMax = boundsMax;
+      it = byCoordinates.insert(coordinates, tile);
+    }
+    Tile &tile = it.value();
+    tile.boundsMin = QVector3D(std::min(tile.boundsMin.x(), boundsMin.x()),
+                               std::min(tile.boundsMin.y(), boundsMin.y()),
+                               std::min(tile.boundsMin.z(), boundsMin.z()));
+    tile.boundsMax = QVector3D(std::max(tile.boundsMax.x(), boundsMax.x()),
+                               std::max(tile.boundsMax.y(), boundsMax.y()),
+                               std::max(tile.boundsMax.z(), boundsMax.z()));
+    tile.actors.append(a);
+  }
+  tiles = byCoordinates.values();
+
+  // Tiles copy the converted assets they use into their own files
+  QVector<quint8> tileWritten(tiles.size());
+  auto readAsset = [&assets](const QString &name)
+  {
+    QFile file(assets.filePath(name));
+    return file.open(QIODevice::ReadOnly) ? file.readAll() : QByteArray();
+  };
+  jobs.parallelFor(0, tiles.size(),
+                   [&](int begin, int end)
+                   {
+                     for (int t = begin; t < end; ++t)
+                     {
+                       Tile &tile = tiles[t];
+                       QVector<int> usedMeshes, usedImages;
+                       for (int a : tile.actors)
+                       {
+                         const MaterialDescription &material = streamed[a].material;
+                         int mesh = meshIndex.value(streamed[a].mesh);
+                         if (written[mesh] && !usedMeshes.contains(mesh))
+                         {
+                           usedMeshes.append(mesh);
+                         }
+                         for (const QString &path : {material.diffuse, material.emission,
+                                                     material.normal, material.specular})
+                         {
+                           int image = imageIndex.value(path, -1);
+                           if (image >= 0 && written[meshPaths.size() + image] &&
+                               !usedImages.contains(image))
+                           {
+                             usedImages.append(image);
+                           }
+                         }
+                       }
+
+                       QVector<QPair<QString, QByteArray>> meshAssets, imageAssets;
+                       for (int mesh : usedMeshes)
+                       {
+                         meshAssets.append({meshPaths[mesh], readAsset(QString("mesh%1").arg(mesh))});
+                         tile.bytes += meshSizes[mesh];
+                       }
+                       for (int image : usedImages)
+                       {
+                         imageAssets.append(
+                             {imagePaths[image], readAsset(QString("image%1").arg(image))});
+                         tile.bytes += imageSizes[image];
+                       }
+                       tileWritten[t] = writeAssets(tileFile(t, "mesh"), meshAssets) &&
+                                        writeAssets(tileFile(t, "tex"), imageAssets);
+                     }
+                   });
+
+  assets.removeRecursively();
+  return !tileWritten.contains(0);
+}
+
+void SceneStreamer::startLoaders()
+{
+  if (!loaders.empty())
+  {
+    return;
+  }
+  stopping = false;
+  for (int i = 0; i < loaderCount; ++i)
+  {
+    loaders.emplace_back([this] { loaderLoop(); });
+  }
+}
+
+void SceneStreamer::stopLoaders()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &loader : loaders)
+  {
+    loader.join();
+  }
+  loaders.clear();
+}
+
+/**
+ * @brief SceneStreamer::loaderLoop Reads the most urgent requested tile until
+ * the streamer is destroyed.
+ */
+void SceneStreamer::loaderLoop()
+{
+  for (;;)
+  {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || !requests.empty(); });
+      if (stopping)
+      {
+        return;
+      }
+      auto next = std::min_element(requests.begin(), requests.end(),
+                                   [](const Request &a, const Request &b)
+                                   { return a.priority < b.priority; });
+      request = *next;
+      requests.erase(next);
+    }
+
+    Loaded loaded = load(request);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    finished.push_back(std::move(loaded));
+  }
+}
+
+/**
+ * @brief SceneStreamer::load Reads the files of a tile. Runs on the loader
+ * threads, so it only uses the request.
+ */
+SceneStreamer::Loaded SceneStreamer::load(const Request &request) const
+{
+  Loaded loaded;
+  loaded.tile = request.tile;
+  loaded.generation = request.generation;
+
+  QVector<QPair<QString, QByteArray>> meshAssets, imageAssets;
+  loaded.valid = readAssets(request.meshFile, meshAssets, loaded.fileBytes) &&
+                 readAssets(request.imageFile, imageAssets, loaded.fileBytes);
+  for (const QPair<QString, QByteArray> &asset : meshAssets)
+  {
+    MeshData mesh;
+    if (deserializeMesh(asset.second, mesh))
+    {
+      loaded.meshes.append({asset.first, mesh});
+    }
+    else
+    {
+      loaded.dropped.append(asset.first);
+    }
+  }
+  for (const QPair<QString, QByteArray> &asset : imageAssets)
+  {
+    Image image;
+    image.path = asset.first;
+    QDataStream stream(asset.second);
+    stream >> image.width >> image.height;
+    if (readArray(stream, image.texels) &&
+        image.texels.size() == image.width * image.height * 4)
+    {
+      loaded.images.append(image);
+    }
+    else
+    {
+      loaded.dropped.append(asset.first);
+    }
+  }
+
+  loaded.nanoseconds = clock.nsecsElapsed() - request.time;
+  return loaded;
+}
+
+bool SceneStreamer::update(const QVector3D &camera, const QVector3D &velocity)
+{
+  QElapsedTimer timer;
+  timer.start();
+  bool changed = false;
+
+  // Take over what the loaders finished
+  std::deque<Loaded> arrived;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    arrived.swap(finished);
+  }
+  for (Loaded &loaded : arrived)
+  {
+    if (loaded.generation != generation)
+    {
+      continue;
+    }
+    Tile &tile = tiles[loaded.tile];
+    if (tile.state != REQUESTED || !loaded.valid)
+    {
+      if (!loaded.valid)
+      {
+        qWarning() << "Streaming: cannot read tile" << tile.x << tile.z;
+      }
+      tile.state = tile.state == REQUESTED ? UNLOADED : tile.state;
+      discarded++;
+      continue;
+    }
+    tile.state = LOADED;
+    bytesRead += loaded.fileBytes;
+    loadNanoseconds += loaded.nanoseconds;
+    maxLoadNanoseconds = std::max(maxLoadNanoseconds, loaded.nanoseconds);
+    ready.push_back(std::move(loaded));
+  }
+
+  // Tiles near the camera or near where it is heading are wanted, nearest
+  // first, as long as they fit into the budget
+  QVector3D predicted = camera + velocity * settings.lookahead;
+  QVector<int> order;
+  for (int t = 0; t < tiles.size(); ++t)
+  {
+    Tile &tile = tiles[t];
+    tile.distance = groundDistance(camera, tile.boundsMin, tile.boundsMax);
+    tile.priority =
+        std::min(tile.distance, groundDistance(predicted, tile.boundsMin, tile.boundsMax));
+    tile.wanted = false;
+    order.append(t);
+  }
+  std::sort(order.begin(), order.end(),
+            [this](int a, int b) { return tiles[a].priority < tiles[b].priority; });
+
+  qint64 budget = qint64(settings.budget) * 1024 * 1024;
+  qint64 kept = 0;
+  for (int t : order)
+  {
+    Tile &tile = tiles[t];
+    if (tile.priority > settings.radius || kept + tile.bytes > budget)
+    {
+      break;
+    }
+    tile.wanted = true;
+    kept += tile.bytes;
+  }
+
+  // Loaded tiles just outside the radius are kept while they fit, so moving
+  // back and forth on the border does not reload them
+  float keepRadius = settings.radius + 0.5F * settings.tileSize;
+  int missing = 0;
+  for (int t : order)
+  {
+    Tile &tile = tiles[t];
+    bool keep = tile.wanted;
+    if (!keep && (tile.state == LOADED || tile.state == RESIDENT) &&
+        tile.priority <= keepRadius && kept + tile.bytes <= budget)
+    {
+      keep = true;
+      kept += tile.bytes;
+    }
+
+    if (tile.state == RESIDENT && !keep)
+    {
+      unload(t);
+      changed = true;
+    }
+    else if (tile.state == LOADED && !keep)
+    {
+      ready.erase(std::find_if(ready.begin(), ready.end(),
+                               [t](const Loaded &loaded) { return loaded.tile == t; }));
+      tile.state = UNLOADED;
+      discarded++;
+    }
+    else if (tile.state == REQUESTED && !tile.wanted)
+    {
+      // A load in flight is dropped when it arrives
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                    [t](const Request &request) { return request.tile == t; }),
+                     requests.end());
+      tile.state = UNLOADED;
+    }
+    else if (tile.state == UNLOADED && tile.wanted)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requests.push_back({t, tile.priority, generation, clock.nsecsElapsed(),
+                          tileFile(t, "mesh"), tileFile(t, "tex")});
+      tile.state = REQUESTED;
+      wake.notify_one();
+    }
+
+    if (tile.distance <= settings.radius && tile.state != RESIDENT)
+    {
+      missing++;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Request &request : requests)
+    {
+      request.priority = tiles[request.tile].priority;
+    }
+  }
+  missingTiles += missing;
+  missingFrames += missing > 0 ? 1 : 0;
+
+  // Upload the nearest finished tiles, at least one per frame
+  std::sort(ready.begin(), ready.end(), [this](const Loaded &a, const Loaded &b)
+            { return tiles[a.tile].priority < tiles[b.tile].priority; });
+  qint64 uploaded = 0;
+  while (!ready.empty() && (uploaded == 0 || uploaded + ready.front().fileBytes <= uploadBudget))
+  {
+    uploaded += ready.front().fileBytes;
+    upload(ready.front());
+    ready.pop_front();
+    changed = true;
+  }
+  peakBytes = std::max(peakBytes, residentBytes());
+
+  float milliseconds = timer.nsecsElapsed() / 1.0e6F;
+  frames++;
+  updateTime += milliseconds;
+  maxUpdateTime = std::max(maxUpdateTime, milliseconds);
+  hitches += milliseconds > hitchMilliseconds ? 1 : 0;
+  return changed;
+}
+
+/**
+ * @brief SceneStreamer::upload Makes a read tile resident: uploads the meshes
+ * and textures no other resident tile has yet and creates its actors.
+ */
+void SceneStreamer::upload(const Loaded &loaded)
+{
+  Tile &tile = tiles[loaded.tile];
+  if (!loaded.dropped.isEmpty())
+  {
+    qWarning() << "Streaming: tile" << tile.x << tile.z << "has broken assets, skipping"
+               << loaded.dropped;
+  }
+
+  // Exactly these keys are released again by unload(), so assets that were
+  // dropped never lose a user another tile holds
+  tile.meshKeys.clear();
+  tile.textureKeys.clear();
+  for (const QPair<QString, MeshData> &mesh : loaded.meshes)
+  {
+    if (tile.meshKeys.contains(mesh.first))
+    {
+      continue;
+    }
+    tile.meshKeys.append(mesh.first);
+    MeshEntry &entry = meshes[mesh.first];
+    if (entry.users++ == 0)
+    {
+      // The program only matters for drawing, prototypes are never drawn
+      entry.prototype = glEnabled ? new Actor(mesh.second, programFor(0)) : nullptr;
+      entry.bytes = mesh.second.bytes();
+      meshBytes += entry.bytes;
+    }
+  }
+  for (const Image &image : loaded.images)
+  {
+    if (tile.textureKeys.contains(image.path))
+    {
+      continue;
+    }
+    tile.textureKeys.append(image.path);
+    TextureEntry &entry = images[image.path];
+    if (entry.users++ == 0)
+    {
+      if (glEnabled)
+      {
+        textures.insert(image.path, image.width, image.height, image.texels);
+      }
+      entry.bytes = image.texels.size();
+      textureBytes += entry.bytes;
+    }
+  }
+
+  QVector<Actor> &actors = residentActors[loaded.tile];
+  tile.residentEntries.clear();
+  for (int a : tile.actors)
+  {
+    const ActorDescription &description = streamed[a];
+    const MeshEntry &mesh = meshes.value(description.mesh);
+    if (!glEnabled || !mesh.prototype)
+    {
+      continue;
+    }
+    const MaterialDescription &material = description.material;
+    int features = SceneLoader::shaderFeatures(
+        description, textures.layer(material.diffuse).texture != 0,
+        textures.layer(material.emission).texture != 0,
+        textures.layer(material.normal).texture != 0,
+        textures.layer(material.specular).texture != 0);
+    Actor actor(*mesh.prototype, programFor(features));
+    SceneLoader::configure(actor, description, features);
+    SceneLoader::assignTextures(actor, material, textures);
+    actors.append(actor);
+    tile.residentEntries.append(a);
+  }
+  tile.state = RESIDENT;
+  loads++;
+}
+
+/**
+ * @brief SceneStreamer::unload Drops the actors of a resident tile and the
+ * meshes and textures no other resident tile uses.
+ */
+void SceneStreamer::unload(int tile)
+{
+  for (const QString &path : tiles[tile].meshKeys)
+  {
+    auto it = meshes.find(path);
+    if (it == meshes.end() || --it.value().users > 0)
+    {
+      continue;
+    }
+    if (it.value().prototype)
+    {
+      it.value().prototype->destroyMesh();
+      delete it.value().prototype;
+    }
+    meshBytes -= it.value().bytes;
+    meshes.erase(it);
+  }
+
+  for (const QString &path : tiles[tile].textureKeys)
+  {
+    auto it = images.find(path);
+    if (it == images.end() || --it.value().users > 0)
+    {
+      continue;
+    }
+    textures.remove(path);
+    textureBytes -= it.value().bytes;
+    images.erase(it);
+  }
+  tiles[tile].meshKeys.clear();
+  tiles[tile].textureKeys.clear();
+  tiles[tile].residentEntries.clear();
+
+  residentActors.remove(tile);
+  tiles[tile].state = UNLOADED;
+  unloads++;
+}
+
+void SceneStreamer::appendActors(QVector<Actor> &actors) const
+{
+  for (const QVector<Actor> &tileActors : residentActors)
+  {
+    actors += tileActors;
+  }
+}
+
+QVector<ActorDescription> SceneStreamer::residentDescriptions() const
+{
+  QVector<ActorDescription> descriptions;
+  for (auto it = residentActors.constBegin(); it != residentActors.constEnd(); ++it)
+  {
+    for (int entry : tiles[it.key()].residentEntries)
+    {
+      descriptions.append(streamed[entry]);
+    }
+  }
+  return descriptions;
+}
+
+void SceneStreamer::report() const
+{
+  const float megabyte = 1024.0F * 1024.0F;
+  qDebug().noquote() << QString("Streaming: %1 of %2 tiles resident, %3 of %4 MB, peak %5 MB")
+                            .arg(residentTileCount())
+                            .arg(tiles.size())
+                            .arg(residentBytes() / megabyte, 0, 'f', 1)
+                            .arg(settings.budget)
+                            .arg(peakBytes / megabyte, 0, 'f', 1);
+  qDebug().noquote() << QString("Streaming: %1 loads, %2 unloads, %3 discarded, %4 MB read, "
+                                "%5 ms per load on average, %6 ms at most")
+                            .arg(loads)
+                            .arg(unloads)
+                            .arg(discarded)
+                            .arg(bytesRead / megabyte, 0, 'f', 1)
+                            .arg(loads > 0 ? loadNanoseconds / 1.0e6 / loads : 0.0, 0, 'f', 2)
+                            .arg(maxLoadNanoseconds / 1.0e6, 0, 'f', 2);
+  qDebug().noquote() << QString("Streaming: update %1 ms on average, %2 ms at most, %3 of %4 "
+                                "frames over %5 ms; %6 missing tiles in %7 frames")
+                            .arg(frames > 0 ? updateTime / frames : 0.0F, 0, 'f', 3)
+                            .arg(maxUpdateTime, 0, 'f', 3)
+                            .arg(hitches)
+                            .arg(frames)
+                            .arg(hitchMilliseconds)
+                            .arg(missingTiles)
+                            .arg(missingFrames);
+}
+
+/**
+ * @brief SceneStreamer::writeBenchmarkWorld Writes a side x side tile world
+ * into a cache in a directory, replacing its content, and returns its scene.
+ */
+SceneDescription SceneStreamer::writeBenchmarkWorld(const QString &path, int side,
+                                                    float tileSize)
+{
+  const int textureSize = 256;
+  const int groundTextures = 4;
+
+  QDir directory(path);
+  directory.removeRecursively();
+  directory.mkpath(".");
+
+  // Per tile a block with its own mesh and facade texture, and the ground,
+  // whose mesh and textures are shared by many tiles. The world is written
+  // straight into the cache, the way a bake leaves it; its source files do
+  // not exist.
+  SceneDescription scene;
+  scene.streaming.enabled = true;
+  scene.streaming.tileSize = tileSize;
+  scene.streaming.radius = 160.0F;
+  scene.streaming.budget = 40;
+  scene.streaming.cache = directory.path();
+  for (int z = 0; z < side; ++z)
+  {
+    for (int x = 0; x < side; ++x)
+    {
+      QMatrix4x4 transform;
+      transform.translate((x - side / 2) * tileSize, 0.0F, (z - side / 2) * tileSize);
+      QString suffix = QString("%1_%2").arg(x).arg(z);
+
+      ActorDescription block;
+      block.name = "block_" + suffix;
+      block.mesh = directory.filePath("block_" + suffix + ".obj");
+      block.shader = "gbuffer";
+      block.material.diffuse = directory.filePath("facade_" + suffix + ".png");
+      block.transform = transform;
+      scene.actors.append(block);
+
+      ActorDescription ground;
+      ground.name = "ground_" + suffix;
+      ground.mesh = directory.filePath("ground.obj");
+      ground.shader = "gbuffer";
+      ground.material.diffuse =
+          directory.filePath(QString("street_%1.png").arg((x + z) % groundTextures));
+      ground.transform = transform;
+      scene.actors.append(ground);
+    }
+  }
+
+  SceneStreamer writer;
+  writer.settings = scene.streaming;
+  writer.streamed = scene.actors;
+  std::mt19937 random(7);
+  MeshData groundData = syntheticGround(tileSize);
+  QByteArray groundMesh = serializeMesh(groundData);
+  qint64 groundBytes = groundData.bytes();
+  QVector<QByteArray> streets;
+  for (int i = 0; i < groundTextures; ++i)
+  {
+    streets.append(serializeImage(textureSize, textureSize, syntheticTexture(random, textureSize)));
+  }
+  qint64 textureBytes = qint64(textureSize) * textureSize * 4;
+  qint64 diskBytes = 0;
+  for (int t = 0; t < side * side; ++t)
+  {
+    const ActorDescription &block = scene.actors[2 * t];
+    const ActorDescription &ground = scene.actors[2 * t + 1];
+    MeshData blockMesh = syntheticBlock(random, tileSize);
+
+    Tile tile;
+    tile.x = t % side - side / 2;
+    tile.z = t / side - side / 2;
+    tile.boundsMin = QVector3D(tile.x * tileSize, 0.0F, tile.z * tileSize);
+    tile.boundsMax = tile.boundsMin + QVector3D(tileSize, blockMesh.boundsMax.y(), tileSize);
+    tile.actors = {2 * t, 2 * t + 1};
+    tile.bytes = blockMesh.bytes() + groundBytes + 2 * textureBytes;
+    writer.tiles.append(tile);
+
+    QVector<QPair<QString, QByteArray>> meshAssets{{block.mesh, serializeMesh(blockMesh)},
+                                                  {ground.mesh, groundMesh}};
+    QVector<QPair<QString, QByteArray>> imageAssets{
+        {block.material.diffuse,
+         serializeImage(textureSize, textureSize, syntheticTexture(random, textureSize))},
+        {ground.material.diffuse, streets[(t % side + t / side) % groundTextures]}};
+    writeAssets(writer.tileFile(t, "mesh"), meshAssets);
+    writeAssets(writer.tileFile(t, "tex"), imageAssets);
+    diskBytes += QFileInfo(writer.tileFile(t, "mesh")).size() +
+                 QFileInfo(writer.tileFile(t, "tex")).size();
+  }
+  writer.writeIndex(directory.filePath("index.bin"), cacheKey(scene, scene.actors));
+  qDebug().noquote() << QString("Streaming benchmark: %1 tiles of %2 m, %3 MB on disk, "
+                                "budget %4 MB, radius %5 m")
+                            .arg(side * side)
+                            .arg(tileSize)
+                            .arg(diskBytes / (1024.0 * 1024.0), 0, 'f', 1)
+                            .arg(scene.streaming.budget)
+                            .arg(scene.streaming.radius);
+  return scene;
+}
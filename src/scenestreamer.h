@@ -0,0 +1,261 @@
+#ifndef SCENESTREAMER_H
+#define SCENESTREAMER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QString>
+#include <QStringList>
+#include <QVector3D>
+#include <QVector>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "actor.h"
+#include "sceneloader.h"
+#include "scenedescription.h"
+#include "texturearrays.h"
+
+/**
+ * @brief The SceneStreamer class keeps only the static actors near the camera
+ * in memory, for scenes too large to load at once.
+ *
+ * The ground plane is divided into square tiles and every static actor belongs
+ * to the tile under the center of its bounds. Opening a scene bakes a cache
+ * next to it, once: per tile a mesh file with the levels of detail of its
+ * meshes, ready for the vertex buffers, and a texture file with its images
+ * already scaled to their texture array layer size. Loading a tile then only
+ * reads two files, without parsing or simplifying anything.
+ *
+ * Every frame the tiles within the radius of the camera are wanted, and so
+ * are the ones within the radius of where the camera will be after the
+ * lookahead time at its current velocity, nearest first until the memory
+ * budget is used up. Loader threads read the wanted tiles in that order. The
+ * GL thread turns a few finished tiles per frame into actors, and unloads the
+ * tiles that are neither wanted nor within a small margin of the radius, so
+ * tiles on the border do not load and unload over and over. Shared meshes and
+ * textures stay resident while any tile uses them. Without initialize(), tiles
+ * become resident without any GL resources, which the stress test uses.
+ */
+class SceneStreamer : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  // Frames whose update() takes longer than this count as hitches
+  static constexpr float hitchMilliseconds = 2.0F;
+  // Threads reading tiles
+  static const int loaderCount = 2;
+
+  SceneStreamer();
+  ~SceneStreamer();
+
+  SceneStreamer(const SceneStreamer &) = delete;
+  SceneStreamer &operator=(const SceneStreamer &) = delete;
+
+  void initialize();
+
+  void setProgramSelector(const SceneLoader::ProgramSelector &selector)
+  {
+    programFor = selector;
+  }
+
+  /**
+   * @brief Whether an entry is streamed: static actors of the geometry pass
+   * placed in world space. The water, dynamic actors and actors with a parent
+   * are always loaded.
+   */
+  static bool isStreamed(const ActorDescription &description);
+
+  /**
+   * @brief Unloads the previous scene and starts streaming the streamed
+   * actors of this one, baking their cache if it is missing or out of date.
+   * Requires a current context after initialize().
+   * @return The entries that are not streamed, for the SceneLoader.
+   */
+  QVector<ActorDescription> open(const SceneDescription &scene);
+
+  /**
+   * @brief Unloads all tiles. Requires a current context after initialize().
+   */
+  void close();
+
+  bool isOpen() const { return !tiles.isEmpty(); }
+
+  // Whether tiles are being read or wait for their upload
+  bool isBusy() const;
+
+  /**
+   * @brief Requests and unloads tiles for a camera at a position, moving with
+   * a velocity in units per second, and turns finished tiles into actors
+   * until uploadBudget bytes are uploaded. Never waits for the loaders.
+   * @return Whether the resident actors changed.
+   */
+  bool update(const QVector3D &camera, const QVector3D &velocity);
+
+  /**
+   * @brief Appends the actors of the resident tiles, in tile order.
+   */
+  void appendActors(QVector<Actor> &actors) const;
+
+  /**
+   * @brief The entries of the resident actors, in the order of appendActors.
+   */
+  QVector<ActorDescription> residentDescriptions() const;
+
+  void setUploadBudget(qint64 bytes) { uploadBudget = bytes; }
+
+  int tileCount() const { return tiles.size(); }
+  int residentTileCount() const { return residentActors.size(); }
+  qint64 residentBytes() const { return meshBytes + textureBytes; }
+
+  /**
+   * @brief Logs the resident tiles and memory, the loads, the time update()
+   * took and the tiles that were missing inside the radius.
+   */
+  void report() const;
+
+  /**
+   * @brief Writes a synthetic city of side x side tiles straight into a cache
+   * directory, the way a bake leaves it, for StreamingBenchmark. Every tile
+   * has a block with its own mesh and texture and a piece of ground shared
+   * with other tiles. No GL.
+   * @return The scene of the world; its source files do not exist.
+   */
+  static SceneDescription writeBenchmarkWorld(const QString &path, int side, float tileSize);
+
+private:
+  enum State
+  {
+    UNLOADED,
+    REQUESTED, // queued or being read by a loader
+    LOADED,    // read, waiting for its upload
+    RESIDENT
+  };
+
+  struct Tile
+  {
+    int x = 0;
+    int z = 0;
+    QVector3D boundsMin; // world space, of all its actors
+    QVector3D boundsMax;
+    QVector<int> actors; // into streamed
+    qint64 bytes = 0;    // of its meshes and textures, shared ones included
+    State state = UNLOADED;
+    float distance = 0.0F; // to the camera, on the ground plane
+    float priority = 0.0F; // the smaller of that and the predicted distance
+    bool wanted = false;
+    // The meshes and textures upload() took a user of, released by unload()
+    QStringList meshKeys;
+    QStringList textureKeys;
+    // Per resident actor, in order, its entry in streamed
+    QVector<int> residentEntries;
+  };
+
+  struct Image
+  {
+    QString path;
+    int width = 0;
+    int height = 0;
+    QVector<quint8> texels; // RGBA, bottom row first
+  };
+
+  struct Request
+  {
+    int tile;
+    float priority;
+    int generation;
+    qint64 time; // of the request, on clock
+    QString meshFile;
+    QString imageFile;
+  };
+
+  struct Loaded
+  {
+    int tile = -1;
+    int generation = 0;
+    bool valid = false;
+    QVector<QPair<QString, MeshData>> meshes;
+    QVector<Image> images;
+    qint64 fileBytes = 0;
+    qint64 nanoseconds = 0; // from the request to the end of reading
+    QStringList dropped;    // assets that could not be decoded
+  };
+
+  struct MeshEntry
+  {
+    Actor *prototype = nullptr; // nullptr without GL
+    int users = 0;
+    qint64 bytes = 0;
+  };
+
+  struct TextureEntry
+  {
+    int users = 0;
+    qint64 bytes = 0;
+  };
+
+  QString tileFile(int tile, const char *extension) const;
+  static QByteArray cacheKey(const SceneDescription &scene,
+                             const QVector<ActorDescription> &streamed);
+  bool readIndex(const QString &path, const QByteArray &key);
+  bool writeIndex(const QString &path, const QByteArray &key) const;
+  bool bake();
+  static bool writeAssets(const QString &path, const QVector<QPair<QString, QByteArray>> &assets);
+
+  void startLoaders();
+  void stopLoaders();
+  void loaderLoop();
+  Loaded load(const Request &request) const;
+
+  void upload(const Loaded &loaded);
+  void unload(int tile);
+
+  SceneLoader::ProgramSelector programFor;
+  bool glEnabled = false;
+
+  StreamingDescription settings;
+  QVector<ActorDescription> streamed;
+  QVector<Tile> tiles;
+
+  // GL thread only
+  std::deque<Loaded> ready; // read, in the order they will be uploaded
+  QMap<int, QVector<Actor>> residentActors; // by tile
+  QHash<QString, MeshEntry> meshes;
+  QHash<QString, TextureEntry> images;
+  TextureArrays textures;
+  qint64 meshBytes = 0;
+  qint64 textureBytes = 0;
+  qint64 uploadBudget = 16 * 1024 * 1024;
+  int generation = 0;
+
+  // Shared with the loaders
+  std::vector<std::thread> loaders;
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  std::vector<Request> requests;
+  std::deque<Loaded> finished;
+  bool stopping = false;
+  QElapsedTimer clock;
+
+  // Statistics since open()
+  int frames = 0;
+  int hitches = 0;
+  float updateTime = 0.0F; // milliseconds, summed
+  float maxUpdateTime = 0.0F;
+  int missingTiles = 0;  // tile frames inside the radius without the tile
+  int missingFrames = 0; // frames with any
+  int loads = 0;
+  int unloads = 0;
+  int discarded = 0; // read but no longer wanted
+  qint64 bytesRead = 0;
+  qint64 loadNanoseconds = 0;
+  qint64 maxLoadNanoseconds = 0;
+  qint64 peakBytes = 0;
+};
+
+#endif // SCENESTREAMER_H
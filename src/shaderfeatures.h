@@ -0,0 +1,39 @@
+#ifndef SHADERFEATURES_H
+#define SHADERFEATURES_H
+
+#include <QStringList>
+
+/**
+ * @brief Features a geometry pass program is specialized for. Every set bit
+ * becomes a #define of the same name in the shader sources, so materials only
+ * pay for what they use and the shaders do not branch per draw.
+ */
+enum ShaderFeature
+{
+  DIFFUSE_MAP = 0x1,
+  EMISSION_MAP = 0x2,
+  WATER_SURFACE = 0x4, // displaced by the waves, per pixel wave normals
+  STATIC_BATCH = 0x8,  // per draw data from the static batches' buffer
+  NORMAL_MAP = 0x10,
+  SPECULAR_MAP = 0x20, // per pixel reflectiveness
+};
+
+/**
+ * @brief shaderDefines The #define names of a feature combination.
+ */
+inline QStringList shaderDefines(int features)
+{
+  QStringList defines;
+  const char *names[] = {"DIFFUSE_MAP",  "EMISSION_MAP", "WATER_SURFACE",
+                         "STATIC_BATCH", "NORMAL_MAP",   "SPECULAR_MAP"};
+  for (int bit = 0; bit < 6; ++bit)
+  {
+    if (features & (1 << bit))
+    {
+      defines.append(names[bit]);
+    }
+  }
+  return defines;
+}
+
+#endif // SHADERFEATURES_H
@@ -0,0 +1,190 @@
+#include "shadermanager.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+
+#include "shaderfeatures.h"
+
+ShaderManager::ShaderManager(QObject *parent) : QObject(parent)
+{
+  shaderDir = qEnvironmentVariable("SHADER_DIR");
+  if (!shaderDir.isEmpty())
+  {
+    qDebug() << "Shaders: reading and watching" << shaderDir;
+  }
+
+  connect(&watcher, &QFileSystemWatcher::fileChanged, this,
+          &ShaderManager::onFileChanged);
+}
+
+bool ShaderManager::load(QOpenGLShaderProgram &program, const QStringList &vertPaths,
+                         const QStringList &fragPaths, const QStringList &defines)
+{
+  Entry entry{&program, vertPaths, fragPaths, defines};
+
+  for (const QStringList &paths : {vertPaths, fragPaths})
+  {
+    for (const QString &path : paths)
+    {
+      QString file = resolve(path);
+      if (!file.startsWith(":") && !watcher.files().contains(file))
+      {
+        watcher.addPath(file);
+      }
+    }
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  bool linked = build(program, entry);
+  qDebug() << "Shaders:" << fragPaths.last() << defines << "ready in" << timer.elapsed()
+           << "ms";
+
+  entries.append(entry);
+  return linked;
+}
+
+/**
+ * @brief ShaderManager::reload Validates the new sources in a scratch program
+ * before touching the live one. The live program is relinked in place (rather
+ * than replaced) because actors hold references to it; after a successful
+ * scratch link the binary is in the cache, so the second link is cheap.
+ */
+bool ShaderManager::reload(const QString &path)
+{
+  bool reloaded = false;
+
+  for (const Entry &entry : entries)
+  {
+    bool uses = false;
+    for (const QStringList &paths : {entry.vertPaths, entry.fragPaths})
+    {
+      for (const QString &source : paths)
+      {
+        uses = uses || resolve(source) == path;
+      }
+    }
+    if (!uses)
+    {
+      continue;
+    }
+
+    QOpenGLShaderProgram scratch;
+    if (!build(scratch, entry))
+    {
+      qWarning() << "Shaders: keeping the last good version of"
+                 << entry.fragPaths.last();
+      continue;
+    }
+
+    entry.program->removeAllShaders();
+    build(*entry.program, entry);
+    qDebug() << "Shaders: reloaded" << entry.fragPaths.last();
+    reloaded = true;
+  }
+
+  return reloaded;
+}
+
+void ShaderManager::onFileChanged(const QString &path)
+{
+  // Editors that save by replacing the file drop it from the watcher
+  if (QFileInfo::exists(path) && !watcher.files().contains(path))
+  {
+    watcher.addPath(path);
+  }
+  emit sourceChanged(path);
+}
+
+/**
+ * @brief ShaderManager::resolve Maps a resource path (":/shaders/x.glsl") to the
+ * file in SHADER_DIR when there is one.
+ */
+QString ShaderManager::resolve(const QString &path) const
+{
+  if (shaderDir.isEmpty())
+  {
+    return path;
+  }
+
+  QString file = shaderDir + "/" + QFileInfo(path).fileName();
+  return QFileInfo::exists(file) ? file : path;
+}
+
+/**
+ * @brief ShaderManager::source Reads a shader source and inserts the defines
+ * after its #version line. A #line directive keeps the line numbers of
+ * compile errors matching the file.
+ */
+QByteArray ShaderManager::source(const QString &path, const QStringList &defines) const
+{
+  QFile file(resolve(path));
+  if (!file.open(QIODevice::ReadOnly))
+  {
+    qWarning() << "Shaders: cannot read" << file.fileName();
+    return QByteArray();
+  }
+  QByteArray code = file.readAll();
+  if (defines.isEmpty())
+  {
+    return code;
+  }
+
+  int versionEnd = code.startsWith("#version") ? code.indexOf('\n') + 1 : 0;
+  QByteArray header;
+  for (const QString &define : defines)
+  {
+    header += "#define " + define.toUtf8() + "\n";
+  }
+  header += "#line " + QByteArray::number(versionEnd > 0 ? 2 : 1) + "\n";
+  return code.insert(versionEnd, header);
+}
+
+bool ShaderManager::build(QOpenGLShaderProgram &program, const Entry &entry) const
+{
+  // The cache is keyed by the source code, so every variant gets its own entry
+  for (const QString &path : entry.vertPaths)
+  {
+    program.addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, source(path, entry.defines));
+  }
+  for (const QString &path : entry.fragPaths)
+  {
+    program.addCacheableShaderFromSourceCode(QOpenGLShader::Fragment,
+                                             source(path, entry.defines));
+  }
+
+  // Cacheable shaders are only compiled on a cache miss, during link(), so
+  // this reports compile errors as well
+  if (!program.link())
+  {
+    qWarning().noquote() << "Shaders: failed to build" << entry.fragPaths.last()
+                         << entry.defines.join(" ") << "\n"
+                         << program.log();
+    return false;
+  }
+  return true;
+}
+
+ShaderVariants::ShaderVariants(const QStringList &vertPaths, const QStringList &fragPaths)
+    : vertPaths(vertPaths), fragPaths(fragPaths)
+{
+}
+
+ShaderVariants::~ShaderVariants()
+{
+  qDeleteAll(variants);
+}
+
+QOpenGLShaderProgram &ShaderVariants::get(ShaderManager &shaders, int features)
+{
+  QOpenGLShaderProgram *program = variants.value(features, nullptr);
+  if (!program)
+  {
+    program = new QOpenGLShaderProgram();
+    shaders.load(*program, vertPaths, fragPaths, shaderDefines(features));
+    variants.insert(features, program);
+  }
+  return *program;
+}
@@ -0,0 +1,112 @@
+#ifndef SHADERMANAGER_H
+#define SHADERMANAGER_H
+
+#include <QFileSystemWatcher>
+#include <QHash>
+#include <QObject>
+#include <QOpenGLShaderProgram>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * @brief The ShaderManager class builds the shader programs and reloads them
+ * when their sources change.
+ *
+ * Programs are linked through Qt's cacheable shader API, which stores the
+ * linked program binary (glGetProgramBinary) on disk keyed by a hash of the
+ * sources. Later runs load the binary instead of compiling, unless a source
+ * changed.
+ *
+ * Shaders are read from the Qt resources by default. When SHADER_DIR points to
+ * the shaders directory of a checkout, files found there are used instead and
+ * watched. A changed file is compiled into a scratch program first, so a
+ * broken edit only logs the errors and the last good program stays in use.
+ *
+ * Programs can be specialized with preprocessor symbols, which are defined
+ * right after the #version line of every source.
+ */
+class ShaderManager : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit ShaderManager(QObject *parent = nullptr);
+
+  /**
+   * @brief Compiles and links a program from several shader objects per stage.
+   * @param program Program to (re)build.
+   * @param vertPaths Resource paths of the vertex stage sources.
+   * @param fragPaths Resource paths of the fragment stage sources.
+   * @param defines Symbols to #define in every source.
+   * @return Whether the program linked.
+   */
+  bool load(QOpenGLShaderProgram &program, const QStringList &vertPaths,
+            const QStringList &fragPaths, const QStringList &defines = {});
+
+  /**
+   * @brief Rebuilds every program that uses the given file. Requires a current
+   * context.
+   * @return Whether any program was rebuilt.
+   */
+  bool reload(const QString &path);
+
+signals:
+  /**
+   * @brief Emitted when a watched source file changed on disk.
+   */
+  void sourceChanged(const QString &path);
+
+private slots:
+  void onFileChanged(const QString &path);
+
+private:
+  struct Entry
+  {
+    QOpenGLShaderProgram *program;
+    QStringList vertPaths;
+    QStringList fragPaths;
+    QStringList defines;
+  };
+
+  QString resolve(const QString &path) const;
+  QByteArray source(const QString &path, const QStringList &defines) const;
+  bool build(QOpenGLShaderProgram &program, const Entry &entry) const;
+
+  QString shaderDir;
+  QVector<Entry> entries;
+  QFileSystemWatcher watcher;
+};
+
+/**
+ * @brief The ShaderVariants class is a program specialized by feature bits
+ * (see ShaderFeature). Each combination is built on first use and cached by
+ * its feature key; actors pick theirs once when they are created.
+ */
+class ShaderVariants
+{
+public:
+  ShaderVariants(const QStringList &vertPaths, const QStringList &fragPaths);
+  ~ShaderVariants();
+
+  ShaderVariants(const ShaderVariants &) = delete;
+  ShaderVariants &operator=(const ShaderVariants &) = delete;
+
+  /**
+   * @brief Returns the variant for a feature combination, building it with
+   * the shader manager on first use. Requires a current context.
+   */
+  QOpenGLShaderProgram &get(ShaderManager &shaders, int features);
+
+  /**
+   * @brief The variants built so far, e.g. to set per frame uniforms.
+   */
+  QList<QOpenGLShaderProgram *> programs() const { return variants.values(); }
+
+private:
+  QStringList vertPaths;
+  QStringList fragPaths;
+  QHash<int, QOpenGLShaderProgram *> variants;
+};
+
+#endif // SHADERMANAGER_H
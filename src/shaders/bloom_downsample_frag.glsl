@@ -0,0 +1,44 @@
+#version 330 core
+
+// Bloom downsample: one step of the dual filter (Kawase) chain. Halves the
+// resolution with 5 bilinear taps, which cover a 4x4 texel footprint while
+// reading far less memory than a Gaussian. The first step also applies the
+// brightness threshold to the lit image.
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D source;
+uniform vec2 sourceScale; // rendered part of source, in texture coordinates
+
+uniform bool prefilter;  // first step, apply the threshold
+uniform float threshold; // brightness where the bloom starts
+uniform float knee;      // width of the soft transition below the threshold
+
+vec3 sampleSource(vec2 uv, vec2 halfTexel) {
+    // Stay inside the rendered region so no stale pixels bleed in
+    return texture(source, clamp(uv, halfTexel, sourceScale - halfTexel)).rgb;
+}
+
+void main() {
+    vec2 halfTexel = 0.5 / vec2(textureSize(source, 0));
+    vec2 uv = TexCoords * sourceScale;
+
+    vec3 sum = sampleSource(uv, halfTexel) * 4.0;
+    sum += sampleSource(uv - halfTexel, halfTexel);
+    sum += sampleSource(uv + halfTexel, halfTexel);
+    sum += sampleSource(uv + vec2(halfTexel.x, -halfTexel.y), halfTexel);
+    sum += sampleSource(uv - vec2(halfTexel.x, -halfTexel.y), halfTexel);
+    vec3 color = sum / 8.0;
+
+    if(prefilter) {
+        // Quadratic soft knee, so the glow fades in instead of popping
+        float brightness = max(color.r, max(color.g, color.b));
+        float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+        soft = soft * soft / (4.0 * knee + 1e-4);
+        color *= max(soft, brightness - threshold) / max(brightness, 1e-4);
+    }
+
+    // R11F_G11F_B10F has no sign bit
+    FragColor = vec4(max(color, 0.0), 1.0);
+}
@@ -0,0 +1,34 @@
+#version 330 core
+
+// Bloom upsample: one step back up the dual filter chain. Doubles the
+// resolution of the blurred level below with an 8 tap tent and adds the
+// downsampled level of the same size, so every mip contributes to the glow.
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D source; // blurred, half the size of the output
+uniform vec2 sourceScale;
+uniform sampler2D detail; // downsample level of the output size
+uniform vec2 detailScale;
+
+vec3 sampleSource(vec2 uv, vec2 halfTexel) {
+    return texture(source, clamp(uv, halfTexel, sourceScale - halfTexel)).rgb;
+}
+
+void main() {
+    vec2 halfTexel = 0.5 / vec2(textureSize(source, 0));
+    vec2 uv = TexCoords * sourceScale;
+
+    vec3 sum = sampleSource(uv + vec2(-2.0 * halfTexel.x, 0.0), halfTexel);
+    sum += sampleSource(uv + vec2(2.0 * halfTexel.x, 0.0), halfTexel);
+    sum += sampleSource(uv + vec2(0.0, -2.0 * halfTexel.y), halfTexel);
+    sum += sampleSource(uv + vec2(0.0, 2.0 * halfTexel.y), halfTexel);
+    sum += sampleSource(uv + vec2(-halfTexel.x, halfTexel.y), halfTexel) * 2.0;
+    sum += sampleSource(uv + vec2(halfTexel.x, halfTexel.y), halfTexel) * 2.0;
+    sum += sampleSource(uv + vec2(halfTexel.x, -halfTexel.y), halfTexel) * 2.0;
+    sum += sampleSource(uv + vec2(-halfTexel.x, -halfTexel.y), halfTexel) * 2.0;
+
+    vec3 color = sum / 12.0 + texture(detail, TexCoords * detailScale).rgb;
+    FragColor = vec4(color, 1.0);
+}
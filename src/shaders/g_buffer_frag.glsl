@@ -7,6 +7,18 @@ in vec3 FragPos;      // View-space position
 in vec3 Normal;       // View-space normal (not yet normalized)
 in vec2 TexCoords;    // Texture coordinates
 in vec4 AlbedoReflectance;        // Vertex color
+in vec4 CurrentClip;      // Unjittered clip position
+in vec4 PreviousClip;     // Same point in the previous frame
+#if defined(DIFFUSE_MAP) || defined(EMISSION_MAP) || defined(NORMAL_MAP) || defined(SPECULAR_MAP)
+// Diffuse, emission, normal and specular layer in the texture arrays
+flat in vec4 MaterialLayers;
+#endif
+#ifdef NORMAL_MAP
+in vec4 Tangent; // View-space tangent, w: handedness
+#endif
+#ifdef WATER_SURFACE
+in vec2 WaveCoords;       // Lookup coordinates into the wave texture
+#endif
 
 // ------------------------------------------------------------------
 // OUTPUTS (Mapped to G-Buffer FBO Color Attachments)
@@ -15,15 +27,26 @@ layout(location = 0) out vec3 gPosition;   // Renders to gPosition texture (Atta
 layout(location = 1) out vec3 gNormal;     // Renders to gNormal texture (Attachment 1)
 layout(location = 2) out vec4 gAlbedoSpec; // Renders to gAlbedoSpec texture (Attachment 2)
 layout(location = 3) out vec3 gEmission;   // Renders to gEmission texture (Attachment 3)
+layout(location = 4) out vec2 gVelocity;   // Renders to gVelocity texture (Attachment 4)
 
 // ------------------------------------------------------------------
 // UNIFORMS (Material Data)
 // ------------------------------------------------------------------
 
-uniform sampler2D texDiffuse;
-uniform bool hasDiffuseTex;
-uniform sampler2D texEmission;
-uniform bool hasEmissionTex;
+// Which of these exist is decided per program variant, by the DIFFUSE_MAP,
+// EMISSION_MAP, NORMAL_MAP, SPECULAR_MAP and WATER_SURFACE defines. The maps
+// of all materials share texture arrays; each draw samples its own layers.
+uniform sampler2DArray texDiffuse;
+uniform sampler2DArray texEmission;
+uniform sampler2DArray texNormal;   // tangent space
+uniform sampler2DArray texSpecular; // reflectiveness in red
+
+#ifdef WATER_SURFACE
+uniform mat4 view;
+
+uniform bool useWaveTexture;
+uniform sampler2D waveTexture; // xyz: world-space normal, w: height
+#endif
 
 void main() {
     // 1. Store View-Space Position
@@ -34,24 +57,43 @@ void main() {
     // Normalize the normal to ensure correct vector length for lighting calculations.
     gNormal = normalize(Normal);
 
-    gEmission = vec3(1.0, 0.0, 0.0); // red emission for testing
+#ifdef NORMAL_MAP
+    // Tangent space to view space, re-orthogonalized after interpolation
+    vec3 T = normalize(Tangent.xyz - gNormal * dot(gNormal, Tangent.xyz));
+    vec3 B = Tangent.w * cross(gNormal, T);
+    vec3 mapped = texture(texNormal, vec3(TexCoords, MaterialLayers.z)).xyz * 2.0 - 1.0;
+    gNormal = normalize(mat3(T, B, gNormal) * mapped);
+#endif
 
-    vec3 Color = AlbedoReflectance.rgb;
+#ifdef WATER_SURFACE
+    // Per-pixel normals from the wave texture keep the small ripples sharp in
+    // the reflections, independent of the density of the water grid.
+    if(useWaveTexture) {
+        vec3 worldNormal = texture(waveTexture, WaveCoords).xyz;
+        gNormal = normalize(mat3(view) * worldNormal);
+    }
+#endif
 
     // 3. Store Albedo (Color) and Specular (Shininess/Intensity)
-    vec4 albedoColor = vec4(Color, 1.0);
-    if(hasDiffuseTex) {
-        albedoColor = texture(texDiffuse, TexCoords);
-    }
+    vec4 albedoColor = vec4(AlbedoReflectance.rgb, 1.0);
+#ifdef DIFFUSE_MAP
+    albedoColor = texture(texDiffuse, vec3(TexCoords, MaterialLayers.x));
+#endif
 
-    if(hasEmissionTex) {
-        gEmission = texture(texEmission, TexCoords).rgb;
-    } else {
-        gEmission = vec3(0.0);
-    }
+#ifdef EMISSION_MAP
+    gEmission = texture(texEmission, vec3(TexCoords, MaterialLayers.y)).rgb;
+#else
+    gEmission = vec3(0.0);
+#endif
 
-    gAlbedoSpec = vec4(albedoColor.rgb, AlbedoReflectance.a);
+    // Reflectiveness in alpha; SSR skips the pixels where it is 0
+#ifdef SPECULAR_MAP
+    float reflectiveness = texture(texSpecular, vec3(TexCoords, MaterialLayers.w)).r;
+#else
+    float reflectiveness = AlbedoReflectance.a;
+#endif
+    gAlbedoSpec = vec4(albedoColor.rgb, reflectiveness);
 
-    // Note: If you have a dedicated Specular Map, you would sample it here 
-    // and use the sampled value instead of a fixed uniform.
+    // Screen space motion since the last frame, in texture coordinates
+    gVelocity = (CurrentClip.xy / CurrentClip.w - PreviousClip.xy / PreviousClip.w) * 0.5;
 }
\ No newline at end of file
@@ -3,25 +3,69 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec3 aColor;
 layout(location = 2) in vec2 aTexCoords;
 layout(location = 3) in vec3 aNormal;
+#ifdef STATIC_BATCH
+layout(location = 4) in uint aDrawIndex; // baked into the merged vertices
+#endif
+layout(location = 5) in vec4 aTangent; // w: handedness of the UV mapping
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 out vec4 AlbedoReflectance;
+out vec4 Tangent; // view space, w: handedness
+flat out vec4 MaterialLayers;
+
+// Unjittered clip positions of this and the previous frame, for the velocity
+out vec4 CurrentClip;
+out vec4 PreviousClip;
+
+#ifdef STATIC_BATCH
+// Per draw data of the static batches, 8 texels per draw: model matrix
+// columns, world space normal matrix columns and the texture array layers
+uniform samplerBuffer drawData;
+#else
+// Per draw data, one slice of the draw list's uniform buffer per actor
+layout(std140) uniform DrawData {
+    mat4 model;
+    mat4 previousModel;
+    mat3 normalMatrix; // of view * model
+    ivec4 layers; // diffuse, emission, normal, specular layer in the texture arrays
+};
+#endif
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+uniform mat4 unjitteredViewProjection;
+uniform mat4 previousViewProjection;
+
 void main() {
+#ifdef STATIC_BATCH
+    int base = int(aDrawIndex) * 8;
+    mat4 model = mat4(texelFetch(drawData, base), texelFetch(drawData, base + 1),
+                      texelFetch(drawData, base + 2), texelFetch(drawData, base + 3));
+    mat3 worldNormalMatrix = mat3(texelFetch(drawData, base + 4).xyz,
+                                  texelFetch(drawData, base + 5).xyz,
+                                  texelFetch(drawData, base + 6).xyz);
+    // Static geometry only moves with the camera
+    mat4 previousModel = model;
+    mat3 normalMatrix = mat3(view) * worldNormalMatrix;
+    vec4 layers = texelFetch(drawData, base + 7);
+#endif
+
     // Calculate world-space or view-space position
     FragPos = vec3(view * model * vec4(aPos, 1.0));
     // Calculate view-space normal
-    Normal = mat3(transpose(inverse(view * model))) * aNormal;
+    Normal = normalMatrix * aNormal;
+    Tangent = vec4(mat3(view * model) * aTangent.xyz, aTangent.w);
 
     TexCoords = aTexCoords;
+    MaterialLayers = vec4(layers);
 
     AlbedoReflectance = vec4(aColor, 0.0);
 
+    CurrentClip = unjitteredViewProjection * model * vec4(aPos, 1.0);
+    PreviousClip = previousViewProjection * previousModel * vec4(aPos, 1.0);
+
     gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+}
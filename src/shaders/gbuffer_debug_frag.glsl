@@ -0,0 +1,35 @@
+#version 330 core
+
+// G-buffer debug view: shows a single channel of the G-buffer instead of the
+// lit image.
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D gPosition;
+uniform sampler2D gNormal;
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gEmission;
+uniform vec2 gBufferScale;
+
+// 1: normals, 2: albedo, 3: reflectiveness, 4: emission, 5: depth
+uniform int view;
+
+void main() {
+    vec2 coords = TexCoords * gBufferScale;
+    vec3 color;
+
+    if(view == 1) {
+        color = texture(gNormal, coords).rgb * 0.5 + 0.5;
+    } else if(view == 2) {
+        color = texture(gAlbedoSpec, coords).rgb;
+    } else if(view == 3) {
+        color = vec3(texture(gAlbedoSpec, coords).a);
+    } else if(view == 4) {
+        color = texture(gEmission, coords).rgb;
+    } else {
+        color = vec3(-texture(gPosition, coords).z / 20.0);
+    }
+
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 330 core
+
+// Runs over the pixels the geometry pass marked as reflective, before the
+// reflections. Pixels whose reflectiveness (from a specular map) is about 0
+// pass and get their stencil bit cleared, glossy ones are discarded and keep
+// it. SSR then only traces the glossy pixels of an actor, not all of them.
+
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedoSpec; // reflectiveness in alpha
+uniform vec2 gBufferScale;
+uniform float minReflectiveness;
+
+void main() {
+    if (texture(gAlbedoSpec, TexCoords * gBufferScale).a >= minReflectiveness) {
+        discard;
+    }
+}
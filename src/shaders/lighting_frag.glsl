@@ -8,56 +8,59 @@ uniform sampler2D gNormal; // normal in view space
 uniform sampler2D gAlbedoSpec;
 uniform sampler2D gEmission;
 
-// light const
-const vec3 lightDir = normalize(vec3(-0.2, -1.0, -0.3));
-
-uniform mat4 projection;
+// Directional light from the scene file
+uniform vec3 lightDir; // normalized
+uniform vec3 lightColor;
+
+// Cascaded shadow maps of the light, see ShadowMaps. Positions are in view
+// space, like the G-buffer.
+uniform bool useShadows;
+uniform sampler2DArrayShadow shadowMap;
+uniform int cascadeCount;
+uniform vec4 cascadeSplits;      // view space distance where each cascade ends
+uniform vec4 cascadeTexels;      // world size of a texel of each cascade
+uniform mat4 cascadeMatrices[4]; // view space to shadow map coordinates
+uniform float shadowTexelSize;   // 1 / shadow map size
+
+// The G-buffer is rendered into the lower left part of larger render targets
+// (dynamic resolution). Screen coordinates in [0, 1] are scaled by this to get
+// G-buffer texture coordinates.
+uniform vec2 gBufferScale;
 // uniform sampler2D gDepth; // You could sample this as well if needed
 
-vec3 ssrRaycast(vec3 O, vec3 R) {
-    float rayLength = 0.0;
-    const int maxSteps = 1000;
-    float stepSize = 0.1;
-
-    for(int i = 0; i < maxSteps; i++) {
-        rayLength += stepSize;
-        vec3 samplePoint = O + rayLength * R;
-
-        vec4 screenPos = projection * vec4(samplePoint, 1.0);
-        screenPos.xyz /= screenPos.w;
-        vec2 screenTexCoords = screenPos.xy * 0.5 + 0.5;
-
-        if(screenTexCoords.x < 0.0 || screenTexCoords.x > 1.0 ||
-            screenTexCoords.y < 0.0 || screenTexCoords.y > 1.0) {
-            return vec3(0.0); // Reflection ray left the screen
-        }
-
-        float sceneDepth = -texture(gPosition, screenTexCoords).z;
-
-        const float bias = 1.0;
-
-        float rayDepth = -samplePoint.z;
-
-        if(rayDepth > sceneDepth + bias) {
-            // hit!
-
-            vec3 reflectedColor = texture(gAlbedoSpec, screenTexCoords).rgb * 0.1 +
-                texture(gEmission, screenTexCoords).rgb;
-
-            // fade todo and potential edge fade
+// Fraction of the light that reaches a point, 1 beyond the last cascade
+float shadow(vec3 position, vec3 normal) {
+    int cascade = 0;
+    while (cascade < cascadeCount && -position.z > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade == cascadeCount) {
+        return 1.0;
+    }
 
-            return reflectedColor;
+    // Moving the point along the normal by about a texel keeps surfaces from
+    // shadowing themselves
+    vec3 offset = normal * cascadeTexels[cascade] * 1.5;
+    vec4 coords = cascadeMatrices[cascade] * vec4(position + offset, 1.0);
+    float depth = min(coords.z, 1.0);
+
+    // 3x3 percentage closer filter; every tap compares and blends 2x2 texels
+    float lit = 0.0;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            vec2 uv = coords.xy + vec2(x, y) * shadowTexelSize;
+            lit += texture(shadowMap, vec4(uv, float(cascade), depth));
         }
     }
-
-    return vec3(0.0);
+    return lit / 9.0;
 }
 
 void main() {
     // Retrieve data from the G-Buffer using the screen-space texture coordinates
-    vec3 FragPos = texture(gPosition, TexCoords).rgb;
-    vec3 Normal = texture(gNormal, TexCoords).rgb;   // <-- The Normal Buffer
-    vec4 AlbedoSpec = texture(gAlbedoSpec, TexCoords);
+    vec2 gBufferCoords = TexCoords * gBufferScale;
+    vec3 FragPos = texture(gPosition, gBufferCoords).rgb;
+    vec3 Normal = texture(gNormal, gBufferCoords).rgb;   // <-- The Normal Buffer
+    vec4 AlbedoSpec = texture(gAlbedoSpec, gBufferCoords);
     vec3 Albedo = AlbedoSpec.rgb;
     float Reflectiveness = AlbedoSpec.a;
 
@@ -71,7 +74,7 @@ void main() {
 
     // Standard lighting calculation goes here, using FragPos, Normal, and Albedo.
 
-    vec3 diffuseLight = max(dot(normalize(Normal), -lightDir), 0.0) * vec3(0.6);
+    vec3 diffuseLight = max(dot(normalize(Normal), -lightDir), 0.0) * lightColor;
     vec3 ambientLight = vec3(0.1);
 
     // compute specular
@@ -80,23 +83,15 @@ void main() {
     vec3 R = reflect(-L, normalize(Normal));
     float spec = pow(max(dot(R, V), 0.0), 32);
 
-    vec3 emission = texture(gEmission, TexCoords).rgb;
+    vec3 emission = texture(gEmission, gBufferCoords).rgb;
 
-    vec3 finalColor = (ambientLight + diffuseLight + spec) * Albedo + emission;
+    float lit = useShadows ? shadow(FragPos, normalize(Normal)) : 1.0;
+    vec3 finalColor = (ambientLight + lit * (diffuseLight + spec)) * Albedo + emission;
     FragColor = vec4(finalColor, 1.0);
 
     // visualizing the reflectiveness (a of gAlbedoSpec)
     // FragColor = vec4(vec3(Reflectiveness), 1.0);
 
-    if(Reflectiveness > 0.0) {
-        vec3 V = normalize(-FragPos); // vector from point to camera
-        vec3 R = normalize(reflect(-V, Normal));
-
-        vec3 ssrColor = ssrRaycast(FragPos, R);
-
-        if(length(ssrColor) > 0.01) {
-            FragColor = mix(FragColor, vec4(ssrColor, 1.0), Reflectiveness);
-        }
-
-    }
+    // Reflective pixels get their reflections from ssr_frag.glsl, which is
+    // blended over this where the stencil marks them
 }
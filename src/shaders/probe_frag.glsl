@@ -0,0 +1,38 @@
+#version 330 core
+
+// Forward shaded version of the lighting pass for the reflection probe faces:
+// the same ambient, diffuse and emission terms, without the view dependent
+// specular and reflections.
+
+in vec3 Normal; // world space
+in vec2 TexCoords;
+in vec3 Color;
+
+out vec4 FragColor;
+
+// Present per program variant, like in g_buffer_frag.glsl
+uniform sampler2DArray texDiffuse;
+uniform sampler2DArray texEmission;
+uniform float diffuseLayer;
+uniform float emissionLayer;
+
+uniform vec3 lightDir; // normalized
+uniform vec3 lightColor;
+
+void main() {
+#ifdef DIFFUSE_MAP
+    vec3 albedo = texture(texDiffuse, vec3(TexCoords, diffuseLayer)).rgb;
+#else
+    vec3 albedo = Color;
+#endif
+#ifdef EMISSION_MAP
+    vec3 emission = texture(texEmission, vec3(TexCoords, emissionLayer)).rgb;
+#else
+    vec3 emission = vec3(0.0);
+#endif
+
+    vec3 diffuseLight = max(dot(normalize(Normal), -lightDir), 0.0) * lightColor;
+    vec3 ambientLight = vec3(0.1);
+
+    FragColor = vec4((ambientLight + diffuseLight) * albedo + emission, 1.0);
+}
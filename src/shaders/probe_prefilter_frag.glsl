@@ -0,0 +1,52 @@
+#version 330 core
+
+// Writes one face of one mip of the filtered reflection probe: the average of
+// the captured cubemap over a cone of directions around each texel.
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform samplerCube source;
+uniform int face;         // GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+uniform float coneAngle;  // half angle in radians, 0 copies
+uniform float sourceLod;  // mip of the source with about the target's texel size
+
+const int sampleCount = 32;
+
+// Direction of a face texel, following the cube map face selection table
+vec3 faceDirection(int face, vec2 uv) {
+    vec2 p = uv * 2.0 - 1.0;
+    if(face == 0) return vec3(1.0, -p.y, -p.x);
+    if(face == 1) return vec3(-1.0, -p.y, p.x);
+    if(face == 2) return vec3(p.x, 1.0, p.y);
+    if(face == 3) return vec3(p.x, -1.0, -p.y);
+    if(face == 4) return vec3(p.x, -p.y, 1.0);
+    return vec3(-p.x, -p.y, -1.0);
+}
+
+void main() {
+    vec3 N = normalize(faceDirection(face, TexCoords));
+    if(coneAngle <= 0.0) {
+        FragColor = textureLod(source, N, sourceLod);
+        return;
+    }
+
+    vec3 up = abs(N.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 T = normalize(cross(up, N));
+    vec3 B = cross(N, T);
+
+    // Spiral over the spherical cap, equal solid angle per sample, weighted
+    // by the cosine to the cone axis
+    float cosMax = cos(coneAngle);
+    vec3 sum = vec3(0.0);
+    float total = 0.0;
+    for(int i = 0; i < sampleCount; i++) {
+        float cosTheta = mix(1.0, cosMax, (float(i) + 0.5) / float(sampleCount));
+        float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+        float phi = float(i) * 2.39996323; // golden angle
+        vec3 direction = (T * cos(phi) + B * sin(phi)) * sinTheta + N * cosTheta;
+        sum += textureLod(source, direction, sourceLod).rgb * cosTheta;
+        total += cosTheta;
+    }
+    FragColor = vec4(sum / total, 1.0);
+}
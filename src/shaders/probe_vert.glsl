@@ -0,0 +1,22 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aColor;
+layout(location = 2) in vec2 aTexCoords;
+layout(location = 3) in vec3 aNormal;
+
+out vec3 Normal; // world space
+out vec2 TexCoords;
+out vec3 Color;
+
+// Captures only happen on load or every few seconds, so the per draw data
+// are plain uniforms instead of the draw list's buffer
+uniform mat4 model;
+uniform mat3 normalMatrix; // of model
+uniform mat4 viewProjection;
+
+void main() {
+    Normal = normalMatrix * aNormal;
+    TexCoords = aTexCoords;
+    Color = aColor;
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,11 @@
+#version 330 core
+layout(location = 0) in vec3 aPos;
+
+// Shadow maps only need depth; casters are drawn one by one with plain
+// uniforms, like the probe faces
+uniform mat4 model;
+uniform mat4 lightViewProjection;
+
+void main() {
+    gl_Position = lightViewProjection * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,160 @@
+#version 330 core
+
+// Screen space reflections, blended over the lit image. Runs as a second full
+// screen draw of the lighting pass, stencil tested so only the pixels the
+// geometry pass marked as reflective pay for the rays.
+
+in vec2 TexCoords;
+out vec4 FragColor; // reflection, alpha: how much of it covers the lit color
+
+uniform sampler2D gPosition;
+uniform sampler2D gNormal; // normal in view space
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gEmission;
+
+uniform mat4 projection;
+
+// The G-buffer is rendered into the lower left part of larger render targets
+// (dynamic resolution). Screen coordinates in [0, 1] are scaled by this to get
+// G-buffer texture coordinates.
+uniform vec2 gBufferScale;
+
+// With temporal anti-aliasing the reflections reuse its history: every frame
+// starts the rays at a different offset, the resolve accumulates the noisy
+// hits, and a hit reflects the lit previous frame at that point.
+uniform bool useHistory;
+uniform sampler2D gVelocity;
+uniform sampler2D history;
+uniform vec2 historyScale;
+uniform int frameIndex;
+
+// Interleaved gradient noise, a well distributed per pixel offset
+float rayOffset() {
+    vec2 pixel = gl_FragCoord.xy + 5.588238 * float(frameIndex % 64);
+    return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+
+vec3 historyColor(vec2 screenCoords, vec3 fallback) {
+    vec2 previousCoords = screenCoords - texture(gVelocity, screenCoords * gBufferScale).xy;
+    if(any(lessThan(previousCoords, vec2(0.0))) || any(greaterThan(previousCoords, vec2(1.0)))) {
+        return fallback;
+    }
+    return texture(history, previousCoords * historyScale).rgb;
+}
+
+// Reflection probe: a prefiltered cubemap of the scene, reflected where the
+// rays leave the screen or hit nothing
+uniform bool useProbe;
+uniform samplerCube probe;
+uniform mat3 viewToWorld; // view space directions to the probe's world space
+uniform float probeLod;   // blur of the probe reflection
+
+const int maxSteps = 1000;
+const float stepSize = 0.1;
+
+vec3 probeColor(vec3 R) {
+    return textureLod(probe, viewToWorld * R, probeLod).rgb;
+}
+
+// Number of steps the ray O + t * R stays on screen (and in front of the near
+// plane). A line stays a line under projection, so this is where the
+// projected segment crosses the screen border, taken back to the ray.
+float stepsOnScreen(vec3 O, vec3 R) {
+    float near = projection[3][2] / (projection[2][2] - 1.0);
+    float rayEnd = float(maxSteps) * stepSize;
+    if(R.z > 0.0) {
+        rayEnd = min(rayEnd, (-near - O.z) / R.z);
+    }
+    vec4 a = projection * vec4(O, 1.0);
+    vec4 b = projection * vec4(O + rayEnd * R, 1.0);
+    vec2 screenA = a.xy / a.w;
+    vec2 screenB = b.xy / b.w;
+
+    vec2 delta = screenB - screenA;
+    delta = mix(delta, vec2(1e-6), lessThan(abs(delta), vec2(1e-6)));
+    vec2 border = mix(vec2(-1.0), vec2(1.0), step(0.0, delta));
+    vec2 exits = (border - screenA) / delta;
+    float s = clamp(min(exits.x, exits.y), 0.0, 1.0);
+
+    // Screen space fraction to ray fraction (perspective correct)
+    float u = s * a.w / mix(b.w, a.w, s);
+    return u * rayEnd / stepSize;
+}
+
+// Reflected color in rgb, 1 for a hit in a (less towards the screen border),
+// 0 for a miss
+vec4 ssrRaycast(vec3 O, vec3 R) {
+    // Early out: rays towards the camera would only find the front of what
+    // they reflect the back of, and rays leaving the screen right away cannot
+    // hit anything
+    if(R.z > 0.0) {
+        return vec4(0.0);
+    }
+    float steps = min(stepsOnScreen(O, R), float(maxSteps));
+    if(steps < 2.0) {
+        return vec4(0.0);
+    }
+
+    float rayLength = useHistory ? (rayOffset() - 1.0) * stepSize : 0.0;
+
+    for(int i = 0; i < int(steps) + 1; i++) {
+        rayLength += stepSize;
+        vec3 samplePoint = O + rayLength * R;
+
+        vec4 screenPos = projection * vec4(samplePoint, 1.0);
+        screenPos.xyz /= screenPos.w;
+        vec2 screenTexCoords = screenPos.xy * 0.5 + 0.5;
+
+        if(screenTexCoords.x < 0.0 || screenTexCoords.x > 1.0 ||
+            screenTexCoords.y < 0.0 || screenTexCoords.y > 1.0) {
+            return vec4(0.0); // Reflection ray left the screen
+        }
+
+        vec2 screenCoords = screenTexCoords;
+        screenTexCoords *= gBufferScale;
+        float sceneDepth = -texture(gPosition, screenTexCoords).z;
+
+        const float bias = 1.0;
+
+        float rayDepth = -samplePoint.z;
+
+        if(rayDepth > sceneDepth + bias) {
+            // hit!
+
+            vec3 reflectedColor = texture(gAlbedoSpec, screenTexCoords).rgb * 0.1 +
+                texture(gEmission, screenTexCoords).rgb;
+            if(useHistory) {
+                reflectedColor = historyColor(screenCoords, reflectedColor);
+            }
+
+            // Fade out towards the screen border, where the probe takes over
+            vec2 border = min(screenCoords, 1.0 - screenCoords);
+            float fade = clamp(min(border.x, border.y) * 10.0, 0.0, 1.0);
+
+            return vec4(reflectedColor, fade);
+        }
+    }
+
+    return vec4(0.0);
+}
+
+void main() {
+    vec2 gBufferCoords = TexCoords * gBufferScale;
+    vec3 FragPos = texture(gPosition, gBufferCoords).rgb;
+    vec3 Normal = texture(gNormal, gBufferCoords).rgb;
+    float Reflectiveness = texture(gAlbedoSpec, gBufferCoords).a;
+
+    vec3 V = normalize(-FragPos); // vector from point to camera
+    vec3 R = normalize(reflect(-V, Normal));
+
+    vec4 ssr = ssrRaycast(FragPos, R);
+
+    // Without a probe, misses keep the lit color
+    vec3 reflection = ssr.rgb;
+    float weight = ssr.a;
+    if(useProbe) {
+        reflection = mix(probeColor(R), ssr.rgb, ssr.a);
+        weight = 1.0;
+    }
+    FragColor = vec4(reflection, Reflectiveness * weight);
+}
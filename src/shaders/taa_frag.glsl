@@ -0,0 +1,104 @@
+#version 330 core
+
+// Temporal anti-aliasing resolve. Every frame is rendered with a different
+// sub-pixel jitter; this pass reprojects the resolved previous frame with the
+// velocity buffer and blends the new frame into it. The history is clipped
+// to the colors around the pixel in this frame, which rejects history that no
+// longer belongs there (disocclusion, moving water) instead of ghosting.
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D sceneColor; // this frame, jittered
+uniform sampler2D gVelocity;  // screen space motion since the last frame
+uniform sampler2D gDepth;
+uniform vec2 colorScale;      // rendered part of the textures above
+
+uniform sampler2D history;    // resolved previous frame
+uniform vec2 historyScale;    // rendered part of history
+uniform bool historyValid;
+
+uniform float feedback;       // weight of the new frame
+
+// Blending in a compressed range keeps single very bright pixels (specular
+// highlights, the lamps) from flickering
+vec3 compress(vec3 c) {
+    return c / (1.0 + max(c.r, max(c.g, c.b)));
+}
+
+vec3 uncompress(vec3 c) {
+    return c / max(1.0 - max(c.r, max(c.g, c.b)), 1e-4);
+}
+
+vec3 toYCoCg(vec3 c) {
+    return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 fromYCoCg(vec3 c) {
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+// Moves q towards the center of the box until it is inside
+vec3 clipToBox(vec3 boxMin, vec3 boxMax, vec3 q) {
+    vec3 center = 0.5 * (boxMax + boxMin);
+    vec3 extent = 0.5 * (boxMax - boxMin) + 1e-4;
+    vec3 offset = q - center;
+    vec3 units = abs(offset / extent);
+    float furthest = max(units.x, max(units.y, units.z));
+    return furthest > 1.0 ? center + offset / furthest : q;
+}
+
+void main() {
+    vec2 texel = 1.0 / vec2(textureSize(sceneColor, 0));
+    vec2 uv = TexCoords * colorScale;
+
+    vec3 current = vec3(0.0);
+    vec3 moment1 = vec3(0.0);
+    vec3 moment2 = vec3(0.0);
+    float closestDepth = 1.0;
+    vec2 closestOffset = vec2(0.0);
+
+    for(int y = -1; y <= 1; y++) {
+        for(int x = -1; x <= 1; x++) {
+            vec2 offset = vec2(x, y);
+            vec2 coords = clamp(uv + offset * texel, 0.5 * texel, colorScale - 0.5 * texel);
+            vec3 color = toYCoCg(compress(texture(sceneColor, coords).rgb));
+            moment1 += color;
+            moment2 += color * color;
+            if(x == 0 && y == 0) {
+                current = color;
+            }
+
+            // The velocity of the nearest surface keeps edges of moving objects
+            // from dragging the background along
+            float depth = texture(gDepth, coords).r;
+            if(depth < closestDepth) {
+                closestDepth = depth;
+                closestOffset = offset;
+            }
+        }
+    }
+
+    vec2 velocity = texture(gVelocity, uv + closestOffset * texel).xy;
+    vec2 previousCoords = TexCoords - velocity;
+    if(!historyValid || any(lessThan(previousCoords, vec2(0.0))) ||
+        any(greaterThan(previousCoords, vec2(1.0)))) {
+        FragColor = vec4(uncompress(fromYCoCg(current)), 1.0);
+        return;
+    }
+
+    // Variance clipping: a box around the mean, sized by the standard deviation
+    vec3 mean = moment1 / 9.0;
+    vec3 deviation = sqrt(max(moment2 / 9.0 - mean * mean, 0.0));
+    vec3 boxMin = mean - 1.25 * deviation;
+    vec3 boxMax = mean + 1.25 * deviation;
+
+    vec2 historyTexel = 1.0 / vec2(textureSize(history, 0));
+    vec2 historyCoords = clamp(previousCoords * historyScale, 0.5 * historyTexel,
+                               historyScale - 0.5 * historyTexel);
+    vec3 previous = toYCoCg(compress(texture(history, historyCoords).rgb));
+    previous = clipToBox(boxMin, boxMax, previous);
+
+    vec3 result = mix(previous, current, feedback);
+    FragColor = vec4(uncompress(fromYCoCg(result)), 1.0);
+}
@@ -0,0 +1,56 @@
+#version 330 core
+
+// Upscale pass: stretches the lit image from the internal render resolution to
+// the window and sharpens it to recover some of the detail lost by rendering
+// fewer pixels (contrast adaptive sharpening, after AMD's FidelityFX CAS).
+// The bloom chain is added here as well, which saves a full resolution pass.
+
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform sampler2D sceneColor;
+uniform vec2 colorScale; // rendered part of sceneColor, in texture coordinates
+uniform float sharpness; // 0: plain bilinear upscale, 1: strongest
+
+uniform sampler2D bloom;
+uniform vec2 bloomScale;
+uniform float bloomIntensity; // 0 disables the bloom
+
+vec3 addBloom(vec3 color) {
+    if(bloomIntensity <= 0.0) {
+        return color;
+    }
+    vec2 halfTexel = 0.5 / vec2(textureSize(bloom, 0));
+    vec2 uv = min(TexCoords * bloomScale, bloomScale - halfTexel);
+    return color + texture(bloom, uv).rgb * bloomIntensity;
+}
+
+void main() {
+    vec2 texel = 1.0 / vec2(textureSize(sceneColor, 0));
+
+    // Stay half a texel inside the rendered region so filtering never picks up
+    // stale pixels outside it
+    vec2 uv = min(TexCoords * colorScale, colorScale - 0.5 * texel);
+
+    vec3 c = texture(sceneColor, uv).rgb;
+    if(sharpness <= 0.0) {
+        FragColor = vec4(addBloom(c), 1.0);
+        return;
+    }
+
+    vec3 n = texture(sceneColor, uv + vec2(0.0, texel.y)).rgb;
+    vec3 s = texture(sceneColor, uv - vec2(0.0, texel.y)).rgb;
+    vec3 e = texture(sceneColor, uv + vec2(texel.x, 0.0)).rgb;
+    vec3 w = texture(sceneColor, uv - vec2(texel.x, 0.0)).rgb;
+
+    // Sharpen less where the neighbourhood already has a lot of contrast, which
+    // avoids ringing around bright lamps and the sign
+    vec3 minColor = clamp(min(c, min(min(n, s), min(e, w))), 0.0, 1.0);
+    vec3 maxColor = clamp(max(c, max(max(n, s), max(e, w))), 0.0, 1.0);
+    vec3 amount = sqrt(clamp(min(minColor, 1.0 - maxColor) / max(maxColor, 1e-4), 0.0, 1.0));
+
+    vec3 weight = -amount / mix(8.0, 5.0, sharpness);
+    vec3 result = (c + (n + s + e + w) * weight) / (1.0 + 4.0 * weight);
+
+    FragColor = vec4(addBloom(max(result, 0.0)), 1.0);
+}
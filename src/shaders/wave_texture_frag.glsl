@@ -0,0 +1,24 @@
+#version 330 core
+
+// Wave texture pass: evaluates the wave model once per texel of a tiling
+// height/normal texture, so the water shaders only have to sample it.
+
+in vec2 TexCoords;
+
+layout(location = 0) out vec4 WaveSample; // xyz: world-space normal, w: height
+
+uniform float time;
+uniform float waveTileSize;
+
+// Defined in waves.glsl
+vec3 waveHeightGradient(vec2 pos, float time);
+vec3 waveNormal(vec3 heightGradient);
+
+void main() {
+    // TexCoords hit the texel centers, so this is the world XZ position the
+    // water shaders will look up for this texel.
+    vec2 pos = TexCoords * waveTileSize;
+
+    vec3 wave = waveHeightGradient(pos, time);
+    WaveSample = vec4(waveNormal(wave), wave.x);
+}
@@ -0,0 +1,37 @@
+#version 330 core
+
+// Shared wave model. This file is attached as an extra shader object to every
+// stage that needs the water height field (the water vertex shader and the wave
+// texture pass), so the waves are evaluated in exactly one place.
+//
+// The wave components are defined on the CPU (WaveModel in waves.h) and uploaded
+// as uniforms, with the angular frequencies already taken from the dispersion
+// relation. WaveModel::sample evaluates the same sum for CPU queries.
+
+const int MAX_WAVES = 16; // WaveModel::maxComponents
+
+uniform int waveCount;
+uniform vec4 waveVectors[MAX_WAVES]; // xy: wave vector K, z: amplitude, w: phase offset
+uniform float waveOmega[MAX_WAVES];  // angular frequency omega(|K|)
+
+// Height and analytic gradient of the sum of Airy waves:
+// h = sum A cos(K . p - omega t + phi), grad h = -sum A K sin(K . p - omega t + phi)
+// Returns vec3(h, dh/dx, dh/dz).
+vec3 waveHeightGradient(vec2 pos, float time) {
+  vec3 result = vec3(0.0);
+  for(int i = 0; i < waveCount; i++) {
+    vec4 wave = waveVectors[i];
+    float phase = dot(wave.xy, pos) - waveOmega[i] * time + wave.w;
+    result += wave.z * vec3(cos(phase), -wave.xy * sin(phase));
+  }
+  return result;
+}
+
+float waveHeight(vec2 pos, float time) {
+  return waveHeightGradient(pos, time).x;
+}
+
+// World-space normal of the height field from its gradient
+vec3 waveNormal(vec3 heightGradient) {
+  return normalize(vec3(-heightGradient.y, 1.0, -heightGradient.z));
+}
@@ -0,0 +1,100 @@
+#include "shadowcascades.h"
+
+#include <algorithm>
+#include <cmath>
+
+int ShadowCascades::mapSize(const ShadowDescription &settings)
+{
+  return std::clamp(settings.size, 64, 8192);
+}
+
+int ShadowCascades::cascadeCount(const ShadowDescription &settings)
+{
+  return std::clamp(settings.cascades, 1, maxCascades);
+}
+
+void ShadowCascades::fit(const ShadowDescription &settings, const QVector3D &lightDirection,
+                         const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                         const QVector3D &casterMin, const QVector3D &casterMax,
+                         Cascade *cascades)
+{
+  int size = mapSize(settings);
+  int count = cascadeCount(settings);
+
+  // Near and far plane and field of view of the perspective projection
+  float nearPlane = projection(2, 3) / (projection(2, 2) - 1.0F);
+  float farPlane = projection(2, 3) / (projection(2, 2) + 1.0F);
+  float tanX = 1.0F / projection(0, 0);
+  float tanY = 1.0F / projection(1, 1);
+  float shadowFar = std::clamp(settings.distance, nearPlane * 2.0F, farPlane);
+  float lambda = std::clamp(settings.splitLambda, 0.0F, 1.0F);
+
+  QVector3D up = std::abs(lightDirection.y()) > 0.99F ? QVector3D(0.0F, 0.0F, 1.0F)
+                                                       : QVector3D(0.0F, 1.0F, 0.0F);
+  QMatrix4x4 lightView;
+  lightView.lookAt(QVector3D(), lightDirection, up);
+
+  // Depth range of the casters along the light, shared by all cascades
+  float minDepth = INFINITY;
+  float maxDepth = -INFINITY;
+  for (int corner = 0; corner < 8; ++corner)
+  {
+    QVector3D p(corner & 1 ? casterMax.x() : casterMin.x(),
+                corner & 2 ? casterMax.y() : casterMin.y(),
+                corner & 4 ? casterMax.z() : casterMin.z());
+    float depth = -lightView.map(p).z();
+    minDepth = std::min(minDepth, depth);
+    maxDepth = std::max(maxDepth, depth);
+  }
+
+  QMatrix4x4 viewToWorld = view.inverted();
+  float previous = nearPlane;
+  for (int i = 0; i < count; ++i)
+  {
+    float t = float(i + 1) / count;
+    float split = lambda * nearPlane * std::pow(shadowFar / nearPlane, t) +
+                  (1.0F - lambda) * (nearPlane + (shadowFar - nearPlane) * t);
+
+    // Bounding sphere of the slice, in view space. It does not depend on the
+    // view direction; the radius is rounded so it stays exactly the same.
+    QVector3D corners[8];
+    QVector3D center;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+      float d = corner & 4 ? split : previous;
+      corners[corner] = QVector3D(corner & 1 ? d * tanX : -d * tanX,
+                                  corner & 2 ? d * tanY : -d * tanY, -d);
+      center += corners[corner] / 8.0F;
+    }
+    float radius = 0.0F;
+    for (const QVector3D &corner : corners)
+    {
+      radius = std::max(radius, (corner - center).length());
+    }
+    radius = std::ceil(radius * 16.0F) / 16.0F;
+
+    // The margin allows snapping the center to cells of up to a quarter
+    // radius, each a whole number of texels
+    float half = radius * 1.25F;
+    float texel = 2.0F * half / size;
+    float cell = texel * std::max(1.0F, std::floor(radius * 0.25F / texel));
+    QVector3D lightCenter = lightView.map(viewToWorld.map(center));
+    float x = std::round(lightCenter.x() / cell) * cell;
+    float y = std::round(lightCenter.y() / cell) * cell;
+
+    QMatrix4x4 ortho;
+    ortho.ortho(x - half, x + half, y - half, y + half, minDepth - 1.0F, maxDepth + 1.0F);
+    cascades[i].viewProjection = ortho * lightView;
+    cascades[i].split = split;
+    cascades[i].texel = texel;
+    previous = split;
+  }
+}
+
+QMatrix4x4 ShadowCascades::textureMatrix(const Cascade &cascade)
+{
+  QMatrix4x4 bias;
+  bias.translate(0.5F, 0.5F, 0.5F);
+  bias.scale(0.5F);
+  return bias * cascade.viewProjection;
+}
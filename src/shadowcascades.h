@@ -0,0 +1,50 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include <QMatrix4x4>
+#include <QVector3D>
+
+#include "scenedescription.h"
+
+/**
+ * @brief Fits the shadow cascades of the directional light to a view, for
+ * ShadowMaps and the reference renderer alike. No GL.
+ *
+ * The distance covered by shadows is split into cascades, each an orthographic
+ * projection along the light. A cascade is fitted to the bounding sphere of its
+ * slice of the view frustum, which keeps its size while the camera turns, and
+ * is enlarged by a margin so its center can be snapped to a coarse grid in
+ * light space. Its projection therefore only changes when the camera moves
+ * across a grid cell, and snapping to whole texels keeps shadow edges from
+ * crawling.
+ */
+namespace ShadowCascades
+{
+constexpr int maxCascades = 4;
+
+struct Cascade
+{
+  QMatrix4x4 viewProjection; // world to the cascade's clip space
+  float split = 0.0F;        // view space distance at which it ends
+  float texel = 0.0F;        // world size of a texel
+};
+
+// The map size and cascade count the settings ask for, clamped
+int mapSize(const ShadowDescription &settings);
+int cascadeCount(const ShadowDescription &settings);
+
+/**
+ * @brief Fits cascadeCount(settings) cascades of mapSize(settings) texels.
+ * @param projection Unjittered perspective projection of the view.
+ * @param casterMin World space bounds of the static casters, which decide the
+ * depth range of every cascade.
+ */
+void fit(const ShadowDescription &settings, const QVector3D &lightDirection,
+         const QMatrix4x4 &view, const QMatrix4x4 &projection, const QVector3D &casterMin,
+         const QVector3D &casterMax, Cascade *cascades);
+
+// World to shadow map coordinates in [0, 1] of a cascade
+QMatrix4x4 textureMatrix(const Cascade &cascade);
+} // namespace ShadowCascades
+
+#endif // SHADOWCASCADES_H
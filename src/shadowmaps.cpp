@@ -0,0 +1,220 @@
+#include "shadowmaps.h"
+
+#include <QDebug>
+
+ShadowMaps::~ShadowMaps()
+{
+  destroy();
+}
+
+/**
+ * @brief ShadowMaps::initialize Requires a current context. The textures are
+ * only created by the first update.
+ */
+void ShadowMaps::initialize()
+{
+  initializeOpenGLFunctions();
+  for (GpuTimer &timer : staticTimers)
+  {
+    timer.initialize();
+  }
+  dynamicTimer.initialize();
+}
+
+void ShadowMaps::invalidate()
+{
+  for (Cascade &cascade : cascades)
+  {
+    cascade.valid = false;
+  }
+}
+
+void ShadowMaps::destroy()
+{
+  if (staticTexture == 0)
+  {
+    return;
+  }
+  glDeleteFramebuffers(2, framebuffers);
+  GLuint textures[2] = {staticTexture, compositeTexture};
+  glDeleteTextures(2, textures);
+  framebuffers[0] = framebuffers[1] = staticTexture = compositeTexture = 0;
+  size = count = 0;
+}
+
+/**
+ * @brief ShadowMaps::allocate Creates both depth arrays. Texels outside a
+ * cascade read as the far plane, i.e. lit.
+ */
+void ShadowMaps::allocate(int newSize, int newCount)
+{
+  destroy();
+  size = newSize;
+  count = newCount;
+
+  const GLfloat border[4] = {1.0F, 1.0F, 1.0F, 1.0F};
+  glGenTextures(1, &staticTexture);
+  glGenTextures(1, &compositeTexture);
+  for (GLuint texture : {staticTexture, compositeTexture})
+  {
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, count, 0,
+                 GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    // Linear filtering of the comparison results gives 2x2 PCF per tap
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  glGenFramebuffers(2, framebuffers);
+  for (GLuint framebuffer : framebuffers)
+  {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  invalidate();
+  qDebug() << ":: Shadow maps:" << count << "cascades of" << size << "x" << size;
+}
+
+/**
+ * @brief ShadowMaps::fitCascades Computes the snapped projection of every
+ * cascade. A cascade whose projection changed has to render its static casters
+ * again.
+ */
+void ShadowMaps::fitCascades(const ShadowDescription &settings, const QVector3D &lightDirection,
+                             const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                             const QVector3D &casterMin, const QVector3D &casterMax)
+{
+  ShadowCascades::Cascade fitted[maxCascades];
+  ShadowCascades::fit(settings, lightDirection, view, projection, casterMin, casterMax, fitted);
+  for (int i = 0; i < count; ++i)
+  {
+    Cascade &cascade = cascades[i];
+    if (fitted[i].viewProjection != cascade.fit.viewProjection)
+    {
+      cascade.valid = false;
+    }
+    cascade.fit = fitted[i];
+  }
+}
+
+/**
+ * @brief ShadowMaps::bindLayer Attaches a layer of a depth array to a
+ * framebuffer and binds it to target.
+ * @return Whether the framebuffer is complete.
+ */
+bool ShadowMaps::bindLayer(GLuint framebuffer, GLenum target, GLuint texture, int layer)
+{
+  glBindFramebuffer(target, framebuffer);
+  glFramebufferTextureLayer(target, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+  if (glCheckFramebufferStatus(target) != GL_FRAMEBUFFER_COMPLETE)
+  {
+    qWarning() << "Shadow map FBO not complete!";
+    return false;
+  }
+  return true;
+}
+
+void ShadowMaps::update(const ShadowDescription &settings, const QVector3D &lightDirection,
+                        const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                        const QVector3D &casterMin, const QVector3D &casterMax,
+                        bool dynamicCasters, const DrawCasters &drawCasters)
+{
+  int newSize = ShadowCascades::mapSize(settings);
+  int newCount = ShadowCascades::cascadeCount(settings);
+  if (newSize != size || newCount != count)
+  {
+    allocate(newSize, newCount);
+  }
+  fitCascades(settings, lightDirection, view, projection, casterMin, casterMax);
+
+  glViewport(0, 0, size, size);
+  glEnable(GL_DEPTH_TEST);
+  // Casters in front of the depth range still cast, at depth 0
+  glEnable(GL_DEPTH_CLAMP);
+  // Slope scaled bias against acne on surfaces at grazing angles to the light
+  glEnable(GL_POLYGON_OFFSET_FILL);
+  glPolygonOffset(2.0F, 4.0F);
+
+  for (int i = 0; i < count; ++i)
+  {
+    Cascade &cascade = cascades[i];
+    staticTimers[i].collect();
+    if (cascade.valid)
+    {
+      continue;
+    }
+    if (!bindLayer(framebuffers[1], GL_FRAMEBUFFER, staticTexture, i))
+    {
+      break;
+    }
+    staticTimers[i].begin();
+    glClear(GL_DEPTH_BUFFER_BIT);
+    drawCasters(cascade.fit.viewProjection, false);
+    staticTimers[i].end();
+    cascade.valid = true;
+    cascade.renders++;
+  }
+
+  // The dynamic casters go over a copy of the cached layers
+  composited = dynamicCasters;
+  if (composited)
+  {
+    dynamicTimer.begin();
+    for (int i = 0; i < count; ++i)
+    {
+      if (!bindLayer(framebuffers[0], GL_READ_FRAMEBUFFER, staticTexture, i) ||
+          !bindLayer(framebuffers[1], GL_DRAW_FRAMEBUFFER, compositeTexture, i))
+      {
+        composited = false;
+        break;
+      }
+      glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1]);
+      drawCasters(cascades[i].fit.viewProjection, true);
+    }
+    dynamicTimer.end();
+  }
+  else
+  {
+    dynamicTimer.collect();
+  }
+
+  glDisable(GL_POLYGON_OFFSET_FILL);
+  glDisable(GL_DEPTH_CLAMP);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+QMatrix4x4 ShadowMaps::textureMatrix(int cascade) const
+{
+  return ShadowCascades::textureMatrix(cascades[cascade].fit);
+}
+
+void ShadowMaps::report() const
+{
+  if (count == 0)
+  {
+    qDebug() << "Shadows: not rendered yet";
+    return;
+  }
+  for (int i = 0; i < count; ++i)
+  {
+    qDebug().noquote() << QString("Shadow cascade %1: up to %2 units, texels of %3, static casters "
+                                  "rendered %4 times, last %5 ms")
+                              .arg(i)
+                              .arg(cascades[i].fit.split, 0, 'f', 1)
+                              .arg(cascades[i].fit.texel, 0, 'f', 3)
+                              .arg(cascades[i].renders)
+                              .arg(staticTimers[i].milliseconds(), 0, 'f', 3);
+  }
+  qDebug() << "Shadow dynamic casters:" << (composited ? dynamicTimer.milliseconds() : 0.0F)
+           << "ms per frame";
+}
@@ -0,0 +1,108 @@
+#ifndef SHADOWMAPS_H
+#define SHADOWMAPS_H
+
+#include <QMatrix4x4>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector3D>
+
+#include <functional>
+
+#include "gputimer.h"
+#include "shadowcascades.h"
+#include "scenedescription.h"
+
+/**
+ * @brief The ShadowMaps class holds the cascaded shadow maps of the
+ * directional light, with the static casters cached between frames.
+ *
+ * The distance covered by shadows is split into cascades, each of which gets
+ * a layer of a depth texture array rendered with an orthographic projection
+ * along the light, fitted by ShadowCascades. A cascade's projection only
+ * changes when the camera moves across a cell of its snapping grid, and its
+ * static casters are only rendered again then, or when the light or the static
+ * actors change.
+ *
+ * Dynamic casters are rendered every frame into a copy of the cached layers.
+ * The lighting pass samples the result with percentage closer filtering.
+ */
+class ShadowMaps : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  static const int maxCascades = ShadowCascades::maxCascades;
+
+  // Draws the static or the dynamic casters into the bound depth layer
+  using DrawCasters = std::function<void(const QMatrix4x4 &lightViewProjection, bool dynamic)>;
+
+  ShadowMaps() = default;
+  ~ShadowMaps();
+
+  void initialize();
+
+  /**
+   * @brief Renders the static casters again before the maps are used next,
+   * e.g. after the scene changed.
+   */
+  void invalidate();
+
+  /**
+   * @brief Fits the cascades to the view, renders the static casters of the
+   * cascades that are out of date and composites the dynamic casters. Changes
+   * the bound framebuffer and the viewport.
+   * @param projection Unjittered, the cascades must not follow the jitter.
+   * @param casterMin World space bounds of the static casters, which decide
+   * the depth range of every cascade. Casters outside it are clamped.
+   * @param dynamicCasters Whether there are any dynamic casters to composite.
+   */
+  void update(const ShadowDescription &settings, const QVector3D &lightDirection,
+              const QMatrix4x4 &view, const QMatrix4x4 &projection, const QVector3D &casterMin,
+              const QVector3D &casterMax, bool dynamicCasters, const DrawCasters &drawCasters);
+
+  bool isValid() const { return staticTexture != 0 && count > 0; }
+  // GL_TEXTURE_2D_ARRAY with depth comparison, one layer per cascade
+  GLuint texture() const { return composited ? compositeTexture : staticTexture; }
+  int cascadeCount() const { return count; }
+  int mapSize() const { return size; }
+
+  /**
+   * @brief World to shadow map coordinates in [0, 1] of a cascade.
+   */
+  QMatrix4x4 textureMatrix(int cascade) const;
+  // View space distance at which a cascade ends
+  float splitDistance(int cascade) const { return cascades[cascade].fit.split; }
+  // World space size of a texel of a cascade
+  float texelSize(int cascade) const { return cascades[cascade].fit.texel; }
+
+  /**
+   * @brief Logs per cascade how often its static casters were rendered and
+   * what that cost on the GPU, and the cost of the dynamic casters.
+   */
+  void report() const;
+
+private:
+  struct Cascade
+  {
+    ShadowCascades::Cascade fit;
+    bool valid = false;
+    int renders = 0;
+  };
+
+  void allocate(int newSize, int newCount);
+  void destroy();
+  void fitCascades(const ShadowDescription &settings, const QVector3D &lightDirection,
+                   const QMatrix4x4 &view, const QMatrix4x4 &projection,
+                   const QVector3D &casterMin, const QVector3D &casterMax);
+  bool bindLayer(GLuint framebuffer, GLenum target, GLuint texture, int layer);
+
+  Cascade cascades[maxCascades];
+  GpuTimer staticTimers[maxCascades];
+  GpuTimer dynamicTimer;
+
+  int size = 0;
+  int count = 0;
+  GLuint staticTexture = 0;    // static casters only, cached
+  GLuint compositeTexture = 0; // static and dynamic casters, every frame
+  GLuint framebuffers[2] = {}; // read and draw, for the copies
+  bool composited = false;     // the last update drew dynamic casters
+};
+
+#endif // SHADOWMAPS_H
@@ -0,0 +1,370 @@
+#include "staticbatches.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QOpenGLContext>
+#include <QSurfaceFormat>
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector4D>
+
+#include <algorithm>
+#include <cstddef>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+namespace
+{
+  // Texels of RGBA32F per draw in the draw data buffer: 4 model matrix
+  // columns, 3 normal matrix columns and the layers of the 4 maps
+  const int texelsPerDraw = 8;
+} // namespace
+
+StaticBatches::~StaticBatches()
+{
+  destroyBuffers();
+}
+
+/**
+ * @brief StaticBatches::initialize Resolves the GL functions and, where the
+ * driver has it, glMultiDrawElementsIndirect. Requires a current context.
+ */
+void StaticBatches::initialize()
+{
+  initializeOpenGLFunctions();
+
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  QSurfaceFormat format = context->format();
+  if (format.majorVersion() * 10 + format.minorVersion() >= 43 ||
+      context->hasExtension("GL_ARB_multi_draw_indirect"))
+  {
+    multiDrawElementsIndirect = reinterpret_cast<MultiDrawElementsIndirect>(
+        context->getProcAddress("glMultiDrawElementsIndirect"));
+  }
+  qDebug() << ":: Static batches use"
+           << (multiDrawElementsIndirect ? "glMultiDrawElementsIndirect" : "glMultiDrawElements");
+}
+
+void StaticBatches::build(QVector<Actor> &actors, const ProgramFor &programFor)
+{
+  clear(actors);
+
+  GLint maxTexels = 65536;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+
+  QHash<GLuint, Mesh> meshes; // by VAO
+  QVector<Vertex> vertices;
+  QVector<quint32> indices;
+  QVector<float> drawData;
+
+  for (int i = 0; i < actors.size(); ++i)
+  {
+    Actor &actor = actors[i];
+    QOpenGLShaderProgram *program = actor.meshSize != 0 ? programFor(actor) : nullptr;
+    if (!program)
+    {
+      continue;
+    }
+    if ((members + 1) * texelsPerDraw > maxTexels)
+    {
+      qWarning() << "StaticBatches: draw data buffer is full, actor" << actor.name
+                 << "is drawn on its own";
+      continue;
+    }
+
+    GLuint textures[4] = {actor.hasDiffuseTex ? actor.texDiffuse : 0,
+                          actor.hasEmissionTex ? actor.texEmission : 0,
+                          actor.hasNormalTex ? actor.texNormal : 0,
+                          actor.hasSpecularTex ? actor.texSpecular : 0};
+    auto batch = std::find_if(batches.begin(), batches.end(),
+                              [&](const Batch &batch)
+                              {
+                                return batch.program == program &&
+                                       std::equal(textures, textures + 4, batch.textures);
+                              });
+    if (batch == batches.end())
+    {
+      batches.append({program, {textures[0], textures[1], textures[2], textures[3]}, {}});
+      batch = batches.end() - 1;
+    }
+
+    if (!meshes.contains(actor.VAO))
+    {
+      meshes.insert(actor.VAO, readMesh(actor));
+    }
+    const Mesh &mesh = meshes[actor.VAO];
+
+    // Own copy of the vertices, tagged with the draw index
+    quint32 drawIndex = members++;
+    quint32 baseVertex = vertices.size();
+    for (Vertex vertex : mesh.vertices)
+    {
+      vertex.drawIndex = drawIndex;
+      vertices.append(vertex);
+    }
+    batch->members.append({i, int(lodRanges.size()), int(mesh.lods.size())});
+    for (const QPair<GLuint, GLsizei> &lod : mesh.lods)
+    {
+      lodRanges.append({GLuint(indices.size()) + lod.first, lod.second});
+    }
+    for (quint32 index : mesh.indices)
+    {
+      indices.append(baseVertex + index);
+    }
+
+    const float *model = actor.transform.constData();
+    drawData.append(QVector<float>(model, model + 16));
+    const QMatrix3x3 &normalMatrix = actor.normalMatrix;
+    for (int column = 0; column < 3; ++column)
+    {
+      drawData << normalMatrix(0, column) << normalMatrix(1, column) << normalMatrix(2, column)
+               << 0.0F;
+    }
+    drawData << float(actor.diffuseLayer) << float(actor.emissionLayer)
+             << float(actor.normalLayer) << float(actor.specularLayer);
+
+    actor.batched = true;
+  }
+
+  if (members == 0)
+  {
+    return;
+  }
+
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+
+  glGenBuffers(1, &vertexBuffer);
+  glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.constData(),
+               GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<GLvoid *>(offsetof(Vertex, position)));
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<GLvoid *>(offsetof(Vertex, color)));
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<GLvoid *>(offsetof(Vertex, uv)));
+  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<GLvoid *>(offsetof(Vertex, normal)));
+  glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(Vertex),
+                         reinterpret_cast<GLvoid *>(offsetof(Vertex, drawIndex)));
+  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                        reinterpret_cast<GLvoid *>(offsetof(Vertex, tangent)));
+  for (GLuint attribute = 0; attribute < 6; ++attribute)
+  {
+    glEnableVertexAttribArray(attribute);
+  }
+
+  glGenBuffers(1, &indexBuffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(quint32), indices.constData(),
+               GL_STATIC_DRAW);
+
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  glGenBuffers(1, &drawDataBuffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, drawDataBuffer);
+  glBufferData(GL_TEXTURE_BUFFER, drawData.size() * sizeof(float), drawData.constData(),
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  glGenTextures(1, &drawDataTexture);
+  glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, drawDataBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+  if (multiDrawElementsIndirect)
+  {
+    glGenBuffers(1, &indirectBuffer);
+  }
+
+  qDebug() << ":: Static batches:" << members << "actors," << batches.size() << "batches,"
+           << vertices.size() << "vertices," << indices.size() / 3 << "triangles";
+}
+
+/**
+ * @brief StaticBatches::readMesh Reads a mesh back from the vertex buffers of
+ * an actor and welds identical vertices, since meshes are stored as plain
+ * triangle lists. The levels of detail mostly reuse the same vertices.
+ */
+StaticBatches::Mesh StaticBatches::readMesh(const Actor &actor)
+{
+  QVector<MeshLod> lods = actor.lods;
+  if (lods.isEmpty())
+  {
+    lods.append({0, GLsizei(actor.meshSize), 0.0F});
+  }
+  int count = lods.last().first + lods.last().count;
+  QVector<QVector3D> positions(count);
+  QVector<QVector3D> colors(count);
+  QVector<QVector2D> uvs(count);
+  QVector<QVector3D> normals(count);
+  QVector<QVector4D> tangents(count);
+
+  glBindBuffer(GL_ARRAY_BUFFER, actor.positionVBO);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(QVector3D), positions.data());
+  glBindBuffer(GL_ARRAY_BUFFER, actor.colorVBO);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(QVector3D), colors.data());
+  glBindBuffer(GL_ARRAY_BUFFER, actor.uvVBO);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(QVector2D), uvs.data());
+  glBindBuffer(GL_ARRAY_BUFFER, actor.normalVBO);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(QVector3D), normals.data());
+  glBindBuffer(GL_ARRAY_BUFFER, actor.tangentVBO);
+  glGetBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(QVector4D), tangents.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+  Mesh mesh;
+  mesh.indices.reserve(count);
+  QHash<QByteArray, quint32> welded;
+  for (int i = 0; i < count; ++i)
+  {
+    Vertex vertex{{positions[i].x(), positions[i].y(), positions[i].z()},
+                  {colors[i].x(), colors[i].y(), colors[i].z()},
+                  {uvs[i].x(), uvs[i].y()},
+                  {normals[i].x(), normals[i].y(), normals[i].z()},
+                  {tangents[i].x(), tangents[i].y(), tangents[i].z(), tangents[i].w()},
+                  0};
+    QByteArray key(reinterpret_cast<const char *>(&vertex), sizeof(Vertex));
+    auto it = welded.constFind(key);
+    if (it != welded.constEnd())
+    {
+      mesh.indices.append(it.value());
+      continue;
+    }
+    welded.insert(key, mesh.vertices.size());
+    mesh.indices.append(mesh.vertices.size());
+    mesh.vertices.append(vertex);
+  }
+  for (const MeshLod &lod : lods)
+  {
+    mesh.lods.append({GLuint(lod.first), lod.count});
+  }
+  return mesh;
+}
+
+void StaticBatches::submit(const DrawList &drawList, const QVector<Actor> &actors)
+{
+  QElapsedTimer timer;
+  timer.start();
+  calls = 0;
+
+  if (batches.isEmpty())
+  {
+    submitTime = 0.0F;
+    return;
+  }
+
+  glBindVertexArray(vao);
+  glActiveTexture(GL_TEXTURE0 + drawDataUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, drawDataTexture);
+
+  // The commands of all batches go into one buffer, batch after batch
+  commands.clear();
+  QVector<int> firstCommand(batches.size() + 1);
+  for (int b = 0; b < batches.size(); ++b)
+  {
+    firstCommand[b] = commands.size();
+    for (const Member &member : batches[b].members)
+    {
+      if (drawList.isVisible(member.actor))
+      {
+        int lod = qBound(0, actors[member.actor].lod, member.lodCount - 1);
+        const QPair<GLuint, GLsizei> &range = lodRanges[member.firstLod + lod];
+        commands.append({GLuint(range.second), 1, range.first, 0, 0});
+      }
+    }
+  }
+  firstCommand[batches.size()] = commands.size();
+  // Batches of the same program follow each other, in the order of the actors
+  QOpenGLShaderProgram *bound = nullptr;
+
+  if (multiDrawElementsIndirect && !commands.isEmpty())
+  {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(IndirectCommand),
+                 commands.constData(), GL_STREAM_DRAW);
+  }
+
+  for (int b = 0; b < batches.size(); ++b)
+  {
+    int first = firstCommand[b];
+    int drawCount = firstCommand[b + 1] - first;
+    if (drawCount == 0)
+    {
+      continue;
+    }
+
+    if (batches[b].program != bound)
+    {
+      batches[b].program->bind();
+      bound = batches[b].program;
+    }
+    for (int map = 0; map < 4; ++map)
+    {
+      glActiveTexture(GL_TEXTURE0 + DrawList::materialUnits[map]);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, batches[b].textures[map]);
+    }
+
+    if (multiDrawElementsIndirect)
+    {
+      multiDrawElementsIndirect(
+          GL_TRIANGLES, GL_UNSIGNED_INT,
+          reinterpret_cast<const void *>(first * sizeof(IndirectCommand)), drawCount, 0);
+    }
+    else
+    {
+      counts.resize(drawCount);
+      offsets.resize(drawCount);
+      for (int i = 0; i < drawCount; ++i)
+      {
+        const IndirectCommand &command = commands[first + i];
+        counts[i] = command.count;
+        offsets[i] = reinterpret_cast<const void *>(command.firstIndex * sizeof(quint32));
+      }
+      glMultiDrawElements(GL_TRIANGLES, counts.constData(), GL_UNSIGNED_INT,
+                          offsets.constData(), drawCount);
+    }
+    calls++;
+  }
+
+  if (multiDrawElementsIndirect)
+  {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  }
+  glActiveTexture(GL_TEXTURE0 + drawDataUnit);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
+  glBindVertexArray(0);
+
+  submitTime = timer.nsecsElapsed() / 1.0e6F;
+}
+
+void StaticBatches::clear(QVector<Actor> &actors)
+{
+  for (Actor &actor : actors)
+  {
+    actor.batched = false;
+  }
+  destroyBuffers();
+  batches.clear();
+  lodRanges.clear();
+  members = 0;
+}
+
+void StaticBatches::destroyBuffers()
+{
+  if (vao == 0)
+  {
+    return;
+  }
+  glDeleteVertexArrays(1, &vao);
+  GLuint buffers[4] = {vertexBuffer, indexBuffer, drawDataBuffer, indirectBuffer};
+  glDeleteBuffers(4, buffers);
+  glDeleteTextures(1, &drawDataTexture);
+  vao = vertexBuffer = indexBuffer = drawDataBuffer = drawDataTexture = indirectBuffer = 0;
+}
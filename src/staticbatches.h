@@ -0,0 +1,142 @@
+#ifndef STATICBATCHES_H
+#define STATICBATCHES_H
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QOpenGLShaderProgram>
+#include <QPair>
+#include <QVector>
+
+#include <functional>
+
+#include "actor.h"
+#include "drawlist.h"
+
+/**
+ * @brief The StaticBatches class merges the geometry of static actors into one
+ * vertex and one index buffer, so a whole material's worth of actors is drawn
+ * with a single multi-draw call.
+ *
+ * Every actor gets its own copy of its mesh's vertices, each tagged with the
+ * actor's draw index. The vertex shader uses that index to fetch the actor's
+ * transform and texture array layers from a texture buffer, which stands in
+ * for gl_DrawID on GL 3.3. Actors are grouped by program variant and texture
+ * arrays, one batch per combination, so materials of the same kind share a
+ * batch. Each frame the visible members of a batch (culled by the draw
+ * list) become the sub-draws of one glMultiDrawElementsIndirect call when the
+ * driver supports it (GL 4.3 or ARB_multi_draw_indirect), or of one
+ * glMultiDrawElements call otherwise.
+ */
+class StaticBatches : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  // Texture unit of the per draw data buffer
+  static const int drawDataUnit = 6;
+
+  // Returns the batch program of an actor, or nullptr to leave it unbatched
+  using ProgramFor = std::function<QOpenGLShaderProgram *(const Actor &actor)>;
+
+  StaticBatches() = default;
+  ~StaticBatches();
+
+  void initialize();
+
+  /**
+   * @brief Merges every actor that programFor gives a program into the batches
+   * and marks them as batched; the previous batches are dropped. Call whenever
+   * the actor list changes. Requires a current context.
+   */
+  void build(QVector<Actor> &actors, const ProgramFor &programFor);
+
+  /**
+   * @brief Draws the members of every batch that the last built draw list
+   * found visible, at the level of detail it picked. Binds the program of each
+   * batch and leaves the last one bound.
+   */
+  void submit(const DrawList &drawList, const QVector<Actor> &actors);
+
+  /**
+   * @brief Releases the buffers and clears the batched flag of all actors.
+   */
+  void clear(QVector<Actor> &actors);
+
+  bool usesIndirect() const { return multiDrawElementsIndirect != nullptr; }
+  int batchCount() const { return batches.size(); }
+  int actorCount() const { return members; }
+  int drawCalls() const { return calls; }
+  float submitMilliseconds() const { return submitTime; }
+
+private:
+  struct Vertex
+  {
+    float position[3];
+    float color[3];
+    float uv[2];
+    float normal[3];
+    float tangent[4];
+    quint32 drawIndex;
+  };
+
+  // A mesh read back from its actor's buffers and welded into indexed form,
+  // with the index range of every level of detail
+  struct Mesh
+  {
+    QVector<Vertex> vertices;
+    QVector<quint32> indices;
+    QVector<QPair<GLuint, GLsizei>> lods;
+  };
+
+  struct Member
+  {
+    int actor;
+    int firstLod; // into lodRanges
+    int lodCount;
+  };
+
+  struct Batch
+  {
+    QOpenGLShaderProgram *program;
+    GLuint textures[4]; // arrays of the maps, in the order of materialUnits
+    QVector<Member> members;
+  };
+
+  // Layout of DrawElementsIndirectCommand
+  struct IndirectCommand
+  {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+
+  using MultiDrawElementsIndirect = void(QOPENGLF_APIENTRYP)(GLenum mode, GLenum type,
+                                                            const void *indirect,
+                                                            GLsizei drawCount, GLsizei stride);
+
+  Mesh readMesh(const Actor &actor);
+  void destroyBuffers();
+
+  QVector<Batch> batches;
+  int members = 0;
+  // First index and index count of every level of every member
+  QVector<QPair<GLuint, GLsizei>> lodRanges;
+
+  GLuint vao = 0;
+  GLuint vertexBuffer = 0;
+  GLuint indexBuffer = 0;
+  GLuint drawDataBuffer = 0;
+  GLuint drawDataTexture = 0;
+  GLuint indirectBuffer = 0;
+
+  MultiDrawElementsIndirect multiDrawElementsIndirect = nullptr;
+
+  // Per frame scratch space, kept to avoid allocations
+  QVector<IndirectCommand> commands;
+  QVector<GLsizei> counts;
+  QVector<const void *> offsets;
+
+  int calls = 0;
+  float submitTime = 0.0F;
+};
+
+#endif // STATICBATCHES_H
@@ -0,0 +1,87 @@
+#include "streamingbenchmark.h"
+
+#include <QDebug>
+#include <QDir>
+
+#include <algorithm>
+
+namespace
+{
+  // Seconds of prefetching of the flights, in order
+  const float lookaheads[] = {1.5F, 0.0F};
+  const int flightCount = 2;
+} // namespace
+
+void StreamingBenchmark::start(const SceneLoader::ProgramSelector &programFor)
+{
+  if (isRunning())
+  {
+    qDebug() << "Streaming benchmark: already running";
+    return;
+  }
+  programs = programFor;
+  directory = QDir::temp().filePath("streaming-benchmark");
+  scene = SceneStreamer::writeBenchmarkWorld(directory, side, tileSize);
+
+  origin = QVector3D(-0.5F * side * tileSize, 2.0F, -0.5F * side * tileSize);
+  QVector3D end = -origin + QVector3D(0.0F, 4.0F, 0.0F);
+  velocity = (end - origin).normalized() * speed;
+  duration = (end - origin).length() / speed;
+  flight = 0;
+  flying = false;
+}
+
+void StreamingBenchmark::step()
+{
+  if (!isRunning())
+  {
+    return;
+  }
+  if (!initialized)
+  {
+    streamer.initialize();
+    streamer.setProgramSelector(programs);
+    initialized = true;
+  }
+  if (!flying)
+  {
+    // The second flight finds the files in the page cache, which only favors it
+    scene.streaming.lookahead = lookaheads[flight];
+    streamer.open(scene);
+    clock.start();
+    flying = true;
+  }
+
+  float seconds = clock.nsecsElapsed() / 1.0e9F;
+  streamer.update(origin + velocity * std::min(seconds, duration), velocity);
+  if (seconds < duration)
+  {
+    return;
+  }
+
+  qDebug().noquote() << QString("Streaming benchmark: %1 m/s, lookahead %2 s, uploads included")
+                            .arg(speed)
+                            .arg(lookaheads[flight]);
+  streamer.report();
+  streamer.close();
+  flying = false;
+  if (++flight == flightCount)
+  {
+    stop();
+  }
+}
+
+void StreamingBenchmark::stop()
+{
+  if (flying)
+  {
+    streamer.close();
+    flying = false;
+  }
+  if (!directory.isEmpty())
+  {
+    QDir(directory).removeRecursively();
+    directory.clear();
+  }
+  flight = -1;
+}
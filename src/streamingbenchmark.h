@@ -0,0 +1,68 @@
+#ifndef STREAMINGBENCHMARK_H
+#define STREAMINGBENCHMARK_H
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QVector3D>
+
+#include "scenedescription.h"
+#include "sceneloader.h"
+#include "scenestreamer.h"
+
+/**
+ * @brief The StreamingBenchmark class flies a camera diagonally across the
+ * synthetic world of SceneStreamer::writeBenchmarkWorld in real time, first
+ * with and then without prefetching, and logs the streamer's report after each
+ * flight.
+ *
+ * The flight advances one step per rendered frame on the GL thread, so the
+ * application keeps running, and its streamer uploads the meshes and texture
+ * layers and creates the actors of the tiles it loads. The update times and
+ * hitches it reports therefore include the uploads, as they would for the
+ * scene. The actors are never drawn.
+ */
+class StreamingBenchmark
+{
+public:
+  StreamingBenchmark() = default;
+
+  /**
+   * @brief Writes the world and starts the flights with the next step(). No
+   * GL, but the programs are selected by programFor.
+   */
+  void start(const SceneLoader::ProgramSelector &programFor);
+
+  bool isRunning() const { return flight >= 0; }
+
+  /**
+   * @brief Moves the camera to where the current flight is by now, lets the
+   * streamer follow and starts the next flight when it arrives. Requires a
+   * current context.
+   */
+  void step();
+
+  /**
+   * @brief Ends the flights and deletes the world. Requires a current context.
+   */
+  void stop();
+
+private:
+  static const int side = 12;
+  static constexpr float tileSize = 64.0F;
+  static constexpr float speed = 120.0F; // m/s
+
+  SceneStreamer streamer;
+  SceneLoader::ProgramSelector programs;
+  bool initialized = false;
+  SceneDescription scene;
+  QString directory;
+
+  int flight = -1; // index of the current lookahead, -1 when not running
+  bool flying = false;
+  QElapsedTimer clock;
+  QVector3D origin;
+  QVector3D velocity;
+  float duration = 0.0F; // s
+};
+
+#endif // STREAMINGBENCHMARK_H
@@ -0,0 +1,159 @@
+#include "texturearrays.h"
+
+#include <QDebug>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+
+#include <algorithm>
+
+#include "mainview.h"
+
+void TextureArrays::initialize()
+{
+  initializeOpenGLFunctions();
+}
+
+void TextureArrays::bake(const QHash<QString, QImage> &images)
+{
+  clear();
+
+  GLint maxLayers = 256;
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+  // Paths by layer size; sorted so the same scene always gets the same layers
+  QMap<QPair<int, int>, QStringList> sizes;
+  for (auto it = images.constBegin(); it != images.constEnd(); ++it)
+  {
+    sizes[{layerSize(it.value().width()), layerSize(it.value().height())}].append(it.key());
+  }
+
+  qint64 bytes = 0;
+  for (auto it = sizes.begin(); it != sizes.end(); ++it)
+  {
+    QStringList &paths = it.value();
+    std::sort(paths.begin(), paths.end());
+    for (int first = 0; first < paths.size(); first += maxLayers)
+    {
+      int count = std::min(int(maxLayers), int(paths.size()) - first);
+      Array array = createArray(it.key().first, it.key().second, count);
+
+      for (int layer = 0; layer < count; ++layer)
+      {
+        const QString &path = paths[first + layer];
+        upload(images.value(path), array, layer);
+        layers.insert(path, {array.texture, layer});
+      }
+      arrays.append(array);
+      bytes += qint64(array.width) * array.height * 4 * count;
+    }
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  qDebug() << ":: Texture arrays:" << layers.size() << "layers in" << arrays.size()
+           << "arrays," << bytes / (1024 * 1024) << "MB";
+}
+
+/**
+ * @brief TextureArrays::createArray Allocates an array and leaves it bound.
+ */
+TextureArrays::Array TextureArrays::createArray(int width, int height, int layers)
+{
+  Array array{0, width, height, {}};
+  glGenTextures(1, &array.texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layers, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  return array;
+}
+
+/**
+ * @brief TextureArrays::upload Writes an image into a layer of the bound array,
+ * scaled to the layer size if it differs.
+ */
+void TextureArrays::upload(const QImage &image, const Array &array, int layer)
+{
+  QImage scaled = image;
+  if (image.width() != array.width || image.height() != array.height)
+  {
+    scaled = image.scaled(array.width, array.height, Qt::IgnoreAspectRatio,
+                          Qt::SmoothTransformation);
+  }
+  QVector<quint8> bytes = MainView::imageToBytes(scaled);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, array.width, array.height, 1, GL_RGBA,
+                  GL_UNSIGNED_BYTE, bytes.constData());
+}
+
+bool TextureArrays::update(const QString &path, const QImage &image)
+{
+  auto it = layers.constFind(path);
+  if (it == layers.constEnd())
+  {
+    return false;
+  }
+  auto array = std::find_if(arrays.cbegin(), arrays.cend(), [&it](const Array &array)
+                            { return array.texture == it.value().texture; });
+  glBindTexture(GL_TEXTURE_2D_ARRAY, array->texture);
+  upload(image, *array, it.value().layer);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  return true;
+}
+
+TextureArrays::Layer TextureArrays::insert(const QString &path, int width, int height,
+                                           const QVector<quint8> &texels)
+{
+  remove(path);
+
+  auto array = std::find_if(arrays.begin(), arrays.end(), [width, height](const Array &array)
+                            { return array.width == width && array.height == height &&
+                                     !array.freeLayers.isEmpty(); });
+  if (array == arrays.end())
+  {
+    Array added = createArray(width, height, streamLayers);
+    for (int layer = streamLayers - 1; layer >= 0; --layer)
+    {
+      added.freeLayers.append(layer);
+    }
+    arrays.append(added);
+    array = arrays.end() - 1;
+  }
+
+  Layer layer{array->texture, array->freeLayers.takeLast()};
+  glBindTexture(GL_TEXTURE_2D_ARRAY, layer.texture);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer.layer, width, height, 1, GL_RGBA,
+                  GL_UNSIGNED_BYTE, texels.constData());
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  layers.insert(path, layer);
+  return layer;
+}
+
+void TextureArrays::remove(const QString &path)
+{
+  auto it = layers.find(path);
+  if (it == layers.end())
+  {
+    return;
+  }
+  for (Array &array : arrays)
+  {
+    if (array.texture == it.value().texture)
+    {
+      array.freeLayers.append(it.value().layer);
+    }
+  }
+  layers.erase(it);
+}
+
+void TextureArrays::clear()
+{
+  for (const Array &array : arrays)
+  {
+    glDeleteTextures(1, &array.texture);
+  }
+  arrays.clear();
+  layers.clear();
+}
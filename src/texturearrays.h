@@ -0,0 +1,112 @@
+#ifndef TEXTUREARRAYS_H
+#define TEXTUREARRAYS_H
+
+#include <QHash>
+#include <QImage>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QString>
+#include <QVector>
+
+/**
+ * @brief The TextureArrays class packs the material textures of a scene into
+ * GL_TEXTURE_2D_ARRAYs, so actors with different materials share one texture
+ * binding and only differ in the layer they sample.
+ *
+ * Baking scales every image to the power of two size at or above its own
+ * (clamped to maxSize) and puts all images of the same size into one array.
+ * Scaling instead of padding keeps repeating UVs working. A scene whose
+ * textures all have about the same size therefore ends up with a single array.
+ *
+ * Streamed textures are inserted and removed one at a time instead, into
+ * arrays with room for streamLayers images, so the other layers never move.
+ */
+class TextureArrays : protected QOpenGLFunctions_3_3_Core
+{
+public:
+  // Largest layer size; bigger images are scaled down
+  static const int maxSize = 2048;
+  // Layers of the arrays insert() adds
+  static const int streamLayers = 32;
+
+  /**
+   * @brief Where an image ended up: the array texture and the layer in it.
+   * A texture of 0 means the image is not in any array.
+   */
+  struct Layer
+  {
+    GLuint texture = 0;
+    int layer = 0;
+  };
+
+  TextureArrays() = default;
+
+  void initialize();
+
+  /**
+   * @brief Replaces all arrays with ones holding the given images, by path.
+   * Requires a current context.
+   */
+  void bake(const QHash<QString, QImage> &images);
+
+  /**
+   * @brief Overwrites the layer of an image that was baked before, scaled to
+   * the layer size. Requires a current context.
+   * @return Whether the path has a layer.
+   */
+  bool update(const QString &path, const QImage &image);
+
+  /**
+   * @brief Puts an image that already has a layer size into a free layer of an
+   * array of that size, adding an array when all of them are full. Requires a
+   * current context.
+   * @param texels RGBA, bottom row first, see MainView::imageToBytes.
+   */
+  Layer insert(const QString &path, int width, int height, const QVector<quint8> &texels);
+
+  /**
+   * @brief Frees the layer of an inserted image for the next insert.
+   */
+  void remove(const QString &path);
+
+  Layer layer(const QString &path) const { return layers.value(path); }
+
+  /**
+   * @brief Deletes all arrays. Requires a current context.
+   */
+  void clear();
+
+  int arrayCount() const { return arrays.size(); }
+  int layerCount() const { return layers.size(); }
+
+  /**
+   * @brief The side of the layers an image side of this size is scaled to: the
+   * power of two at or above it, at most maxSize. Inline, so the reference
+   * renderer can use it without the GL code.
+   */
+  static int layerSize(int size)
+  {
+    int result = 1;
+    while (result < size && result < maxSize)
+    {
+      result *= 2;
+    }
+    return result;
+  }
+
+private:
+  struct Array
+  {
+    GLuint texture;
+    int width;
+    int height;
+    QVector<int> freeLayers; // only in the arrays of insert()
+  };
+
+  Array createArray(int width, int height, int layers);
+  void upload(const QImage &image, const Array &array, int layer);
+
+  QVector<Array> arrays;
+  QHash<QString, Layer> layers;
+};
+
+#endif // TEXTUREARRAYS_H
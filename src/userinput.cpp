@@ -11,6 +11,120 @@ void MainView::keyPressEvent(QKeyEvent *ev) {
     case 'A':
       qDebug() << "A pressed";
       break;
+    case 'W':
+      waveMode = static_cast<WaveMode>((waveMode + 1) % 3);
+      qDebug() << "Wave mode:"
+               << (waveMode == PER_VERTEX ? "per vertex"
+                                          : waveMode == TEXTURE ? "wave texture" : "FFT ocean");
+      break;
+    case 'B':
+      Ocean::benchmark();
+      break;
+    case 'J':
+      DrawList::benchmark();
+      break;
+    case 'K':
+      DrawList::benchmarkLods(actors, unjitteredProjection, renderHeight());
+      break;
+    case 'C':
+      OcclusionCuller::benchmark();
+      break;
+    case 'Z':
+      streamingBenchmark.start([this](int features) -> QOpenGLShaderProgram &
+                               { return geometryProgram(features); });
+      scheduler.requestFrame();
+      break;
+    case 'N':
+      Model::benchmark();
+      break;
+    case 'S':
+      SceneGraph::benchmark();
+      break;
+    case 'Y':
+      // The cached static G-buffer may hold a jittered frame
+      referenceRequested = true;
+      staticGBufferValid = false;
+      break;
+    case 'U':
+      benchmarkReference();
+      break;
+    case 'O':
+      occlusionEnabled = !occlusionEnabled;
+      staticGBufferValid = false;
+      qDebug() << "Occlusion culling:" << (occlusionEnabled ? "on" : "off");
+      break;
+    case 'F':
+      scheduler.setMode(static_cast<FrameMode>((scheduler.getMode() + 1) % 4));
+      staticGBufferValid = false;
+      break;
+    case 'I':
+      scheduler.report();
+      qDebug() << "Render scale:" << dynamicResolution.scale();
+      qDebug() << "Frame graph:";
+      frameGraph.report();
+      qDebug() << "Bloom:" << frameGraph.milliseconds("bloom") << "ms";
+      qDebug() << "Draws:" << drawList.size() << "of" << drawList.actorCount()
+               << "| build" << drawList.buildMilliseconds() << "ms on"
+               << JobSystem::global().threadCount() << "threads | submit"
+               << drawList.submitMilliseconds() << "ms";
+      qDebug() << "Triangles:" << drawList.triangleCount() << "of"
+               << drawList.fullDetailTriangleCount() << "at full detail";
+      qDebug() << "Occlusion culling:" << (occlusionEnabled ? "on" : "off") << "|"
+               << drawList.occludedCount() << "actors culled," << occlusionCuller.triangleCount()
+               << "occluder triangles in" << occlusionCuller.renderMilliseconds() << "ms";
+      if (scene.shadows.enabled) {
+        shadowMaps.report();
+      }
+      if (recorder.isRecording()) {
+        recorder.report();
+      }
+      if (streamer.isOpen()) {
+        streamer.report();
+      }
+      qDebug() << "Static batches:" << (batchingEnabled ? "on" : "off") << "|"
+               << staticBatches.actorCount() << "actors in" << staticBatches.batchCount()
+               << "batches," << staticBatches.drawCalls()
+               << (staticBatches.usesIndirect() ? "indirect" : "") << "multi-draws | submit"
+               << staticBatches.submitMilliseconds() << "ms";
+      break;
+    case 'T':
+      taaEnabled = !taaEnabled;
+      staticGBufferValid = false;
+      qDebug() << "Temporal anti-aliasing:" << (taaEnabled ? "on" : "off");
+      break;
+    case 'L':
+      scene.bloom.enabled = !scene.bloom.enabled;
+      qDebug() << "Bloom:" << (scene.bloom.enabled ? "on" : "off");
+      break;
+    case 'H':
+      scene.shadows.enabled = !scene.shadows.enabled;
+      qDebug() << "Shadows:" << (scene.shadows.enabled ? "on" : "off");
+      break;
+    case 'V':
+      toggleRecording(FrameRecorder::PNG);
+      break;
+    case 'X':
+      toggleRecording(FrameRecorder::EXR);
+      break;
+    case 'P':
+      scene.probe.enabled = !scene.probe.enabled;
+      qDebug() << "Reflection probe:" << (scene.probe.enabled ? "on" : "off");
+      break;
+    case 'M':
+      batchingEnabled = !batchingEnabled;
+      staticGBufferValid = false;
+      qDebug() << "Static batching:" << (batchingEnabled ? "on" : "off");
+      break;
+    case 'G': {
+      const char *views[] = {"off", "normals", "albedo", "reflectiveness", "emission", "depth"};
+      gBufferView = (gBufferView + 1) % 6;
+      qDebug() << "G-buffer view:" << views[gBufferView];
+      break;
+    }
+    case 'R':
+      dynamicResolution.setEnabled(!dynamicResolution.isEnabled());
+      qDebug() << "Dynamic resolution:" << (dynamicResolution.isEnabled() ? "on" : "off");
+      break;
     default:
       // ev->key() is an integer. For alpha numeric characters keys it
       // equivalent with the char value ('A' == 65, '1' == 49) Alternatively,
@@ -18,8 +132,9 @@ void MainView::keyPressEvent(QKeyEvent *ev) {
       qDebug() << ev->key() << "pressed";
       break;
   }
-  // Used to update the screen after changes
-  update();
+  // Used to update the screen after changes; the scheduler decides when, so
+  // input never draws frames beyond the cap
+  scheduler.requestFrame();
 }
 
 /**
@@ -36,7 +151,7 @@ void MainView::keyReleaseEvent(QKeyEvent *ev) {
       break;
   }
 
-  update();
+  scheduler.requestFrame();
 }
 
 /**
@@ -48,7 +163,7 @@ void MainView::keyReleaseEvent(QKeyEvent *ev) {
 void MainView::mouseDoubleClickEvent(QMouseEvent *ev) {
   qDebug() << "Mouse double clicked:" << ev->button();
 
-  update();
+  scheduler.requestFrame();
 }
 
 /**
@@ -59,7 +174,7 @@ void MainView::mouseDoubleClickEvent(QMouseEvent *ev) {
 void MainView::mouseMoveEvent(QMouseEvent *ev) {
   qDebug() << "x" << ev->position().x() << "y" << ev->position().y();
 
-  update();
+  scheduler.requestFrame();
 }
 
 /**
@@ -69,7 +184,7 @@ void MainView::mouseMoveEvent(QMouseEvent *ev) {
 void MainView::mousePressEvent(QMouseEvent *ev) {
   qDebug() << "Mouse button pressed:" << ev->button();
 
-  update();
+  scheduler.requestFrame();
   // Do not remove the line below, clicking must focus on this widget!
   setFocus();
 }
@@ -81,7 +196,7 @@ void MainView::mousePressEvent(QMouseEvent *ev) {
 void MainView::mouseReleaseEvent(QMouseEvent *ev) {
   qDebug() << "Mouse button released" << ev->button();
 
-  update();
+  scheduler.requestFrame();
 }
 
 /**
@@ -92,5 +207,5 @@ void MainView::mouseReleaseEvent(QMouseEvent *ev) {
 void MainView::wheelEvent(QWheelEvent *ev) {
   qDebug() << "Mouse wheel:" << ev->angleDelta();
 
-  update();
+  scheduler.requestFrame();
 }
@@ -0,0 +1,11 @@
+#ifndef WAVEMODE_H
+#define WAVEMODE_H
+
+/**
+ * @brief Where the water surface comes from: the analytic wave model evaluated
+ * per vertex, the analytic model baked into a texture on the GPU once per frame,
+ * or a spectrum synthesized with the CPU FFT (see Ocean).
+ */
+enum WaveMode { PER_VERTEX = 0, TEXTURE, FFT };
+
+#endif  // WAVEMODE_H
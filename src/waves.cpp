@@ -0,0 +1,209 @@
+#include "waves.h"
+
+#include "parallel.h"
+
+#include <QOpenGLShaderProgram>
+#include <QVector4D>
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+  const float twoPi = 6.28318531F;
+
+  // Points are processed in blocks so the per-block arrays stay in L1 and the
+  // inner loops have a fixed, vectorizable shape.
+  const int blockSize = 64;
+
+  /**
+   * @brief sinCos Branchless sine and cosine that the compiler can vectorize
+   * (std::sin/std::cos calls cannot be). The angle is reduced to [-pi, pi] and
+   * halved; sin/cos of the half angle use Taylor polynomials, which are
+   * accurate to about 1e-6 on [-pi/2, pi/2], and the double angle formulas
+   * give the result.
+   */
+  inline void sinCos(float x, float &s, float &c)
+  {
+    // Round to the nearest period through an int conversion, which vectorizes
+    // on every target (rounding instructions need SSE4.1 on x86)
+    float t = x * (1.0F / twoPi);
+    float r = x - twoPi * static_cast<float>(static_cast<int>(t + (t >= 0.0F ? 0.5F : -0.5F)));
+    float y = 0.5F * r;
+    float y2 = y * y;
+    float sy = y * (1.0F + y2 * (-1.0F / 6.0F + y2 * (1.0F / 120.0F + y2 * (-1.0F / 5040.0F + y2 * (1.0F / 362880.0F)))));
+    float cy = 1.0F + y2 * (-0.5F + y2 * (1.0F / 24.0F + y2 * (-1.0F / 720.0F + y2 * (1.0F / 40320.0F + y2 * (-1.0F / 3628800.0F)))));
+    s = 2.0F * sy * cy;
+    c = 1.0F - 2.0F * sy * sy;
+  }
+} // namespace
+
+/**
+ * @brief WaveModel::WaveModel Creates the default waves: a dominant long wave
+ * plus crossing chop and ripples, tuned for a calm canal at night.
+ */
+WaveModel::WaveModel()
+{
+  setComponents({
+      {0.15F, 2.0F, QVector2D(1.0F, 0.0F), 0.0F},    // dominant long wave
+      {0.08F, 4.5F, QVector2D(0.8F, 0.5F), 1.2F},    // medium crossing wave for chop
+      {0.05F, 8.0F, QVector2D(0.1F, 1.0F), 3.5F},    // small, highly choppy wave
+      {0.02F, 12.0F, QVector2D(-0.5F, -0.7F), 5.1F}, // tiny high frequency ripple
+      {0.008F, 18.0F, QVector2D(1.0F, -0.2F), 6.4F}, // short, very small wave
+      {0.004F, 25.0F, QVector2D(-0.8F, 0.9F), 2.7F}, // micro ripple
+  });
+}
+
+void WaveModel::setComponents(const QVector<WaveComponent> &newComponents)
+{
+  components = newComponents;
+  if (components.size() > maxComponents)
+  {
+    components.resize(maxComponents);
+  }
+  updateDerived();
+}
+
+void WaveModel::setDepth(float newDepth)
+{
+  depth = newDepth;
+  updateDerived();
+}
+
+void WaveModel::setHeightScale(float newScale)
+{
+  heightScale = newScale;
+  updateDerived();
+}
+
+/**
+ * @brief WaveModel::setTileSize When > 0, snaps every wave vector to the lattice
+ * 2 pi n / tileSize so the surface repeats every tile (needed by the tiling wave
+ * texture).
+ */
+void WaveModel::setTileSize(float newTileSize)
+{
+  tileSize = newTileSize;
+  updateDerived();
+}
+
+/**
+ * @brief WaveModel::updateDerived Precomputes everything that does not depend on
+ * time: the (snapped) wave vectors and the angular frequencies from the
+ * dispersion relation omega = sqrt(g k tanh(k d)).
+ */
+void WaveModel::updateDerived()
+{
+  int count = components.size();
+  for (QVector<float> *field : {&waveX, &waveZ, &amplitude, &phase, &omega})
+  {
+    field->fill(0.0F, count);
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    const WaveComponent &wave = components[i];
+    QVector2D K = wave.wavenumber * wave.direction.normalized();
+    if (tileSize > 0.0F)
+    {
+      float dk = twoPi / tileSize;
+      K = QVector2D(std::round(K.x() / dk) * dk, std::round(K.y() / dk) * dk);
+    }
+
+    float k = K.length();
+    waveX[i] = K.x();
+    waveZ[i] = K.y();
+    amplitude[i] = wave.amplitude * heightScale;
+    phase[i] = wave.phase;
+    // Shallow water approximation (tanh(x) ~ x) for tiny k * d
+    omega[i] = k * depth < 0.01F ? std::sqrt(gravity * k * k * depth)
+                                  : std::sqrt(gravity * k * std::tanh(k * depth));
+  }
+}
+
+float WaveModel::height(const QVector2D &position, float time) const
+{
+  float result = 0.0F;
+  sample(&position, 1, time, &result);
+  return result;
+}
+
+void WaveModel::sample(const QVector2D *positions, int count, float time,
+                       float *heights, QVector3D *normals) const
+{
+  auto body = [&](int begin, int end)
+  {
+    for (int i = begin; i < end; i += blockSize)
+    {
+      int n = std::min(blockSize, end - i);
+      sampleBlock(positions + i, n, time, heights + i, normals ? normals + i : nullptr);
+    }
+  };
+
+  // Only worth waking up other threads for large batches
+  parallelFor(0, count, body, 16384);
+}
+
+/**
+ * @brief WaveModel::sampleBlock Evaluates up to blockSize points. Mirrors
+ * waveHeightGradient in waves.glsl:
+ * h = sum A cos(K . p - omega t + phi), grad h = -sum A K sin(...).
+ */
+void WaveModel::sampleBlock(const QVector2D *positions, int count, float time,
+                            float *heights, QVector3D *normals) const
+{
+  float x[blockSize], z[blockSize];
+  float h[blockSize], gx[blockSize], gz[blockSize];
+
+  for (int i = 0; i < count; ++i)
+  {
+    x[i] = positions[i].x();
+    z[i] = positions[i].y();
+    h[i] = gx[i] = gz[i] = 0.0F;
+  }
+
+  for (int w = 0; w < components.size(); ++w)
+  {
+    float Kx = waveX[w], Kz = waveZ[w], A = amplitude[w];
+    float offset = phase[w] - omega[w] * time;
+    for (int i = 0; i < count; ++i)
+    {
+      float s, c;
+      sinCos(Kx * x[i] + Kz * z[i] + offset, s, c);
+      h[i] += A * c;
+      gx[i] -= A * Kx * s;
+      gz[i] -= A * Kz * s;
+    }
+  }
+
+  for (int i = 0; i < count; ++i)
+  {
+    heights[i] = h[i];
+  }
+
+  if (normals)
+  {
+    for (int i = 0; i < count; ++i)
+    {
+      normals[i] = QVector3D(-gx[i], 1.0F, -gz[i]).normalized();
+    }
+  }
+}
+
+/**
+ * @brief WaveModel::setUniforms Uploads the wave table to a program that links
+ * waves.glsl. The program must be bound.
+ */
+void WaveModel::setUniforms(QOpenGLShaderProgram &program) const
+{
+  QVector<QVector4D> vectors;
+  vectors.reserve(components.size());
+  for (int i = 0; i < components.size(); ++i)
+  {
+    vectors.append(QVector4D(waveX[i], waveZ[i], amplitude[i], phase[i]));
+  }
+
+  program.setUniformValue("waveCount", static_cast<GLint>(components.size()));
+  program.setUniformValueArray("waveVectors", vectors.constData(), vectors.size());
+  program.setUniformValueArray("waveOmega", omega.constData(), omega.size(), 1);
+}
@@ -0,0 +1,75 @@
+#ifndef WAVES_H
+#define WAVES_H
+
+#include <QVector2D>
+#include <QVector3D>
+#include <QVector>
+
+class QOpenGLShaderProgram;
+
+/**
+ * @brief A single Airy wave: h = amplitude * cos(k D . p - omega t + phase).
+ */
+struct WaveComponent
+{
+  float amplitude;     // m
+  float wavenumber;    // rad/m
+  QVector2D direction; // travel direction in the XZ plane
+  float phase;         // phase offset in radians
+};
+
+/**
+ * @brief The WaveModel class is the single definition of the analytic water
+ * waves, shared by the GPU and the CPU.
+ *
+ * The components live here and are uploaded to waves.glsl as uniforms, together
+ * with the angular frequencies, which are precomputed from the dispersion
+ * relation. sample() evaluates exactly the same sum on the CPU, including the
+ * analytic gradient, so gameplay and physics code can query the surface (e.g.
+ * for buoyancy) for thousands of points per frame.
+ */
+class WaveModel
+{
+public:
+  static const int maxComponents = 16; // MAX_WAVES in waves.glsl
+
+  WaveModel();
+
+  void setComponents(const QVector<WaveComponent> &newComponents);
+  const QVector<WaveComponent> &getComponents() const { return components; }
+
+  void setDepth(float newDepth);
+  void setHeightScale(float newScale);
+  void setTileSize(float newTileSize);
+
+  float height(const QVector2D &position, float time) const;
+
+  /**
+   * @brief Evaluates the surface at many points at once.
+   * @param positions World-space XZ positions.
+   * @param count Number of positions.
+   * @param time Scene time in seconds.
+   * @param heights Receives count heights.
+   * @param normals Optionally receives count world-space normals.
+   */
+  void sample(const QVector2D *positions, int count, float time, float *heights,
+              QVector3D *normals = nullptr) const;
+
+  void setUniforms(QOpenGLShaderProgram &program) const;
+
+private:
+  void updateDerived();
+  void sampleBlock(const QVector2D *positions, int count, float time,
+                   float *heights, QVector3D *normals) const;
+
+  QVector<WaveComponent> components;
+  float gravity = 9.8F;
+  float depth = 5.0F;
+  float heightScale = 0.2F;
+  float tileSize = 0.0F;
+
+  // Per component: wave vector, scaled amplitude, phase and angular frequency
+  QVector<float> waveX, waveZ, amplitude, phase, omega;
+};
+
+#endif // WAVES_H